@@ -501,5 +501,16 @@ typedef struct _Xi18nCore
     Xi18nMethodsRec methods;
 } Xi18nCore;
 
+/* snapshot of a client for introspection */
+typedef struct
+{
+    CARD16	connect_id;
+    CARD8	byte_order;
+    int		sync;
+    int		n_pending;	/* queued messages waiting for sync */
+} Xi18nClientInfo;
+
+int Xi18nGetClients (XIMS ims, Xi18nClientInfo *info, int max);
+
 #endif
 
@@ -0,0 +1,90 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef _Xi18nReplay_h
+#define _Xi18nReplay_h
+
+#include <X11/Xmd.h>
+
+/* XIM session capture file
+ *
+ *   XimCaptureHeader
+ *   { XimCaptureRecord, message bytes[length] } ...
+ *
+ * Each record holds one XIM message exactly as _Xi18nMessageHandler()
+ * received it, header included. The file is written in host byte order,
+ * byte_order field is used to reject captures of another endianness.
+ * The message bytes are kept in the byte order of the client, which is
+ * stored in every record. Since version 2 the attribute ids in the
+ * messages are positions in the attribute lists, not quarks.
+ *
+ * The replay output uses the same format with XIM_CAPTURE_OUT records
+ * and zero timestamps, so two replays of one capture can be compared
+ * with cmp(1). */
+
+#define XIM_CAPTURE_MAGIC	"NABIXIMC"
+#define XIM_CAPTURE_MAGIC_LEN	8
+#define XIM_CAPTURE_VERSION	2
+#define XIM_CAPTURE_BYTE_ORDER	0x01020304
+
+#define XIM_CAPTURE_IN		'<'
+#define XIM_CAPTURE_OUT		'>'
+
+typedef struct
+{
+    char	magic[XIM_CAPTURE_MAGIC_LEN];
+    CARD32	version;
+    CARD32	byte_order;
+} XimCaptureHeader;
+
+typedef struct
+{
+    CARD32	sec;		/* time since the start of the capture */
+    CARD32	usec;
+    CARD16	connect_id;	/* connect_id of the captured session */
+    CARD8	direction;	/* XIM_CAPTURE_IN or XIM_CAPTURE_OUT */
+    CARD8	byte_order;	/* 'B' or 'l' of the client */
+    CARD32	length;		/* bytes of the message that follows */
+} XimCaptureRecord;
+
+typedef struct
+{
+    unsigned long	n_in;		/* messages fed to the handler */
+    unsigned long	n_out;		/* messages sent by the server */
+    unsigned long	n_dropped;	/* messages without a session */
+    unsigned long	bytes_in;
+    unsigned long	bytes_out;
+    unsigned long	n_clients;
+    double		elapsed;	/* seconds spent in the handler */
+} XimReplayStats;
+
+/* capture every inbound message of the X transport to filename */
+Bool Xi18nCaptureStart (const char *filename);
+void Xi18nCaptureStop (void);
+
+/* called after each message of the capture is handled, so that the
+ * work the server defers, to the main loop or to another thread, is done
+ * before the next message */
+typedef void (*XimReplayIdleProc) (void);
+
+/* feed a capture to an IM opened with the "replay/" transport,
+ * outbound messages are written to output if it is not NULL */
+Bool Xi18nReplay (XIMS ims, const char *capture, const char *output,
+		  XimReplayIdleProc idle, XimReplayStats *stats);
+
+#endif
@@ -52,6 +52,11 @@ void _Xi18nChangeIC (XIMS ims, IMProtocol *call_data, unsigned char *p,
                      int create_flag);
 void _Xi18nGetIC (XIMS ims, IMProtocol *call_data, unsigned char *p);
 
+/* i18nReplay.c */
+void _Xi18nCaptureMessage (Xi18n i18n_core, CARD16 connect_id,
+                           unsigned char *p, long length);
+Bool _Xi18nIsReplayTransport (Xi18n i18n_core);
+
 /* i18nUtil.c */
 int _Xi18nNeedSwap (Xi18n i18n_core, CARD16 connect_id);
 Xi18nClient *_Xi18nNewClient(Xi18n i18n_core);
@@ -30,7 +30,6 @@ IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 ******************************************************************/
 
 #include <X11/Xlib.h>
-#include <X11/Xresource.h>
 #include "IMdkit.h"
 #include "Xi18n.h"
 #include "XimFunc.h"
@@ -119,12 +118,15 @@ static XIMAttr *CreateAttrList (Xi18n i18n_core,
     /*endif*/
     memset (args, 0, buf_size);
 
+    /* the ids are the positions in the list rather than quarks, which
+     * depend on what the process has interned before, so a captured
+     * session refers to the same attributes when it is replayed */
     for (p = args;  attr->name != NULL;  attr++, p++)
     {
         p->name = attr->name;
         p->length = strlen (attr->name);
         p->type = (CARD16) attr->type;
-        p->attribute_id = XrmStringToQuark (p->name);
+        p->attribute_id = (CARD16) (p - args);
         if (strcmp (p->name, XNPreeditAttributes) == 0)
             i18n_core->address.preeditAttr_id = p->attribute_id;
         else if (strcmp (p->name, XNStatusAttributes) == 0)
@@ -78,10 +78,12 @@ IMMethodsRec Xi18n_im_methods =
 
 extern Bool _Xi18nCheckXAddress (Xi18n, TransportSW *, char *);
 extern Bool _Xi18nCheckTransAddress (Xi18n, TransportSW *, char *);
+extern Bool _Xi18nCheckReplayAddress (Xi18n, TransportSW *, char *);
 
 TransportSW _TransR[] =
 {
     {"X",               1, _Xi18nCheckXAddress},
+    {"replay",          6, _Xi18nCheckReplayAddress},
 #ifdef TCPCONN
     {"tcp",             3, _Xi18nCheckTransAddress},
     {"local",           5, _Xi18nCheckTransAddress},
@@ -754,9 +756,22 @@ static Status xi18n_openIM(XIMS ims)
     Xi18n i18n_core = ims->protocol;
     Display *dpy = i18n_core->address.dpy;
 
-    if (!CheckIMName (i18n_core)
-        ||
-        !SetXi18nSelectionOwner (i18n_core)
+    if (!CheckIMName (i18n_core))
+    {
+        free (i18n_core->address.im_name);
+        free (i18n_core->address.im_locale);
+        free (i18n_core->address.im_addr);
+        free (i18n_core);
+        return False;
+    }
+    /*endif*/
+
+    /* a replayed session is not announced to the clients */
+    if (_Xi18nIsReplayTransport (i18n_core))
+        return i18n_core->methods.begin (ims);
+    /*endif*/
+
+    if (!SetXi18nSelectionOwner (i18n_core)
         ||
         !i18n_core->methods.begin (ims))
     {
@@ -789,14 +804,24 @@ static Status xi18n_closeIM(XIMS ims)
 	i18n_core->methods.disconnect(ims, connect_id);
     }
 
-    DeleteXi18nAtom(i18n_core);
-    if (!i18n_core->methods.end (ims))
-        return False;
-    
-    _XUnregisterFilter (dpy,
-                        i18n_core->address.im_window,
-                        WaitXSelectionRequest,
-                        (XPointer)ims);
+    if (_Xi18nIsReplayTransport (i18n_core))
+    {
+        if (!i18n_core->methods.end (ims))
+            return False;
+        /*endif*/
+    }
+    else
+    {
+        DeleteXi18nAtom(i18n_core);
+        if (!i18n_core->methods.end (ims))
+            return False;
+
+        _XUnregisterFilter (dpy,
+                            i18n_core->address.im_window,
+                            WaitXSelectionRequest,
+                            (XPointer)ims);
+    }
+    /*endif*/
 
     _Xi18nDeleteAllClients(i18n_core);
     _Xi18nDeleteFreeClients(i18n_core);
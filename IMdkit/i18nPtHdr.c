@@ -39,6 +39,9 @@ extern void DebugLog(int deflevel, int inplevel, char *fmt, ...);
 #endif
 
 #include "../src/debug.h"
+#include "../src/latency.h"
+#include "../src/probes.h"
+#include "../src/stat.h"
 
 #include <stdlib.h>
 #include <sys/param.h>
@@ -1363,7 +1366,12 @@ static void ExtForwardKeyEventMessageProc (XIMS ims,
     ((XKeyEvent *) ev)->state = (unsigned int) state;
     ((XKeyEvent *) ev)->time = (Time) ev_time;
     ((XKeyEvent *) ev)->window = (Window) window;
-    ((XKeyEvent *) ev)->root = DefaultRootWindow (ev->xany.display);
+    /* the replay transport has no display */
+    if (ev->xany.display != NULL)
+        ((XKeyEvent *) ev)->root = DefaultRootWindow (ev->xany.display);
+    else
+        ((XKeyEvent *) ev)->root = None;
+    /*endif*/
     ((XKeyEvent *) ev)->x = 0;
     ((XKeyEvent *) ev)->y = 0;
     ((XKeyEvent *) ev)->x_root = 0;
@@ -1759,6 +1767,20 @@ static char* ctstombs(Display* display, char* compound_text, size_t len)
     int count = 0;
     XTextProperty text_prop;
 
+    /* the replay transport has no display to convert with,
+     * only the ASCII part of the text comes out right */
+    if (display == NULL)
+    {
+        if ((ret = malloc (len + 1)) != NULL)
+        {
+            memcpy (ret, compound_text, len);
+            ret[len] = '\0';
+        }
+        /*endif*/
+        return ret;
+    }
+    /*endif*/
+
     text_prop.value = (unsigned char*)compound_text;
     text_prop.encoding = XInternAtom(display, "COMPOUND_TEXT", False);
     text_prop.format = 8;
@@ -1873,6 +1895,9 @@ static void ProcessQueue (XIMS ims, CARD16 connect_id)
         unsigned char *p1 = (unsigned char *) (hdr + 1);
         IMProtocol call_data;
 
+        /* the fields of the event not on the wire are forwarded back
+         * as they are, as _Xi18nMessageHandler() does */
+        memset (&call_data, 0, sizeof (IMProtocol));
         call_data.major_code = hdr->major_opcode;
         call_data.any.minor_code = hdr->minor_opcode;
         call_data.any.connect_id = connect_id;
@@ -1908,6 +1933,8 @@ void _Xi18nMessageHandler (XIMS ims,
     Xi18n i18n_core = ims->protocol;
     Xi18nClient *client;
 
+    nabi_latency_message_begin ();
+
     client = (Xi18nClient *) _Xi18nFindClient (i18n_core, connect_id);
     if (hdr == (XimProtoHdr *) NULL)
         return;
@@ -1919,6 +1946,10 @@ void _Xi18nMessageHandler (XIMS ims,
     call_data.any.minor_code = hdr->minor_opcode;
     call_data.any.connect_id = connect_id;
 
+    NABI_PROBE3(xim_message, connect_id,
+		hdr->major_opcode, hdr->minor_opcode);
+    NABI_STAT_INC(msg_in[hdr->major_opcode]);
+
     switch (call_data.major_code)
     {
     case XIM_CONNECT:
@@ -1992,6 +2023,7 @@ void _Xi18nMessageHandler (XIMS ims,
         {
 	    nabi_log(6, "XIM_FORWARD_EVENT(cid=%x: sync, add to queue\n", connect_id);
             AddQueue (client, p);
+            NABI_STAT_INC(sync_waits);
             *delete = False;
         }
         else
@@ -2049,4 +2081,7 @@ void _Xi18nMessageHandler (XIMS ims,
 	break;
     }
     /*endswitch*/
+
+    NABI_PROBE3(xim_dispatched, connect_id,
+		call_data.major_code, call_data.any.minor_code);
 }
@@ -0,0 +1,655 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* XIM session capture and replay
+ *
+ * The capture side writes every message the X transport hands to
+ * _Xi18nMessageHandler() to a file. The replay side is a transport
+ * without any X connection: it reads a capture, creates the client
+ * records itself and pushes the messages through the same handler,
+ * so the protocol and IC code run exactly as they did in the session
+ * while everything the server sends back is written to a file. */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <X11/Xlib.h>
+#include "IMdkit.h"
+#include "Xi18n.h"
+#include "Xi18nReplay.h"
+#include "XimFunc.h"
+
+#include "../src/debug.h"
+
+extern void _Xi18nMessageHandler (XIMS, CARD16, unsigned char *, Bool *);
+
+typedef struct
+{
+    CARD16	captured_id;	/* connect_id in the capture */
+} ReplayClient;
+
+/* a message read ahead while the server waited for another one */
+typedef struct _ReplayRecord
+{
+    XimCaptureRecord rec;
+    unsigned char *p;
+    struct _ReplayRecord *next;
+} ReplayRecord;
+
+typedef struct
+{
+    FILE	*input;
+    FILE	*output;
+    CARD16	*id_map;	/* captured connect_id -> replay connect_id */
+    ReplayRecord *pending;	/* read ahead by ReplayWait(), in order */
+    ReplayRecord *pending_tail;
+    XimReplayStats *stats;
+} ReplaySpecRec;
+
+static FILE *capture_file = NULL;
+static struct timeval capture_start;
+
+static Bool WriteRecord (FILE *file,
+                         struct timeval *tv,
+                         CARD16 connect_id,
+                         CARD8 direction,
+                         CARD8 byte_order,
+                         unsigned char *p,
+                         long length)
+{
+    XimCaptureRecord rec;
+
+    memset (&rec, 0, sizeof (rec));
+    if (tv != NULL)
+    {
+        rec.sec = tv->tv_sec;
+        rec.usec = tv->tv_usec;
+    }
+    /*endif*/
+    rec.connect_id = connect_id;
+    rec.direction = direction;
+    rec.byte_order = byte_order;
+    rec.length = length;
+
+    if (fwrite (&rec, sizeof (rec), 1, file) != 1)
+        return False;
+    /*endif*/
+    if (length > 0  &&  fwrite (p, length, 1, file) != 1)
+        return False;
+    /*endif*/
+    return True;
+}
+
+static Bool WriteHeader (FILE *file)
+{
+    XimCaptureHeader header;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, XIM_CAPTURE_MAGIC, XIM_CAPTURE_MAGIC_LEN);
+    header.version = XIM_CAPTURE_VERSION;
+    header.byte_order = XIM_CAPTURE_BYTE_ORDER;
+    return fwrite (&header, sizeof (header), 1, file) == 1;
+}
+
+Bool Xi18nCaptureStart (const char *filename)
+{
+    Xi18nCaptureStop ();
+
+    capture_file = fopen (filename, "wb");
+    if (capture_file == NULL)
+    {
+        nabi_log (1, "xim capture: can't open %s\n", filename);
+        return False;
+    }
+    /*endif*/
+    if (!WriteHeader (capture_file))
+    {
+        fclose (capture_file);
+        capture_file = NULL;
+        return False;
+    }
+    /*endif*/
+    gettimeofday (&capture_start, NULL);
+    nabi_log (1, "xim capture: %s\n", filename);
+    return True;
+}
+
+void Xi18nCaptureStop (void)
+{
+    if (capture_file != NULL)
+    {
+        fclose (capture_file);
+        capture_file = NULL;
+    }
+    /*endif*/
+}
+
+void _Xi18nCaptureMessage (Xi18n i18n_core,
+                           CARD16 connect_id,
+                           unsigned char *p,
+                           long length)
+{
+    Xi18nClient *client;
+    struct timeval tv;
+
+    if (capture_file == NULL)
+        return;
+    /*endif*/
+
+    client = _Xi18nFindClient (i18n_core, connect_id);
+    gettimeofday (&tv, NULL);
+    tv.tv_sec -= capture_start.tv_sec;
+    tv.tv_usec -= capture_start.tv_usec;
+    if (tv.tv_usec < 0)
+    {
+        tv.tv_sec--;
+        tv.tv_usec += 1000000;
+    }
+    /*endif*/
+
+    if (!WriteRecord (capture_file,
+                      &tv,
+                      connect_id,
+                      XIM_CAPTURE_IN,
+                      client != NULL  ?  client->byte_order  :  '?',
+                      p,
+                      length))
+    {
+        nabi_log (1, "xim capture: write error, capture stopped\n");
+        Xi18nCaptureStop ();
+    }
+    /*endif*/
+}
+
+static unsigned char *ReadRecord (FILE *file, XimCaptureRecord *rec)
+{
+    unsigned char *p;
+
+    if (fread (rec, sizeof (*rec), 1, file) != 1)
+        return NULL;
+    /*endif*/
+    /* 4 bytes header at least, and a sane upper bound */
+    if (rec->length < 4  ||  rec->length > 16 * 1024 * 1024)
+        return NULL;
+    /*endif*/
+    if ((p = (unsigned char *) malloc (rec->length)) == NULL)
+        return NULL;
+    /*endif*/
+    if (fread (p, rec->length, 1, file) != 1)
+    {
+        free (p);
+        return NULL;
+    }
+    /*endif*/
+    return p;
+}
+
+static Bool QueueRecord (ReplaySpecRec *spec,
+                         XimCaptureRecord *rec,
+                         unsigned char *p)
+{
+    ReplayRecord *r;
+
+    if ((r = (ReplayRecord *) malloc (sizeof (ReplayRecord))) == NULL)
+        return False;
+    /*endif*/
+    r->rec = *rec;
+    r->p = p;
+    r->next = NULL;
+    if (spec->pending_tail != NULL)
+        spec->pending_tail->next = r;
+    else
+        spec->pending = r;
+    /*endif*/
+    spec->pending_tail = r;
+    return True;
+}
+
+/* unlinks the record after prev, or the first one if prev is NULL */
+static unsigned char *UnqueueRecord (ReplaySpecRec *spec,
+                                     ReplayRecord *prev,
+                                     XimCaptureRecord *rec)
+{
+    ReplayRecord *r = prev != NULL  ?  prev->next  :  spec->pending;
+    unsigned char *p;
+
+    if (r == NULL)
+        return NULL;
+    /*endif*/
+    if (prev != NULL)
+        prev->next = r->next;
+    else
+        spec->pending = r->next;
+    /*endif*/
+    if (spec->pending_tail == r)
+        spec->pending_tail = prev;
+    /*endif*/
+    *rec = r->rec;
+    p = r->p;
+    free (r);
+    return p;
+}
+
+static void FreeQueue (ReplaySpecRec *spec)
+{
+    XimCaptureRecord rec;
+    unsigned char *p;
+
+    while ((p = UnqueueRecord (spec, NULL, &rec)) != NULL)
+        free (p);
+    /*endwhile*/
+}
+
+/* the messages ReplayWait() has read ahead go first */
+static unsigned char *NextRecord (ReplaySpecRec *spec, XimCaptureRecord *rec)
+{
+    if (spec->pending != NULL)
+        return UnqueueRecord (spec, NULL, rec);
+    /*endif*/
+    return ReadRecord (spec->input, rec);
+}
+
+static Xi18nClient *NewReplayClient (Xi18n i18n_core,
+                                     CARD16 captured_id,
+                                     CARD8 byte_order)
+{
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    Xi18nClient *client;
+    ReplayClient *r_client;
+
+    if ((r_client = (ReplayClient *) malloc (sizeof (ReplayClient))) == NULL)
+        return NULL;
+    /*endif*/
+    client = _Xi18nNewClient (i18n_core);
+    r_client->captured_id = captured_id;
+    client->trans_rec = r_client;
+    client->byte_order = byte_order;
+    spec->id_map[captured_id] = client->connect_id;
+    if (spec->stats != NULL)
+        spec->stats->n_clients++;
+    /*endif*/
+    return client;
+}
+
+/* returns the replay connect_id of a captured message or 0 if it does
+ * not belong to any session; XIM_CONNECT starts a new one */
+static CARD16 MapConnectId (Xi18n i18n_core,
+                            XimCaptureRecord *rec,
+                            unsigned char *p)
+{
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    XimProtoHdr *hdr = (XimProtoHdr *) p;
+    Xi18nClient *client;
+
+    if (hdr->major_opcode == XIM_CONNECT)
+    {
+        if (spec->id_map[rec->connect_id] != 0)
+            return spec->id_map[rec->connect_id];
+        /*endif*/
+        /* the byte order is the first byte of XIM_CONNECT,
+         * same as ReadXIMMessage() does */
+        client = NewReplayClient (i18n_core,
+                                  rec->connect_id,
+                                  rec->length > 4  ?  p[4]  :  rec->byte_order);
+        return client != NULL  ?  client->connect_id  :  0;
+    }
+    /*endif*/
+    return spec->id_map[rec->connect_id];
+}
+
+static void DispatchRecord (XIMS ims, CARD16 connect_id, unsigned char *p)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    struct timeval start;
+    struct timeval end;
+    Bool delete = True;
+
+    gettimeofday (&start, NULL);
+    _Xi18nMessageHandler (ims, connect_id, p, &delete);
+    gettimeofday (&end, NULL);
+    if (delete)
+        free (p);
+    /*endif*/
+
+    if (spec->stats != NULL)
+    {
+        spec->stats->n_in++;
+        spec->stats->elapsed += (end.tv_sec - start.tv_sec)
+                                + (end.tv_usec - start.tv_usec) / 1000000.0;
+    }
+    /*endif*/
+}
+
+static Bool ReplayBegin (XIMS ims)
+{
+    return True;
+}
+
+static Bool ReplayEnd (XIMS ims)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+
+    FreeQueue (spec);
+    free (spec->id_map);
+    free (spec);
+    i18n_core->address.connect_addr = NULL;
+    return True;
+}
+
+static Bool ReplaySend (XIMS ims,
+                        CARD16 connect_id,
+                        unsigned char *reply,
+                        long length)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    Xi18nClient *client = _Xi18nFindClient (i18n_core, connect_id);
+    ReplayClient *r_client;
+
+    if (client == NULL)
+        return False;
+    /*endif*/
+    r_client = (ReplayClient *) client->trans_rec;
+
+    if (spec->stats != NULL)
+    {
+        spec->stats->n_out++;
+        spec->stats->bytes_out += length;
+    }
+    /*endif*/
+
+    /* the captured connect_id, so the output does not depend on
+     * the order connect ids are reused */
+    if (spec->output != NULL)
+    {
+        return WriteRecord (spec->output,
+                            NULL,
+                            r_client->captured_id,
+                            XIM_CAPTURE_OUT,
+                            client->byte_order,
+                            reply,
+                            length);
+    }
+    /*endif*/
+    return True;
+}
+
+/* the reply the server waits for is somewhere ahead in the capture.
+ * Unlike Xi18nXWait(), the other messages read on the way are not lost:
+ * they are queued and replayed in their order once the wait is over,
+ * as a client on the X transport would have them delivered later. */
+static Bool ReplayWait (XIMS ims,
+                        CARD16 connect_id,
+                        CARD8 major_opcode,
+                        CARD8 minor_opcode)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    XimCaptureRecord rec;
+    ReplayRecord *prev;
+    ReplayRecord *r;
+    unsigned char *p = NULL;
+
+    if (spec->input == NULL)
+        return False;
+    /*endif*/
+
+    /* a message queued by an earlier wait */
+    prev = NULL;
+    for (r = spec->pending;  r != NULL;  prev = r, r = r->next)
+    {
+        XimProtoHdr *hdr = (XimProtoHdr *) r->p;
+
+        if (r->rec.direction == XIM_CAPTURE_IN
+            &&
+            spec->id_map[r->rec.connect_id] == connect_id
+            &&
+            hdr->major_opcode == major_opcode
+            &&
+            hdr->minor_opcode == minor_opcode)
+        {
+            p = UnqueueRecord (spec, prev, &rec);
+            break;
+        }
+        /*endif*/
+    }
+    /*endfor*/
+
+    while (p == NULL  &&  (p = ReadRecord (spec->input, &rec)) != NULL)
+    {
+        XimProtoHdr *hdr = (XimProtoHdr *) p;
+
+        /* a new session is not what anybody waits for, it is
+         * created when its XIM_CONNECT comes out of the queue */
+        if (rec.direction == XIM_CAPTURE_IN
+            &&
+            hdr->major_opcode != XIM_CONNECT
+            &&
+            spec->id_map[rec.connect_id] == connect_id)
+        {
+            if (hdr->major_opcode == major_opcode
+                &&
+                hdr->minor_opcode == minor_opcode)
+            {
+                break;
+            }
+            else if (hdr->major_opcode == XIM_ERROR)
+            {
+                free (p);
+                return False;
+            }
+            /*endif*/
+        }
+        /*endif*/
+        if (rec.direction != XIM_CAPTURE_IN)
+        {
+            free (p);
+        }
+        else if (!QueueRecord (spec, &rec, p))
+        {
+            if (spec->stats != NULL)
+                spec->stats->n_dropped++;
+            /*endif*/
+            free (p);
+        }
+        /*endif*/
+        p = NULL;
+    }
+    /*endwhile*/
+
+    if (p == NULL)
+        return False;
+    /*endif*/
+    if (spec->stats != NULL)
+        spec->stats->bytes_in += rec.length;
+    /*endif*/
+    DispatchRecord (ims, connect_id, p);
+    return True;
+}
+
+static Bool ReplayDisconnect (XIMS ims, CARD16 connect_id)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    Xi18nClient *client = _Xi18nFindClient (i18n_core, connect_id);
+    ReplayClient *r_client;
+
+    if (client == NULL)
+        return False;
+    /*endif*/
+    r_client = (ReplayClient *) client->trans_rec;
+    if (spec->id_map != NULL)
+        spec->id_map[r_client->captured_id] = 0;
+    /*endif*/
+    free (r_client);
+    _Xi18nDeleteClient (i18n_core, connect_id);
+    return True;
+}
+
+Bool _Xi18nCheckReplayAddress (Xi18n i18n_core,
+                               TransportSW *transSW,
+                               char *address)
+{
+    ReplaySpecRec *spec;
+
+    if (!(spec = (ReplaySpecRec *) malloc (sizeof (ReplaySpecRec))))
+        return False;
+    /*endif*/
+    memset (spec, 0, sizeof (ReplaySpecRec));
+    spec->id_map = (CARD16 *) calloc (65536, sizeof (CARD16));
+    if (spec->id_map == NULL)
+    {
+        free (spec);
+        return False;
+    }
+    /*endif*/
+
+    i18n_core->address.connect_addr = (ReplaySpecRec *) spec;
+    i18n_core->methods.begin = ReplayBegin;
+    i18n_core->methods.end = ReplayEnd;
+    i18n_core->methods.send = ReplaySend;
+    i18n_core->methods.wait = ReplayWait;
+    i18n_core->methods.disconnect = ReplayDisconnect;
+    return True;
+}
+
+Bool _Xi18nIsReplayTransport (Xi18n i18n_core)
+{
+    return i18n_core->methods.begin == ReplayBegin;
+}
+
+Bool Xi18nReplay (XIMS ims,
+                  const char *capture,
+                  const char *output,
+                  XimReplayIdleProc idle,
+                  XimReplayStats *stats)
+{
+    Xi18n i18n_core = ims->protocol;
+    ReplaySpecRec *spec = (ReplaySpecRec *) i18n_core->address.connect_addr;
+    XimCaptureHeader header;
+    XimCaptureRecord rec;
+    unsigned char *p;
+    Bool ret = True;
+
+    if (!_Xi18nIsReplayTransport (i18n_core))
+        return False;
+    /*endif*/
+
+    if (stats != NULL)
+        memset (stats, 0, sizeof (XimReplayStats));
+    /*endif*/
+
+    spec->input = fopen (capture, "rb");
+    if (spec->input == NULL)
+    {
+        nabi_log (1, "xim replay: can't open %s\n", capture);
+        return False;
+    }
+    /*endif*/
+    if (fread (&header, sizeof (header), 1, spec->input) != 1
+        ||
+        memcmp (header.magic, XIM_CAPTURE_MAGIC, XIM_CAPTURE_MAGIC_LEN) != 0
+        ||
+        header.version != XIM_CAPTURE_VERSION
+        ||
+        header.byte_order != XIM_CAPTURE_BYTE_ORDER)
+    {
+        nabi_log (1, "xim replay: %s is not a capture file\n", capture);
+        fclose (spec->input);
+        spec->input = NULL;
+        return False;
+    }
+    /*endif*/
+
+    if (output != NULL)
+    {
+        spec->output = fopen (output, "wb");
+        if (spec->output == NULL  ||  !WriteHeader (spec->output))
+        {
+            nabi_log (1, "xim replay: can't write %s\n", output);
+            ret = False;
+            goto done;
+        }
+        /*endif*/
+    }
+    /*endif*/
+
+    spec->stats = stats;
+    while ((p = NextRecord (spec, &rec)) != NULL)
+    {
+        CARD16 connect_id;
+
+        if (rec.direction != XIM_CAPTURE_IN)
+        {
+            free (p);
+            continue;
+        }
+        /*endif*/
+
+        connect_id = MapConnectId (i18n_core, &rec, p);
+        if (connect_id == 0)
+        {
+            nabi_log (3, "xim replay: no session for message %d of cid %d\n",
+                      ((XimProtoHdr *) p)->major_opcode, rec.connect_id);
+            if (stats != NULL)
+                stats->n_dropped++;
+            /*endif*/
+            free (p);
+            continue;
+        }
+        /*endif*/
+
+        if (stats != NULL)
+            stats->bytes_in += rec.length;
+        /*endif*/
+        DispatchRecord (ims, connect_id, p);
+        if (idle != NULL)
+            (*idle) ();
+        /*endif*/
+    }
+    /*endwhile*/
+
+    if (!feof (spec->input))
+    {
+        nabi_log (1, "xim replay: %s is truncated\n", capture);
+        ret = False;
+    }
+    /*endif*/
+
+done:
+    FreeQueue (spec);
+    spec->stats = NULL;
+    if (spec->output != NULL)
+    {
+        if (fclose (spec->output) != 0)
+            ret = False;
+        /*endif*/
+        spec->output = NULL;
+    }
+    /*endif*/
+    fclose (spec->input);
+    spec->input = NULL;
+    return ret;
+}
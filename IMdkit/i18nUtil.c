@@ -300,3 +300,36 @@ void _Xi18nSetEventMask (XIMS ims,
     FrameMgrFree (fm);
     free (reply);
 }
+
+/* fills at most max entries, returns the number of clients */
+int Xi18nGetClients (XIMS ims, Xi18nClientInfo *info, int max)
+{
+    Xi18n i18n_core = ims->protocol;
+    Xi18nClient *client;
+    XIMPending *pending;
+    int n = 0;
+
+    for (client = i18n_core->address.clients;
+         client != NULL;
+         client = client->next)
+    {
+        if (n < max)
+        {
+            info[n].connect_id = client->connect_id;
+            info[n].byte_order = client->byte_order;
+            info[n].sync = client->sync;
+            info[n].n_pending = 0;
+            for (pending = client->pending;
+                 pending != NULL;
+                 pending = pending->next)
+            {
+                info[n].n_pending++;
+            }
+            /*endfor*/
+        }
+        /*endif*/
+        n++;
+    }
+    /*endfor*/
+    return n;
+}
@@ -29,6 +29,10 @@ IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  
 ******************************************************************/
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include "FrameMgr.h"
@@ -36,6 +40,8 @@ IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include "Xi18n.h"
 #include "Xi18nX.h"
 #include "XimFunc.h"
+#include "../src/probes.h"
+#include "../src/stat.h"
 
 extern Xi18nClient *_Xi18nFindClient(Xi18n, CARD16);
 extern Xi18nClient *_Xi18nNewClient(Xi18n);
@@ -69,7 +75,8 @@ static XClient *NewXClient (Xi18n i18n_core, Window new_client)
 
 static unsigned char *ReadXIMMessage (XIMS ims,
                                       XClientMessageEvent *ev,
-                                      int *connect_id)
+                                      int *connect_id,
+                                      long *size)
 {
     Xi18n i18n_core = ims->protocol;
     Xi18nClient *client = i18n_core->address.clients;
@@ -126,6 +133,7 @@ static unsigned char *ReadXIMMessage (XIMS ims,
         memmove (p1, &length, sizeof (CARD16));
         p1 += sizeof (CARD16);
         memmove (p1, rec, length * 4);
+        *size = total_size + length * 4;
     }
     else if (ev->format == 32) {
         /* ClientMessage and WindowProperty */
@@ -168,6 +176,7 @@ static unsigned char *ReadXIMMessage (XIMS ims,
 
         memmove (p, prop, length);
         XFree (prop);
+        *size = length;
     }
     return (unsigned char *) p;
 }
@@ -274,6 +283,9 @@ static Bool Xi18nXSend (XIMS ims,
     XClient *x_client = (XClient *) client->trans_rec;
     XEvent event;
 
+    NABI_PROBE3(xim_send, connect_id, reply[0], length);
+    NABI_STAT_INC(msg_out[reply[0]]);
+
     event.type = ClientMessage;
     event.xclient.window = x_client->client_win;
     event.xclient.message_type = spec->xim_request;
@@ -376,6 +388,7 @@ static Bool Xi18nXWait (XIMS ims,
         unsigned char *packet;
         XimProtoHdr *hdr;
         int connect_id_ret;
+        long size = 0;
 
         XIfEvent (i18n_core->address.dpy,
                   &event,
@@ -385,7 +398,8 @@ static Bool Xi18nXWait (XIMS ims,
         {
             if ((packet = ReadXIMMessage (ims,
                                           (XClientMessageEvent *) & event,
-                                          &connect_id_ret))
+                                          &connect_id_ret,
+                                          &size))
                 == (unsigned char*) NULL)
             {
                 return False;
@@ -398,6 +412,7 @@ static Bool Xi18nXWait (XIMS ims,
                 (hdr->minor_opcode == minor_opcode))
             {
 		Bool delete = True;
+		_Xi18nCaptureMessage (i18n_core, connect_id_ret, packet, size);
 		_Xi18nMessageHandler (ims, connect_id_ret, packet, &delete);
 		if (delete)
 		    free (packet);
@@ -481,18 +496,21 @@ static Bool WaitXIMProtocol (Display *dpy,
     Bool delete = True;
     unsigned char *packet;
     int connect_id;
+    long size = 0;
 
     if (((XClientMessageEvent *) ev)->message_type
         == spec->xim_request)
     {
         if ((packet = ReadXIMMessage (ims,
                                       (XClientMessageEvent *) ev,
-                                      &connect_id))
+                                      &connect_id,
+                                      &size))
             == (unsigned char *)  NULL)
         {
             return False;
         }
         /*endif*/
+        _Xi18nCaptureMessage (i18n_core, connect_id, packet, size);
         _Xi18nMessageHandler (ims, connect_id, packet, &delete);
         if (delete == True)
             free (packet);
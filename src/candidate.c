@@ -30,15 +30,46 @@
 #include "candidate.h"
 #include "gettext.h"
 #include "util.h"
+#include "window-cache.h"
 #include "nabi.h"
 
-enum {
-    COLUMN_INDEX,
-    COLUMN_CHARACTER,
-    COLUMN_COMMENT,
-    NO_OF_COLUMNS
+typedef struct _NabiCandidateRow    NabiCandidateRow;
+typedef struct _NabiCandidateWindow NabiCandidateWindow;
+
+struct _NabiCandidateRow {
+    PangoLayout *index;
+    PangoLayout *character;
+    PangoLayout *comment;
+    int y;
+    int height;
+};
+
+/* There is only one candidate window. It is created once, kept hidden
+ * while no candidate is shown and moved to the next client instead of
+ * being recreated. Rows are drawn directly from the cached layouts,
+ * a page flip only changes their text. */
+struct _NabiCandidateWindow {
+    GtkWidget *window;
+    GtkWidget *label;
+    GtkWidget *area;
+    GPtrArray *rows;		/* NabiCandidateRow */
+    int n_rows;			/* rows in use on the current page */
+    int index_width;
+    int character_width;
+    int comment_width;
+    GtkWidget *format_buttons[3];
+    NabiCandidate *candidate;	/* the candidate shown now */
 };
 
+#define ROW_PADDING	2
+#define COLUMN_SPACING	6
+#define COMMENT_WRAP_WIDTH 250
+
+static NabiCandidateWindow candidate_window = { NULL, };
+
+static void nabi_candidate_update_list(NabiCandidate *candidate);
+static void nabi_candidate_update_cursor(NabiCandidate *candidate);
+
 static void
 nabi_candidate_on_format(GtkWidget* widget, gpointer data)
 {
@@ -53,60 +84,133 @@ nabi_candidate_on_format(GtkWidget* widget, gpointer data)
 }
 
 static void
-nabi_candidate_on_row_activated(GtkWidget *widget,
-				GtkTreePath *path,
-				GtkTreeViewColumn *column,
-				NabiCandidate *candidate)
+nabi_candidate_on_expose(GtkWidget *widget,
+			 GdkEventExpose *event,
+			 gpointer data)
+{
+    GtkStyle *style;
+    GtkAllocation alloc;
+
+    style = gtk_widget_get_style(widget);
+    alloc = GTK_WIDGET(widget)->allocation;
+    gdk_draw_rectangle(widget->window, style->black_gc,
+		       FALSE,
+		       0, 0, alloc.width - 1, alloc.height - 1);
+}
+
+/* 후보 목록을 treeview 대신 직접 그린다.
+ * candidate window는 포커스가 없는 윈도우이므로 treeview를 쓰면 선택된
+ * row가 active 상태로 그려지고, 테마에 따라 normal과 구분이 안되는
+ * 경우가 있었다. 여기서는 선택된 row를 항상 selected 색으로 그린다. */
+static gboolean
+nabi_candidate_on_area_expose(GtkWidget *widget,
+			      GdkEventExpose *event,
+			      gpointer data)
 {
-    const Hanja* hanja;
-    if (path != NULL) {
-	int *indices;
-	indices = gtk_tree_path_get_indices(path);
-	candidate->current = candidate->first + indices[0];
+    NabiCandidate *candidate = candidate_window.candidate;
+    GtkStyle *style;
+    int i;
+    int width;
+    int x_character;
+    int x_comment;
+
+    if (candidate == NULL)
+	return FALSE;
+
+    style = gtk_widget_get_style(widget);
+    width = widget->allocation.width;
+    gdk_draw_rectangle(widget->window, style->base_gc[GTK_STATE_NORMAL],
+		       TRUE,
+		       0, 0, width, widget->allocation.height);
+
+    x_character = COLUMN_SPACING + candidate_window.index_width +
+		  COLUMN_SPACING;
+    x_comment = x_character + candidate_window.character_width +
+		COLUMN_SPACING;
+
+    for (i = 0; i < candidate_window.n_rows; i++) {
+	NabiCandidateRow *row = g_ptr_array_index(candidate_window.rows, i);
+	GtkStateType state = GTK_STATE_NORMAL;
+
+	if (row->y >= event->area.y + event->area.height ||
+	    row->y + row->height <= event->area.y)
+	    continue;
+
+	if (candidate->first + i == candidate->current) {
+	    state = GTK_STATE_SELECTED;
+	    gdk_draw_rectangle(widget->window,
+			       style->base_gc[GTK_STATE_SELECTED], TRUE,
+			       0, row->y, width, row->height);
+	}
+
+	gdk_draw_layout(widget->window, style->text_gc[state],
+			COLUMN_SPACING, row->y + ROW_PADDING, row->index);
+	gdk_draw_layout(widget->window, style->text_gc[state],
+			x_character, row->y + ROW_PADDING, row->character);
+	gdk_draw_layout(widget->window, style->text_gc[state],
+			x_comment, row->y + ROW_PADDING, row->comment);
     }
 
-    hanja = nabi_candidate_get_current(candidate);
-    if (hanja != NULL &&
-	candidate->commit != NULL && candidate->commit_data != NULL)
-	candidate->commit(candidate, hanja, candidate->commit_data);
+    return TRUE;
 }
 
 static void
-nabi_candidate_on_cursor_changed(GtkWidget *widget,
-				 NabiCandidate *candidate)
+nabi_candidate_on_area_style_set(GtkWidget *widget,
+				 GtkStyle *previous_style,
+				 gpointer data)
 {
-    GtkTreePath *path;
-
-    gtk_tree_view_get_cursor(GTK_TREE_VIEW(widget), &path, NULL);
-    if (path != NULL) {
-	int *indices;
-	indices = gtk_tree_path_get_indices(path);
-	candidate->current = candidate->first + indices[0];
-	gtk_tree_path_free(path);
+    guint i;
+
+    for (i = 0; i < candidate_window.rows->len; i++) {
+	NabiCandidateRow *row = g_ptr_array_index(candidate_window.rows, i);
+	pango_layout_context_changed(row->index);
+	pango_layout_context_changed(row->character);
+	pango_layout_context_changed(row->comment);
     }
+
+    if (candidate_window.candidate != NULL)
+	nabi_candidate_update_list(candidate_window.candidate);
 }
 
-static void
-nabi_candidate_on_expose(GtkWidget *widget,
-		    GdkEventExpose *event,
-		    gpointer data)
+static gboolean
+nabi_candidate_on_area_button_press(GtkWidget *widget,
+				    GdkEventButton *event,
+				    gpointer data)
 {
-    GtkStyle *style;
-    GtkAllocation alloc;
+    NabiCandidate *candidate = candidate_window.candidate;
+    int i;
 
-    style = gtk_widget_get_style(widget);
-    alloc = GTK_WIDGET(widget)->allocation;
-    gdk_draw_rectangle(widget->window, style->black_gc,
-		       FALSE,
-		       0, 0, alloc.width - 1, alloc.height - 1);
+    if (candidate == NULL || event->button != 1)
+	return FALSE;
+
+    for (i = 0; i < candidate_window.n_rows; i++) {
+	NabiCandidateRow *row = g_ptr_array_index(candidate_window.rows, i);
+	if (event->y >= row->y && event->y < row->y + row->height)
+	    break;
+    }
+
+    if (i >= candidate_window.n_rows)
+	return FALSE;
+
+    candidate->current = candidate->first + i;
+    nabi_candidate_update_cursor(candidate);
+
+    if (event->type == GDK_2BUTTON_PRESS) {
+	const NabiDictItem* hanja = nabi_candidate_get_current(candidate);
+	if (hanja != NULL && candidate->commit != NULL)
+	    candidate->commit(candidate, hanja, candidate->commit_data);
+    }
+
+    return TRUE;
 }
 
 static gboolean
 nabi_candidate_on_key_press(GtkWidget *widget,
 			    GdkEventKey *event,
-			    NabiCandidate *candidate)
+			    gpointer data)
 {
-    const Hanja* hanja = NULL;
+    NabiCandidate *candidate = candidate_window.candidate;
+    const NabiDictItem* hanja = NULL;
 
     if (candidate == NULL)
 	return FALSE;
@@ -215,8 +319,10 @@ nabi_candidate_on_key_press(GtkWidget *widget,
 static gboolean
 nabi_candidate_on_scroll(GtkWidget *widget,
 			 GdkEventScroll *event,
-			 NabiCandidate *candidate)
+			 gpointer data)
 {
+    NabiCandidate *candidate = candidate_window.candidate;
+
     if (candidate == NULL)
 	return FALSE;
 
@@ -236,28 +342,19 @@ nabi_candidate_on_scroll(GtkWidget *widget,
 static void
 nabi_candidate_update_cursor(NabiCandidate *candidate)
 {
-    GtkTreePath *path;
-
-    if (candidate->treeview == NULL)
+    if (candidate == NULL || candidate != candidate_window.candidate)
 	return;
 
-    path = gtk_tree_path_new_from_indices(candidate->current - candidate->first,
-					  -1);
-    gtk_tree_view_set_cursor(GTK_TREE_VIEW(candidate->treeview),
-			     path, NULL, FALSE);
-    gtk_tree_path_free(path);
+    gtk_widget_queue_draw(candidate_window.area);
 }
 
 /* keep the whole window on screen */
 static void
 nabi_candidate_set_window_position(NabiCandidate *candidate)
 {
-    Window root;
-    Window child;
-    int x = 0, y = 0;
-    unsigned int width = 0, height = 0, border = 0, depth = 0;
     int absx = 0;
     int absy = 0;
+    unsigned int width = 0;
     int root_w, root_h, cand_w, cand_h;
     GtkRequisition requisition;
 
@@ -267,12 +364,10 @@ nabi_candidate_set_window_position(NabiCandidate *candidate)
 	return;
 
     /* move candidate window to focus window below */
-    XGetGeometry(nabi_server->display,
-		 candidate->parent,
-		 &root, &x, &y, &width, &height, &border, &depth);
-    XTranslateCoordinates(nabi_server->display,
-			  candidate->parent, root,
-			  0, 0, &absx, &absy, &child);
+    if (!nabi_window_cache_get_geometry(nabi_server->display,
+					candidate->parent,
+					&absx, &absy, &width, NULL))
+	return;
 
     root_w = gdk_screen_width();
     root_h = gdk_screen_height();
@@ -290,70 +385,136 @@ nabi_candidate_set_window_position(NabiCandidate *candidate)
     gtk_window_move(GTK_WINDOW(candidate->window), absx, absy);
 }
 
+static NabiCandidateRow*
+nabi_candidate_get_row(int n)
+{
+    NabiCandidateRow *row;
+    GtkWidget *area = candidate_window.area;
+
+    while (candidate_window.rows->len <= n) {
+	row = g_new0(NabiCandidateRow, 1);
+	row->index = gtk_widget_create_pango_layout(area, NULL);
+	row->character = gtk_widget_create_pango_layout(area, NULL);
+	row->comment = gtk_widget_create_pango_layout(area, NULL);
+	pango_layout_set_width(row->comment, COMMENT_WRAP_WIDTH * PANGO_SCALE);
+	pango_layout_set_wrap(row->comment, PANGO_WRAP_WORD_CHAR);
+	g_ptr_array_add(candidate_window.rows, row);
+    }
+
+    return g_ptr_array_index(candidate_window.rows, n);
+}
+
 static void
 nabi_candidate_update_list(NabiCandidate *candidate)
 {
     int i;
-    GtkTreeIter iter;
+    int y;
+    int width;
+    GTimer *timer;
 
-    gtk_list_store_clear(candidate->store);
+    if (candidate == NULL || candidate != candidate_window.candidate)
+	return;
+
+    timer = g_timer_new();
+
+    candidate_window.index_width = 0;
+    candidate_window.character_width = 0;
+    candidate_window.comment_width = 0;
+
+    y = 0;
     for (i = 0;
 	 i < candidate->n_per_page && candidate->first + i < candidate->n;
 	 i++) {
-	const Hanja* hanja = candidate->data[candidate->first + i];
-	const char* value = hanja_get_value(hanja);
-	const char* comment = hanja_get_comment(hanja);
-	char* candidate_str;
-
-	if (nabi_server->use_simplified_chinese) {
-	    candidate_str = nabi_traditional_to_simplified(value);
-	} else {
-	    candidate_str = g_strdup(value);
-	}
-
-	gtk_list_store_append(candidate->store, &iter);
-	gtk_list_store_set(candidate->store, &iter,
-			   COLUMN_INDEX, (i + 1) % 10,
-			   COLUMN_CHARACTER, candidate_str,
-			   COLUMN_COMMENT, comment,
-			   -1);
-	g_free(candidate_str);
+	const NabiDictItem* hanja = candidate->data[candidate->first + i];
+	NabiCandidateRow *row = nabi_candidate_get_row(i);
+	char index[4];
+	int w, h;
+
+	g_snprintf(index, sizeof(index), "%d", (i + 1) % 10);
+	pango_layout_set_text(row->index, index, -1);
+	pango_layout_set_font_description(row->character,
+					  nabi_server->candidate_font);
+	pango_layout_set_text(row->character, hanja->value, -1);
+	pango_layout_set_text(row->comment, hanja->comment, -1);
+
+	row->y = y;
+	row->height = 0;
+
+	pango_layout_get_pixel_size(row->index, &w, &h);
+	candidate_window.index_width = MAX(candidate_window.index_width, w);
+	row->height = MAX(row->height, h);
+
+	pango_layout_get_pixel_size(row->character, &w, &h);
+	candidate_window.character_width =
+				    MAX(candidate_window.character_width, w);
+	row->height = MAX(row->height, h);
+
+	pango_layout_get_pixel_size(row->comment, &w, &h);
+	candidate_window.comment_width = MAX(candidate_window.comment_width, w);
+	row->height = MAX(row->height, h);
+
+	row->height += ROW_PADDING * 2;
+	y += row->height;
     }
+    candidate_window.n_rows = i;
+
+    width = candidate_window.index_width +
+	    candidate_window.character_width +
+	    candidate_window.comment_width +
+	    COLUMN_SPACING * 4;
+    gtk_widget_set_size_request(candidate_window.area, width, y);
+    /* let the window shrink to the new page */
+    gtk_window_resize(GTK_WINDOW(candidate_window.window), 1, 1);
+    gtk_widget_queue_draw(candidate_window.area);
+
     nabi_candidate_set_window_position(candidate);
+
+    nabi_log(4, "candidate update: %d rows, %.3f ms\n",
+	     candidate_window.n_rows, g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
 }
 
+static const char *candidate_formats[] = {
+    "hanja",
+    "hanja(hangul)",
+    "hangul(hanja)"
+};
+
 static void
-nabi_candidate_on_treeview_realize(GtkWidget* widget, gpointer data)
+nabi_candidate_update_format(void)
 {
-    gtk_widget_modify_fg  (widget, GTK_STATE_ACTIVE,
-			   &widget->style->fg[GTK_STATE_SELECTED]);
-    gtk_widget_modify_bg  (widget, GTK_STATE_ACTIVE,
-			   &widget->style->bg[GTK_STATE_SELECTED]);
-    gtk_widget_modify_text(widget, GTK_STATE_ACTIVE,
-			   &widget->style->text[GTK_STATE_SELECTED]);
-    gtk_widget_modify_base(widget, GTK_STATE_ACTIVE,
-			   &widget->style->base[GTK_STATE_SELECTED]);
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(candidate_formats); i++) {
+	if (strcmp(nabi->config->candidate_format->str,
+		   candidate_formats[i]) == 0) {
+	    GtkWidget *button = candidate_window.format_buttons[i];
+	    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
+	}
+    }
 }
 
 static void
-nabi_candidate_create_window(NabiCandidate *candidate)
+nabi_candidate_create_window(void)
 {
     GtkWidget *frame;
     GtkWidget *vbox;
     GtkWidget *hbox;
     GtkWidget *label;
     GtkWidget *button;
-    GtkWidget *treeview;
-    GtkTreeViewColumn *column;
-    GtkCellRenderer *renderer;
+    GtkWidget *area;
 
-    candidate->window = gtk_window_new(GTK_WINDOW_POPUP);
+    if (candidate_window.window != NULL)
+	return;
 
-    nabi_candidate_update_list(candidate);
+    candidate_window.window = gtk_window_new(GTK_WINDOW_POPUP);
+    candidate_window.rows = g_ptr_array_new();
+    candidate_window.n_rows = 0;
+    candidate_window.candidate = NULL;
 
     frame = gtk_frame_new(NULL);
     gtk_frame_set_shadow_type(GTK_FRAME(frame), GTK_SHADOW_OUT);
-    gtk_container_add(GTK_CONTAINER(candidate->window), frame);
+    gtk_container_add(GTK_CONTAINER(candidate_window.window), frame);
 
     vbox = gtk_vbox_new(FALSE, 0);
     gtk_container_add(GTK_CONTAINER(frame), vbox);
@@ -361,113 +522,75 @@ nabi_candidate_create_window(NabiCandidate *candidate)
     hbox = gtk_hbox_new(FALSE, 0);
     gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, TRUE, 0);
 
-    label = GTK_WIDGET(candidate->label);
+    label = gtk_label_new("");
     gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 6);
+    candidate_window.label = label;
 
     button = gtk_radio_button_new_with_label(NULL, _("hanja"));
     gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, TRUE, 6);
-    if (strcmp(nabi->config->candidate_format->str, "hanja") == 0)
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
     g_signal_connect(G_OBJECT(button), "toggled",
 		     G_CALLBACK(nabi_candidate_on_format), "hanja");
+    candidate_window.format_buttons[0] = button;
 
     button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), _("hanja(hangul)"));
     gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, TRUE, 6);
-    if (strcmp(nabi->config->candidate_format->str, "hanja(hangul)") == 0)
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
     g_signal_connect(G_OBJECT(button), "toggled",
 		     G_CALLBACK(nabi_candidate_on_format), "hanja(hangul)");
+    candidate_window.format_buttons[1] = button;
+
     button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), _("hangul(hanja)"));
     gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, TRUE, 6);
-    if (strcmp(nabi->config->candidate_format->str, "hangul(hanja)") == 0)
-	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
     g_signal_connect(G_OBJECT(button), "toggled",
 		     G_CALLBACK(nabi_candidate_on_format), "hangul(hanja)");
+    candidate_window.format_buttons[2] = button;
+
+    area = gtk_drawing_area_new();
+    gtk_widget_add_events(area, GDK_BUTTON_PRESS_MASK);
+    gtk_box_pack_start(GTK_BOX(vbox), area, TRUE, TRUE, 0);
+    candidate_window.area = area;
+
+    g_signal_connect(G_OBJECT(area), "expose-event",
+		     G_CALLBACK(nabi_candidate_on_area_expose), NULL);
+    g_signal_connect(G_OBJECT(area), "style-set",
+		     G_CALLBACK(nabi_candidate_on_area_style_set), NULL);
+    g_signal_connect(G_OBJECT(area), "button-press-event",
+		     G_CALLBACK(nabi_candidate_on_area_button_press), NULL);
+
+    g_signal_connect(G_OBJECT(candidate_window.window), "key-press-event",
+		     G_CALLBACK(nabi_candidate_on_key_press), NULL);
+    g_signal_connect(G_OBJECT(candidate_window.window), "scroll-event",
+		     G_CALLBACK(nabi_candidate_on_scroll), NULL);
+    g_signal_connect_after(G_OBJECT(candidate_window.window), "expose-event",
+                           G_CALLBACK(nabi_candidate_on_expose), NULL);
+
+    gtk_widget_show_all(frame);
+    gtk_widget_realize(candidate_window.window);
+}
 
-    treeview = gtk_tree_view_new_with_model(GTK_TREE_MODEL(candidate->store));
-    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(treeview), FALSE);
-    gtk_box_pack_start(GTK_BOX(vbox), treeview, TRUE, TRUE, 0);
-    candidate->treeview = treeview;
-    g_object_unref(candidate->store);
-
-    /* number column */
-    renderer = gtk_cell_renderer_text_new();
-    column = gtk_tree_view_column_new_with_attributes("No",
-						      renderer,
-						      "text", COLUMN_INDEX,
-						      NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    /* character column */
-    renderer = gtk_cell_renderer_text_new();
-    if (nabi_server->candidate_font != NULL)
-	g_object_set(renderer, "font-desc", nabi_server->candidate_font, NULL);
-    column = gtk_tree_view_column_new_with_attributes("Character",
-						      renderer,
-						      "text", COLUMN_CHARACTER,
-						      NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    /* comment column */
-    renderer = gtk_cell_renderer_text_new();
-    column = gtk_tree_view_column_new_with_attributes("Comment",
-						      renderer,
-						      "text", COLUMN_COMMENT,
-						      NULL);
-
-    if (gtk_major_version > 2 ||
-	    (gtk_major_version == 2 && gtk_minor_version >= 8)) {
-	gint wrap_width = 250;
-	g_object_set(G_OBJECT(renderer),
-		"wrap-mode", PANGO_WRAP_WORD_CHAR,
-		"wrap-width", wrap_width, NULL);
-    }
-
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    nabi_candidate_update_cursor(candidate);
-
-    g_signal_connect(G_OBJECT(treeview), "row-activated",
-		     G_CALLBACK(nabi_candidate_on_row_activated), candidate);
-    g_signal_connect(G_OBJECT(treeview), "cursor-changed",
-		     G_CALLBACK(nabi_candidate_on_cursor_changed), candidate);
-    // candidate window는 포커스가 없는 윈도우이므로 treeview에는 
-    // focus가 없는 상태가 되어서 select가 되지 않는다.
-    // 그런데 테마에 따라서 active 색상이 normal 색상과 같은 것들이 있다.
-    // 그런 경우에는 active 상태인 row가 normal과 같이 그려지므로 
-    // 구분이 되지 않는다. 즉 선택된 candidate가 구분이 안되는 경우가 
-    // 있다는 것이다.
-    // 그런 경우를 피하기 위해서 realize된 후(style이 attach된 후)
-    // style을 modify해서 active인 것이 select 된 것과 동일하게 그려지도록
-    // 처리한다.
-    g_signal_connect_after(G_OBJECT(treeview), "realize",
-		     G_CALLBACK(nabi_candidate_on_treeview_realize), NULL);
-
-    g_signal_connect(G_OBJECT(candidate->window), "key-press-event",
-		     G_CALLBACK(nabi_candidate_on_key_press), candidate);
-    g_signal_connect(G_OBJECT(candidate->window), "scroll-event",
-		     G_CALLBACK(nabi_candidate_on_scroll), candidate);
-    g_signal_connect_after(G_OBJECT(candidate->window), "expose-event",
-                           G_CALLBACK(nabi_candidate_on_expose), candidate);
-    g_signal_connect_swapped(G_OBJECT(candidate->window), "realize",
-		             G_CALLBACK(nabi_candidate_set_window_position),
-			     candidate);
-
-    gtk_widget_show_all(candidate->window);
-    gtk_grab_add(candidate->window);
+/* candidate window를 미리 만들어 두어서 처음 한자 변환할 때
+ * 윈도우를 만드는 시간을 줄인다. */
+void
+nabi_candidate_preload(void)
+{
+    nabi_candidate_create_window();
 }
 
 NabiCandidate*
 nabi_candidate_new(const char *label_str,
 		   int n_per_page,
-		   HanjaList *list,
-		   const Hanja **valid_list,
+		   NabiDictList *list,
+		   const NabiDictItem **valid_list,
 		   int valid_list_length,
 		   Window parent,
 		   NabiCandidateCommitFunc commit,
 		   gpointer commit_data)
 {
     NabiCandidate *candidate;
+    GTimer *timer;
+
+    timer = g_timer_new();
+
+    nabi_candidate_create_window();
 
     candidate = (NabiCandidate*)g_malloc(sizeof(NabiCandidate));
     candidate->first = 0;
@@ -476,9 +599,8 @@ nabi_candidate_new(const char *label_str,
     candidate->n = 0;
     candidate->data = NULL;
     candidate->parent = parent;
-    candidate->label = GTK_LABEL(gtk_label_new(label_str));
-    candidate->store = NULL;
-    candidate->treeview = NULL;
+    candidate->window = candidate_window.window;
+    candidate->label = GTK_LABEL(candidate_window.label);
     candidate->commit = commit;
     candidate->commit_data = commit_data;
     candidate->hanja_list = list;
@@ -486,18 +608,32 @@ nabi_candidate_new(const char *label_str,
     candidate->data = valid_list;
     candidate->n = valid_list_length;
 
-    candidate->store = gtk_list_store_new(NO_OF_COLUMNS,
-				    G_TYPE_INT, G_TYPE_STRING, G_TYPE_STRING);
-
     if (n_per_page == 0)
 	candidate->n_per_page = candidate->n;
 
-    nabi_candidate_create_window(candidate);
-    nabi_candidate_update_cursor(candidate);
+    /* 다른 candidate가 윈도우를 쓰고 있으면 새 것이 윈도우를 가져간다.
+     * 이전 candidate는 delete될 때까지 그려지지 않는다. */
+    if (candidate_window.candidate == NULL) {
+	candidate_window.candidate = candidate;
+	gtk_label_set_label(candidate->label, label_str);
+	nabi_candidate_update_format();
+	nabi_candidate_update_list(candidate);
+	gtk_widget_show(candidate->window);
+	gtk_grab_add(candidate->window);
+    } else {
+	candidate_window.candidate = candidate;
+	gtk_label_set_label(candidate->label, label_str);
+	nabi_candidate_update_list(candidate);
+    }
+
+    nabi_log(4, "candidate popup: %.3f ms\n",
+	     g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
 
     return candidate;
 }
 
+
 void
 nabi_candidate_prev(NabiCandidate *candidate)
 {
@@ -562,7 +698,7 @@ nabi_candidate_next_page(NabiCandidate *candidate)
     nabi_candidate_update_cursor(candidate);
 }
 
-const Hanja*
+const NabiDictItem*
 nabi_candidate_get_current(NabiCandidate *candidate)
 {
     if (candidate == NULL)
@@ -571,7 +707,7 @@ nabi_candidate_get_current(NabiCandidate *candidate)
     return candidate->data[candidate->current];
 }
 
-const Hanja*
+const NabiDictItem*
 nabi_candidate_get_nth(NabiCandidate *candidate, int n)
 {
     if (candidate == NULL)
@@ -591,17 +727,23 @@ nabi_candidate_delete(NabiCandidate *candidate)
     if (candidate == NULL)
 	return;
 
-    hanja_list_delete(candidate->hanja_list);
-    gtk_grab_remove(candidate->window);
-    gtk_widget_destroy(candidate->window);
+    /* 윈도우는 다음에 다시 쓰기 위해서 숨기기만 한다 */
+    if (candidate == candidate_window.candidate) {
+	gtk_grab_remove(candidate->window);
+	gtk_widget_hide(candidate->window);
+	candidate_window.candidate = NULL;
+	candidate_window.n_rows = 0;
+    }
+
+    nabi_dict_list_delete(candidate->hanja_list);
     g_free(candidate->data);
     g_free(candidate);
 }
 
 void
 nabi_candidate_set_hanja_list(NabiCandidate *candidate,
-			    HanjaList* list,
-			    const Hanja** valid_list,
+			    NabiDictList* list,
+			    const NabiDictItem** valid_list,
 			    int valid_list_length)
 {
     const char* label;
@@ -612,7 +754,7 @@ nabi_candidate_set_hanja_list(NabiCandidate *candidate,
     if (list == NULL)
 	return;
 
-    hanja_list_delete(candidate->hanja_list);
+    nabi_dict_list_delete(candidate->hanja_list);
     g_free(candidate->data);
 
     candidate->hanja_list = list;
@@ -620,8 +762,10 @@ nabi_candidate_set_hanja_list(NabiCandidate *candidate,
     candidate->n = valid_list_length;
     candidate->current = 0;
 
-    label = hanja_list_get_key(list);
-    gtk_label_set_label(candidate->label, label);
+    if (candidate == candidate_window.candidate) {
+	label = nabi_dict_list_get_key(list);
+	gtk_label_set_label(candidate->label, label);
+    }
 
     nabi_candidate_update_list(candidate);
     nabi_candidate_update_cursor(candidate);
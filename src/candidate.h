@@ -22,31 +22,30 @@
 #include <X11/Xlib.h>
 #include <gtk/gtk.h>
 
-#include <hangul.h>
+#include "dictionary.h"
 
 typedef struct _NabiCandidate     NabiCandidate;
-typedef void (*NabiCandidateCommitFunc)(NabiCandidate*, const Hanja*, gpointer);
+typedef void (*NabiCandidateCommitFunc)(NabiCandidate*, const NabiDictItem*, gpointer);
 
 struct _NabiCandidate {
     GtkWidget *window;
     Window parent;
     GtkLabel *label;
-    GtkListStore *store;
-    GtkWidget *treeview;
-    const Hanja **data;
+    const NabiDictItem **data;
     NabiCandidateCommitFunc commit;
     gpointer commit_data;
     int first;
     int n;
     int n_per_page;
     int current;
-    HanjaList *hanja_list;
+    NabiDictList *hanja_list;
 };
 
+void               nabi_candidate_preload(void);
 NabiCandidate*     nabi_candidate_new(const char *label_str,
 		   	              int n_per_page,
-			              HanjaList* list,
-			              const Hanja** valid_list,
+			              NabiDictList* list,
+			              const NabiDictItem** valid_list,
 			              int valid_list_length,
 			              Window parent,
 				      NabiCandidateCommitFunc commit,
@@ -57,12 +56,12 @@ void               nabi_candidate_prev_row(NabiCandidate *candidate);
 void               nabi_candidate_next_row(NabiCandidate *candidate);
 void               nabi_candidate_prev_page(NabiCandidate *candidate);
 void               nabi_candidate_next_page(NabiCandidate *candidate);
-const Hanja*       nabi_candidate_get_current(NabiCandidate *candidate);
-const Hanja*       nabi_candidate_get_nth(NabiCandidate *candidate, int n);
+const NabiDictItem* nabi_candidate_get_current(NabiCandidate *candidate);
+const NabiDictItem* nabi_candidate_get_nth(NabiCandidate *candidate, int n);
 void               nabi_candidate_delete(NabiCandidate *candidate);
 void               nabi_candidate_set_hanja_list(NabiCandidate *candidate,
-						 HanjaList* list,
-						 const Hanja** valid_list,
+						 NabiDictList* list,
+						 const NabiDictItem** valid_list,
 						 int valid_list_length);
 
 #endif /* _NABICANDIDATE_H_ */
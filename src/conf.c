@@ -73,6 +73,9 @@ const static struct config_item config_items[] = {
     { "hanja_mode",         CONFIG_BOOL, OFFSET(hanja_mode)               },
     { "ignore_app_fontset", CONFIG_BOOL, OFFSET(ignore_app_fontset)       },
     { "use_system_keymap",  CONFIG_BOOL, OFFSET(use_system_keymap)        },
+    { "preedit_idle_timeout", CONFIG_INT, OFFSET(preedit_idle_timeout)    },
+    { "preedit_glyph_atlas", CONFIG_BOOL, OFFSET(preedit_glyph_atlas)     },
+    { "input_lag_slo",      CONFIG_INT,  OFFSET(input_lag_slo)            },
     { NULL,                 0,           0                                }
 };
 
@@ -220,6 +223,9 @@ nabi_config_new()
     config->use_simplified_chinese = FALSE;
     config->ignore_app_fontset = FALSE;
     config->use_system_keymap = FALSE;
+    config->preedit_idle_timeout = 300;
+    config->preedit_glyph_atlas = FALSE;
+    config->input_lag_slo = 0;
 
     return config;
 }
@@ -53,6 +53,9 @@ struct _NabiConfig {
     gboolean        hanja_mode;
     gboolean        ignore_app_fontset;
     gboolean        use_system_keymap;
+    gint            preedit_idle_timeout;
+    gboolean        preedit_glyph_atlas;
+    gint            input_lag_slo;
 
     /* candidate options */
     GString*        candidate_font;
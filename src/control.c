@@ -0,0 +1,672 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* struct ucred */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "server.h"
+#include "ic.h"
+#include "latency.h"
+#include "trace.h"
+#include "control.h"
+
+/* the socket is $XDG_RUNTIME_DIR/nabi-<display>.ctl, or
+ * $TMPDIR/nabi-<uid>-<display>.ctl without XDG_RUNTIME_DIR
+ *
+ * usage: echo state | socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/nabi-:0.ctl
+ *
+ * commands:
+ *   state            connections, ics and xim clients
+ *   log-level [n]    get or set the log level
+ *   trace-level [n]  get or set the level the trace ring records
+ *   dump-trace       write the trace ring in the background, see nabi-trace
+ *   latency          the latency report
+ *   help
+ */
+
+#define MAX_CLIENTS	8
+#define MAX_LINE	1024
+#define MAX_OUTPUT	(4 * 1024 * 1024)
+
+typedef struct _NabiControlClient NabiControlClient;
+
+struct _NabiControlClient {
+    int      fd;
+    guint    in_source;
+    guint    out_source;
+    GString* in;
+    GString* out;
+    gboolean closing;	/* close after the output is written */
+};
+
+static int control_fd = -1;
+static guint control_source = 0;
+static char* control_path = NULL;
+static GSList* control_clients = NULL;
+
+static void nabi_control_client_free(NabiControlClient* client);
+static gboolean on_client_out(GIOChannel* channel, GIOCondition condition,
+			      gpointer data);
+
+static char*
+nabi_control_get_socket_path(const char* display)
+{
+    const char* runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+    char* name;
+    char* path;
+    char* p;
+
+    if (runtime_dir != NULL && runtime_dir[0] != '\0') {
+	name = g_strdup_printf("nabi-%s.ctl", display);
+	p = name + 5;
+    } else {
+	runtime_dir = g_get_tmp_dir();
+	name = g_strdup_printf("nabi-%u-%s.ctl", (unsigned)getuid(), display);
+	p = name;
+    }
+
+    for (; *p != '\0'; p++) {
+	if (*p == '/')
+	    *p = '_';
+    }
+
+    path = g_build_filename(runtime_dir, name, NULL);
+    g_free(name);
+    return path;
+}
+
+static void
+json_append_string(GString* out, const char* str)
+{
+    const unsigned char* p;
+
+    if (str == NULL) {
+	g_string_append(out, "null");
+	return;
+    }
+
+    g_string_append_c(out, '"');
+    for (p = (const unsigned char*)str; *p != '\0'; p++) {
+	switch (*p) {
+	case '"':
+	    g_string_append(out, "\\\"");
+	    break;
+	case '\\':
+	    g_string_append(out, "\\\\");
+	    break;
+	case '\n':
+	    g_string_append(out, "\\n");
+	    break;
+	case '\t':
+	    g_string_append(out, "\\t");
+	    break;
+	default:
+	    if (*p < 0x20)
+		g_string_append_printf(out, "\\u%04x", *p);
+	    else
+		g_string_append_c(out, *p);
+	}
+    }
+    g_string_append_c(out, '"');
+}
+
+static void
+json_append_key(GString* out, const char* key)
+{
+    if (out->len > 0) {
+	char last = out->str[out->len - 1];
+	if (last != '{' && last != '[')
+	    g_string_append_c(out, ',');
+    }
+    json_append_string(out, key);
+    g_string_append_c(out, ':');
+}
+
+static void
+json_append_int(GString* out, const char* key, long value)
+{
+    json_append_key(out, key);
+    g_string_append_printf(out, "%ld", value);
+}
+
+static void
+json_append_bool(GString* out, const char* key, gboolean value)
+{
+    json_append_key(out, key);
+    g_string_append(out, value ? "true" : "false");
+}
+
+static void
+json_append_window(GString* out, const char* key, Window window)
+{
+    char buf[32];
+
+    json_append_key(out, key);
+    if (window == 0) {
+	g_string_append(out, "null");
+    } else {
+	g_snprintf(buf, sizeof(buf), "0x%lx", (unsigned long)window);
+	json_append_string(out, buf);
+    }
+}
+
+static void
+json_append_str(GString* out, const char* key, const char* value)
+{
+    json_append_key(out, key);
+    json_append_string(out, value);
+}
+
+static void
+json_begin_object(GString* out)
+{
+    if (out->len > 0) {
+	char last = out->str[out->len - 1];
+	if (last != '{' && last != '[' && last != ':')
+	    g_string_append_c(out, ',');
+    }
+    g_string_append_c(out, '{');
+}
+
+static const char*
+get_mode_name(NabiInputMode mode)
+{
+    return mode == NABI_INPUT_MODE_COMPOSE ? "compose" : "direct";
+}
+
+static const char*
+get_input_style_name(long input_style)
+{
+    if (input_style & XIMPreeditCallbacks)
+	return "on the spot";
+    else if (input_style & XIMPreeditPosition)
+	return "over the spot";
+    else if (input_style & XIMPreeditArea)
+	return "off the spot";
+    return "root window";
+}
+
+static void
+append_ic_state(GString* out, NabiIC* ic)
+{
+    char* preedit;
+
+    preedit = nabi_engine_get_preedit_string(&ic->engine);
+
+    json_begin_object(out);
+    json_append_int(out, "id", ic->id);
+    json_append_str(out, "input_style", get_input_style_name(ic->input_style));
+    json_append_str(out, "mode", get_mode_name(ic->mode));
+    json_append_bool(out, "focus", ic->has_focus);
+    /* only the length, the text is what the user types */
+    json_append_int(out, "preedit_length", g_utf8_strlen(preedit, -1));
+    json_append_bool(out, "preedit_started", ic->preedit.start);
+    json_append_bool(out, "candidate_open", ic->candidate != NULL);
+    json_append_bool(out, "candidate_pending", ic->candidate_serial != 0);
+    json_append_window(out, "client_window", ic->client_window);
+    json_append_window(out, "focus_window", ic->focus_window);
+    json_append_window(out, "toplevel",
+		       ic->toplevel != NULL ? ic->toplevel->id : 0);
+    json_append_str(out, "resource_name", ic->resource_name);
+    json_append_str(out, "resource_class", ic->resource_class);
+    g_string_append_c(out, '}');
+
+    g_free(preedit);
+}
+
+static void
+append_connection_state(GString* out, NabiConnection* conn)
+{
+    const char* resource_class = NULL;
+    GSList* item;
+
+    /* XIM has no per connection class, take the one of the first ic */
+    for (item = conn->ic_list; item != NULL; item = g_slist_next(item)) {
+	NabiIC* ic = item->data;
+	if (ic != NULL && ic->resource_class != NULL) {
+	    resource_class = ic->resource_class;
+	    break;
+	}
+    }
+
+    json_begin_object(out);
+    json_append_int(out, "id", conn->id);
+    json_append_str(out, "resource_class", resource_class);
+    json_append_str(out, "mode", get_mode_name(conn->mode));
+    json_append_str(out, "encoding", conn->encoding);
+    json_append_int(out, "recycled_ics", g_slist_length(conn->recycled_ics));
+
+    json_append_key(out, "ics");
+    g_string_append_c(out, '[');
+    for (item = conn->ic_list; item != NULL; item = g_slist_next(item)) {
+	if (item->data != NULL)
+	    append_ic_state(out, item->data);
+    }
+    g_string_append(out, "]}");
+}
+
+static void
+append_clients_state(GString* out)
+{
+    Xi18nClientInfo* info;
+    char byte_order[2];
+    int i, n;
+
+    json_append_key(out, "clients");
+    g_string_append_c(out, '[');
+
+    n = Xi18nGetClients(nabi_server->xims, NULL, 0);
+    info = g_new(Xi18nClientInfo, n > 0 ? n : 1);
+    n = Xi18nGetClients(nabi_server->xims, info, n);
+    for (i = 0; i < n; i++) {
+	byte_order[0] = info[i].byte_order;
+	byte_order[1] = '\0';
+
+	json_begin_object(out);
+	json_append_int(out, "connect_id", info[i].connect_id);
+	json_append_str(out, "byte_order", byte_order);
+	json_append_bool(out, "sync", info[i].sync);
+	json_append_int(out, "pending", info[i].n_pending);
+	g_string_append_c(out, '}');
+    }
+    g_free(info);
+
+    g_string_append_c(out, ']');
+}
+
+static void
+append_state(GString* out)
+{
+    GSList* item;
+
+    json_append_int(out, "pid", getpid());
+    json_append_str(out, "xim", nabi_server->name);
+    json_append_int(out, "uptime", time(NULL) - nabi_server->start_time);
+    json_append_int(out, "log_level", nabi_log_get_level());
+    json_append_bool(out, "trace", nabi_trace_is_enabled());
+    json_append_int(out, "trace_level", nabi_log_get_trace_level());
+    json_append_str(out, "input_mode", get_mode_name(nabi_server->input_mode));
+    json_append_str(out, "hangul_keyboard", nabi_server->hangul_keyboard);
+    json_append_bool(out, "hanja_mode", nabi_server->hanja_mode);
+    json_append_int(out, "toplevels", g_slist_length(nabi_server->toplevels));
+
+    append_clients_state(out);
+
+    json_append_key(out, "connections");
+    g_string_append_c(out, '[');
+    for (item = nabi_server->connections; item != NULL;
+	 item = g_slist_next(item)) {
+	append_connection_state(out, item->data);
+    }
+    g_string_append_c(out, ']');
+}
+
+static void
+append_reply(GString* out, const char* line)
+{
+    char** argv;
+    int argc;
+
+    argv = g_strsplit_set(line, " \t", 0);
+    for (argc = 0; argv[argc] != NULL; argc++)
+	continue;
+
+    g_string_append_c(out, '{');
+
+    if (argc == 0 || argv[0][0] == '\0') {
+	json_append_str(out, "error", "empty command");
+    } else if (strcmp(argv[0], "state") == 0) {
+	if (nabi_server != NULL)
+	    append_state(out);
+	else
+	    json_append_str(out, "error", "no server");
+    } else if (strcmp(argv[0], "log-level") == 0) {
+	if (argc > 1) {
+	    char* end = NULL;
+	    long level = strtol(argv[1], &end, 10);
+	    if (end == argv[1] || *end != '\0' || level < 0 || level > 9) {
+		json_append_str(out, "error", "log level is 0 to 9");
+		goto done;
+	    }
+	    nabi_log_set_level(level);
+	    nabi_log(1, "log level: %ld\n", level);
+	}
+	json_append_int(out, "log_level", nabi_log_get_level());
+    } else if (strcmp(argv[0], "trace-level") == 0) {
+	if (!nabi_trace_is_enabled()) {
+	    json_append_str(out, "error", "trace is disabled, see --trace");
+	    goto done;
+	}
+	if (argc > 1) {
+	    char* end = NULL;
+	    long level = strtol(argv[1], &end, 10);
+	    if (end == argv[1] || *end != '\0' || level < 0 || level > 9) {
+		json_append_str(out, "error", "trace level is 0 to 9");
+		goto done;
+	    }
+	    nabi_log_set_trace_level(level);
+	    nabi_log(1, "trace level: %ld\n", level);
+	}
+	json_append_int(out, "trace_level", nabi_log_get_trace_level());
+    } else if (strcmp(argv[0], "dump-trace") == 0) {
+	if (nabi_trace_is_enabled()) {
+	    /* the reply does not wait for the file, nabi reports it on
+	     * stderr when it is written */
+	    char* filename = nabi_trace_get_dump_filename();
+	    if (nabi_trace_dump_async(filename))
+		json_append_str(out, "trace", filename);
+	    else
+		json_append_str(out, "error", "can't write the trace dump");
+	    g_free(filename);
+	} else {
+	    json_append_str(out, "error", "trace is disabled, see --trace");
+	}
+    } else if (strcmp(argv[0], "latency") == 0) {
+	char* report = nabi_latency_get_report(TRUE);
+	json_append_str(out, "latency", report);
+	g_free(report);
+    } else if (strcmp(argv[0], "help") == 0) {
+	json_append_str(out, "commands",
+			"state, log-level [n], trace-level [n], dump-trace, "
+			"latency, help");
+    } else {
+	json_append_str(out, "error", "unknown command");
+	json_append_str(out, "command", argv[0]);
+    }
+
+done:
+    g_string_append(out, "}\n");
+    g_strfreev(argv);
+}
+
+/* writes what the socket takes now, FALSE on error */
+static gboolean
+nabi_control_client_write(NabiControlClient* client)
+{
+    while (client->out->len > 0) {
+	ssize_t n = send(client->fd, client->out->str, client->out->len,
+			 MSG_NOSIGNAL);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    return FALSE;
+	}
+	g_string_erase(client->out, 0, n);
+    }
+
+    return TRUE;
+}
+
+static void
+nabi_control_client_watch_out(NabiControlClient* client)
+{
+    GIOChannel* channel;
+
+    if (client->out->len == 0 || client->out_source != 0)
+	return;
+
+    channel = g_io_channel_unix_new(client->fd);
+    client->out_source = g_io_add_watch(channel, G_IO_OUT,
+					on_client_out, client);
+    g_io_channel_unref(channel);
+}
+
+static gboolean
+on_client_out(GIOChannel* channel, GIOCondition condition, gpointer data)
+{
+    NabiControlClient* client = data;
+
+    if (!nabi_control_client_write(client)) {
+	client->out_source = 0;
+	nabi_control_client_free(client);
+	return FALSE;
+    }
+
+    if (client->out->len > 0)
+	return TRUE;
+
+    client->out_source = 0;
+    if (client->closing)
+	nabi_control_client_free(client);
+    return FALSE;
+}
+
+static gboolean
+on_client_in(GIOChannel* channel, GIOCondition condition, gpointer data)
+{
+    NabiControlClient* client = data;
+    char buf[1024];
+    char* newline;
+    ssize_t n;
+
+    n = recv(client->fd, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+	return TRUE;
+
+    if (n <= 0) {
+	/* the reader may still wait for the replies */
+	client->in_source = 0;
+	client->closing = TRUE;
+	if (!nabi_control_client_write(client) || client->out->len == 0)
+	    nabi_control_client_free(client);
+	else
+	    nabi_control_client_watch_out(client);
+	return FALSE;
+    }
+
+    g_string_append_len(client->in, buf, n);
+    while ((newline = memchr(client->in->str, '\n', client->in->len)) != NULL) {
+	*newline = '\0';
+	if (newline > client->in->str && newline[-1] == '\r')
+	    newline[-1] = '\0';
+	append_reply(client->out, client->in->str);
+	g_string_erase(client->in, 0, newline - client->in->str + 1);
+    }
+
+    if (!nabi_control_client_write(client) ||
+	client->in->len > MAX_LINE || client->out->len > MAX_OUTPUT) {
+	nabi_log(3, "control: drop client %d\n", client->fd);
+	client->in_source = 0;
+	nabi_control_client_free(client);
+	return FALSE;
+    }
+
+    nabi_control_client_watch_out(client);
+    return TRUE;
+}
+
+static void
+nabi_control_client_free(NabiControlClient* client)
+{
+    control_clients = g_slist_remove(control_clients, client);
+
+    if (client->in_source != 0)
+	g_source_remove(client->in_source);
+    if (client->out_source != 0)
+	g_source_remove(client->out_source);
+    close(client->fd);
+    g_string_free(client->in, TRUE);
+    g_string_free(client->out, TRUE);
+    g_free(client);
+}
+
+static gboolean
+nabi_control_check_peer(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+	return FALSE;
+    return cred.uid == getuid();
+#else
+    /* the socket file is only accessible by the user */
+    return TRUE;
+#endif
+}
+
+static gboolean
+on_accept(GIOChannel* channel, GIOCondition condition, gpointer data)
+{
+    NabiControlClient* client;
+    GIOChannel* client_channel;
+    int fd;
+
+    fd = accept(control_fd, NULL, NULL);
+    if (fd < 0)
+	return TRUE;
+
+    if (g_slist_length(control_clients) >= MAX_CLIENTS ||
+	!nabi_control_check_peer(fd)) {
+	close(fd);
+	return TRUE;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    client = g_new0(NabiControlClient, 1);
+    client->fd = fd;
+    client->in = g_string_new(NULL);
+    client->out = g_string_new(NULL);
+
+    client_channel = g_io_channel_unix_new(fd);
+    client->in_source = g_io_add_watch(client_channel,
+				       G_IO_IN | G_IO_HUP | G_IO_ERR,
+				       on_client_in, client);
+    g_io_channel_unref(client_channel);
+
+    control_clients = g_slist_prepend(control_clients, client);
+    return TRUE;
+}
+
+/* whether another nabi is serving the socket */
+static gboolean
+nabi_control_is_alive(const struct sockaddr_un* addr)
+{
+    int fd;
+    gboolean ret;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	return FALSE;
+
+    ret = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return ret;
+}
+
+gboolean
+nabi_control_start(const char* display)
+{
+    struct sockaddr_un addr;
+    GIOChannel* channel;
+    mode_t mask;
+    int fd;
+    int ret;
+
+    if (control_fd >= 0)
+	return TRUE;
+
+    control_path = nabi_control_get_socket_path(display);
+    if (strlen(control_path) >= sizeof(addr.sun_path)) {
+	nabi_log(1, "control socket path is too long: %s\n", control_path);
+	goto fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, control_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	nabi_log(1, "can't create control socket: %s\n", strerror(errno));
+	goto fail;
+    }
+
+    mask = umask(077);
+    ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    if (ret != 0 && errno == EADDRINUSE && !nabi_control_is_alive(&addr)) {
+	/* left by a nabi which did not exit cleanly */
+	unlink(control_path);
+	ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    umask(mask);
+
+    if (ret != 0 || listen(fd, MAX_CLIENTS) != 0) {
+	nabi_log(1, "can't bind control socket %s: %s\n",
+		 control_path, strerror(errno));
+	close(fd);
+	goto fail;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    control_fd = fd;
+
+    channel = g_io_channel_unix_new(control_fd);
+    control_source = g_io_add_watch(channel, G_IO_IN, on_accept, NULL);
+    g_io_channel_unref(channel);
+
+    nabi_log(3, "control socket: %s\n", control_path);
+    return TRUE;
+
+fail:
+    g_free(control_path);
+    control_path = NULL;
+    return FALSE;
+}
+
+void
+nabi_control_stop(void)
+{
+    if (control_fd < 0)
+	return;
+
+    while (control_clients != NULL)
+	nabi_control_client_free(control_clients->data);
+
+    g_source_remove(control_source);
+    control_source = 0;
+    close(control_fd);
+    control_fd = -1;
+
+    unlink(control_path);
+    g_free(control_path);
+    control_path = NULL;
+}
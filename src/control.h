@@ -0,0 +1,31 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_control_h
+#define nabi_control_h
+
+#include <glib.h>
+
+/* local control socket for introspection
+ * Each line is a command, each reply is one line of JSON.
+ * The socket is served from the main loop and never blocks it. */
+
+gboolean nabi_control_start(const char* display);
+void     nabi_control_stop(void);
+
+#endif /* nabi_control_h */
@@ -23,18 +23,53 @@
 #include "debug.h"
 
 static FILE* output_device = NULL;
-static int log_level = 0;
+
+/* they may be changed by a signal handler */
+volatile int nabi_log_level = 0;
+volatile int nabi_log_threshold = 0;
+static volatile int trace_level = -1;	/* -1: nothing is recorded */
+static NabiLogTraceFunc volatile trace_func = NULL;
+
+static void
+nabi_log_update_threshold(void)
+{
+    if (nabi_log_level > trace_level)
+	nabi_log_threshold = nabi_log_level;
+    else
+	nabi_log_threshold = trace_level;
+}
 
 void
 nabi_log_set_level(int level)
 {
-    log_level = level;
+    nabi_log_level = level;
+    nabi_log_update_threshold();
+}
+
+/* the messages up to this level go to the trace ring when it is enabled */
+void
+nabi_log_set_trace_level(int level)
+{
+    trace_level = level;
+    nabi_log_update_threshold();
+}
+
+void
+nabi_log_set_trace_func(NabiLogTraceFunc func)
+{
+    trace_func = func;
 }
 
 int
 nabi_log_get_level(void)
 {
-    return log_level;
+    return nabi_log_level;
+}
+
+int
+nabi_log_get_trace_level(void)
+{
+    return trace_level;
 }
 
 void
@@ -47,13 +82,24 @@ nabi_log_set_device(const char* device)
     }
 }
 
+/* use nabi_log(), it checks the level before evaluating the arguments */
 void
-nabi_log(int level, const char* format, ...)
+nabi_log_message(int level, const char* format, ...)
 {
+    NabiLogTraceFunc func = trace_func;
+
+    if (level <= trace_level && func != NULL) {
+	va_list ap;
+
+	va_start(ap, format);
+	func(level, format, ap);
+	va_end(ap);
+    }
+
     if (output_device == NULL)
 	return;
 
-    if (level <= log_level) {
+    if (level <= nabi_log_level) {
 	va_list ap;
 
 	fprintf(output_device, "Nabi(%d): ", level);
@@ -19,9 +19,31 @@
 #ifndef nabi_debug_h
 #define nabi_debug_h
 
+#include <stdarg.h>
+
+/* nabi_log_level is the level printed to the device (-d), the trace
+ * ring records up to its own level independently. nabi_log_threshold
+ * is the larger of the two. */
+extern volatile int nabi_log_level;
+extern volatile int nabi_log_threshold;
+
+/* where the messages up to the trace level go, nabi_trace_init() sets
+ * it so that the core library does not need the trace ring */
+typedef void (*NabiLogTraceFunc)(int level, const char* format, va_list ap);
+
 int  nabi_log_get_level(void);
 void nabi_log_set_level(int level);
+int  nabi_log_get_trace_level(void);
+void nabi_log_set_trace_level(int level);
+void nabi_log_set_trace_func(NabiLogTraceFunc func);
 void nabi_log_set_device(const char* device);
-void nabi_log(int level, const char* format, ...);
+void nabi_log_message(int level, const char* format, ...);
+
+/* the arguments are not evaluated when the level is off */
+#define nabi_log(level, ...)					\
+    do {							\
+	if ((level) <= nabi_log_threshold)			\
+	    nabi_log_message((level), __VA_ARGS__);		\
+    } while (0)
 
 #endif /* nabi_debug_h */
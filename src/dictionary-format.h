@@ -0,0 +1,94 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_dictionary_format_h
+#define nabi_dictionary_format_h
+
+#include <stdint.h>
+#include <string.h>
+
+/* compiled dictionary file layout
+ *
+ *   NabiDictHeader
+ *   NabiDictEntry[n_entries]    sorted by key (strcmp), stable
+ *   NabiDictSuffix[n_suffixes]  suffix index: every distinct key,
+ *                               sorted by the reversed key
+ *                               (nabi_dict_reverse_compare)
+ *   string pool                 NUL terminated utf8 strings
+ *
+ * All offsets are in bytes. Entry fields are offsets into the string pool,
+ * entries of the same key share one key offset.
+ * The file is written in host byte order, byte_order field is used to
+ * reject files made on a machine of different endianness. */
+
+#define NABI_DICT_MAGIC		"NABIDICT"
+#define NABI_DICT_MAGIC_LEN	8
+#define NABI_DICT_VERSION	3
+#define NABI_DICT_BYTE_ORDER	0x01020304
+
+typedef struct _NabiDictHeader NabiDictHeader;
+typedef struct _NabiDictEntry  NabiDictEntry;
+typedef struct _NabiDictSuffix NabiDictSuffix;
+
+struct _NabiDictHeader {
+    char     magic[NABI_DICT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n_entries;
+    uint32_t entries_offset;
+    uint32_t n_suffixes;
+    uint32_t suffix_offset;
+    uint32_t pool_offset;
+    uint32_t pool_size;
+};
+
+struct _NabiDictEntry {
+    uint32_t key;
+    uint32_t value;
+    uint32_t comment;
+};
+
+/* the key length is kept so that the lookup can read the key from its
+ * end without strlen() */
+struct _NabiDictSuffix {
+    uint32_t entry;		/* first entry of the key */
+    uint32_t key_len;		/* in bytes */
+};
+
+/* compare the strings from the last byte, the order of the suffix index */
+static inline int
+nabi_dict_reverse_compare(const char* a, const char* b)
+{
+    const unsigned char* p = (const unsigned char*)a + strlen(a);
+    const unsigned char* q = (const unsigned char*)b + strlen(b);
+
+    while (p > (const unsigned char*)a && q > (const unsigned char*)b) {
+	p--;
+	q--;
+	if (*p != *q)
+	    return *p < *q ? -1 : 1;
+    }
+
+    if (p > (const unsigned char*)a)
+	return 1;
+    if (q > (const unsigned char*)b)
+	return -1;
+    return 0;
+}
+
+#endif /* nabi_dictionary_format_h */
@@ -0,0 +1,480 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "debug.h"
+#include "dictionary.h"
+#include "dictionary-format.h"
+
+struct _NabiDict {
+    /* compiled dictionary, mapped read only so that the pages are
+     * shared by every nabi process on the host */
+    GMappedFile*         file;
+    const NabiDictEntry* entries;
+    guint32              n_entries;
+    const NabiDictSuffix* suffixes;	/* distinct keys, reversed order */
+    guint32              n_suffixes;
+    const char*          pool;
+
+    /* fallback: text table loaded by libhangul */
+    HanjaTable*          table;
+};
+
+static gboolean
+nabi_dict_is_newer(const char* a, const char* b)
+{
+    struct stat sa, sb;
+
+    if (a == NULL || b == NULL)
+	return FALSE;
+
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0)
+	return FALSE;
+
+    return sa.st_mtime > sb.st_mtime;
+}
+
+static gboolean
+nabi_dict_map(NabiDict* dict, const char* filename)
+{
+    GError* error = NULL;
+    GMappedFile* file;
+    const char* data;
+    gsize size;
+    const NabiDictHeader* header;
+    const NabiDictEntry* entries;
+    const NabiDictSuffix* suffixes;
+    guint32 i;
+
+    file = g_mapped_file_new(filename, FALSE, &error);
+    if (file == NULL) {
+	nabi_log(3, "can't map dictionary: %s\n", error->message);
+	g_error_free(error);
+	return FALSE;
+    }
+
+    data = g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+    if (size < sizeof(NabiDictHeader))
+	goto invalid;
+
+    header = (const NabiDictHeader*)data;
+    if (memcmp(header->magic, NABI_DICT_MAGIC, NABI_DICT_MAGIC_LEN) != 0 ||
+	header->version != NABI_DICT_VERSION ||
+	header->byte_order != NABI_DICT_BYTE_ORDER)
+	goto invalid;
+
+    if (header->entries_offset > size ||
+	(size - header->entries_offset) / sizeof(NabiDictEntry)
+						< header->n_entries)
+	goto invalid;
+
+    if (header->suffix_offset > size ||
+	(size - header->suffix_offset) / sizeof(NabiDictSuffix)
+						< header->n_suffixes)
+	goto invalid;
+
+    if (header->pool_offset > size ||
+	size - header->pool_offset < header->pool_size ||
+	header->pool_size == 0 ||
+	data[header->pool_offset + header->pool_size - 1] != '\0')
+	goto invalid;
+
+    /* every string offset must point into the pool, then all lookups
+     * can trust the mapped data */
+    entries = (const NabiDictEntry*)(data + header->entries_offset);
+    for (i = 0; i < header->n_entries; i++) {
+	if (entries[i].key >= header->pool_size ||
+	    entries[i].value >= header->pool_size ||
+	    entries[i].comment >= header->pool_size)
+	    goto invalid;
+    }
+
+    /* the key must end where the index says, the walk reads it
+     * backward from there */
+    suffixes = (const NabiDictSuffix*)(data + header->suffix_offset);
+    for (i = 0; i < header->n_suffixes; i++) {
+	guint32 key;
+
+	if (suffixes[i].entry >= header->n_entries)
+	    goto invalid;
+	key = entries[suffixes[i].entry].key;
+	if (suffixes[i].key_len == 0 ||
+	    suffixes[i].key_len >= header->pool_size - key ||
+	    data[header->pool_offset + key + suffixes[i].key_len] != '\0')
+	    goto invalid;
+    }
+
+    dict->file = file;
+    dict->entries = entries;
+    dict->n_entries = header->n_entries;
+    dict->suffixes = suffixes;
+    dict->n_suffixes = header->n_suffixes;
+    dict->pool = data + header->pool_offset;
+
+    return TRUE;
+
+invalid:
+    nabi_log(1, "invalid dictionary file: %s\n", filename);
+    g_mapped_file_unref(file);
+    return FALSE;
+}
+
+/* compiled: the binary dictionary made by nabi-mkdict
+ * text:     the text table of the same content, if the compiled one is
+ *           missing, invalid or older than this, nabi uses this instead.
+ *           NULL means the default hanja table of libhangul */
+NabiDict*
+nabi_dict_load(const char* compiled, const char* text)
+{
+    NabiDict* dict;
+    GTimer* timer;
+
+    dict = g_new0(NabiDict, 1);
+    timer = g_timer_new();
+
+    if (compiled != NULL && !nabi_dict_is_newer(text, compiled)) {
+	if (nabi_dict_map(dict, compiled)) {
+	    nabi_log(3, "load dictionary: %s, %d entries, %.3fms\n",
+		     compiled, dict->n_entries,
+		     g_timer_elapsed(timer, NULL) * 1000.0);
+	    g_timer_destroy(timer);
+	    return dict;
+	}
+    }
+
+    dict->table = hanja_table_load(text);
+    nabi_log(3, "load dictionary: %s, %.3fms\n",
+	     text != NULL ? text : "(libhangul hanja table)",
+	     g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
+
+    if (dict->table == NULL) {
+	g_free(dict);
+	return NULL;
+    }
+
+    return dict;
+}
+
+void
+nabi_dict_delete(NabiDict* dict)
+{
+    if (dict == NULL)
+	return;
+
+    if (dict->file != NULL)
+	g_mapped_file_unref(dict->file);
+
+    if (dict->table != NULL)
+	hanja_table_delete(dict->table);
+
+    g_free(dict);
+}
+
+gboolean
+nabi_dict_is_mapped(const NabiDict* dict)
+{
+    return dict != NULL && dict->file != NULL;
+}
+
+static NabiDictList*
+nabi_dict_list_new(const char* key)
+{
+    NabiDictList* list = g_new(NabiDictList, 1);
+    list->key = g_strdup(key);
+    list->items = g_array_new(FALSE, FALSE, sizeof(NabiDictItem));
+    list->hanja_list = NULL;
+    list->strings = NULL;
+    return list;
+}
+
+/* first entry whose key is not less than the given key */
+static guint32
+nabi_dict_lower_bound(const NabiDict* dict, const char* key)
+{
+    guint32 low = 0;
+    guint32 high = dict->n_entries;
+
+    while (low < high) {
+	guint32 mid = low + (high - low) / 2;
+	const char* k = dict->pool + dict->entries[mid].key;
+	if (strcmp(k, key) < 0)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+
+    return low;
+}
+
+static void
+nabi_dict_match_exact(const NabiDict* dict, const char* key,
+		      NabiDictList** list, const char* list_key)
+{
+    guint32 i;
+
+    i = nabi_dict_lower_bound(dict, key);
+    while (i < dict->n_entries) {
+	const NabiDictEntry* entry = &dict->entries[i];
+	NabiDictItem item;
+
+	item.key = dict->pool + entry->key;
+	if (strcmp(item.key, key) != 0)
+	    break;
+
+	item.value = dict->pool + entry->value;
+	item.comment = dict->pool + entry->comment;
+
+	if (*list == NULL)
+	    *list = nabi_dict_list_new(list_key);
+	g_array_append_val((*list)->items, item);
+	i++;
+    }
+}
+
+static NabiDictList*
+nabi_dict_list_new_from_hanja_list(HanjaList* hanja_list)
+{
+    NabiDictList* list;
+    int i, n;
+
+    if (hanja_list == NULL)
+	return NULL;
+
+    list = nabi_dict_list_new(hanja_list_get_key(hanja_list));
+    list->hanja_list = hanja_list;
+
+    n = hanja_list_get_size(hanja_list);
+    for (i = 0; i < n; i++) {
+	const Hanja* hanja = hanja_list_get_nth(hanja_list, i);
+	NabiDictItem item;
+
+	item.key = hanja_get_key(hanja);
+	item.value = hanja_get_value(hanja);
+	item.comment = hanja_get_comment(hanja);
+	g_array_append_val(list->items, item);
+    }
+
+    return list;
+}
+
+/* same semantics as hanja_table_match_prefix():
+ * the longest prefix of the key comes first */
+NabiDictList*
+nabi_dict_match_prefix(NabiDict* dict, const char* key)
+{
+    NabiDictList* list = NULL;
+    char* newkey;
+    char* p;
+
+    if (dict == NULL || key == NULL)
+	return NULL;
+
+    if (dict->table != NULL) {
+	HanjaList* hanja_list = hanja_table_match_prefix(dict->table, key);
+	return nabi_dict_list_new_from_hanja_list(hanja_list);
+    }
+
+    newkey = g_strdup(key);
+    p = newkey + strlen(newkey);
+    while (newkey[0] != '\0') {
+	nabi_dict_match_exact(dict, newkey, &list, key);
+	p = g_utf8_prev_char(p);
+	*p = '\0';
+    }
+    g_free(newkey);
+
+    return list;
+}
+
+/* the byte of the nth suffix index key at depth bytes from its end,
+ * -1 if the key is not that long */
+static inline int
+nabi_dict_suffix_byte(const NabiDict* dict, guint32 n, guint32 depth)
+{
+    const NabiDictSuffix* suffix = &dict->suffixes[n];
+    const char* key;
+
+    if (suffix->key_len <= depth)
+	return -1;
+
+    key = dict->pool + dict->entries[suffix->entry].key;
+    return (unsigned char)key[suffix->key_len - 1 - depth];
+}
+
+/* first index in [low, high) whose byte at depth is not less than c */
+static guint32
+nabi_dict_suffix_lower_bound(const NabiDict* dict, guint32 low, guint32 high,
+			     guint32 depth, int c)
+{
+    while (low < high) {
+	guint32 mid = low + (high - low) / 2;
+	if (nabi_dict_suffix_byte(dict, mid, depth) < c)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+
+    return low;
+}
+
+static void
+nabi_dict_append_key(const NabiDict* dict, guint32 n,
+		     NabiDictList** list, const char* list_key)
+{
+    guint32 i = dict->suffixes[n].entry;
+    guint32 key_offset = dict->entries[i].key;
+
+    /* entries of the same key share the key offset */
+    while (i < dict->n_entries && dict->entries[i].key == key_offset) {
+	const NabiDictEntry* entry = &dict->entries[i];
+	NabiDictItem item;
+
+	item.key = dict->pool + entry->key;
+	item.value = dict->pool + entry->value;
+	item.comment = dict->pool + entry->comment;
+
+	if (*list == NULL)
+	    *list = nabi_dict_list_new(list_key);
+	g_array_append_val((*list)->items, item);
+	i++;
+    }
+}
+
+/* One walk from the end of the key. The keys ending with the bytes
+ * seen so far are a range of the suffix index, each byte narrows it.
+ * A shorter key sorts first, so the range starts with the key which
+ * is exactly the suffix seen, if there is one. */
+static NabiDictList*
+nabi_dict_match_suffix_mapped(const NabiDict* dict, const char* key)
+{
+    NabiDictList* list = NULL;
+    guint32 matches[64];
+    guint32* found = matches;
+    guint32 n_found = 0;
+    guint32 low = 0;
+    guint32 high = dict->n_suffixes;
+    guint32 len = strlen(key);
+    guint32 depth;
+    int i;
+
+    if (len > G_N_ELEMENTS(matches))
+	found = g_new(guint32, len);
+
+    for (depth = 0; depth < len && low < high; depth++) {
+	int c = (unsigned char)key[len - 1 - depth];
+
+	low = nabi_dict_suffix_lower_bound(dict, low, high, depth, c);
+	high = nabi_dict_suffix_lower_bound(dict, low, high, depth, c + 1);
+
+	if (low < high && dict->suffixes[low].key_len == depth + 1)
+	    found[n_found++] = low;
+    }
+
+    /* the longest suffix first */
+    for (i = n_found - 1; i >= 0; i--)
+	nabi_dict_append_key(dict, found[i], &list, key);
+
+    if (found != matches)
+	g_free(found);
+
+    return list;
+}
+
+/* same semantics as hanja_table_match_suffix():
+ * the longest suffix of the key comes first */
+NabiDictList*
+nabi_dict_match_suffix(NabiDict* dict, const char* key)
+{
+    if (dict == NULL || key == NULL)
+	return NULL;
+
+    if (dict->table != NULL) {
+	HanjaList* hanja_list = hanja_table_match_suffix(dict->table, key);
+	return nabi_dict_list_new_from_hanja_list(hanja_list);
+    }
+
+    return nabi_dict_match_suffix_mapped(dict, key);
+}
+
+int
+nabi_dict_list_get_size(const NabiDictList* list)
+{
+    if (list == NULL)
+	return 0;
+    return list->items->len;
+}
+
+const char*
+nabi_dict_list_get_key(const NabiDictList* list)
+{
+    if (list == NULL)
+	return NULL;
+    return list->key;
+}
+
+const NabiDictItem*
+nabi_dict_list_get_nth(const NabiDictList* list, int n)
+{
+    if (list == NULL || n < 0 || n >= list->items->len)
+	return NULL;
+    return &g_array_index(list->items, NabiDictItem, n);
+}
+
+/* replace the value of the nth item with a copy of the given string,
+ * used for the simplified chinese conversion */
+void
+nabi_dict_list_set_value(NabiDictList* list, int n, const char* value)
+{
+    NabiDictItem* item;
+
+    if (list == NULL || n < 0 || n >= list->items->len)
+	return;
+
+    if (list->strings == NULL)
+	list->strings = g_string_chunk_new(256);
+
+    item = &g_array_index(list->items, NabiDictItem, n);
+    item->value = g_string_chunk_insert(list->strings, value);
+}
+
+void
+nabi_dict_list_delete(NabiDictList* list)
+{
+    if (list == NULL)
+	return;
+
+    if (list->strings != NULL)
+	g_string_chunk_free(list->strings);
+
+    if (list->hanja_list != NULL)
+	hanja_list_delete(list->hanja_list);
+    g_array_free(list->items, TRUE);
+    g_free(list->key);
+    g_free(list);
+}
@@ -0,0 +1,56 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_dictionary_h
+#define nabi_dictionary_h
+
+#include <glib.h>
+#include <hangul.h>
+
+typedef struct _NabiDict     NabiDict;
+typedef struct _NabiDictItem NabiDictItem;
+typedef struct _NabiDictList NabiDictList;
+
+struct _NabiDictItem {
+    const char* key;
+    const char* value;
+    const char* comment;
+};
+
+struct _NabiDictList {
+    char*         key;
+    GArray*       items;	/* NabiDictItem */
+    HanjaList*    hanja_list;	/* owns the strings of text table results */
+    GStringChunk* strings;	/* owns the values set by set_value() */
+};
+
+NabiDict*     nabi_dict_load(const char* compiled, const char* text);
+void          nabi_dict_delete(NabiDict* dict);
+gboolean      nabi_dict_is_mapped(const NabiDict* dict);
+
+NabiDictList* nabi_dict_match_prefix(NabiDict* dict, const char* key);
+NabiDictList* nabi_dict_match_suffix(NabiDict* dict, const char* key);
+
+int                 nabi_dict_list_get_size(const NabiDictList* list);
+const char*         nabi_dict_list_get_key(const NabiDictList* list);
+const NabiDictItem* nabi_dict_list_get_nth(const NabiDictList* list, int n);
+void                nabi_dict_list_set_value(NabiDictList* list, int n,
+					     const char* value);
+void                nabi_dict_list_delete(NabiDictList* list);
+
+#endif /* nabi_dictionary_h */
@@ -0,0 +1,311 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "debug.h"
+#include "engine.h"
+
+static void
+nabi_engine_on_translate(HangulInputContext* hic,
+			 int ascii, ucschar* c, void* data)
+{
+    NabiEngine* engine = (NabiEngine*)data;
+
+    if (engine->sink->translate != NULL)
+	engine->sink->translate(engine, *c, engine->sink_data);
+}
+
+static bool
+nabi_engine_on_transition(HangulInputContext* hic,
+			  ucschar c, const ucschar* preedit, void* data)
+{
+    bool ret = true;
+    NabiEngine* engine = (NabiEngine*)data;
+
+    if (!engine->config->auto_reorder) {
+	if (hangul_is_choseong(c)) {
+	    if (hangul_ic_has_jungseong(hic) || hangul_ic_has_jongseong(hic)) {
+		return false;
+	    }
+	}
+
+	if (hangul_is_jungseong(c)) {
+	    if (hangul_ic_has_jongseong(hic)) {
+		return false;
+	    }
+	}
+    }
+
+    if (engine->sink->is_valid != NULL) {
+	char* utf8 = g_ucs4_to_utf8((const gunichar*)preedit, -1, NULL, NULL, NULL);
+	ret = engine->sink->is_valid(engine, utf8, engine->sink_data);
+	nabi_log(6, "on translation: %s: %s\n", utf8, ret ? "true" : "false");
+	g_free(utf8);
+    }
+
+    return ret;
+}
+
+void
+nabi_engine_init(NabiEngine* engine, const NabiEngineConfig* config,
+		 const NabiEngineSink* sink, gpointer sink_data)
+{
+    engine->hic = NULL;
+    engine->transliteration = FALSE;
+    engine->str = ustring_new();
+    engine->config = config;
+    engine->sink = sink;
+    engine->sink_data = sink_data;
+}
+
+void
+nabi_engine_clear(NabiEngine* engine)
+{
+    if (engine->str != NULL) {
+	ustring_delete(engine->str);
+	engine->str = NULL;
+    }
+
+    nabi_engine_release_hic(engine);
+}
+
+void
+nabi_engine_reset(NabiEngine* engine)
+{
+    if (engine->hic != NULL)
+	hangul_ic_reset(engine->hic);
+    ustring_clear(engine->str);
+}
+
+/* returns TRUE if the hic was freed */
+gboolean
+nabi_engine_release_hic(NabiEngine* engine)
+{
+    if (engine->hic == NULL)
+	return FALSE;
+
+    hangul_ic_delete(engine->hic);
+    engine->hic = NULL;
+    return TRUE;
+}
+
+/* HangulInputContext is made on the first key event, many ics of
+ * browsers or IDEs never get any key */
+HangulInputContext*
+nabi_engine_get_hic(NabiEngine* engine)
+{
+    if (engine->hic == NULL) {
+	engine->hic = hangul_ic_new(engine->config->hangul_keyboard);
+	hangul_ic_connect_callback(engine->hic, "translate",
+				   nabi_engine_on_translate, engine);
+	hangul_ic_connect_callback(engine->hic, "transition",
+				   nabi_engine_on_transition, engine);
+	nabi_engine_select_keyboard(engine, engine->config->hangul_keyboard);
+    }
+
+    return engine->hic;
+}
+
+void
+nabi_engine_select_keyboard(NabiEngine* engine, const char* keyboard)
+{
+    if (engine->hic == NULL)
+	return;
+
+    hangul_ic_select_keyboard(engine->hic, keyboard);
+    engine->transliteration = hangul_ic_is_transliteration(engine->hic);
+
+    if (engine->config->jamo_output) {
+	hangul_ic_set_output_mode(engine->hic, HANGUL_OUTPUT_JAMO);
+    } else {
+	hangul_ic_set_output_mode(engine->hic, HANGUL_OUTPUT_SYLLABLE);
+    }
+}
+
+gboolean
+nabi_engine_is_empty(NabiEngine* engine)
+{
+    if (engine->hic == NULL)
+	return TRUE;
+
+    return hangul_ic_is_empty(engine->hic);
+}
+
+/* whether the keys go to the engine as the user's keymap gives them,
+ * it is kept when the keyboard is selected, not asked on every key */
+gboolean
+nabi_engine_is_transliteration(NabiEngine* engine)
+{
+    nabi_engine_get_hic(engine);
+    return engine->transliteration;
+}
+
+/* map the keysym to the qwerty one and apply the shift state,
+ * layout is NULL when the system keymap is not used */
+KeySym
+nabi_engine_normalize_keysym(NabiKeyboardLayout* layout,
+			     KeySym keysym, unsigned int state)
+{
+    KeySym upper, lower;
+
+    /* for non-qwerty mapping */
+    if (layout != NULL) {
+	keysym = nabi_keyboard_layout_get_key(layout, keysym);
+    }
+
+    upper = keysym;
+    lower = keysym;
+    XConvertCase(keysym, &lower, &upper);
+
+    if (state & ShiftMask)
+	keysym = upper;
+    else
+	keysym = lower;
+
+    return keysym;
+}
+
+/* returns TRUE if the preedit string has changed */
+gboolean
+nabi_engine_backspace(NabiEngine* engine)
+{
+    guint len;
+
+    if (hangul_ic_backspace(nabi_engine_get_hic(engine)))
+	return TRUE;
+
+    len = ustring_length(engine->str);
+    if (len > 0) {
+	ustring_erase(engine->str, len - 1, 1);
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* hangul_ic_process() only, the caller sends its commit string with
+ * nabi_engine_commit(), so the two can be timed apart */
+gboolean
+nabi_engine_feed(NabiEngine* engine, KeySym keysym)
+{
+    return hangul_ic_process(nabi_engine_get_hic(engine), keysym);
+}
+
+/* returns what hangul_ic_process() returns, FALSE means the key
+ * was not used and the commit string has the flushed preedit */
+gboolean
+nabi_engine_process(NabiEngine* engine, KeySym keysym)
+{
+    gboolean ret;
+
+    ret = nabi_engine_feed(engine, keysym);
+    nabi_engine_commit(engine);
+
+    return ret;
+}
+
+void
+nabi_engine_commit(NabiEngine* engine)
+{
+    const ucschar* str = hangul_ic_get_commit_string(nabi_engine_get_hic(engine));
+
+    if (engine->config->word_commit) {
+	ustring_append_ucs4(engine->str, str, -1);
+
+	if (nabi_engine_is_empty(engine)) {
+	    if (engine->sink->flush != NULL)
+		engine->sink->flush(engine, engine->sink_data);
+	    else
+		nabi_engine_flush(engine);
+	}
+    } else if (str != NULL && str[0] != 0) {
+	char* utf8 = g_ucs4_to_utf8((const gunichar*)str, -1, NULL, NULL, NULL);
+	if (utf8 != NULL && utf8[0] != '\0')
+	    engine->sink->commit(engine, utf8, engine->sink_data);
+	g_free(utf8);
+    }
+}
+
+/* the word buffer and the hic preedit, both are cleared */
+char*
+nabi_engine_take_flush_string(NabiEngine* engine)
+{
+    char* flushed;
+
+    if (engine->hic != NULL) {
+	const ucschar* hic_flushed = hangul_ic_flush(engine->hic);
+	ustring_append_ucs4(engine->str, hic_flushed, -1);
+    }
+
+    flushed = ustring_to_utf8(engine->str, -1);
+    ustring_clear(engine->str);
+
+    return flushed;
+}
+
+/* commit the word buffer and the hic preedit */
+void
+nabi_engine_flush(NabiEngine* engine)
+{
+    char* flushed = nabi_engine_take_flush_string(engine);
+
+    if (flushed != NULL && flushed[0] != '\0')
+	engine->sink->commit(engine, flushed, engine->sink_data);
+    g_free(flushed);
+}
+
+/* normal is the word buffer, hilight is the syllable being composed */
+void
+nabi_engine_get_preedit(NabiEngine* engine, char** normal, char** hilight)
+{
+    *normal = ustring_to_utf8(engine->str, -1);
+
+    if (engine->hic != NULL) {
+	const ucschar* str = hangul_ic_get_preedit_string(engine->hic);
+	*hilight = g_ucs4_to_utf8((const gunichar*)str, -1, NULL, NULL, NULL);
+    } else {
+	*hilight = g_strdup("");
+    }
+}
+
+char*
+nabi_engine_get_preedit_string(NabiEngine* engine)
+{
+    char* preedit;
+    UString* str;
+
+    str = ustring_new();
+    ustring_append(str, engine->str);
+
+    if (engine->hic != NULL) {
+	const ucschar* hic_preedit = hangul_ic_get_preedit_string(engine->hic);
+	ustring_append_ucs4(str, hic_preedit, -1);
+    }
+
+    preedit = ustring_to_utf8(str, str->len);
+    ustring_delete(str);
+
+    return preedit;
+}
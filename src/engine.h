@@ -0,0 +1,92 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_engine_h
+#define nabi_engine_h
+
+#include <X11/Xlib.h>
+#include <glib.h>
+#include <hangul.h>
+
+#include "ustring.h"
+#include "keyboard-layout.h"
+
+/* keystroke engine: the part of an ic that turns keysyms into preedit and
+ * commit strings. It does not know about X connections, windows or the
+ * XIM protocol, the results go to a NabiEngineSink. NabiIC embeds one,
+ * nabi-bench drives it directly. */
+
+typedef struct _NabiEngine       NabiEngine;
+typedef struct _NabiEngineConfig NabiEngineConfig;
+typedef struct _NabiEngineSink   NabiEngineSink;
+
+struct _NabiEngineConfig {
+    const char* hangul_keyboard;
+    gboolean    word_commit;	/* keep the commit string until flush,
+				 * commit_by_word or hanja_mode */
+    gboolean    auto_reorder;
+    gboolean    jamo_output;
+};
+
+struct _NabiEngineSink {
+    /* send the string to the client */
+    void     (*commit)   (NabiEngine* engine, const char* str, gpointer data);
+    /* the engine wants everything committed, the sink should end
+     * the preedit and call nabi_engine_flush() */
+    void     (*flush)    (NabiEngine* engine, gpointer data);
+    /* whether the client can take the preedit string, may be NULL */
+    gboolean (*is_valid) (NabiEngine* engine, const char* str, gpointer data);
+    /* a key is translated to a jamo, may be NULL */
+    void     (*translate)(NabiEngine* engine, ucschar c, gpointer data);
+};
+
+struct _NabiEngine {
+    HangulInputContext*     hic;	/* made on the first key */
+    gboolean                transliteration; /* of the keyboard of hic */
+    UString*                str;	/* committed, not yet sent */
+    const NabiEngineConfig* config;
+    const NabiEngineSink*   sink;
+    gpointer                sink_data;
+};
+
+void     nabi_engine_init(NabiEngine* engine, const NabiEngineConfig* config,
+			  const NabiEngineSink* sink, gpointer sink_data);
+void     nabi_engine_clear(NabiEngine* engine);
+void     nabi_engine_reset(NabiEngine* engine);
+gboolean nabi_engine_release_hic(NabiEngine* engine);
+
+HangulInputContext* nabi_engine_get_hic(NabiEngine* engine);
+void     nabi_engine_select_keyboard(NabiEngine* engine, const char* keyboard);
+gboolean nabi_engine_is_empty(NabiEngine* engine);
+gboolean nabi_engine_is_transliteration(NabiEngine* engine);
+
+KeySym   nabi_engine_normalize_keysym(NabiKeyboardLayout* layout,
+				      KeySym keysym, unsigned int state);
+
+gboolean nabi_engine_feed(NabiEngine* engine, KeySym keysym);
+gboolean nabi_engine_process(NabiEngine* engine, KeySym keysym);
+gboolean nabi_engine_backspace(NabiEngine* engine);
+void     nabi_engine_commit(NabiEngine* engine);
+void     nabi_engine_flush(NabiEngine* engine);
+char*    nabi_engine_take_flush_string(NabiEngine* engine);
+
+void     nabi_engine_get_preedit(NabiEngine* engine,
+				 char** normal, char** hilight);
+char*    nabi_engine_get_preedit_string(NabiEngine* engine);
+
+#endif /* nabi_engine_h */
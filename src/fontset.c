@@ -21,6 +21,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <X11/Xlib.h>
 #include <glib.h>
@@ -29,22 +30,188 @@
 #include "gettext.h"
 #include "fontset.h"
 
+/* XCreateFontSet() may block for a long time matching and loading big
+ * CJK bitmap fonts, so every fontset is made on the loader thread with
+ * its own display. The main thread only draws with them: the fonts are
+ * X server resources and can be used on any display while the loader
+ * display keeps them open. Only the loader thread uses its display, so
+ * freeing a fontset and writing the extents cache are loader jobs too. */
+typedef enum {
+    NABI_FONTSET_JOB_LOAD,
+    NABI_FONTSET_JOB_FREE,
+    NABI_FONTSET_JOB_WRITE_CACHE
+} NabiFontSetJobType;
+
+typedef struct _NabiFontSetJob NabiFontSetJob;
+struct _NabiFontSetJob {
+    NabiFontSetJobType type;
+    char *name;			/* LOAD */
+    XFontSet xfontset;		/* LOAD result, NULL on error, or FREE */
+    int ascent;
+    int descent;
+    NabiFontSetLoadFunc func;	/* LOAD, called on the main thread */
+    gchar *data;		/* WRITE_CACHE, contents of the file */
+};
+
 static GHashTable *fontset_hash = NULL;
+static GHashTable *xfontset_hash = NULL;	/* XFontSet -> NabiFontSet */
 static GSList *fontset_list = NULL;
-static Display *_display = NULL;
 
-static NabiFontSet*
-nabi_fontset_new(const char *name)
+static GThreadPool *loader = NULL;
+static gchar *loader_display_name = NULL;
+static Display *loader_display = NULL;		/* loader thread only,
+						 * until it is stopped */
+
+/* finished loads waiting for the main loop, as candidate results.
+ * loader_pending has the names being loaded, main thread only */
+G_LOCK_DEFINE_STATIC(loader_results);
+static GSList *loader_results = NULL;
+static guint loader_results_source = 0;
+static GSList *loader_pending = NULL;
+
+static void nabi_fontset_loader_push(NabiFontSetJob *job);
+
+/* extents of the fontsets made before, kept in ~/.nabi/fontset.cache
+ * so the preedit window can be placed before the fontset is made.
+ * each line is "ascent descent name" */
+static GHashTable *extents_cache = NULL;	/* name -> int[2] */
+
+static gchar*
+extents_cache_get_filename(void)
+{
+    return g_build_filename(g_get_home_dir(), ".nabi", "fontset.cache", NULL);
+}
+
+static void
+extents_cache_load(void)
+{
+    gchar *filename;
+    FILE *file;
+    char buf[1024];
+
+    if (extents_cache != NULL)
+	return;
+
+    extents_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					  g_free, g_free);
+
+    filename = extents_cache_get_filename();
+    file = fopen(filename, "r");
+    g_free(filename);
+    if (file == NULL)
+	return;
+
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+	int *extents;
+	char *p;
+	char *name;
+	long ascent, descent;
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+
+	ascent = strtol(buf, &p, 10);
+	if (p == buf || *p != ' ')
+	    continue;
+	name = p;
+	descent = strtol(name, &p, 10);
+	if (p == name || *p != ' ' || p[1] == '\0')
+	    continue;
+	name = p + 1;
+
+	extents = g_new(int, 2);
+	extents[0] = ascent;
+	extents[1] = descent;
+	g_hash_table_replace(extents_cache, g_strdup(name), extents);
+    }
+    fclose(file);
+
+    nabi_log(4, "fontset extents cache: %d entries\n",
+	     g_hash_table_size(extents_cache));
+}
+
+static void
+extents_cache_write_entry(gpointer key, gpointer value, gpointer data)
+{
+    int *extents = (int*)value;
+
+    g_string_append_printf((GString*)data, "%d %d %s\n",
+			   extents[0], extents[1], (const char*)key);
+}
+
+/* runs on the loader thread */
+static void
+extents_cache_write(const gchar *data)
+{
+    gchar *filename;
+    FILE *file;
+
+    filename = extents_cache_get_filename();
+    file = fopen(filename, "w");
+    if (file != NULL) {
+	fputs(data, file);
+	if (fclose(file) != 0)
+	    nabi_log(3, "can't write fontset cache: %s\n", filename);
+    } else {
+	nabi_log(3, "can't write fontset cache: %s\n", filename);
+    }
+    g_free(filename);
+}
+
+/* the file is written by the loader, not to block the main loop */
+static void
+extents_cache_update(const char *name, int ascent, int descent)
+{
+    NabiFontSetJob *job;
+    GString *data;
+    int *extents;
+
+    extents_cache_load();
+
+    extents = g_hash_table_lookup(extents_cache, name);
+    if (extents != NULL && extents[0] == ascent && extents[1] == descent)
+	return;
+
+    extents = g_new(int, 2);
+    extents[0] = ascent;
+    extents[1] = descent;
+    g_hash_table_replace(extents_cache, g_strdup(name), extents);
+
+    data = g_string_new(NULL);
+    g_hash_table_foreach(extents_cache, extents_cache_write_entry, data);
+
+    job = g_new0(NabiFontSetJob, 1);
+    job->type = NABI_FONTSET_JOB_WRITE_CACHE;
+    job->data = g_string_free(data, FALSE);
+    nabi_fontset_loader_push(job);
+}
+
+gboolean
+nabi_fontset_get_cached_extents(const char *fontset_name,
+				int *ascent, int *descent)
+{
+    int *extents;
+
+    extents_cache_load();
+
+    extents = g_hash_table_lookup(extents_cache, fontset_name);
+    if (extents == NULL)
+	return FALSE;
+
+    *ascent = extents[0];
+    *descent = extents[1];
+    return TRUE;
+}
+
+static XFontSet
+nabi_fontset_open(Display *display, const char *name)
 {
     XFontSet xfontset;
-    XFontSetExtents* ext;
-    NabiFontSet *fontset;
     char **missing_list;
     int    missing_list_count;
     char  *error_message;
 
     nabi_log(4, "create fontset: %s\n", name);
-    xfontset = XCreateFontSet(_display,
+    xfontset = XCreateFontSet(display,
                               name,
                               &missing_list,
                               &missing_list_count,
@@ -53,7 +220,7 @@ nabi_fontset_new(const char *name)
 	gchar *name2;
         XFreeStringList(missing_list);
 	name2 = g_strconcat(name, ",*", NULL);
-	xfontset = XCreateFontSet(_display,
+	xfontset = XCreateFontSet(display,
 				  name2,
 				  &missing_list,
 				  &missing_list_count,
@@ -70,18 +237,37 @@ nabi_fontset_new(const char *name)
 	}
     }
 
-    ext = XExtentsOfFontSet(xfontset);
+    return xfontset;
+}
+
+static void
+nabi_fontset_get_extents(XFontSet xfontset, int *ascent, int *descent)
+{
+    XFontSetExtents* ext = XExtentsOfFontSet(xfontset);
+
+    *ascent = ABS(ext->max_logical_extent.y);
+    *descent = ext->max_logical_extent.height - *ascent;
+}
+
+static NabiFontSet*
+nabi_fontset_insert(const char *name, XFontSet xfontset,
+		    int ascent, int descent)
+{
+    NabiFontSet *fontset;
 
     fontset = g_malloc(sizeof(NabiFontSet));
     fontset->name = g_strdup(name);
     fontset->ref = 1;
     fontset->xfontset = xfontset;
-    fontset->ascent = ABS(ext->max_logical_extent.y);
-    fontset->descent = ext->max_logical_extent.height - fontset->ascent;
+    fontset->ascent = ascent;
+    fontset->descent = descent;
 
     g_hash_table_insert(fontset_hash, fontset->name, fontset);
+    g_hash_table_insert(xfontset_hash, fontset->xfontset, fontset);
     fontset_list = g_slist_prepend(fontset_list, fontset);
 
+    extents_cache_update(name, fontset->ascent, fontset->descent);
+
     return fontset;
 }
 
@@ -97,16 +283,23 @@ nabi_fontset_ref(NabiFontSet *fontset)
 static void
 nabi_fontset_unref(NabiFontSet *fontset)
 {
+    NabiFontSetJob *job;
+
     if (fontset == NULL)
 	return;
 
     fontset->ref--;
     if (fontset->ref <= 0) {
 	g_hash_table_remove(fontset_hash, fontset->name);
+	g_hash_table_remove(xfontset_hash, fontset->xfontset);
 	fontset_list = g_slist_remove(fontset_list, fontset);
 
 	nabi_log(4, "delete fontset: %s\n", fontset->name);
-	XFreeFontSet(_display, fontset->xfontset);
+	job = g_new0(NabiFontSetJob, 1);
+	job->type = NABI_FONTSET_JOB_FREE;
+	job->xfontset = fontset->xfontset;
+	nabi_fontset_loader_push(job);
+
 	g_free(fontset->name);
 	g_free(fontset);
     }
@@ -115,38 +308,166 @@ nabi_fontset_unref(NabiFontSet *fontset)
 static NabiFontSet*
 nabi_fontset_find_by_xfontset(XFontSet xfontset)
 {
-    NabiFontSet *fontset;
-    GSList *list;
-    list = fontset_list;
-
-    while (list != NULL) {
-	fontset = (NabiFontSet*)(list->data);
-	if (fontset->xfontset == xfontset)
-	    return fontset;
-	list = list->next;
-    }
+    if (xfontset_hash == NULL)
+	return NULL;
 
-    return NULL;
+    return g_hash_table_lookup(xfontset_hash, xfontset);
 }
 
+/* returns the fontset only if it is made already, it never makes
+ * a new one, so it does not block */
 NabiFontSet*
-nabi_fontset_create(Display *display, const char *fontset_name)
+nabi_fontset_lookup(Display *display, const char *fontset_name)
 {
     NabiFontSet *nabi_fontset;
 
-    _display = display;
     if (fontset_hash == NULL)
-	fontset_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	return NULL;
 
     nabi_fontset = g_hash_table_lookup(fontset_hash, fontset_name);
-    if (nabi_fontset != NULL) {
+    if (nabi_fontset != NULL)
 	nabi_fontset_ref(nabi_fontset);
-	return nabi_fontset;
+
+    return nabi_fontset;
+}
+
+static void
+nabi_fontset_job_free(NabiFontSetJob *job)
+{
+    g_free(job->name);
+    g_free(job->data);
+    g_free(job);
+}
+
+/* the loaded fontset arrives here, on the main thread */
+static void
+nabi_fontset_load_done(NabiFontSetJob *job)
+{
+    NabiFontSet *fontset = NULL;
+    GSList *item;
+
+    item = g_slist_find_custom(loader_pending, job->name,
+			       (GCompareFunc)strcmp);
+    if (item != NULL) {
+	g_free(item->data);
+	loader_pending = g_slist_delete_link(loader_pending, item);
     }
 
-    nabi_fontset = nabi_fontset_new(fontset_name);
+    if (job->xfontset != NULL)
+	fontset = nabi_fontset_insert(job->name, job->xfontset,
+				      job->ascent, job->descent);
 
-    return nabi_fontset;
+    /* the callers take their own references with nabi_fontset_lookup() */
+    job->func(job->name);
+    nabi_fontset_unref(fontset);
+
+    nabi_fontset_job_free(job);
+}
+
+static gboolean
+nabi_fontset_on_loader_results(gpointer data)
+{
+    GSList *results;
+    GSList *item;
+
+    G_LOCK(loader_results);
+    results = loader_results;
+    loader_results = NULL;
+    loader_results_source = 0;
+    G_UNLOCK(loader_results);
+
+    for (item = results; item != NULL; item = g_slist_next(item))
+	nabi_fontset_load_done(item->data);
+    g_slist_free(results);
+
+    return FALSE;
+}
+
+/* runs on the loader thread, it uses only its own display */
+static void
+nabi_fontset_loader_run(gpointer data, gpointer user_data)
+{
+    NabiFontSetJob *job = data;
+
+    if (job->type == NABI_FONTSET_JOB_WRITE_CACHE) {
+	extents_cache_write(job->data);
+	nabi_fontset_job_free(job);
+	return;
+    }
+
+    if (job->type == NABI_FONTSET_JOB_FREE) {
+	XFreeFontSet(loader_display, job->xfontset);
+	nabi_fontset_job_free(job);
+	return;
+    }
+
+    if (loader_display == NULL) {
+	loader_display = XOpenDisplay(loader_display_name);
+	if (loader_display == NULL)
+	    nabi_log(1, "can't open display for fontsets: %s\n",
+		     loader_display_name);
+    }
+
+    /* xfontset is left NULL if it fails */
+    if (loader_display != NULL) {
+	job->xfontset = nabi_fontset_open(loader_display, job->name);
+	if (job->xfontset != NULL)
+	    nabi_fontset_get_extents(job->xfontset,
+				     &job->ascent, &job->descent);
+    }
+
+    G_LOCK(loader_results);
+    loader_results = g_slist_append(loader_results, job);
+    if (loader_results_source == 0)
+	loader_results_source = g_idle_add(nabi_fontset_on_loader_results,
+					   NULL);
+    G_UNLOCK(loader_results);
+}
+
+static void
+nabi_fontset_loader_push(NabiFontSetJob *job)
+{
+    if (loader == NULL)
+	loader = g_thread_pool_new(nabi_fontset_loader_run, NULL,
+				   1, FALSE, NULL);
+
+    g_thread_pool_push(loader, job, NULL);
+}
+
+/* makes the fontset on the loader thread, func is called on the main
+ * loop when it is done, the fontset is taken with nabi_fontset_lookup()
+ * from there. A fontset already loading is not asked again. */
+void
+nabi_fontset_load(Display *display, const char *fontset_name,
+		  NabiFontSetLoadFunc func)
+{
+    NabiFontSetJob *job;
+
+    if (g_slist_find_custom(loader_pending, fontset_name,
+			    (GCompareFunc)strcmp) != NULL)
+	return;
+
+    if (fontset_hash == NULL) {
+	fontset_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	xfontset_hash = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    if (loader_display_name == NULL)
+	loader_display_name = g_strdup(DisplayString(display));
+
+    loader_pending = g_slist_prepend(loader_pending, g_strdup(fontset_name));
+
+    job = g_new0(NabiFontSetJob, 1);
+    job->type = NABI_FONTSET_JOB_LOAD;
+    job->name = g_strdup(fontset_name);
+    job->func = func;
+    nabi_fontset_loader_push(job);
+}
+
+gboolean
+nabi_fontset_is_loading(void)
+{
+    return loader_pending != NULL;
 }
 
 void
@@ -154,17 +475,50 @@ nabi_fontset_free(Display *display, XFontSet xfontset)
 {
     NabiFontSet *nabi_fontset;
 
-    _display = display;
     nabi_fontset = nabi_fontset_find_by_xfontset(xfontset);
     nabi_fontset_unref(nabi_fontset);
 }
 
+/* finishes the queued jobs */
+void
+nabi_fontset_loader_stop(void)
+{
+    if (loader != NULL) {
+	g_thread_pool_free(loader, FALSE, TRUE);
+	loader = NULL;
+    }
+}
+
+/* stops the loader first, then its display is used here */
 void
 nabi_fontset_free_all(Display *display)
 {
     NabiFontSet *fontset;
     GSList *list;
-    _display = display;
+
+    nabi_fontset_loader_stop();
+
+    /* loaded but not delivered */
+    G_LOCK(loader_results);
+    list = loader_results;
+    loader_results = NULL;
+    if (loader_results_source != 0) {
+	g_source_remove(loader_results_source);
+	loader_results_source = 0;
+    }
+    G_UNLOCK(loader_results);
+
+    while (list != NULL) {
+	NabiFontSetJob *job = list->data;
+	if (job->xfontset != NULL)
+	    XFreeFontSet(loader_display, job->xfontset);
+	nabi_fontset_job_free(job);
+	list = g_slist_delete_link(list, list);
+    }
+
+    g_slist_foreach(loader_pending, (GFunc)g_free, NULL);
+    g_slist_free(loader_pending);
+    loader_pending = NULL;
 
     if (fontset_list != NULL) {
 	nabi_log(1, "remaining fontsets will be freed,"
@@ -172,17 +526,33 @@ nabi_fontset_free_all(Display *display)
 	list = fontset_list;
 	while (list != NULL) {
 	    fontset = (NabiFontSet*)(list->data);
-	    XFreeFontSet(_display, fontset->xfontset);
+	    XFreeFontSet(loader_display, fontset->xfontset);
 	    g_free(fontset->name);
 	    g_free(fontset);
 	    list = list->next;
 	}
     }
 
+    if (loader_display != NULL) {
+	XCloseDisplay(loader_display);
+	loader_display = NULL;
+    }
+    g_free(loader_display_name);
+    loader_display_name = NULL;
+
     if (fontset_hash != NULL)
 	g_hash_table_destroy(fontset_hash);
+    if (xfontset_hash != NULL)
+	g_hash_table_destroy(xfontset_hash);
     if (fontset_list != NULL)
 	g_slist_free(fontset_list);
+    if (extents_cache != NULL)
+	g_hash_table_destroy(extents_cache);
+
+    fontset_hash = NULL;
+    xfontset_hash = NULL;
+    fontset_list = NULL;
+    extents_cache = NULL;
 }
 
 /* vim: set ts=8 sw=4 : */
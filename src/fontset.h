@@ -29,8 +29,17 @@ struct _NabiFontSet {
 
 typedef struct _NabiFontSet NabiFontSet;
 
-NabiFontSet* nabi_fontset_create   (Display *display, const char *fontset_name);
+/* called on the main loop when a fontset is loaded or has failed */
+typedef void (*NabiFontSetLoadFunc)(const char *fontset_name);
+
+void         nabi_fontset_load     (Display *display, const char *fontset_name,
+				    NabiFontSetLoadFunc func);
+gboolean     nabi_fontset_is_loading(void);
+NabiFontSet* nabi_fontset_lookup   (Display *display, const char *fontset_name);
+gboolean     nabi_fontset_get_cached_extents(const char *fontset_name,
+					     int *ascent, int *descent);
 void         nabi_fontset_free     (Display *display, XFontSet xfontset);
 void         nabi_fontset_free_all (Display *display);
+void         nabi_fontset_loader_stop(void);
 
 #endif /* _FONTSET_H */
@@ -0,0 +1,145 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* shared GCs for the preedit windows
+ *
+ * Most ics use the same few colors on the same screen, so a GC is
+ * shared by all the preedit windows of the same (screen, depth,
+ * foreground, background). The GCs are never changed after they are
+ * made; to change colors, release the GC and get another one. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gtk/gtk.h>
+
+#include "debug.h"
+#include "gc-cache.h"
+
+typedef struct _NabiGCKey NabiGCKey;
+typedef struct _NabiGCEntry NabiGCEntry;
+
+struct _NabiGCKey {
+    GdkScreen *screen;
+    int depth;
+    gulong foreground;
+    gulong background;
+};
+
+struct _NabiGCEntry {
+    NabiGCKey key;
+    GdkGC *gc;
+    int ref;
+};
+
+static GHashTable *gc_cache = NULL;	/* NabiGCKey -> NabiGCEntry */
+
+static guint
+nabi_gc_key_hash(gconstpointer data)
+{
+    const NabiGCKey *key = (const NabiGCKey*)data;
+
+    return g_direct_hash(key->screen) ^ (key->depth << 24) ^
+	   (key->foreground * 31) ^ key->background;
+}
+
+static gboolean
+nabi_gc_key_equal(gconstpointer a, gconstpointer b)
+{
+    const NabiGCKey *key1 = (const NabiGCKey*)a;
+    const NabiGCKey *key2 = (const NabiGCKey*)b;
+
+    return key1->screen == key2->screen &&
+	   key1->depth == key2->depth &&
+	   key1->foreground == key2->foreground &&
+	   key1->background == key2->background;
+}
+
+GdkGC*
+nabi_gc_cache_get(GdkDrawable *drawable, gulong foreground, gulong background)
+{
+    NabiGCKey key;
+    NabiGCEntry *entry;
+    GdkColor fg = { 0, 0, 0, 0 };
+    GdkColor bg = { 0, 0, 0, 0 };
+
+    if (gc_cache == NULL)
+	gc_cache = g_hash_table_new(nabi_gc_key_hash, nabi_gc_key_equal);
+
+    key.screen = gdk_drawable_get_screen(drawable);
+    key.depth = gdk_drawable_get_depth(drawable);
+    key.foreground = foreground;
+    key.background = background;
+
+    entry = g_hash_table_lookup(gc_cache, &key);
+    if (entry != NULL) {
+	entry->ref++;
+	return entry->gc;
+    }
+
+    fg.pixel = foreground;
+    bg.pixel = background;
+
+    entry = g_new(NabiGCEntry, 1);
+    entry->key = key;
+    entry->ref = 1;
+    entry->gc = gdk_gc_new(drawable);
+    gdk_gc_set_foreground(entry->gc, &fg);
+    gdk_gc_set_background(entry->gc, &bg);
+
+    g_object_set_data(G_OBJECT(entry->gc), "nabi-gc-cache-entry", entry);
+    g_hash_table_insert(gc_cache, &entry->key, entry);
+
+    nabi_log(4, "new shared gc: fg %lx, bg %lx, depth %d, %d gcs\n",
+	     foreground, background, key.depth,
+	     g_hash_table_size(gc_cache));
+
+    return entry->gc;
+}
+
+void
+nabi_gc_cache_release(GdkGC *gc)
+{
+    NabiGCEntry *entry;
+
+    if (gc == NULL)
+	return;
+
+    entry = g_object_get_data(G_OBJECT(gc), "nabi-gc-cache-entry");
+    if (entry == NULL) {
+	g_object_unref(G_OBJECT(gc));
+	return;
+    }
+
+    entry->ref--;
+    if (entry->ref <= 0) {
+	g_hash_table_remove(gc_cache, &entry->key);
+	g_object_unref(G_OBJECT(entry->gc));
+	g_free(entry);
+    }
+}
+
+int
+nabi_gc_cache_get_size(void)
+{
+    if (gc_cache == NULL)
+	return 0;
+
+    return g_hash_table_size(gc_cache);
+}
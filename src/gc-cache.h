@@ -0,0 +1,29 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef _GC_CACHE_H
+#define _GC_CACHE_H
+
+#include <gtk/gtk.h>
+
+GdkGC* nabi_gc_cache_get     (GdkDrawable *drawable,
+			      gulong foreground, gulong background);
+void   nabi_gc_cache_release (GdkGC *gc);
+int    nabi_gc_cache_get_size(void);
+
+#endif /* _GC_CACHE_H */
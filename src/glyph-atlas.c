@@ -0,0 +1,323 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* pre-rendered glyph atlas for preedit drawing
+ *
+ * The preedit string is made of hangul syllables and compatibility jamo
+ * of one font. Each of them is rendered once with pango into a server
+ * side pixmap, then a preedit string is drawn by copying the cells, so
+ * no shaping or rasterizing is done while typing.
+ * One atlas holds one (screen, depth, font, fg, bg) combination. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "debug.h"
+#include "glyph-atlas.h"
+
+#define ATLAS_WIDTH	1024
+#define ATLAS_ROWS	16
+#define ATLAS_MAX	4	/* number of atlases kept */
+
+typedef struct _NabiGlyphCell NabiGlyphCell;
+
+struct _NabiGlyphCell {
+    short x;
+    short y;
+    short width;
+};
+
+struct _NabiGlyphAtlas {
+    GdkScreen *screen;
+    int depth;
+    guint font_serial;
+
+    GdkPixmap *pixmap;
+    GdkGC *gc;
+    PangoLayout *layout;
+    GdkColor fg_color;
+    GdkColor bg_color;
+    int ascent;
+    int height;
+
+    GHashTable *cells;		/* gunichar -> NabiGlyphCell */
+    int next_x;
+    int next_y;
+    gboolean full;
+};
+
+/* most frequent syllables in korean text */
+static const char *warm_up_syllables =
+    "이다는의에가하고지로을를한기사서자리수도대있시나아어인정일적것들"
+    "해상그부보구주전여제만라과요우스국와동면게오원성장내중비소계거";
+
+static GList *atlas_list = NULL;
+
+static gboolean
+is_cacheable_char(gunichar c)
+{
+    /* conjoining jamo are shaped as a cluster, so they are not here */
+    return (c >= 0xac00 && c <= 0xd7a3) ||
+	   (c >= 0x3131 && c <= 0x318e);
+}
+
+static void
+nabi_glyph_atlas_free(NabiGlyphAtlas *atlas)
+{
+    g_hash_table_destroy(atlas->cells);
+    g_object_unref(G_OBJECT(atlas->layout));
+    g_object_unref(G_OBJECT(atlas->gc));
+    g_object_unref(G_OBJECT(atlas->pixmap));
+    g_free(atlas);
+}
+
+static NabiGlyphCell*
+nabi_glyph_atlas_add(NabiGlyphAtlas *atlas, gunichar c)
+{
+    NabiGlyphCell *cell;
+    PangoRectangle rect;
+    char buf[8];
+    int len;
+
+    if (atlas->full)
+	return NULL;
+
+    len = g_unichar_to_utf8(c, buf);
+    pango_layout_set_text(atlas->layout, buf, len);
+    pango_layout_get_pixel_extents(atlas->layout, NULL, &rect);
+
+    if (atlas->next_x + rect.width > ATLAS_WIDTH) {
+	atlas->next_x = 0;
+	atlas->next_y += atlas->height;
+	if (atlas->next_y + atlas->height > atlas->height * ATLAS_ROWS) {
+	    nabi_log(3, "glyph atlas is full: %d glyphs\n",
+		     g_hash_table_size(atlas->cells));
+	    atlas->full = TRUE;
+	    return NULL;
+	}
+    }
+
+    cell = g_new(NabiGlyphCell, 1);
+    cell->x = atlas->next_x;
+    cell->y = atlas->next_y;
+    cell->width = rect.width;
+
+    gdk_draw_rectangle(atlas->pixmap, atlas->gc, TRUE,
+		       cell->x, cell->y, cell->width, atlas->height);
+    gdk_draw_layout_with_colors(atlas->pixmap, atlas->gc,
+				cell->x, cell->y, atlas->layout,
+				&atlas->fg_color, &atlas->bg_color);
+
+    atlas->next_x += rect.width;
+    g_hash_table_insert(atlas->cells, GUINT_TO_POINTER(c), cell);
+
+    return cell;
+}
+
+static NabiGlyphCell*
+nabi_glyph_atlas_lookup(NabiGlyphAtlas *atlas, gunichar c)
+{
+    NabiGlyphCell *cell;
+
+    cell = g_hash_table_lookup(atlas->cells, GUINT_TO_POINTER(c));
+    if (cell == NULL)
+	cell = nabi_glyph_atlas_add(atlas, c);
+
+    return cell;
+}
+
+static NabiGlyphAtlas*
+nabi_glyph_atlas_new(GdkDrawable *target,
+		     const PangoFontDescription *font, guint font_serial,
+		     const GdkColor *fg, const GdkColor *bg)
+{
+    NabiGlyphAtlas *atlas;
+    PangoContext *context;
+    PangoFontMetrics *metrics;
+    PangoLanguage *language;
+    const char *p;
+
+    atlas = g_new0(NabiGlyphAtlas, 1);
+    atlas->screen = gdk_drawable_get_screen(target);
+    atlas->depth = gdk_drawable_get_depth(target);
+    atlas->font_serial = font_serial;
+    atlas->fg_color = *fg;
+    atlas->bg_color = *bg;
+
+    context = gdk_pango_context_get_for_screen(atlas->screen);
+    language = pango_language_from_string("ko");
+    pango_context_set_font_description(context, font);
+    pango_context_set_base_dir(context, PANGO_DIRECTION_LTR);
+    pango_context_set_language(context, language);
+
+    metrics = pango_context_get_metrics(context, font, language);
+    atlas->ascent = PANGO_PIXELS(pango_font_metrics_get_ascent(metrics));
+    atlas->height = atlas->ascent +
+		PANGO_PIXELS(pango_font_metrics_get_descent(metrics));
+    pango_font_metrics_unref(metrics);
+
+    atlas->layout = pango_layout_new(context);
+    g_object_unref(G_OBJECT(context));
+
+    atlas->pixmap = gdk_pixmap_new(target, ATLAS_WIDTH,
+				   atlas->height * ATLAS_ROWS, -1);
+    atlas->gc = gdk_gc_new(atlas->pixmap);
+    gdk_gc_set_foreground(atlas->gc, &atlas->bg_color);
+
+    atlas->cells = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, g_free);
+
+    for (p = warm_up_syllables; *p != '\0'; p = g_utf8_next_char(p))
+	nabi_glyph_atlas_lookup(atlas, g_utf8_get_char(p));
+
+    nabi_log(3, "new glyph atlas: %d glyphs, cell height %d\n",
+	     g_hash_table_size(atlas->cells), atlas->height);
+
+    return atlas;
+}
+
+NabiGlyphAtlas*
+nabi_glyph_atlas_get(GdkDrawable *target,
+		     const PangoFontDescription *font, guint font_serial,
+		     const GdkColor *fg, const GdkColor *bg)
+{
+    GList *item;
+    NabiGlyphAtlas *atlas;
+    GdkScreen *screen = gdk_drawable_get_screen(target);
+    int depth = gdk_drawable_get_depth(target);
+
+    for (item = atlas_list; item != NULL; item = g_list_next(item)) {
+	atlas = (NabiGlyphAtlas*)item->data;
+	if (atlas->screen == screen &&
+	    atlas->depth == depth &&
+	    atlas->font_serial == font_serial &&
+	    atlas->fg_color.pixel == fg->pixel &&
+	    atlas->bg_color.pixel == bg->pixel &&
+	    gdk_color_equal(&atlas->fg_color, fg) &&
+	    gdk_color_equal(&atlas->bg_color, bg)) {
+	    /* move to front, the last one is dropped first */
+	    atlas_list = g_list_remove_link(atlas_list, item);
+	    atlas_list = g_list_concat(item, atlas_list);
+	    return atlas;
+	}
+    }
+
+    atlas = nabi_glyph_atlas_new(target, font, font_serial, fg, bg);
+    atlas_list = g_list_prepend(atlas_list, atlas);
+
+    if (g_list_length(atlas_list) > ATLAS_MAX) {
+	item = g_list_last(atlas_list);
+	nabi_glyph_atlas_free((NabiGlyphAtlas*)item->data);
+	atlas_list = g_list_delete_link(atlas_list, item);
+    }
+
+    return atlas;
+}
+
+/* returns FALSE if str has any glyph which is not in the atlas,
+ * then the caller should draw it with pango */
+gboolean
+nabi_glyph_atlas_measure(NabiGlyphAtlas *atlas, const char *str, int *width)
+{
+    const char *p;
+    int w = 0;
+
+    for (p = str; *p != '\0'; p = g_utf8_next_char(p)) {
+	gunichar c = g_utf8_get_char(p);
+	NabiGlyphCell *cell;
+
+	if (!is_cacheable_char(c))
+	    return FALSE;
+
+	cell = nabi_glyph_atlas_lookup(atlas, c);
+	if (cell == NULL)
+	    return FALSE;
+
+	w += cell->width;
+    }
+
+    *width = w;
+    return TRUE;
+}
+
+/* str must be measured by nabi_glyph_atlas_measure() before */
+void
+nabi_glyph_atlas_draw(NabiGlyphAtlas *atlas, GdkDrawable *drawable,
+		      int x, int y, const char *str)
+{
+    const char *p;
+
+    for (p = str; *p != '\0'; p = g_utf8_next_char(p)) {
+	NabiGlyphCell *cell;
+
+	cell = g_hash_table_lookup(atlas->cells,
+				   GUINT_TO_POINTER(g_utf8_get_char(p)));
+	if (cell == NULL)
+	    continue;
+
+	gdk_draw_drawable(drawable, atlas->gc, atlas->pixmap,
+			  cell->x, cell->y, x, y, cell->width, atlas->height);
+	x += cell->width;
+    }
+}
+
+int
+nabi_glyph_atlas_get_ascent(NabiGlyphAtlas *atlas)
+{
+    return atlas->ascent;
+}
+
+int
+nabi_glyph_atlas_get_height(NabiGlyphAtlas *atlas)
+{
+    return atlas->height;
+}
+
+void
+nabi_glyph_atlas_free_all(void)
+{
+    GList *item;
+
+    for (item = atlas_list; item != NULL; item = g_list_next(item))
+	nabi_glyph_atlas_free((NabiGlyphAtlas*)item->data);
+
+    g_list_free(atlas_list);
+    atlas_list = NULL;
+}
+
+/* X server memory of the atlas pixmaps */
+gsize
+nabi_glyph_atlas_get_memory_size(void)
+{
+    GList *item;
+    gsize size = 0;
+
+    for (item = atlas_list; item != NULL; item = g_list_next(item)) {
+	NabiGlyphAtlas *atlas = (NabiGlyphAtlas*)item->data;
+	int bytes_per_pixel = atlas->depth > 16 ? 4 : (atlas->depth + 7) / 8;
+
+	size += (gsize)ATLAS_WIDTH * atlas->height * ATLAS_ROWS *
+		bytes_per_pixel;
+    }
+
+    return size;
+}
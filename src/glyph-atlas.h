@@ -0,0 +1,41 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef _GLYPH_ATLAS_H
+#define _GLYPH_ATLAS_H
+
+#include <gtk/gtk.h>
+
+typedef struct _NabiGlyphAtlas NabiGlyphAtlas;
+
+NabiGlyphAtlas* nabi_glyph_atlas_get     (GdkDrawable *target,
+					  const PangoFontDescription *font,
+					  guint font_serial,
+					  const GdkColor *fg,
+					  const GdkColor *bg);
+gboolean        nabi_glyph_atlas_measure (NabiGlyphAtlas *atlas,
+					  const char *str, int *width);
+void            nabi_glyph_atlas_draw    (NabiGlyphAtlas *atlas,
+					  GdkDrawable *drawable,
+					  int x, int y, const char *str);
+int             nabi_glyph_atlas_get_ascent(NabiGlyphAtlas *atlas);
+int             nabi_glyph_atlas_get_height(NabiGlyphAtlas *atlas);
+void            nabi_glyph_atlas_free_all(void);
+gsize           nabi_glyph_atlas_get_memory_size(void);
+
+#endif /* _GLYPH_ATLAS_H */
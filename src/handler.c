@@ -33,6 +33,7 @@
 #include "server.h"
 #include "candidate.h"
 #include "debug.h"
+#include "latency.h"
 
 #include "xim_protocol.h"
 
@@ -125,7 +126,9 @@ nabi_handler_forward_event(XIMS ims, IMForwardEventStruct *data)
 {
     NabiIC* ic;
     KeySym keysym;
+    KeySym normalized;
     XKeyEvent *kevent;
+    long long start;
     
     if (data->event.type != KeyPress) {
 	nabi_log(4, "process event: id = %d-%d, key release\n",
@@ -139,7 +142,11 @@ nabi_handler_forward_event(XIMS ims, IMForwardEventStruct *data)
 	return True;
 
     kevent = (XKeyEvent*)&data->event;
-    keysym = nabi_ic_lookup_keysym(ic, kevent);
+    nabi_latency_event_begin(ic->input_style, kevent->time);
+
+    start = nabi_latency_now();
+    keysym = nabi_ic_lookup_keysym(ic, kevent, &normalized);
+    nabi_latency_add(NABI_LATENCY_LOOKUP, start);
 
     nabi_log(3, "process event: id = %d-%d, keysym = 0x%x('%c')\n",
 	     (int)data->connect_id, (int)data->icid,
@@ -154,25 +161,26 @@ nabi_handler_forward_event(XIMS ims, IMForwardEventStruct *data)
 	if (nabi_server_is_trigger_key(nabi_server, keysym, kevent->state)) {
 	    /* change input mode to compose mode */
 	    nabi_ic_set_mode(ic, NABI_INPUT_MODE_COMPOSE);
-	    return True;
+	} else {
+	    IMForwardEvent(ims, (XPointer)data);
 	}
-
-	IMForwardEvent(ims, (XPointer)data);
     } else {
 	if (nabi_server_is_trigger_key(nabi_server, keysym, kevent->state)) {
 	    /* change input mode to direct mode */
 	    nabi_ic_set_mode(ic, NABI_INPUT_MODE_DIRECT);
-	    return True;
-	}
-
-	/* compose mode */
-	if (!ic->preedit.start) {
-	    nabi_ic_status_start(ic);
+	} else {
+	    /* compose mode */
+	    if (!ic->preedit.start) {
+		nabi_ic_status_start(ic);
+	    }
+	    if (!nabi_ic_process_keyevent(ic, keysym, normalized,
+					  kevent->state))
+		IMForwardEvent(ims, (XPointer)data);
 	}
-	if (!nabi_ic_process_keyevent(ic, keysym, kevent->state))
-	    IMForwardEvent(ims, (XPointer)data);
     }
 
+    nabi_latency_event_end();
+
     return True;
 }
 
@@ -205,10 +213,7 @@ nabi_handler_unset_ic_focus(XIMS ims, IMChangeFocusStruct *data)
 
     nabi_server_set_mode_info(nabi_server, NABI_MODE_INFO_NONE);
 
-    if (ic->candidate) {
-	nabi_candidate_delete(ic->candidate);
-	ic->candidate = NULL;
-    }
+    nabi_ic_unset_focus(ic);
 
     return True;
 }
@@ -23,7 +23,6 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
-#include <ctype.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -37,20 +36,45 @@
 #include "server.h"
 #include "fontset.h"
 #include "debug.h"
-#include "util.h"
+#include "lookup.h"
 #include "ustring.h"
 #include "nabi.h"
 #include "keyboard-layout.h"
+#include "window-cache.h"
+#include "glyph-atlas.h"
+#include "gc-cache.h"
+#include "latency.h"
+#include "probes.h"
+#include "stat.h"
 
 static void  nabi_ic_preedit_configure(NabiIC *ic);
-static char* nabi_ic_get_hic_preedit_string(NabiIC *ic);
-static char* nabi_ic_get_flush_string(NabiIC *ic);
-static void  nabi_ic_hic_on_translate(HangulInputContext* hic,
-                         int ascii, ucschar* c, void* data);
-static bool  nabi_ic_hic_on_transition(HangulInputContext* hic,
-			 ucschar c, const ucschar* preedit, void* data);
+static void  nabi_ic_preedit_hide(NabiIC *ic);
+static void  nabi_ic_preedit_create_fontset(NabiIC *ic);
+static void  nabi_ic_preedit_free_render_cache(NabiIC *ic);
+static void  nabi_ic_preedit_free_backing(NabiIC *ic);
+static void  nabi_ic_preedit_release_gcs(NabiIC *ic);
+static void  nabi_ic_preedit_update_gcs(NabiIC *ic);
+static void  nabi_ic_recycle(NabiIC *ic);
+static void  nabi_ic_reuse(NabiIC *ic, CARD16 id, IMChangeICStruct *data);
+static GdkFilterReturn gdk_event_filter(GdkXEvent *xevent, GdkEvent *gevent,
+					gpointer data);
+static void  nabi_ic_commit_utf8(NabiIC *ic, const char *utf8_str);
+static void  nabi_ic_engine_on_commit(NabiEngine* engine, const char* str,
+				      gpointer data);
+static void  nabi_ic_engine_on_flush(NabiEngine* engine, gpointer data);
+static gboolean nabi_ic_engine_is_valid(NabiEngine* engine, const char* str,
+					gpointer data);
+static void  nabi_ic_engine_on_translate(NabiEngine* engine, ucschar c,
+					 gpointer data);
 static Bool  nabi_ic_update_candidate_window(NabiIC *ic);
 
+static const NabiEngineSink nabi_ic_engine_sink = {
+    nabi_ic_engine_on_commit,
+    nabi_ic_engine_on_flush,
+    nabi_ic_engine_is_valid,
+    nabi_ic_engine_on_translate
+};
+
 
 static gboolean
 is_syllable_boundary(ucschar prev, ucschar next)
@@ -134,6 +158,7 @@ nabi_connection_create(CARD16 id, const char* locale)
     conn = g_new(NabiConnection, 1);
     conn->id = id;
     conn->mode = nabi_server->default_input_mode;
+    conn->encoding = NULL;
     conn->cd = (GIConv)-1;
     if (locale != NULL) {
 	char* encoding = strchr(locale, '.');
@@ -142,6 +167,7 @@ nabi_connection_create(CARD16 id, const char* locale)
 
 	    if (!strniequal(encoding, "UTF-8", 5) ||
 		!strniequal(encoding, "UTF8", 4)) {
+		conn->encoding = g_strdup(encoding);
 		conn->cd = g_iconv_open(encoding, "UTF-8");
 		nabi_log(3, "connection %d use encoding: %s (%lx)\n",
 			    id, encoding, (unsigned long)conn->cd);
@@ -151,6 +177,11 @@ nabi_connection_create(CARD16 id, const char* locale)
 
     conn->next_new_ic_id = 1;
     conn->ic_list = NULL;
+    conn->recycled_ics = NULL;
+    conn->recycle_source = 0;
+
+    NABI_STAT_INC(connections);
+    NABI_STAT_INC(connections_total);
     
     return conn;
 }
@@ -162,34 +193,164 @@ nabi_connection_destroy(NabiConnection* conn)
     
     if (conn->cd != (GIConv)-1)
 	g_iconv_close(conn->cd);
+    g_free(conn->encoding);
 
     item = conn->ic_list;
     while (item != NULL) {
-	if (item->data != NULL)
+	if (item->data != NULL) {
 	    nabi_ic_destroy((NabiIC*)item->data);
+	    NABI_STAT_DEC(ics);
+	}
 	item = g_slist_next(item);
     }
     g_slist_free(conn->ic_list);
 
+    if (conn->recycle_source != 0)
+	g_source_remove(conn->recycle_source);
+
+    item = conn->recycled_ics;
+    while (item != NULL) {
+	nabi_ic_destroy((NabiIC*)item->data);
+	item = g_slist_next(item);
+    }
+    g_slist_free(conn->recycled_ics);
+
+    NABI_STAT_DEC(connections);
     g_free(conn);
 }
 
+/* ic recycling
+ * gvim 같은 프로그램은 모드를 바꾸거나 focus가 바뀔때 XIC를 destroy했다가
+ * 곧바로 다시 create한다. 그때마다 HangulInputContext, preedit 문자열,
+ * preedit window와 GC를 새로 만들지 않도록, destroy된 ic를 잠시
+ * 가지고 있다가 같은 client window로 ic를 만들면 다시 쓴다. */
+#define NABI_IC_RECYCLE_MAX	4
+#define NABI_IC_RECYCLE_TIMEOUT	5000	/* ms */
+
+static gboolean
+nabi_connection_on_expire_recycled_ics(gpointer data)
+{
+    NabiConnection* conn = (NabiConnection*)data;
+    GSList* item;
+    GTimeVal now;
+
+    g_get_current_time(&now);
+
+    item = conn->recycled_ics;
+    while (item != NULL) {
+	NabiIC* ic = (NabiIC*)item->data;
+	glong elapsed;
+
+	item = g_slist_next(item);
+
+	elapsed = (now.tv_sec - ic->recycled_time.tv_sec) * 1000 +
+		  (now.tv_usec - ic->recycled_time.tv_usec) / 1000;
+	if (elapsed >= NABI_IC_RECYCLE_TIMEOUT) {
+	    conn->recycled_ics = g_slist_remove(conn->recycled_ics, ic);
+	    nabi_ic_destroy(ic);
+	    NABI_STAT_INC(ic_recycle_expired);
+	}
+    }
+
+    if (conn->recycled_ics == NULL) {
+	conn->recycle_source = 0;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+nabi_connection_recycle_ic(NabiConnection* conn, NabiIC* ic)
+{
+    GSList* last;
+
+    nabi_ic_recycle(ic);
+    conn->recycled_ics = g_slist_prepend(conn->recycled_ics, ic);
+
+    if (g_slist_length(conn->recycled_ics) > NABI_IC_RECYCLE_MAX) {
+	last = g_slist_last(conn->recycled_ics);
+	nabi_ic_destroy((NabiIC*)last->data);
+	conn->recycled_ics = g_slist_delete_link(conn->recycled_ics, last);
+	NABI_STAT_INC(ic_recycle_expired);
+    }
+
+    if (conn->recycle_source == 0)
+	conn->recycle_source = g_timeout_add(NABI_IC_RECYCLE_TIMEOUT,
+				    nabi_connection_on_expire_recycled_ics,
+				    conn);
+}
+
+static NabiIC*
+nabi_connection_take_recycled_ic(NabiConnection* conn, Window client_window)
+{
+    GSList* item;
+
+    if (client_window == 0)
+	return NULL;
+
+    item = conn->recycled_ics;
+    while (item != NULL) {
+	NabiIC* ic = (NabiIC*)item->data;
+	if (ic->client_window == client_window) {
+	    conn->recycled_ics = g_slist_delete_link(conn->recycled_ics, item);
+	    return ic;
+	}
+	item = g_slist_next(item);
+    }
+
+    return NULL;
+}
+
+static Window
+ic_attr_get_client_window(IMChangeICStruct* data)
+{
+    XICAttribute *attr;
+    CARD16 i;
+
+    attr = data->ic_attr;
+    for (i = 0; i < data->ic_attr_num; i++, attr++) {
+	if (strcmp(XNClientWindow, attr->name) == 0)
+	    return *(CARD32*)attr->value;
+    }
+
+    return 0;
+}
+
 NabiIC*
 nabi_connection_create_ic(NabiConnection* conn, IMChangeICStruct* data)
 {
     NabiIC* ic; 
+    Window client_window;
+    int recycled = 0;
 
     if (conn == NULL)
 	return NULL;
 
-    ic = nabi_ic_create(conn, data);
-    ic->id = conn->next_new_ic_id;
+    client_window = ic_attr_get_client_window(data);
+    ic = nabi_connection_take_recycled_ic(conn, client_window);
+    if (ic != NULL) {
+	nabi_ic_reuse(ic, conn->next_new_ic_id, data);
+	nabi_server->statistics.ic_recycled++;
+	NABI_STAT_INC(ic_recycle_hits);
+	recycled = 1;
+    } else {
+	ic = nabi_ic_create(conn, data);
+	ic->id = conn->next_new_ic_id;
+	nabi_server->statistics.ic_fresh++;
+	/* client window 없이 만든 ic는 재사용할 수 없으므로 세지 않는다 */
+	if (client_window != 0)
+	    NABI_STAT_INC(ic_recycle_misses);
+    }
 
     conn->next_new_ic_id++;
     if (conn->next_new_ic_id == 0)
 	conn->next_new_ic_id++;
 
     conn->ic_list = g_slist_prepend(conn->ic_list, ic);
+    NABI_STAT_INC(ics);
+    NABI_STAT_INC(ics_total);
+    NABI_PROBE3(ic_create, conn->id, ic->id, recycled);
     return ic;
 }
 
@@ -199,8 +360,13 @@ nabi_connection_destroy_ic(NabiConnection* conn, NabiIC* ic)
     if (conn == NULL || ic == NULL)
 	return;
 
+    NABI_PROBE2(ic_destroy, conn->id, ic->id);
+    NABI_STAT_DEC(ics);
     conn->ic_list = g_slist_remove(conn->ic_list, ic);
-    nabi_ic_destroy(ic);
+    if (ic->client_window != 0)
+	nabi_connection_recycle_ic(conn, ic);
+    else
+	nabi_ic_destroy(ic);
 }
 
 NabiIC*
@@ -232,22 +398,10 @@ nabi_connection_need_check_charset(NabiConnection* conn)
 gboolean
 nabi_connection_is_valid_str(NabiConnection* conn, const char* str)
 {
-    size_t ret;
-    gchar buf[32];
-    gsize inbytesleft, outbytesleft;
-    gchar *inbuf, *outbuf;
-
     if (!nabi_connection_need_check_charset(conn))
 	return TRUE;
 
-    inbuf = (char*)str;
-    outbuf = buf;
-    inbytesleft = strlen(str);
-    outbytesleft = sizeof(buf);
-    ret = g_iconv(conn->cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
-    if (ret == -1)
-	return False;
-    return True;
+    return nabi_lookup_is_valid_str(conn->cd, str);
 }
 
 NabiToplevel*
@@ -293,8 +447,6 @@ nabi_ic_init_values(NabiIC *ic)
     ic->mode = nabi_server->default_input_mode;
 
     /* preedit attr */
-    ic->preedit.str = ustring_new();
-    ic->preedit.window = NULL;
     ic->preedit.width = 1;	/* minimum window size is 1 x 1 */
     ic->preedit.height = 1;	/* minimum window size is 1 x 1 */
     ic->preedit.area.x = 0;
@@ -308,14 +460,13 @@ nabi_ic_init_values(NabiIC *ic)
     ic->preedit.spot.x = 0;
     ic->preedit.spot.y = 0;
     ic->preedit.cmap = 0;
-    ic->preedit.normal_gc = NULL;
-    ic->preedit.hilight_gc = NULL;
     ic->preedit.foreground = nabi_server->preedit_fg.pixel;
     ic->preedit.background = nabi_server->preedit_bg.pixel;
     ic->preedit.bg_pixmap = 0;
     ic->preedit.cursor = 0;
     ic->preedit.base_font = NULL;
     ic->preedit.font_set = NULL;
+    ic->preedit.fontset_pending = FALSE;
     ic->preedit.ascent = 0;
     ic->preedit.descent = 0;
     ic->preedit.line_space = 0;
@@ -325,6 +476,8 @@ nabi_ic_init_values(NabiIC *ic)
     ic->preedit.has_start_cb = FALSE;
     ic->preedit.has_draw_cb = FALSE;
     ic->preedit.has_done_cb = FALSE;
+    ic->preedit.has_colors = FALSE;
+    ic->preedit.backing_valid = FALSE;
 
     /* status attributes */
     ic->status.area.x = 0;
@@ -347,8 +500,10 @@ nabi_ic_init_values(NabiIC *ic)
     ic->status.base_font = NULL;
 
     ic->candidate = NULL;
+    ic->candidate_serial = 0;
 
     ic->toplevel = NULL;
+    ic->toplevel_query = 0;
 
     ic->composing_started = FALSE;
 
@@ -356,11 +511,8 @@ nabi_ic_init_values(NabiIC *ic)
     ic->wait_for_client_text = FALSE;
     ic->has_str_conv_cb = FALSE;
 
-    ic->hic = hangul_ic_new(nabi_server->hangul_keyboard);
-    hangul_ic_connect_callback(ic->hic, "translate",
-			       nabi_ic_hic_on_translate, ic);
-    hangul_ic_connect_callback(ic->hic, "transition",
-			       nabi_ic_hic_on_transition, ic);
+    ic->has_focus = FALSE;
+    g_get_current_time(&ic->unfocus_time);
 }
 
 NabiIC*
@@ -370,18 +522,31 @@ nabi_ic_create(NabiConnection* conn, IMChangeICStruct *data)
 
     ic->connection = conn;
 
+    /* resources kept while the ic is recycled,
+     * hic, preedit window and gc are made when they are needed */
+    nabi_engine_init(&ic->engine, &nabi_server->engine_config,
+		     &nabi_ic_engine_sink, ic);
+    ic->preedit.window = NULL;
+    ic->preedit.normal_gc = NULL;
+    ic->preedit.hilight_gc = NULL;
+    ic->preedit.pango_context = NULL;
+    ic->preedit.normal_layout = NULL;
+    ic->preedit.hilight_layout = NULL;
+    ic->preedit.font_serial = 0;
+    ic->preedit.backing = NULL;
+    ic->preedit.backing_width = 0;
+    ic->preedit.backing_height = 0;
+
     nabi_ic_init_values(ic);
     nabi_ic_set_values(ic, data);
 
     return ic;
 }
 
-void
-nabi_ic_destroy(NabiIC *ic)
+/* free the values given by the client */
+static void
+nabi_ic_release_values(NabiIC *ic)
 {
-    if (ic == NULL)
-	return;
-
     nabi_free(ic->resource_name);
     ic->resource_name = NULL;
     nabi_free(ic->resource_class);
@@ -389,56 +554,228 @@ nabi_ic_destroy(NabiIC *ic)
     nabi_free(ic->preedit.base_font);
     ic->preedit.base_font = NULL;
     nabi_free(ic->status.base_font);
+    ic->status.base_font = NULL;
 
-    /* destroy preedit string */
-    if (ic->preedit.str != NULL) {
-	g_array_free(ic->preedit.str, TRUE);
-	ic->preedit.str = NULL;
-    }
-
-    /* destroy preedit window */
-    if (ic->preedit.window != NULL)
-	gdk_window_destroy(ic->preedit.window);
+    /* destroy fontset, a fontset still loading is left to the loader */
+    ic->preedit.fontset_pending = FALSE;
 
-    /* destroy fontset */
     if (ic->preedit.font_set != NULL) {
 	nabi_fontset_free(nabi_server->display, ic->preedit.font_set);
 	ic->preedit.font_set = NULL;
     }
 
-    if (ic->preedit.normal_gc != NULL) {
-	g_object_unref(G_OBJECT(ic->preedit.normal_gc));
-	ic->preedit.normal_gc = NULL;
-    }
-
-    if (ic->preedit.hilight_gc != NULL) {
-	g_object_unref(G_OBJECT(ic->preedit.hilight_gc));
-	ic->preedit.hilight_gc = NULL;
-    }
-
     if (ic->candidate != NULL) {
 	nabi_candidate_delete(ic->candidate);
 	ic->candidate = NULL;
     }
+    ic->candidate_serial = 0;
 
     if (ic->client_text != NULL) {
 	g_array_free(ic->client_text, TRUE);
 	ic->client_text = NULL;
     }
 
+    if (ic->toplevel_query != 0) {
+	nabi_window_cache_cancel(ic->toplevel_query);
+	ic->toplevel_query = 0;
+    }
+
     if (ic->toplevel != NULL) {
 	nabi_toplevel_unref(ic->toplevel);
 	ic->toplevel = NULL;
     }
+}
 
-    if (ic->hic != NULL) {
-	hangul_ic_delete(ic->hic);
-	ic->hic = NULL;
-    }
+void
+nabi_ic_destroy(NabiIC *ic)
+{
+    if (ic == NULL)
+	return;
+
+    nabi_ic_release_values(ic);
+
+    /* destroy preedit string and hic */
+    nabi_engine_clear(&ic->engine);
+
+    /* destroy preedit window */
+    if (ic->preedit.window != NULL)
+	gdk_window_destroy(ic->preedit.window);
+    nabi_ic_preedit_free_backing(ic);
+
+    nabi_ic_preedit_release_gcs(ic);
+
+    nabi_ic_preedit_free_render_cache(ic);
 
     g_free(ic);
 }
 
+static Window
+nabi_ic_get_preedit_parent(NabiIC *ic)
+{
+    if (ic->focus_window != 0)
+	return ic->focus_window;
+    return ic->client_window;
+}
+
+/* keep the resources, drop the state of the destroyed ic */
+static void
+nabi_ic_recycle(NabiIC *ic)
+{
+    nabi_ic_release_values(ic);
+
+    nabi_engine_reset(&ic->engine);
+    nabi_ic_preedit_hide(ic);
+
+    g_get_current_time(&ic->recycled_time);
+
+    nabi_log(3, "recycle ic: %d-%d\n", ic->connection->id, ic->id);
+}
+
+static void
+nabi_ic_reuse(NabiIC *ic, CARD16 id, IMChangeICStruct *data)
+{
+    Window old_parent = nabi_ic_get_preedit_parent(ic);
+    CARD16 old_id = ic->id;
+
+    nabi_log(3, "reuse ic: %d-%d as %d-%d\n",
+	     ic->connection->id, old_id, ic->connection->id, id);
+
+    ic->id = id;
+    nabi_ic_init_values(ic);
+    nabi_ic_set_values(ic, data);
+
+    if (ic->preedit.window != NULL) {
+	guint connect_id = ic->connection->id;
+
+	gdk_window_remove_filter(ic->preedit.window, gdk_event_filter,
+				 GUINT_TO_POINTER(connect_id << 16 | old_id));
+
+	/* preedit window is a child of the focus window,
+	 * it can't be used under another one */
+	if (nabi_ic_get_preedit_parent(ic) != old_parent) {
+	    gdk_window_destroy(ic->preedit.window);
+	    ic->preedit.window = NULL;
+	    nabi_ic_preedit_free_backing(ic);
+	} else {
+	    GdkColor bg = { ic->preedit.background, 0, 0, 0 };
+
+	    gdk_window_set_background(ic->preedit.window, &bg);
+	    nabi_ic_preedit_update_gcs(ic);
+	    ic->preedit.backing_valid = FALSE;
+
+	    gdk_window_add_filter(ic->preedit.window, gdk_event_filter,
+				  GUINT_TO_POINTER(connect_id << 16 | id));
+	}
+    }
+}
+
+/* ic가 focus를 잃은지 timeout초가 지났으면 preedit window, gc, fontset,
+ * HangulInputContext를 해제한다. 필요하면 다시 만든다. */
+gboolean
+nabi_ic_reclaim_idle(NabiIC *ic, const GTimeVal *now, int timeout)
+{
+    gboolean released = FALSE;
+
+    if (ic->has_focus || ic->candidate != NULL)
+	return FALSE;
+
+    if (!nabi_ic_is_empty(ic) || ustring_length(ic->engine.str) > 0)
+	return FALSE;
+
+    if (now->tv_sec - ic->unfocus_time.tv_sec < timeout)
+	return FALSE;
+
+    if (ic->preedit.window != NULL) {
+	gdk_window_destroy(ic->preedit.window);
+	ic->preedit.window = NULL;
+	ic->preedit.start = False;
+	released = TRUE;
+    }
+
+    if (ic->preedit.backing != NULL) {
+	nabi_ic_preedit_free_backing(ic);
+	released = TRUE;
+    }
+
+    if (ic->preedit.normal_gc != NULL || ic->preedit.hilight_gc != NULL) {
+	nabi_ic_preedit_release_gcs(ic);
+	released = TRUE;
+    }
+
+    if (ic->preedit.pango_context != NULL) {
+	nabi_ic_preedit_free_render_cache(ic);
+	released = TRUE;
+    }
+
+    /* base_font is kept to create the fontset again */
+    ic->preedit.fontset_pending = FALSE;
+
+    if (ic->preedit.font_set != NULL) {
+	nabi_fontset_free(nabi_server->display, ic->preedit.font_set);
+	ic->preedit.font_set = NULL;
+	released = TRUE;
+    }
+
+    if (nabi_engine_release_hic(&ic->engine))
+	released = TRUE;
+
+    if (released)
+	nabi_log(4, "reclaim idle ic: %d-%d\n", ic->connection->id, ic->id);
+
+    return released;
+}
+
+/* adds the resources of the ic to usage.
+ * heap is approximate: libhangul internals are not counted, and pango
+ * objects are counted by number because their size is not known */
+void
+nabi_ic_add_memory_usage(NabiIC *ic, NabiICMemory *usage)
+{
+    gsize size = sizeof(NabiIC);
+
+    if (ic->resource_name != NULL)
+	size += strlen(ic->resource_name) + 1;
+    if (ic->resource_class != NULL)
+	size += strlen(ic->resource_class) + 1;
+    if (ic->preedit.base_font != NULL)
+	size += strlen(ic->preedit.base_font) + 1;
+    if (ic->status.base_font != NULL)
+	size += strlen(ic->status.base_font) + 1;
+
+    if (ic->engine.str != NULL)
+	size += sizeof(GArray) + ic->engine.str->len * sizeof(ucschar);
+    if (ic->client_text != NULL)
+	size += sizeof(GArray) + ic->client_text->len * sizeof(ucschar);
+
+    usage->heap += size;
+
+    if (ic->preedit.window != NULL)
+	usage->windows++;
+
+    if (ic->preedit.backing != NULL) {
+	int depth = gdk_drawable_get_depth(ic->preedit.backing);
+	/* 24 bit 픽스맵도 서버에서는 픽셀당 4 바이트를 쓴다 */
+	int bytes_per_pixel = depth > 16 ? 4 : (depth + 7) / 8;
+
+	usage->pixmaps++;
+	usage->pixmap_bytes += (gsize)ic->preedit.backing_width *
+			       ic->preedit.backing_height * bytes_per_pixel;
+    }
+
+    if (ic->preedit.normal_gc != NULL)
+	usage->gcs++;
+    if (ic->preedit.hilight_gc != NULL)
+	usage->gcs++;
+    if (ic->preedit.font_set != NULL)
+	usage->fontsets++;
+    if (ic->preedit.pango_context != NULL)
+	usage->pango_contexts++;
+    if (ic->preedit.normal_layout != NULL)
+	usage->pango_layouts++;
+    if (ic->preedit.hilight_layout != NULL)
+	usage->pango_layouts++;
+}
+
 CARD16
 nabi_ic_get_id(NabiIC* ic)
 {
@@ -448,87 +785,251 @@ nabi_ic_get_id(NabiIC* ic)
     return ic->id;
 }
 
+static HangulInputContext*
+nabi_ic_get_hic(NabiIC *ic)
+{
+    return nabi_engine_get_hic(&ic->engine);
+}
+
 Bool
 nabi_ic_is_empty(NabiIC *ic)
 {
-    if (ic == NULL || ic->hic == NULL)
+    if (ic == NULL)
 	return True;
 
-    return hangul_ic_is_empty(ic->hic);
+    return nabi_engine_is_empty(&ic->engine);
 }
 
 void
 nabi_ic_set_hangul_keyboard(NabiIC *ic, const char* hangul_keyboard)
 {
-    if (ic == NULL || ic->hic == NULL)
+    if (ic == NULL)
 	return;
 
-    hangul_ic_select_keyboard(ic->hic, hangul_keyboard);
+    nabi_engine_select_keyboard(&ic->engine, hangul_keyboard);
+}
 
-    if (nabi_server->output_mode == NABI_OUTPUT_JAMO) {
-	hangul_ic_set_output_mode(ic->hic, HANGUL_OUTPUT_JAMO);
-    } else {
-	hangul_ic_set_output_mode(ic->hic, HANGUL_OUTPUT_SYLLABLE);
-    }
+static void
+nabi_ic_engine_on_commit(NabiEngine* engine, const char* str, gpointer data)
+{
+    nabi_ic_commit_utf8((NabiIC*)data, str);
 }
 
 static void
-nabi_ic_hic_on_translate(HangulInputContext* hic,
-                         int ascii, ucschar* c, void* data)
+nabi_ic_engine_on_flush(NabiEngine* engine, gpointer data)
 {
-    nabi_server_log_key(nabi_server, *c, 0);
+    nabi_ic_flush((NabiIC*)data);
 }
 
-static bool
-nabi_ic_hic_on_transition(HangulInputContext* hic,
-			  ucschar c, const ucschar* preedit, void* data)
+static gboolean
+nabi_ic_engine_is_valid(NabiEngine* engine, const char* str, gpointer data)
 {
-    bool ret = true;
     NabiIC* ic = (NabiIC*)data;
+    return nabi_connection_is_valid_str(ic->connection, str);
+}
 
-    if (!nabi_server->auto_reorder) {
-	if (hangul_is_choseong(c)) {
-	    if (hangul_ic_has_jungseong(hic) || hangul_ic_has_jongseong(hic)) {
-		return false;
-	    }
-	}
+static void
+nabi_ic_engine_on_translate(NabiEngine* engine, ucschar c, gpointer data)
+{
+    nabi_server_log_key(nabi_server, c, 0);
+}
 
-	if (hangul_is_jungseong(c)) {
-	    if (hangul_ic_has_jongseong(hic)) {
-		return false;
-	    }
+static void
+nabi_ic_preedit_free_render_cache(NabiIC *ic)
+{
+    if (ic->preedit.normal_layout != NULL) {
+	g_object_unref(G_OBJECT(ic->preedit.normal_layout));
+	ic->preedit.normal_layout = NULL;
+    }
+
+    if (ic->preedit.hilight_layout != NULL) {
+	g_object_unref(G_OBJECT(ic->preedit.hilight_layout));
+	ic->preedit.hilight_layout = NULL;
+    }
+
+    if (ic->preedit.pango_context != NULL) {
+	g_object_unref(G_OBJECT(ic->preedit.pango_context));
+	ic->preedit.pango_context = NULL;
+    }
+
+    ic->preedit.has_colors = FALSE;
+}
+
+/* pango context, layouts, font metrics and colors are kept in the ic
+ * and made again only when the preedit font or the ic colors change */
+static void
+nabi_ic_preedit_update_render_cache(NabiIC *ic)
+{
+    if (ic->preedit.pango_context != NULL &&
+	ic->preedit.font_serial != nabi_server->preedit_font_serial)
+	nabi_ic_preedit_free_render_cache(ic);
+
+    if (ic->preedit.pango_context == NULL) {
+	GdkScreen* screen;
+	PangoContext* context;
+	PangoFontMetrics* metrics;
+	PangoLanguage* language;
+
+	screen = gdk_drawable_get_screen(ic->preedit.window);
+	context = gdk_pango_context_get_for_screen(screen);
+	language = pango_language_from_string("ko");
+
+	pango_context_set_font_description(context, nabi_server->preedit_font);
+	pango_context_set_base_dir(context, PANGO_DIRECTION_LTR);
+	pango_context_set_language(context, language);
+
+	metrics = pango_context_get_metrics(context,
+					    nabi_server->preedit_font,
+					    language);
+	ic->preedit.pango_ascent =
+			PANGO_PIXELS(pango_font_metrics_get_ascent(metrics));
+	pango_font_metrics_unref(metrics);
+
+	ic->preedit.pango_context = context;
+	ic->preedit.normal_layout = pango_layout_new(context);
+	ic->preedit.hilight_layout = pango_layout_new(context);
+	ic->preedit.font_serial = nabi_server->preedit_font_serial;
+    }
+
+    if (!ic->preedit.has_colors) {
+	GdkColormap* colormap;
+
+	ic->preedit.fg_color = nabi_server->preedit_fg;
+	ic->preedit.bg_color = nabi_server->preedit_bg;
+	colormap = gdk_drawable_get_colormap(ic->preedit.window);
+	if (colormap != NULL) {
+	    gdk_colormap_query_color(colormap, ic->preedit.foreground,
+				     &ic->preedit.fg_color);
+	    gdk_colormap_query_color(colormap, ic->preedit.background,
+				     &ic->preedit.bg_color);
 	}
+	ic->preedit.has_colors = TRUE;
     }
+}
 
-    if (ic != NULL) {
-	char* utf8 = g_ucs4_to_utf8((const gunichar*)preedit, -1, NULL, NULL, NULL);
-	ret = nabi_connection_is_valid_str(ic->connection, utf8);
-	nabi_log(6, "on translation: %s: %s\n", utf8, ret ? "true" : "false");
-	g_free(utf8);
+static void
+nabi_ic_preedit_release_gcs(NabiIC *ic)
+{
+    nabi_gc_cache_release(ic->preedit.normal_gc);
+    ic->preedit.normal_gc = NULL;
+    nabi_gc_cache_release(ic->preedit.hilight_gc);
+    ic->preedit.hilight_gc = NULL;
+}
+
+/* the gcs are shared with other ics, so they are replaced
+ * instead of changing their colors */
+static void
+nabi_ic_preedit_update_gcs(NabiIC *ic)
+{
+    nabi_ic_preedit_release_gcs(ic);
+
+    ic->preedit.normal_gc = nabi_gc_cache_get(ic->preedit.window,
+					      ic->preedit.foreground,
+					      ic->preedit.background);
+    ic->preedit.hilight_gc = nabi_gc_cache_get(ic->preedit.window,
+					       ic->preedit.background,
+					       ic->preedit.foreground);
+}
+
+static void
+nabi_ic_preedit_free_backing(NabiIC *ic)
+{
+    if (ic->preedit.backing != NULL) {
+	g_object_unref(G_OBJECT(ic->preedit.backing));
+	ic->preedit.backing = NULL;
     }
+    ic->preedit.backing_width = 0;
+    ic->preedit.backing_height = 0;
+    ic->preedit.backing_valid = FALSE;
+}
 
-    return ret;
+/* returns the backing pixmap cleared to the size of the preedit window,
+ * the drawing functions render to this and call
+ * nabi_ic_preedit_end_draw() to show it */
+static GdkDrawable*
+nabi_ic_preedit_begin_draw(NabiIC *ic)
+{
+    int w = MAX(ic->preedit.width, 1);
+    int h = MAX(ic->preedit.height, 1);
+
+    if (ic->preedit.backing != NULL &&
+	(ic->preedit.backing_width < w || ic->preedit.backing_height < h))
+	nabi_ic_preedit_free_backing(ic);
+
+    if (ic->preedit.backing == NULL) {
+	/* some room for next syllables not to make it on every key */
+	ic->preedit.backing_width = (w + 63) & ~63;
+	ic->preedit.backing_height = h;
+	ic->preedit.backing = gdk_pixmap_new(ic->preedit.window,
+					     ic->preedit.backing_width,
+					     ic->preedit.backing_height, -1);
+    }
+
+    /* foreground of hilight gc is the preedit background */
+    gdk_draw_rectangle(ic->preedit.backing, ic->preedit.hilight_gc, TRUE,
+		       0, 0, w, h);
+    ic->preedit.backing_valid = FALSE;
+
+    return ic->preedit.backing;
 }
 
-static PangoLayout*
-nabi_ic_create_pango_layout(NabiIC *ic, const char* text)
+static void
+nabi_ic_preedit_end_draw(NabiIC *ic)
 {
-    GdkScreen* screen;
-    PangoContext* context;
-    PangoLayout* layout;
+    gdk_draw_drawable(ic->preedit.window, ic->preedit.normal_gc,
+		      ic->preedit.backing, 0, 0, 0, 0,
+		      MAX(ic->preedit.width, 1), MAX(ic->preedit.height, 1));
+    ic->preedit.backing_valid = TRUE;
+}
+
+/* draw preedit by copying pre-rendered glyphs,
+ * returns FALSE if the atlas does not have all the glyphs */
+static gboolean
+nabi_ic_preedit_atlas_draw_string(NabiIC *ic, char* normal, char* hilight)
+{
+    NabiGlyphAtlas *normal_atlas;
+    NabiGlyphAtlas *hilight_atlas;
+    GdkDrawable *drawable;
+    int normal_w = 0;
+    int hilight_w = 0;
+    int h;
+
+    normal_atlas = nabi_glyph_atlas_get(ic->preedit.window,
+					nabi_server->preedit_font,
+					nabi_server->preedit_font_serial,
+					&ic->preedit.fg_color,
+					&ic->preedit.bg_color);
+    if (!nabi_glyph_atlas_measure(normal_atlas, normal, &normal_w))
+	return FALSE;
+
+    hilight_atlas = nabi_glyph_atlas_get(ic->preedit.window,
+					 nabi_server->preedit_font,
+					 nabi_server->preedit_font_serial,
+					 &ic->preedit.bg_color,
+					 &ic->preedit.fg_color);
+    if (!nabi_glyph_atlas_measure(hilight_atlas, hilight, &hilight_w))
+	return FALSE;
+
+    h = nabi_glyph_atlas_get_height(normal_atlas);
+    ic->preedit.ascent = nabi_glyph_atlas_get_ascent(normal_atlas);
+    ic->preedit.descent = h - ic->preedit.ascent;
+
+    ic->preedit.width = normal_w + hilight_w + 3;
+    ic->preedit.height = h + 3;
+    nabi_ic_preedit_configure(ic);
+
+    drawable = nabi_ic_preedit_begin_draw(ic);
 
-    screen = gdk_drawable_get_screen(ic->preedit.window);
-    context = gdk_pango_context_get_for_screen(screen);
+    nabi_glyph_atlas_draw(normal_atlas, drawable, 1, 1, normal);
+    nabi_glyph_atlas_draw(hilight_atlas, drawable, 1 + normal_w, 1, hilight);
 
-    pango_context_set_font_description(context, nabi_server->preedit_font);
-    pango_context_set_base_dir(context, PANGO_DIRECTION_LTR);
-    pango_context_set_language(context, pango_language_from_string("ko"));
+    if (normal_w > 0)
+	gdk_draw_line(drawable, ic->preedit.normal_gc,
+		      1, h, 1 + normal_w + hilight_w, h);
 
-    layout = pango_layout_new(context);
-    if (text != NULL)
-	pango_layout_set_text(layout, text, -1);
+    nabi_ic_preedit_end_draw(ic);
 
-    return layout;
+    return TRUE;
 }
 
 static void
@@ -537,65 +1038,73 @@ nabi_ic_preedit_gdk_draw_string(NabiIC *ic, char *preedit,
 {
     GdkGC *normal_gc;
     GdkGC *hilight_gc;
-    PangoContext *context;
-    const PangoFontDescription *desc;
-    PangoFontMetrics *metrics;
-    int ascent;
     PangoLayout *normal_l;
     PangoLayout *hilight_l;
     PangoRectangle normal_r = { 0, 0, 12, 12 };
     PangoRectangle hilight_r = { 0, 0, 12, 12 };
-    GdkColor fg, bg;
-    GdkColormap* colormap;
+    GdkColor *fg, *bg;
+    GdkDrawable *drawable;
+    GTimer *timer = NULL;
 
     if (ic->preedit.window == NULL)
 	return;
 
+    if (nabi_log_get_level() >= 5)
+	timer = g_timer_new();
+
+    nabi_ic_preedit_update_render_cache(ic);
+
+    if (nabi_server->use_glyph_atlas &&
+	nabi_ic_preedit_atlas_draw_string(ic, normal, hilight)) {
+	if (timer != NULL) {
+	    nabi_log(5, "preedit draw (atlas): %.3f ms\n",
+		     g_timer_elapsed(timer, NULL) * 1000.0);
+	    g_timer_destroy(timer);
+	}
+	return;
+    }
+
     normal_gc = ic->preedit.normal_gc;
     hilight_gc = ic->preedit.hilight_gc;
 
-    normal_l = nabi_ic_create_pango_layout(ic, normal);
+    normal_l = ic->preedit.normal_layout;
+    pango_layout_set_text(normal_l, normal, -1);
     pango_layout_get_pixel_extents(normal_l, NULL, &normal_r);
 
-    hilight_l = nabi_ic_create_pango_layout(ic, hilight);
+    hilight_l = ic->preedit.hilight_layout;
+    pango_layout_set_text(hilight_l, hilight, -1);
     pango_layout_get_pixel_extents(hilight_l, NULL, &hilight_r);
 
-    fg = nabi_server->preedit_fg;
-    bg = nabi_server->preedit_bg;
-    colormap = gdk_drawable_get_colormap(ic->preedit.window);
-    if (colormap != NULL) {
-	gdk_colormap_query_color(colormap, ic->preedit.foreground, &fg);
-	gdk_colormap_query_color(colormap, ic->preedit.background, &bg);
-    }
-
-    context = pango_layout_get_context(hilight_l);
-    desc = pango_layout_get_font_description(hilight_l);
-    metrics = pango_context_get_metrics(context, desc,
-				 pango_language_from_string("ko"));
+    fg = &ic->preedit.fg_color;
+    bg = &ic->preedit.bg_color;
 
-    ascent = pango_font_metrics_get_ascent(metrics);
-    ic->preedit.ascent = PANGO_PIXELS(ascent);
+    ic->preedit.ascent = ic->preedit.pango_ascent;
     ic->preedit.descent = normal_r.height - ic->preedit.ascent;
 
     ic->preedit.width = normal_r.width + hilight_r.height + 3;
     ic->preedit.height = MAX(normal_r.height, hilight_r.height) + 3;
     nabi_ic_preedit_configure(ic);
 
-    gdk_window_clear(ic->preedit.window);
+    drawable = nabi_ic_preedit_begin_draw(ic);
 
-    gdk_draw_layout_with_colors(ic->preedit.window, normal_gc,
-				1, 1, normal_l, &fg, &bg);
-    gdk_draw_layout_with_colors(ic->preedit.window, hilight_gc,
-				1 + normal_r.width, 1, hilight_l, &bg, &fg);
+    gdk_draw_layout_with_colors(drawable, normal_gc,
+				1, 1, normal_l, fg, bg);
+    gdk_draw_layout_with_colors(drawable, hilight_gc,
+				1 + normal_r.width, 1, hilight_l, bg, fg);
 
     if (normal_r.width > 0) {
 	int w = normal_r.width + hilight_r.width;
 	int h = MAX(normal_r.height, hilight_r.height);
-	gdk_draw_line(ic->preedit.window, normal_gc, 1, h, 1 + w, h);
+	gdk_draw_line(drawable, normal_gc, 1, h, 1 + w, h);
     }
 
-    g_object_unref(G_OBJECT(normal_l));
-    g_object_unref(G_OBJECT(hilight_l));
+    nabi_ic_preedit_end_draw(ic);
+
+    if (timer != NULL) {
+	nabi_log(5, "preedit draw (pango): %.3f ms\n",
+		 g_timer_elapsed(timer, NULL) * 1000.0);
+	g_timer_destroy(timer);
+    }
 }
 
 static void
@@ -621,7 +1130,6 @@ nabi_ic_preedit_x11_draw_string(NabiIC *ic, char* preedit,
     if (ic->preedit.font_set == 0)
 	return;
 
-    drawable = GDK_WINDOW_XWINDOW(ic->preedit.window);
     normal_gc = gdk_x11_gc_get_xgc(ic->preedit.normal_gc);
     hilight_gc = gdk_x11_gc_get_xgc(ic->preedit.hilight_gc);
     fontset = ic->preedit.font_set;
@@ -649,6 +1157,8 @@ nabi_ic_preedit_x11_draw_string(NabiIC *ic, char* preedit,
 
     nabi_ic_preedit_configure(ic);
 
+    drawable = GDK_PIXMAP_XID(nabi_ic_preedit_begin_draw(ic));
+
     if (normal_size > 0) {
 	int x = 0;
 	int offset;
@@ -674,6 +1184,8 @@ nabi_ic_preedit_x11_draw_string(NabiIC *ic, char* preedit,
 			   preedit_mb, preedit_size);
     }
 
+    nabi_ic_preedit_end_draw(ic);
+
     g_free(preedit_mb);
     g_free(normal_mb);
     g_free(hilight_mb);
@@ -686,8 +1198,7 @@ nabi_ic_preedit_draw(NabiIC *ic)
     char* normal;
     char* hilight;
 
-    normal = ustring_to_utf8(ic->preedit.str, -1);
-    hilight = nabi_ic_get_hic_preedit_string(ic);
+    nabi_engine_get_preedit(&ic->engine, &normal, &hilight);
     preedit = g_strconcat(normal, hilight, NULL);
 
     if (ic->input_style & XIMPreeditPosition) {
@@ -707,6 +1218,31 @@ nabi_ic_preedit_draw(NabiIC *ic)
     g_free(hilight);
 }
 
+/* the preedit text is drawn to the backing pixmap when it changes,
+ * so Expose needs only a copy of the exposed area */
+static void
+nabi_ic_preedit_expose(NabiIC *ic, XExposeEvent *event)
+{
+    int w, h;
+
+    if (!ic->preedit.backing_valid ||
+	(ic->preedit.pango_context != NULL &&
+	 ic->preedit.font_serial != nabi_server->preedit_font_serial)) {
+	if (event->count == 0)
+	    nabi_ic_preedit_draw(ic);
+	return;
+    }
+
+    w = MIN(event->x + event->width, ic->preedit.backing_width) - event->x;
+    h = MIN(event->y + event->height, ic->preedit.backing_height) - event->y;
+    if (w <= 0 || h <= 0)
+	return;
+
+    gdk_draw_drawable(ic->preedit.window, ic->preedit.normal_gc,
+		      ic->preedit.backing, event->x, event->y,
+		      event->x, event->y, w, h);
+}
+
 /* map preedit window */
 static void
 nabi_ic_preedit_show(NabiIC *ic)
@@ -795,11 +1331,11 @@ gdk_event_filter(GdkXEvent *xevent, GdkEvent *gevent, gpointer data)
     case DestroyNotify:
 	/* preedit window is destroyed, so we set it 0 */
 	ic->preedit.window = NULL;
+	nabi_ic_preedit_free_backing(ic);
 	return GDK_FILTER_REMOVE;
 	break;
     case Expose:
-	//g_print("Redraw Window\n");
-	nabi_ic_preedit_draw(ic);
+	nabi_ic_preedit_expose(ic, &event->xexpose);
 	break;
     default:
 	//g_print("event type: %d\n", event->type);
@@ -817,9 +1353,14 @@ nabi_ic_preedit_window_new(NabiIC *ic)
     gint mask;
     guint connect_id;
     guint ic_id;
-    GdkColor fg = { 0, 0, 0, 0 };
     GdkColor bg = { 0, 0, 0, 0 };
 
+    /* replay에는 display가 없으므로 preedit window도 없다 */
+    if (nabi_server->display == NULL)
+	return;
+
+    nabi_ic_preedit_create_fontset(ic);
+
     if (ic->focus_window != 0)
 	parent = gdk_window_foreign_new(ic->focus_window);
     else if (ic->client_window != 0)
@@ -841,23 +1382,10 @@ nabi_ic_preedit_window_new(NabiIC *ic)
 
     ic->preedit.window = gdk_window_new(parent, &attr, mask);
 
-    fg.pixel = ic->preedit.foreground;
     bg.pixel = ic->preedit.background;
     gdk_window_set_background(ic->preedit.window, &bg);
 
-    if (ic->preedit.normal_gc != NULL)
-	g_object_unref(G_OBJECT(ic->preedit.normal_gc));
-
-    if (ic->preedit.hilight_gc != NULL)
-	g_object_unref(G_OBJECT(ic->preedit.hilight_gc));
-
-    ic->preedit.normal_gc = gdk_gc_new(ic->preedit.window);
-    gdk_gc_set_foreground(ic->preedit.normal_gc, &fg);
-    gdk_gc_set_background(ic->preedit.normal_gc, &bg);
-
-    ic->preedit.hilight_gc = gdk_gc_new(ic->preedit.window);
-    gdk_gc_set_foreground(ic->preedit.hilight_gc, &bg);
-    gdk_gc_set_background(ic->preedit.hilight_gc, &fg);
+    nabi_ic_preedit_update_gcs(ic);
 
     /* install our preedit window event filter */
     connect_id = ic->connection->id;
@@ -868,46 +1396,70 @@ nabi_ic_preedit_window_new(NabiIC *ic)
     g_object_unref(G_OBJECT(parent));
 }
 
+static void
+nabi_ic_set_toplevel(NabiIC* ic, Window w)
+{
+    nabi_log(3, "ic: %d-%d, toplevel: %x\n", ic->id, ic->connection->id, w);
+
+    if (ic->toplevel != NULL)
+	nabi_toplevel_unref(ic->toplevel);
+
+    ic->toplevel = nabi_server_get_toplevel(nabi_server, w);
+
+    /* 새로 만든 toplevel이면 provisional 상태에서 바꾼 입력 모드를
+     * 그대로 이어 받는다. 이미 있던 toplevel이면 그 모드는 다음 focus
+     * 때부터 적용된다. */
+    if (ic->toplevel->ref == 1)
+	ic->toplevel->mode = ic->mode;
+}
+
+/* window cache의 XQueryTree 응답이 오면 불린다. 그동안 main loop는
+ * X 서버를 기다리지 않고 다른 client의 요청을 처리한다. */
+static void
+nabi_ic_on_find_toplevel(Window toplevel, gpointer data)
+{
+    NabiIC* ic = (NabiIC*)data;
+
+    ic->toplevel_query = 0;
+    nabi_ic_set_toplevel(ic, toplevel);
+}
+
 static void
 nabi_ic_set_client_window(NabiIC* ic, Window client_window)
 {
-    Status s;
-    Window w;
-    Window root = None;
-    Window parent = None;
-    Window* children = NULL;
-    unsigned int  nchildren = 0;
+    Window w = None;
 
     ic->client_window = client_window;
-    
-    w = client_window;
-    s = XQueryTree(nabi_server->display, w,
-		   &root, &parent, &children, &nchildren);
-    if (s) {
-	while (parent != root) {
-	    if (children != NULL) {
-		XFree(children);
-		children = NULL;
-	    }
 
-	    w = parent;
-	    s = XQueryTree(nabi_server->display, w,
-			   &root, &parent, &children, &nchildren);
-	    if (!s)
-		break;
-	}
-	if (children != NULL) {
-	    XFree(children);
-	    children = NULL;
-	}
+    if (ic->toplevel_query != 0) {
+	nabi_window_cache_cancel(ic->toplevel_query);
+	ic->toplevel_query = 0;
     }
 
-    nabi_log(3, "ic: %d-%d, toplevel: %x\n", ic->id, ic->connection->id, w);
+    /* replay에서는 X 서버에 물어볼 수 없으므로 client window를
+     * toplevel로 쓴다 */
+    if (nabi_server->display == NULL) {
+	nabi_ic_set_toplevel(ic, client_window);
+	return;
+    }
 
-    if (ic->toplevel != NULL)
+    if (nabi_window_cache_find_toplevel(nabi_server->display,
+					client_window, &w)) {
+	nabi_ic_set_toplevel(ic, w);
+	return;
+    }
+
+    /* toplevel을 알아낼 때까지는 provisional 상태로 ic별 입력 모드를
+     * 쓴다. */
+    if (ic->toplevel != NULL) {
 	nabi_toplevel_unref(ic->toplevel);
+	ic->toplevel = NULL;
+    }
 
-    ic->toplevel = nabi_server_get_toplevel(nabi_server, w);
+    ic->toplevel_query =
+	nabi_window_cache_find_toplevel_async(nabi_server->display,
+					      client_window,
+					      nabi_ic_on_find_toplevel, ic);
 }
 
 static void
@@ -919,37 +1471,116 @@ nabi_ic_set_focus_window(NabiIC *ic, Window focus_window)
 static void
 nabi_ic_set_preedit_foreground(NabiIC *ic, unsigned long foreground)
 {
-    GdkColor color = { foreground, 0, 0, 0 };
-
     ic->preedit.foreground = foreground;
+    ic->preedit.has_colors = FALSE;
+    ic->preedit.backing_valid = FALSE;
 
-    if (ic->preedit.normal_gc != NULL)
-	gdk_gc_set_foreground(ic->preedit.normal_gc, &color);
-    if (ic->preedit.hilight_gc != NULL)
-	gdk_gc_set_background(ic->preedit.hilight_gc, &color);
+    if (ic->preedit.window != NULL)
+	nabi_ic_preedit_update_gcs(ic);
+}
+
+static void
+nabi_ic_set_preedit_background(NabiIC *ic, unsigned long background)
+{
+    GdkColor color = { background, 0, 0, 0 };
+
+    ic->preedit.background = background;
+    ic->preedit.has_colors = FALSE;
+    ic->preedit.backing_valid = FALSE;
+
+    if (ic->preedit.window != NULL) {
+	nabi_ic_preedit_update_gcs(ic);
+	gdk_window_set_background(ic->preedit.window, &color);
+    }
 }
 
-static void
-nabi_ic_set_preedit_background(NabiIC *ic, unsigned long background)
-{
-    GdkColor color = { background, 0, 0, 0 };
+static void
+nabi_ic_preedit_set_fontset(NabiIC *ic, NabiFontSet *fontset)
+{
+    ic->preedit.font_set = fontset->xfontset;
+    ic->preedit.ascent = fontset->ascent;
+    ic->preedit.descent = fontset->descent;
+    ic->preedit.height = ic->preedit.ascent + ic->preedit.descent;
+    ic->preedit.width = 1;
+}
+
+/* the fontset arrives here, on the main thread, every ic waiting for it
+ * takes it */
+static void
+nabi_ic_on_fontset_loaded(const char *fontset_name)
+{
+    GSList *conn_item;
+    GSList *item;
+
+    for (conn_item = nabi_server->connections; conn_item != NULL;
+	 conn_item = g_slist_next(conn_item)) {
+	NabiConnection* conn = (NabiConnection*)conn_item->data;
+
+	for (item = conn->ic_list; item != NULL; item = g_slist_next(item)) {
+	    NabiIC* ic = (NabiIC*)item->data;
+	    NabiFontSet* fontset;
+
+	    if (!ic->preedit.fontset_pending ||
+		strcmp(ic->preedit.base_font, fontset_name) != 0)
+		continue;
+
+	    ic->preedit.fontset_pending = FALSE;
+	    if (ic->preedit.font_set != NULL)
+		continue;
+
+	    fontset = nabi_fontset_lookup(nabi_server->display, fontset_name);
+	    if (fontset == NULL)
+		continue;
+
+	    nabi_ic_preedit_set_fontset(ic, fontset);
+
+	    /* it has been drawn with pango until now */
+	    if (ic->preedit.window != NULL && !nabi_ic_is_empty(ic))
+		nabi_ic_preedit_draw(ic);
+	}
+    }
+}
+
+/* XCreateFontSet() may block for a long time with big CJK bitmap
+ * fonts, so the fontset is made on the loader thread, see fontset.c.
+ * The preedit is drawn with pango until the fontset arrives. */
+static void
+nabi_ic_preedit_create_fontset(NabiIC *ic)
+{
+    NabiFontSet *fontset;
+    int ascent, descent;
+
+    if (ic->preedit.font_set != NULL || ic->preedit.base_font == NULL)
+	return;
+
+    fontset = nabi_fontset_lookup(nabi_server->display, ic->preedit.base_font);
+    if (fontset != NULL) {
+	nabi_ic_preedit_set_fontset(ic, fontset);
+	return;
+    }
 
-    ic->preedit.background = background;
+    if (ic->preedit.fontset_pending)
+	return;
 
-    if (ic->preedit.normal_gc != NULL)
-	gdk_gc_set_background(ic->preedit.normal_gc, &color);
-    if (ic->preedit.hilight_gc != NULL)
-	gdk_gc_set_foreground(ic->preedit.hilight_gc, &color);
+    if (nabi_fontset_get_cached_extents(ic->preedit.base_font,
+					&ascent, &descent)) {
+	ic->preedit.ascent = ascent;
+	ic->preedit.descent = descent;
+	ic->preedit.height = ascent + descent;
+	ic->preedit.width = 1;
+    }
 
-    if (ic->preedit.window != 0)
-	gdk_window_set_background(ic->preedit.window, &color);
+    /* another ic may be waiting for the same fontset already */
+    ic->preedit.fontset_pending = TRUE;
+    nabi_fontset_load(nabi_server->display, ic->preedit.base_font,
+		      nabi_ic_on_fontset_loaded);
 }
 
+/* fontset is created with the preedit window, most ics set the fontset
+ * but never show any preedit string */
 static void
 nabi_ic_load_preedit_fontset(NabiIC *ic, char *font_name)
 {
-    NabiFontSet *fontset;
-
     if (ic->preedit.base_font != NULL &&
 	strcmp(ic->preedit.base_font, font_name) == 0)
 	/* same font, do not create fontset */
@@ -957,18 +1588,14 @@ nabi_ic_load_preedit_fontset(NabiIC *ic, char *font_name)
 
     nabi_free(ic->preedit.base_font);
     ic->preedit.base_font = strdup(font_name);
-    if (ic->preedit.font_set)
+    ic->preedit.fontset_pending = FALSE;
+    if (ic->preedit.font_set) {
 	nabi_fontset_free(nabi_server->display, ic->preedit.font_set);
+	ic->preedit.font_set = NULL;
+    }
 
-    fontset = nabi_fontset_create(nabi_server->display, font_name);
-    if (fontset == NULL)
-	return;
-
-    ic->preedit.font_set = fontset->xfontset;
-    ic->preedit.ascent = fontset->ascent;
-    ic->preedit.descent = fontset->descent;
-    ic->preedit.height = ic->preedit.ascent + ic->preedit.descent;
-    ic->preedit.width = 1;
+    if (ic->preedit.window != NULL)
+	nabi_ic_preedit_create_fontset(ic);
 }
 
 static void
@@ -1241,12 +1868,66 @@ nabi_ic_get_values(NabiIC *ic, IMChangeICStruct *data)
 
 #undef streql
 
+/* replay has no display for XmbTextListToTextProperty(), so the compound
+ * text is made here: ASCII as it is, Latin-1 and KS X 1001 characters in
+ * GR after their designation, '?' for the others */
+static char *utf8_to_compound_text_without_display(const char *utf8)
+{
+    GString *str;
+    const char *p;
+    int designation = 0;	/* of G1: 0 none, 1 Latin-1, 2 KS X 1001 */
+    char *ret;
+
+    str = g_string_new(NULL);
+    for (p = utf8; *p != '\0'; p = g_utf8_next_char(p)) {
+	gunichar c = g_utf8_get_char(p);
+	char buf[6];
+	char *euckr;
+	gsize len;
+
+	if (c < 0x80) {
+	    g_string_append_c(str, c);
+	    continue;
+	}
+
+	if (c >= 0xa0 && c <= 0xff) {
+	    if (designation != 1) {
+		g_string_append(str, "\033-A");
+		designation = 1;
+	    }
+	    g_string_append_c(str, c);
+	    continue;
+	}
+
+	len = g_unichar_to_utf8(c, buf);
+	euckr = g_convert(buf, len, "EUC-KR", "UTF-8", NULL, &len, NULL);
+	if (euckr != NULL && len == 2) {
+	    if (designation != 2) {
+		g_string_append(str, "\033$)C");
+		designation = 2;
+	    }
+	    g_string_append_len(str, euckr, 2);
+	} else {
+	    g_string_append_c(str, '?');
+	}
+	g_free(euckr);
+    }
+
+    /* it is freed with XFree() as the one from Xlib */
+    ret = strdup(str->str);
+    g_string_free(str, TRUE);
+    return ret;
+}
+
 static char *utf8_to_compound_text(const char *utf8)
 {
     char *list[2];
     XTextProperty tp;
     int ret;
 
+    if (nabi_server->display == NULL)
+	return utf8_to_compound_text_without_display(utf8);
+
     list[0] = g_locale_from_utf8(utf8, -1, NULL, NULL, NULL);
     list[1] = 0;
     ret = XmbTextListToTextProperty(nabi_server->display, list, 1,
@@ -1262,7 +1943,7 @@ static char *utf8_to_compound_text(const char *utf8)
 void
 nabi_ic_reset(NabiIC *ic, IMResetICStruct *data)
 {
-    char* preedit = nabi_ic_get_flush_string(ic);
+    char* preedit = nabi_engine_take_flush_string(&ic->engine);
     if (preedit != NULL && strlen(preedit) > 0) {
 	char* compound_text = utf8_to_compound_text(preedit);
 	data->commit_string = compound_text;
@@ -1273,7 +1954,6 @@ nabi_ic_reset(NabiIC *ic, IMResetICStruct *data)
     }
     g_free(preedit);
 
-    ustring_clear(ic->preedit.str);
     ic->preedit.prev_length = 0;
 
     if (ic->input_style & XIMPreeditPosition) {
@@ -1290,6 +1970,8 @@ nabi_ic_set_focus(NabiIC* ic)
 {
     NabiInputMode mode = ic->mode;
 
+    ic->has_focus = TRUE;
+
     switch (nabi_server->input_mode_scope) {
     case NABI_INPUT_MODE_PER_DESKTOP:
 	mode = nabi_server->input_mode;
@@ -1311,6 +1993,15 @@ nabi_ic_set_focus(NabiIC* ic)
     nabi_ic_set_hangul_keyboard(ic, nabi_server->hangul_keyboard);
 }
 
+void
+nabi_ic_unset_focus(NabiIC* ic)
+{
+    ic->has_focus = FALSE;
+    g_get_current_time(&ic->unfocus_time);
+
+    nabi_ic_close_candidate_window(ic);
+}
+
 void
 nabi_ic_set_mode(NabiIC *ic, NabiInputMode mode)
 {
@@ -1468,56 +2159,10 @@ nabi_ic_preedit_done(NabiIC *ic)
     ic->preedit.start = False;
 }
 
-static char*
-nabi_ic_get_hic_preedit_string(NabiIC *ic)
-{
-    const ucschar *str = hangul_ic_get_preedit_string(ic->hic);
-    return g_ucs4_to_utf8((const gunichar*)str, -1, NULL, NULL, NULL);
-}
-
 static char*
 nabi_ic_get_preedit_string(NabiIC *ic)
 {
-    char* preedit;
-    const ucschar* hic_preedit;
-    UString* str;
-
-    str = ustring_new();
-    ustring_append(str, ic->preedit.str);
-
-    hic_preedit = hangul_ic_get_preedit_string(ic->hic);
-    ustring_append_ucs4(str, hic_preedit, -1);
-
-    preedit = ustring_to_utf8(str, str->len);
-    ustring_delete(str);
-
-    return preedit;
-}
-
-static char*
-nabi_ic_get_hic_commit_string(NabiIC *ic)
-{
-    const ucschar *str = hangul_ic_get_commit_string(ic->hic);
-    return g_ucs4_to_utf8((const gunichar*)str, -1, NULL, NULL, NULL);
-}
-
-static char*
-nabi_ic_get_flush_string(NabiIC *ic)
-{
-    char* flushed;
-    const ucschar* hic_flushed;
-    GArray* str;
-
-    str = ustring_new();
-    ustring_append(str, ic->preedit.str);
-
-    hic_flushed = hangul_ic_flush(ic->hic);
-    ustring_append_ucs4(str, hic_flushed, -1);
-
-    flushed = ustring_to_utf8(str, -1);
-    ustring_delete(str);
-
-    return flushed;
+    return nabi_engine_get_preedit_string(&ic->engine);
 }
 
 static inline XIMFeedback *
@@ -1547,19 +2192,20 @@ nabi_ic_preedit_update(NabiIC *ic)
     char* normal;
     char* hilight;
 
-    normal = ustring_to_utf8(ic->preedit.str, -1);
-    hilight = nabi_ic_get_hic_preedit_string(ic);
+    nabi_engine_get_preedit(&ic->engine, &normal, &hilight);
     preedit = g_strconcat(normal, hilight, NULL);
+    NABI_PROBE3(preedit_update, ic->connection->id, ic->id, preedit);
 
     normal_len = g_utf8_strlen(normal, -1);
     hilight_len = g_utf8_strlen(hilight, -1);
     preedit_len = normal_len + hilight_len;
 
+    /* the preedit string has changed, so the result of the pending
+     * candidate lookup is not valid any more */
+    ic->candidate_serial = 0;
+
     if (preedit_len <= 0) {
-	if (ic->candidate != NULL) {
-	    nabi_candidate_delete(ic->candidate);
-	    ic->candidate = NULL;
-	}
+	nabi_ic_close_candidate_window(ic);
 
 	nabi_ic_preedit_clear(ic);
 	g_free(normal);
@@ -1671,6 +2317,7 @@ nabi_ic_commit_utf8(NabiIC *ic, const char *utf8_str)
 {
     IMCommitStruct commit_data;
     char *compound_text;
+    long long start;
 
     /* According to XIM Spec, We should delete preedit string here 
      * befor commiting the string. but it makes too many flickering
@@ -1684,7 +2331,12 @@ nabi_ic_commit_utf8(NabiIC *ic, const char *utf8_str)
 
     nabi_log(1, "commit: id = %d-%d, str = '%s'\n",
 	     ic->connection->id, ic->id, utf8_str);
+    NABI_PROBE3(commit, ic->connection->id, ic->id, utf8_str);
+    NABI_STAT_INC(commits);
+    NABI_STAT_ADD(commit_bytes, strlen(utf8_str));
+    start = nabi_latency_now();
     compound_text = utf8_to_compound_text(utf8_str);
+    nabi_latency_add(NABI_LATENCY_ENCODE, start);
 
     commit_data.major_code = XIM_COMMIT;
     commit_data.minor_code = 0;
@@ -1693,7 +2345,9 @@ nabi_ic_commit_utf8(NabiIC *ic, const char *utf8_str)
     commit_data.flag = XimLookupChars;
     commit_data.commit_string = compound_text;
 
+    start = nabi_latency_now();
     IMCommitString(nabi_server->xims, (XPointer)&commit_data);
+    nabi_latency_add(NABI_LATENCY_SEND, start);
     XFree(compound_text);
 
     /* we delete preedit string here when PreeditPosition */
@@ -1704,38 +2358,17 @@ nabi_ic_commit_utf8(NabiIC *ic, const char *utf8_str)
 Bool
 nabi_ic_commit(NabiIC *ic)
 {
-    if (nabi_server->commit_by_word ||
-	nabi_server->hanja_mode) {
-	const ucschar *str = hangul_ic_get_commit_string(ic->hic);
-
-	ustring_append_ucs4(ic->preedit.str, str, -1);
-
-	if (hangul_ic_is_empty(ic->hic))
-	    nabi_ic_flush(ic);
-    } else {
-	char* str = nabi_ic_get_hic_commit_string(ic);
-	if (str != NULL && strlen(str) > 0)
-	    nabi_ic_commit_utf8(ic, str);
-	g_free(str);
-    }
-
+    nabi_engine_commit(&ic->engine);
     return True;
 }
 
 void
 nabi_ic_flush(NabiIC *ic)
 {
-    char* str;
-
     nabi_ic_preedit_clear(ic);
     nabi_ic_preedit_done(ic);
 
-    str = nabi_ic_get_flush_string(ic);
-    if (str != NULL && strlen(str) > 0)
-	nabi_ic_commit_utf8(ic, str);
-    g_free(str);
-
-    ustring_clear(ic->preedit.str);
+    nabi_engine_flush(&ic->engine);
 }
 
 void
@@ -1846,7 +2479,7 @@ nabi_ic_status_update(NabiIC *ic)
 static Bool
 nabi_ic_candidate_process(NabiIC* ic, KeySym keyval)
 {
-    const Hanja* hanja = NULL;
+    const NabiDictItem* hanja = NULL;
 
     switch (keyval) {
     case XK_Up:
@@ -1866,8 +2499,7 @@ nabi_ic_candidate_process(NabiIC* ic, KeySym keyval)
 	nabi_candidate_next_page(ic->candidate);
 	break;
     case XK_Escape:
-	nabi_candidate_delete(ic->candidate);
-	ic->candidate = NULL;
+	nabi_ic_close_candidate_window(ic);
 	break;
     case XK_Return:
     case XK_KP_Enter:
@@ -2002,37 +2634,20 @@ nabi_ic_delete_client_text(NabiIC* ic, size_t len)
 }
 
 static KeySym
-nabi_ic_normalize_keysym(NabiIC* ic, KeySym keysym, unsigned int state)
+nabi_ic_real_normalize_keysym(KeySym keysym, unsigned int state)
 {
-    KeySym upper, lower;
-    bool need_normalize;
+    NabiKeyboardLayout* layout = NULL;
 
-    /* unicode keysym */
-    if ((keysym & 0xff000000) == 0x01000000)
-	keysym &= 0x00ffffff;
-
-    need_normalize = !hangul_ic_is_transliteration(ic->hic);
-    if (need_normalize) {
-	/* for non-qwerty mapping */
-	if (nabi_server->use_system_keymap && nabi_server->layout != NULL) {
-	    keysym = nabi_keyboard_layout_get_key(nabi_server->layout, keysym);
-	}
-
-	upper = keysym;
-	lower = keysym;
-	XConvertCase(keysym, &lower, &upper);
-
-	if (state & ShiftMask)
-	    keysym = upper;
-	else
-	    keysym = lower;
-    }
+    /* for non-qwerty mapping */
+    if (nabi_server->use_system_keymap)
+	layout = nabi_server->layout;
 
-    return keysym;
+    return nabi_engine_normalize_keysym(layout, keysym, state);
 }
 
-Bool
-nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, unsigned int state)
+static Bool
+nabi_ic_real_process_keyevent(NabiIC* ic, KeySym keysym, KeySym normalized,
+			      unsigned int state)
 {
     Bool ret;
 
@@ -2083,26 +2698,23 @@ nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, unsigned int state)
     nabi_server_log_key(nabi_server, keysym, state);
 
     if (keysym == XK_BackSpace) {
-	ret = hangul_ic_backspace(ic->hic);
+	ret = nabi_engine_backspace(&ic->engine);
 	if (ret)
 	    nabi_ic_preedit_update(ic);
-	else {
-	    guint len = ustring_length(ic->preedit.str);
-	    if (len > 0) {
-		ustring_erase(ic->preedit.str, len - 1, 1);
-		nabi_ic_preedit_update(ic);
-		return True;
-	    }
-	}
 	return ret;
     }
 
-    keysym = nabi_ic_normalize_keysym(ic, keysym, state);
-    if (keysym >= XK_exclam && keysym <= XK_asciitilde) {
-	ret = hangul_ic_process(ic->hic, keysym);
+    if (normalized >= XK_exclam && normalized <= XK_asciitilde) {
+	long long start;
 
-	nabi_ic_commit(ic);
+	start = nabi_latency_now();
+	ret = nabi_engine_feed(&ic->engine, normalized);
+	nabi_latency_add(NABI_LATENCY_PROCESS, start);
+	nabi_engine_commit(&ic->engine);
+
+	start = nabi_latency_now();
 	nabi_ic_preedit_update(ic);
+	nabi_latency_add(NABI_LATENCY_PREEDIT, start);
 
 	if (nabi_server->hanja_mode) {
 	    nabi_ic_update_candidate_window(ic);
@@ -2111,20 +2723,32 @@ nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, unsigned int state)
 	return ret;
     }
 
-    if (nabi_server->hanja_mode) {
-	if (ic->candidate != NULL) {
-	    nabi_candidate_delete(ic->candidate);
-	    ic->candidate = NULL;
-	}
-    }
+    if (nabi_server->hanja_mode)
+	nabi_ic_close_candidate_window(ic);
 
     nabi_ic_flush(ic);
     return False;
 }
 
+/* normalized is the keysym for the engine that nabi_ic_lookup_keysym()
+ * gives with keysym */
+Bool
+nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, KeySym normalized,
+			 unsigned int state)
+{
+    Bool ret;
+
+    NABI_PROBE4(key_begin, ic->connection->id, ic->id, keysym, state);
+    NABI_STAT_INC(keys);
+    ret = nabi_ic_real_process_keyevent(ic, keysym, normalized, state);
+    NABI_PROBE4(key_end, ic->connection->id, ic->id, keysym, ret);
+
+    return ret;
+}
+
 static void
 nabi_ic_candidate_commit_cb(NabiCandidate *candidate,
-			    const Hanja* hanja, gpointer data)
+			    const NabiDictItem* hanja, gpointer data)
 {
     NabiIC *ic;
 
@@ -2137,108 +2761,240 @@ nabi_ic_candidate_commit_cb(NabiCandidate *candidate,
     nabi_ic_update_candidate_window(ic);
 }
 
-static void
+void
 nabi_ic_close_candidate_window(NabiIC* ic)
 {
-    nabi_candidate_delete(ic->candidate);
-    ic->candidate = NULL;
+    ic->candidate_serial = 0;
+
+    if (ic->candidate != NULL) {
+	nabi_candidate_delete(ic->candidate);
+	ic->candidate = NULL;
+    }
 }
 
-static Bool
-nabi_ic_update_candidate_window_with_key(NabiIC *ic, const char* key)
+typedef struct _NabiCandidateQuery NabiCandidateQuery;
+struct _NabiCandidateQuery {
+    /* input: filled on the main thread */
+    CARD16         connect_id;
+    CARD16         icid;
+    guint          serial;
+    char*          label;
+    char*          key;
+    char*          encoding;
+    GTimer*        timer;
+
+    /* its results are filled on the lookup thread */
+    NabiLookup     lookup;
+};
+
+static void
+nabi_candidate_query_free(NabiCandidateQuery* query)
+{
+    nabi_lookup_clear(&query->lookup);
+    g_free(query->label);
+    g_free(query->key);
+    g_free(query->encoding);
+    g_timer_destroy(query->timer);
+    g_free(query);
+}
+
+/* finished queries waiting for the main loop, the lookup threads add
+ * to the list and the idle source takes it. candidate_pending counts the
+ * queries pushed to the threads and not taken by the idle source yet. */
+G_LOCK_DEFINE_STATIC(candidate_results);
+static GSList* candidate_results = NULL;
+static guint candidate_results_source = 0;
+static int candidate_pending = 0;
+
+/* the result of the lookup thread arrives here, on the main thread */
+static void
+nabi_ic_candidate_lookup_done(NabiCandidateQuery* query)
 {
+    NabiIC* ic = NULL;
     Window parent = 0;
-    HanjaList* list;
-    char* p;
-    char* normalized;
-    int valid_list_length = 0;
-    const Hanja **valid_list = NULL;
+    GTimer* timer;
+
+    if (nabi_server != NULL)
+	ic = nabi_server_get_ic(nabi_server, query->connect_id, query->icid);
+
+    if (ic == NULL || ic->candidate_serial != query->serial) {
+	nabi_log(4, "drop stale candidate lookup: id = %d-%d, key = %s\n",
+		 query->connect_id, query->icid, query->key);
+	NABI_PROBE4(candidate_end, query->connect_id, query->icid,
+		    query->serial, -1);
+	NABI_STAT_INC(candidate_stale);
+	nabi_candidate_query_free(query);
+	return;
+    }
+
+    timer = g_timer_new();
+    ic->candidate_serial = 0;
 
     if (ic->focus_window != 0)
 	parent = ic->focus_window;
     else if (ic->client_window != 0)
 	parent = ic->client_window;
 
-    p = strrchr(key, ' ');
-    if (p != NULL)
-	key = p;
-    
-    while (isspace(*key) || ispunct(*key))
-	key++;
-
-    if (key[0] == '\0') {
+    /* replay has no display to show the candidates on */
+    if (query->lookup.valid_list_length > 0 && nabi_server->display != NULL) {
+	if (ic->candidate != NULL) {
+	    nabi_candidate_set_hanja_list(ic->candidate,
+			query->lookup.list, query->lookup.valid_list,
+			query->lookup.valid_list_length);
+	} else {
+	    ic->candidate = nabi_candidate_new(query->label, 9,
+			query->lookup.list, query->lookup.valid_list,
+			query->lookup.valid_list_length,
+			parent, &nabi_ic_candidate_commit_cb, ic);
+	}
+	/* the candidate window owns them now */
+	query->lookup.list = NULL;
+	query->lookup.valid_list = NULL;
+    } else {
 	nabi_ic_close_candidate_window(ic);
-	return True;
     }
 
-    /* candidate 검색을 위한 스트링이 자모형일 수도 있으므로 normalized하여
-     * hanja table에서 검색을 해야 한다. */
-    normalized = g_utf8_normalize(key, -1,
-				  G_NORMALIZE_DEFAULT_COMPOSE);
-    if (normalized == NULL) {
-	nabi_ic_close_candidate_window(ic);
-	return True;
-    }
+    nabi_log(3, "candidate lookup: id = %d-%d, key = %s, %d items, "
+		"latency = %.3fms, main loop = %.3fms\n",
+	     query->connect_id, query->icid, query->key,
+	     query->lookup.valid_list_length,
+	     g_timer_elapsed(query->timer, NULL) * 1000.0,
+	     g_timer_elapsed(timer, NULL) * 1000.0);
+    g_timer_destroy(timer);
 
-    nabi_log(6, "lookup string: %s\n", normalized);
-    if (nabi_server->hanja_mode && ic->client_text == NULL)
-	list = hanja_table_match_prefix(nabi_server->symbol_table, normalized);
-    else if (nabi_server->commit_by_word && ic->client_text == NULL)
-	list = hanja_table_match_prefix(nabi_server->symbol_table, normalized);
-    else
-	list = hanja_table_match_suffix(nabi_server->symbol_table, normalized);
-
-    if (list == NULL) {
-	if (nabi_server->hanja_mode && ic->client_text == NULL)
-	    list = hanja_table_match_prefix(nabi_server->hanja_table,
-					    normalized);
-	else if (nabi_server->commit_by_word && ic->client_text == NULL)
-	    list = hanja_table_match_prefix(nabi_server->hanja_table,
-					    normalized);
-	else
-	    list = hanja_table_match_suffix(nabi_server->hanja_table,
-					    normalized);
-    }
+    NABI_PROBE4(candidate_end, query->connect_id, query->icid,
+		query->serial, query->lookup.valid_list_length);
+    nabi_candidate_query_free(query);
+}
 
-    if (list != NULL) {
-	int i;
-	int n = hanja_list_get_size(list);
+static gboolean
+nabi_ic_on_candidate_results(gpointer data)
+{
+    GSList* results;
+    GSList* item;
 
-	valid_list = g_new(const Hanja*, n);
+    G_LOCK(candidate_results);
+    results = candidate_results;
+    candidate_results = NULL;
+    candidate_results_source = 0;
+    candidate_pending -= g_slist_length(results);
+    G_UNLOCK(candidate_results);
 
-	if (nabi_connection_need_check_charset(ic->connection)) {
-	    int j;
-	    for (i = 0, j = 0; i < n; i++) {
-		const Hanja* hanja = hanja_list_get_nth(list, i);
-		const char* value = hanja_get_value(hanja);
-		if (nabi_connection_is_valid_str(ic->connection, value)) {
-		    valid_list[j] = hanja;
-		    j++;
-		}
-	    }
-	    valid_list_length = j;
-	} else {
-	    for (i = 0; i < n; i++) {
-		valid_list[i] = hanja_list_get_nth(list, i);
-	    }
-	    valid_list_length = n;
-	}
+    for (item = results; item != NULL; item = g_slist_next(item))
+	nabi_ic_candidate_lookup_done(item->data);
+    g_slist_free(results);
+
+    return FALSE;
+}
+
+/* Called when the lookup threads are finished, before the tables are
+ * deleted. The results not delivered yet are dropped. */
+void
+nabi_ic_drop_candidate_results(void)
+{
+    GSList* results;
+    GSList* item;
+
+    G_LOCK(candidate_results);
+    results = candidate_results;
+    candidate_results = NULL;
+    candidate_pending = 0;
+    if (candidate_results_source != 0) {
+	g_source_remove(candidate_results_source);
+	candidate_results_source = 0;
     }
+    G_UNLOCK(candidate_results);
 
-    if (valid_list_length > 0) {
-	if (ic->candidate != NULL) {
-	    nabi_candidate_set_hanja_list(ic->candidate,
-				list, valid_list, valid_list_length);
-	} else {
-	    ic->candidate = nabi_candidate_new(key, 9,
-				list, valid_list, valid_list_length,
-				parent, &nabi_ic_candidate_commit_cb, ic);
-	}
-    } else {
+    for (item = results; item != NULL; item = g_slist_next(item))
+	nabi_candidate_query_free(item->data);
+    g_slist_free(results);
+}
+
+/* whether some work is still running on the worker threads or waiting
+ * for the X server, its result will be posted to the main loop later */
+Bool
+nabi_ic_has_pending_jobs(void)
+{
+    Bool ret;
+
+    G_LOCK(candidate_results);
+    ret = candidate_pending > 0;
+    G_UNLOCK(candidate_results);
+
+    return ret || nabi_fontset_is_loading() ||
+	   nabi_window_cache_has_pending();
+}
+
+/* runs on the lookup thread, it must not touch the ic or any gtk object */
+static void
+nabi_ic_candidate_lookup(gpointer data, gpointer user_data)
+{
+    NabiCandidateQuery* query = data;
+
+    nabi_lookup_run(&query->lookup);
+
+    G_LOCK(candidate_results);
+    candidate_results = g_slist_append(candidate_results, query);
+    if (candidate_results_source == 0)
+	candidate_results_source = g_idle_add(nabi_ic_on_candidate_results,
+					      NULL);
+    G_UNLOCK(candidate_results);
+}
+
+/* The lookup runs on a worker thread, so that the main loop keeps
+ * serving other clients meanwhile. The result is posted back to the main
+ * loop and dropped if the ic has started another lookup or its preedit
+ * string has changed. */
+static Bool
+nabi_ic_update_candidate_window_with_key(NabiIC *ic, const char* key)
+{
+    static guint serial = 0;
+    NabiCandidateQuery* query;
+    const char* label;
+    char* normalized;
+
+    normalized = nabi_lookup_make_key(key, &label);
+    if (normalized == NULL) {
 	nabi_ic_close_candidate_window(ic);
+	return True;
     }
 
-    g_free(normalized);
+    serial++;
+    if (serial == 0)
+	serial++;
+
+    query = g_new0(NabiCandidateQuery, 1);
+    query->connect_id = ic->connection->id;
+    query->icid = ic->id;
+    query->serial = serial;
+    query->label = g_strdup(label);
+    query->key = normalized;
+    query->encoding = g_strdup(ic->connection->encoding);
+    query->lookup.symbol_table = nabi_server->symbol_table;
+    query->lookup.hanja_table = nabi_server->hanja_table;
+    query->lookup.key = query->key;
+    query->lookup.match_prefix = (nabi_server->hanja_mode ||
+				  nabi_server->commit_by_word) &&
+				 ic->client_text == NULL;
+    query->lookup.encoding = query->encoding;
+    query->lookup.use_simplified_chinese =
+				nabi_server->use_simplified_chinese;
+    query->timer = g_timer_new();
+
+    ic->candidate_serial = serial;
+    NABI_PROBE4(candidate_begin, query->connect_id, query->icid,
+		serial, query->key);
+    NABI_STAT_INC(candidate_lookups);
+
+    if (nabi_server->candidate_lookup == NULL)
+	nabi_server->candidate_lookup =
+		g_thread_pool_new(nabi_ic_candidate_lookup, NULL,
+				  1, FALSE, NULL);
+
+    G_LOCK(candidate_results);
+    candidate_pending++;
+    G_UNLOCK(candidate_results);
+    g_thread_pool_push(nabi_server->candidate_lookup, query, NULL);
 
     return True;
 }
@@ -2255,7 +3011,7 @@ nabi_ic_update_candidate_window(NabiIC *ic)
 }
 
 void
-nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
+nabi_ic_insert_candidate(NabiIC *ic, const NabiDictItem* hanja)
 {
     const char* key;
     const char* value;
@@ -2264,11 +3020,11 @@ nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
     if (!nabi_server_is_valid_ic(nabi_server, ic))
 	return;
 
-    value = hanja_get_value(hanja);
+    value = hanja->value;
     if (value == NULL)
 	return;
 
-    key = hanja_get_key(hanja);
+    key = hanja->key;
     if (key != NULL)
 	keylen = g_utf8_strlen(key, -1);
 
@@ -2277,10 +3033,10 @@ nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
 	/* 한자 모드나 단어 단위 입력에서는 prefix 방식으로 매칭하여 변환하므로
 	 * 앞에서부터 preedit text를 지워 나간다.
 	 * 그러나 client text가 있을 때에는 suffix 방식으로 검색해야 한다. */
-	if (ic->preedit.str != NULL &&
-	    ic->preedit.str->len > 0) {
-	    const ucschar* begin = ustring_begin(ic->preedit.str);
-	    const ucschar* end   = ustring_end(ic->preedit.str);
+	if (ic->engine.str != NULL &&
+	    ic->engine.str->len > 0) {
+	    const ucschar* begin = ustring_begin(ic->engine.str);
+	    const ucschar* end   = ustring_end(ic->engine.str);
 	    const ucschar* iter  = begin;
 	    guint n;
 
@@ -2291,12 +3047,12 @@ nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
 
 	    n = iter - begin;
 	    if (n > 0)
-		ustring_erase(ic->preedit.str, 0, n);
+		ustring_erase(ic->engine.str, 0, n);
 	}
 
 	if (keylen > 0) {
-	    if (!hangul_ic_is_empty(ic->hic)) {
-		hangul_ic_reset(ic->hic);
+	    if (!nabi_ic_is_empty(ic)) {
+		hangul_ic_reset(ic->engine.hic);
 		keylen--;
 	    }
 	}
@@ -2313,23 +3069,23 @@ nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
 	 * 과 같으므로 뒤쪽부터 순서대로 지운다.*/
 	/* hangul_ic_preedit_str */
 	if (keylen > 0) {
-	    if (!hangul_ic_is_empty(ic->hic)) {
-		hangul_ic_reset(ic->hic);
+	    if (!nabi_ic_is_empty(ic)) {
+		hangul_ic_reset(ic->engine.hic);
 		keylen--;
 	    }
 	}
 
 	/* nabi_ic_preedit_str */
-	if (ic->preedit.str != NULL) {
-	    const ucschar* begin = ustring_begin(ic->preedit.str);
-	    const ucschar* iter = ustring_end(ic->preedit.str);
-	    while (keylen > 0 && ustring_length(ic->preedit.str) > 0) {
+	if (ic->engine.str != NULL) {
+	    const ucschar* begin = ustring_begin(ic->engine.str);
+	    const ucschar* iter = ustring_end(ic->engine.str);
+	    while (keylen > 0 && ustring_length(ic->engine.str) > 0) {
 		guint pos;
 		guint n;
 		iter = ustr_syllable_iter_prev(iter, begin);
 		pos = iter - begin;
-		n = ustring_length(ic->preedit.str) - pos;
-		ustring_erase(ic->preedit.str, pos, n);
+		n = ustring_length(ic->engine.str) - pos;
+		ustring_erase(ic->engine.str, pos, n);
 		keylen--;
 	    }
 	}
@@ -2355,24 +3111,18 @@ nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja)
 	/* nabi ic의 preedit string이 남아 있으면 그것도 commit해야지 
 	 * 그렇지 않으면 한자로 변환되지 않은 preedit string은 한자 변환후
 	 * commit된 스트링뒤에서 나타나게 된다. */
-	if (ustring_length(ic->preedit.str) > 0) {
-	    preedit_left = ustring_to_utf8(ic->preedit.str, -1);
+	if (ustring_length(ic->engine.str) > 0) {
+	    preedit_left = ustring_to_utf8(ic->engine.str, -1);
 	    if (!nabi_server->hanja_mode && !nabi_server->commit_by_word) {
-		ustring_clear(ic->preedit.str);
+		ustring_clear(ic->engine.str);
 	    }
 	} else {
 	    preedit_left = g_strdup("");
 	}
 
-	if (nabi_server->use_simplified_chinese) {
-	    modified_value = nabi_traditional_to_simplified(value);
-	    if (!nabi_connection_is_valid_str(ic->connection, modified_value)) {
-		g_free(modified_value);
-		modified_value = g_strdup(value);
-	    }
-	} else {
-	    modified_value = g_strdup(value);
-	}
+	/* the value is already converted to simplified chinese,
+	 * if needed, on lookup */
+	modified_value = g_strdup(value);
 
 	if (strcmp(nabi->config->candidate_format->str, "hanja(hangul)") == 0) {
 	    if (nabi_server->hanja_mode || nabi_server->commit_by_word)
@@ -2497,53 +3247,350 @@ static const unsigned int keymap[][2] = {
     { XK_slash,         XK_question       },  /* 61 */
 };
 
-KeySym
-nabi_ic_lookup_keysym(NabiIC* ic, XKeyEvent* event)
+/* replay에는 keymap을 물어볼 display가 없으므로 keycode 9부터 135까지를
+ * 이 테이블로 고정한다. evdev rules, pc105 model의 us layout
+ * (setxkbmap -rules evdev -model pc105 -layout us)과 같으며
+ * capture도 이 keymap에서 만들어야 한다. 멀티미디어 키는 넣지 않았다. */
+static const unsigned int replay_keymap[][2] = {
+    { XK_Escape,           XK_Escape            },  /* 9 */
+    { XK_1,                XK_exclam            },  /* 10 */
+    { XK_2,                XK_at                },  /* 11 */
+    { XK_3,                XK_numbersign        },  /* 12 */
+    { XK_4,                XK_dollar            },  /* 13 */
+    { XK_5,                XK_percent           },  /* 14 */
+    { XK_6,                XK_asciicircum       },  /* 15 */
+    { XK_7,                XK_ampersand         },  /* 16 */
+    { XK_8,                XK_asterisk          },  /* 17 */
+    { XK_9,                XK_parenleft         },  /* 18 */
+    { XK_0,                XK_parenright        },  /* 19 */
+    { XK_minus,            XK_underscore        },  /* 20 */
+    { XK_equal,            XK_plus              },  /* 21 */
+    { XK_BackSpace,        XK_BackSpace         },  /* 22 */
+    { XK_Tab,              XK_ISO_Left_Tab      },  /* 23 */
+    { XK_q,                XK_Q                 },  /* 24 */
+    { XK_w,                XK_W                 },  /* 25 */
+    { XK_e,                XK_E                 },  /* 26 */
+    { XK_r,                XK_R                 },  /* 27 */
+    { XK_t,                XK_T                 },  /* 28 */
+    { XK_y,                XK_Y                 },  /* 29 */
+    { XK_u,                XK_U                 },  /* 30 */
+    { XK_i,                XK_I                 },  /* 31 */
+    { XK_o,                XK_O                 },  /* 32 */
+    { XK_p,                XK_P                 },  /* 33 */
+    { XK_bracketleft,      XK_braceleft         },  /* 34 */
+    { XK_bracketright,     XK_braceright        },  /* 35 */
+    { XK_Return,           XK_Return            },  /* 36 */
+    { XK_Control_L,        XK_Control_L         },  /* 37 */
+    { XK_a,                XK_A                 },  /* 38 */
+    { XK_s,                XK_S                 },  /* 39 */
+    { XK_d,                XK_D                 },  /* 40 */
+    { XK_f,                XK_F                 },  /* 41 */
+    { XK_g,                XK_G                 },  /* 42 */
+    { XK_h,                XK_H                 },  /* 43 */
+    { XK_j,                XK_J                 },  /* 44 */
+    { XK_k,                XK_K                 },  /* 45 */
+    { XK_l,                XK_L                 },  /* 46 */
+    { XK_semicolon,        XK_colon             },  /* 47 */
+    { XK_apostrophe,       XK_quotedbl          },  /* 48 */
+    { XK_grave,            XK_asciitilde        },  /* 49 */
+    { XK_Shift_L,          XK_Shift_L           },  /* 50 */
+    { XK_backslash,        XK_bar               },  /* 51 */
+    { XK_z,                XK_Z                 },  /* 52 */
+    { XK_x,                XK_X                 },  /* 53 */
+    { XK_c,                XK_C                 },  /* 54 */
+    { XK_v,                XK_V                 },  /* 55 */
+    { XK_b,                XK_B                 },  /* 56 */
+    { XK_n,                XK_N                 },  /* 57 */
+    { XK_m,                XK_M                 },  /* 58 */
+    { XK_comma,            XK_less              },  /* 59 */
+    { XK_period,           XK_greater           },  /* 60 */
+    { XK_slash,            XK_question          },  /* 61 */
+    { XK_Shift_R,          XK_Shift_R           },  /* 62 */
+    { XK_KP_Multiply,      XK_KP_Multiply       },  /* 63 */
+    { XK_Alt_L,            XK_Meta_L            },  /* 64 */
+    { XK_space,            XK_space             },  /* 65 */
+    { XK_Caps_Lock,        XK_Caps_Lock         },  /* 66 */
+    { XK_F1,               XK_F1                },  /* 67 */
+    { XK_F2,               XK_F2                },  /* 68 */
+    { XK_F3,               XK_F3                },  /* 69 */
+    { XK_F4,               XK_F4                },  /* 70 */
+    { XK_F5,               XK_F5                },  /* 71 */
+    { XK_F6,               XK_F6                },  /* 72 */
+    { XK_F7,               XK_F7                },  /* 73 */
+    { XK_F8,               XK_F8                },  /* 74 */
+    { XK_F9,               XK_F9                },  /* 75 */
+    { XK_F10,              XK_F10               },  /* 76 */
+    { XK_Num_Lock,         XK_Num_Lock          },  /* 77 */
+    { XK_Scroll_Lock,      XK_Scroll_Lock       },  /* 78 */
+    { XK_KP_Home,          XK_KP_7              },  /* 79 */
+    { XK_KP_Up,            XK_KP_8              },  /* 80 */
+    { XK_KP_Prior,         XK_KP_9              },  /* 81 */
+    { XK_KP_Subtract,      XK_KP_Subtract       },  /* 82 */
+    { XK_KP_Left,          XK_KP_4              },  /* 83 */
+    { XK_KP_Begin,         XK_KP_5              },  /* 84 */
+    { XK_KP_Right,         XK_KP_6              },  /* 85 */
+    { XK_KP_Add,           XK_KP_Add            },  /* 86 */
+    { XK_KP_End,           XK_KP_1              },  /* 87 */
+    { XK_KP_Down,          XK_KP_2              },  /* 88 */
+    { XK_KP_Next,          XK_KP_3              },  /* 89 */
+    { XK_KP_Insert,        XK_KP_0              },  /* 90 */
+    { XK_KP_Delete,        XK_KP_Decimal        },  /* 91 */
+    { XK_ISO_Level3_Shift, XK_ISO_Level3_Shift  },  /* 92 */
+    { NoSymbol,            NoSymbol             },  /* 93 */
+    { XK_less,             XK_greater           },  /* 94 */
+    { XK_F11,              XK_F11               },  /* 95 */
+    { XK_F12,              XK_F12               },  /* 96 */
+    { NoSymbol,            NoSymbol             },  /* 97 */
+    { XK_Katakana,         XK_Katakana          },  /* 98 */
+    { XK_Hiragana,         XK_Hiragana          },  /* 99 */
+    { XK_Henkan_Mode,      XK_Henkan_Mode       },  /* 100 */
+    { XK_Hiragana_Katakana, XK_Hiragana_Katakana },  /* 101 */
+    { XK_Muhenkan,         XK_Muhenkan          },  /* 102 */
+    { NoSymbol,            NoSymbol             },  /* 103 */
+    { XK_KP_Enter,         XK_KP_Enter          },  /* 104 */
+    { XK_Control_R,        XK_Control_R         },  /* 105 */
+    { XK_KP_Divide,        XK_KP_Divide         },  /* 106 */
+    { XK_Print,            XK_Sys_Req           },  /* 107 */
+    { XK_Alt_R,            XK_Meta_R            },  /* 108 */
+    { XK_Linefeed,         XK_Linefeed          },  /* 109 */
+    { XK_Home,             XK_Home              },  /* 110 */
+    { XK_Up,               XK_Up                },  /* 111 */
+    { XK_Prior,            XK_Prior             },  /* 112 */
+    { XK_Left,             XK_Left              },  /* 113 */
+    { XK_Right,            XK_Right             },  /* 114 */
+    { XK_End,              XK_End               },  /* 115 */
+    { XK_Down,             XK_Down              },  /* 116 */
+    { XK_Next,             XK_Next              },  /* 117 */
+    { XK_Insert,           XK_Insert            },  /* 118 */
+    { XK_Delete,           XK_Delete            },  /* 119 */
+    { NoSymbol,            NoSymbol             },  /* 120 */
+    { NoSymbol,            NoSymbol             },  /* 121 */
+    { NoSymbol,            NoSymbol             },  /* 122 */
+    { NoSymbol,            NoSymbol             },  /* 123 */
+    { NoSymbol,            NoSymbol             },  /* 124 */
+    { XK_KP_Equal,         XK_KP_Equal          },  /* 125 */
+    { XK_plusminus,        XK_plusminus         },  /* 126 */
+    { XK_Pause,            XK_Break             },  /* 127 */
+    { NoSymbol,            NoSymbol             },  /* 128 */
+    { XK_KP_Decimal,       XK_KP_Decimal        },  /* 129 */
+    { XK_Hangul,           XK_Hangul            },  /* 130 */
+    { XK_Hangul_Hanja,     XK_Hangul_Hanja      },  /* 131 */
+    { NoSymbol,            NoSymbol             },  /* 132 */
+    { XK_Super_L,          XK_Super_L           },  /* 133 */
+    { XK_Super_R,          XK_Super_R           },  /* 134 */
+    { XK_Menu,             XK_Menu              },  /* 135 */
+};
+
+/* keysym translation table
+ *
+ * key_table has, for each keycode, shift level and whether the keyboard
+ * is a transliteration one, the keysym nabi_ic_lookup_keysym() gives and
+ * the normalized keysym that goes to the engine, so a key press is one
+ * table read. It depends on the X keymap, the keyboard layout and
+ * use_system_keymap, nabi_ic_invalidate_keysym_table() makes it again
+ * when any of them changes.
+ * The transliteration keyboards use XLookupString() which depends on
+ * the whole modifier state, so their entries are used only when no
+ * modifier other than shift is set. */
+typedef struct _NabiKeyEntry NabiKeyEntry;
+struct _NabiKeyEntry {
+    KeySym keysym;		/* NoSymbol if it must be looked up */
+    KeySym normalized;
+};
+
+static NabiKeyEntry key_table[256][2][2];	/* [keycode][shift][translit] */
+static gboolean key_table_valid = FALSE;
+
+static KeySym
+nabi_ic_strip_unicode_keysym(KeySym keysym)
+{
+    /* unicode keysym */
+    if ((keysym & 0xff000000) == 0x01000000)
+	keysym &= 0x00ffffff;
+    return keysym;
+}
+
+static KeySym
+nabi_ic_replay_keysym(unsigned int keycode, int index)
+{
+    if (keycode >= 9 && keycode <= 135)
+	return replay_keymap[keycode - 9][index];
+    return NoSymbol;
+}
+
+static void
+on_keys_changed(GdkKeymap* keymap, gpointer data)
+{
+    nabi_log(3, "keymap changed\n");
+    nabi_ic_invalidate_keysym_table();
+}
+
+static void
+nabi_ic_update_keysym_table(Display* display)
 {
+    static gboolean signal_connected = FALSE;
+    unsigned int keycode;
     int index;
     KeySym keysym;
-    bool is_transliteration;
-
-    is_transliteration = hangul_ic_is_transliteration(ic->hic);
-    if (is_transliteration) {
-	/* transliteration method인 경우에는 사용자의 자판 설정에서
-	 * 오는 값을 임의로 바꿔서는 안된다. 사용자 설정에 따르는 것이
-	 * 맞다. */
-	char buf[64];
-	XLookupString(event, buf, sizeof(buf), &keysym, NULL);
-    } else {
-	keysym = NoSymbol;
-	index = (event->state & ShiftMask) ? 1 : 0;
-
-	/* 자판 설정에 따른 변환 문제를 피하기 위해서 내장 keymap을 사용하여
-	 * keycode를 keysym으로 변환함 */
-	if (!nabi_server->use_system_keymap) {
-	    if (event->keycode >= 10 && event->keycode <= 61)
-		keysym = keymap[event->keycode - 10][index];
-	}
+    XKeyEvent event;
+    char buf[64];
+
+    /* MappingNotify and XkbMapNotify are delivered as keys-changed,
+     * replay has no display and uses replay_keymap */
+    if (display != NULL && !signal_connected) {
+	g_signal_connect(G_OBJECT(gdk_keymap_get_default()), "keys-changed",
+			 G_CALLBACK(on_keys_changed), NULL);
+	signal_connected = TRUE;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.type = KeyPress;
+    event.display = display;
+
+    for (keycode = 0; keycode < 256; keycode++) {
+	event.keycode = keycode;
+	for (index = 0; index < 2; index++) {
+	    NabiKeyEntry* entry = key_table[keycode][index];
+
+	    /* 자판 설정에 따른 변환 문제를 피하기 위해서 내장 keymap을
+	     * 사용하여 keycode를 keysym으로 변환함 */
+	    keysym = NoSymbol;
+	    if (!nabi_server->use_system_keymap) {
+		if (keycode >= 10 && keycode <= 61)
+		    keysym = keymap[keycode - 10][index];
+	    }
 
-	/* XLookupString()을 사용하지 않고 XLookupKeysym()함수를
-	 * 사용한 것은 데스크탑에서 여러 언어 자판을 지원하기위해서 Xkb를
-	 * 사용하는 경우에 쉽게 처리하기 위한 방편이다.
-	 * Xkb를 사용하게 되면 keymap이 재정의되므로 XLookupString()의 리턴값은
-	 * 재정의된 키값을 얻게되어 각 언어(예를 들어 프랑스, 러시아 등)의
-	 * 자판에서 일반 qwerty 자판으로 변환을 해줘야 한다. 이 문제를 좀더 
-	 * 손쉽게 풀기 위해서 재정의된 자판이 아닌 첫번째 자판의 값을 직접
-	 * 가져오기 위해서 XLookupKeysym()함수를 사용한다. */
-	if (keysym == NoSymbol) {
-	    keysym = XLookupKeysym(event, index);
-	}
+	    /* XLookupString()을 사용하지 않고 XLookupKeysym()함수를
+	     * 사용한 것은 데스크탑에서 여러 언어 자판을 지원하기위해서 Xkb를
+	     * 사용하는 경우에 쉽게 처리하기 위한 방편이다.
+	     * Xkb를 사용하게 되면 keymap이 재정의되므로 XLookupString()의
+	     * 리턴값은 재정의된 키값을 얻게되어 각 언어(예를 들어 프랑스,
+	     * 러시아 등)의 자판에서 일반 qwerty 자판으로 변환을 해줘야 한다.
+	     * 이 문제를 좀더 손쉽게 풀기 위해서 재정의된 자판이 아닌 첫번째
+	     * 자판의 값을 직접 가져오기 위해서 XLookupKeysym()함수를
+	     * 사용한다. */
+	    if (keysym == NoSymbol) {
+		if (display != NULL)
+		    keysym = XLookupKeysym(&event, index);
+		else
+		    keysym = nabi_ic_replay_keysym(keycode, index);
+	    }
 
-	/* 그러나 이 함수를 사용하게되면 새로 정의된 키를 가져와야 되는 경우에
-	 * 못가져오는 수가 생긴다. 이를 피하기 위해서 XLookupKeysym() 함수가
-	 * 0을 리턴하면 XLookupString()으로 다시한번 시도하는 방식으로 
-	 * 처리한다. */
-	if (keysym == NoSymbol) {
-	    char buf[64];
-	    XLookupString(event, buf, sizeof(buf), &keysym, NULL);
+	    entry[0].keysym = keysym;
+	    entry[0].normalized = NoSymbol;
+	    if (keysym != NoSymbol)
+		entry[0].normalized = nabi_ic_real_normalize_keysym(
+				nabi_ic_strip_unicode_keysym(keysym),
+				index ? ShiftMask : 0);
+
+	    /* transliteration method인 경우에는 사용자의 자판 설정에서
+	     * 오는 값을 그대로 쓴다 */
+	    event.state = index ? ShiftMask : 0;
+	    keysym = NoSymbol;
+	    if (display != NULL)
+		XLookupString(&event, buf, sizeof(buf), &keysym, NULL);
+	    else
+		keysym = nabi_ic_replay_keysym(keycode, index);
+	    event.state = 0;
+
+	    entry[1].keysym = keysym;
+	    entry[1].normalized = nabi_ic_strip_unicode_keysym(keysym);
 	}
     }
 
+    key_table_valid = TRUE;
+    nabi_log(3, "keysym table updated\n");
+}
+
+void
+nabi_ic_invalidate_keysym_table(void)
+{
+    /* it is made on the first key if there is no display yet */
+    key_table_valid = FALSE;
+    if (nabi_server != NULL && nabi_server->display != NULL)
+	nabi_ic_update_keysym_table(nabi_server->display);
+}
+
+/* the keysym without the table, as the table is made */
+static KeySym
+nabi_ic_real_lookup_keysym(XKeyEvent* event, int index, int translit)
+{
+    KeySym keysym = NoSymbol;
+    char buf[64];
+
+    /* replay_keymap agrees with the builtin keymap */
+    if (event->display == NULL)
+	return nabi_ic_replay_keysym(event->keycode, index);
+
+    if (translit) {
+	XLookupString(event, buf, sizeof(buf), &keysym, NULL);
+	return keysym;
+    }
+
+    if (!nabi_server->use_system_keymap &&
+	event->keycode >= 10 && event->keycode <= 61)
+	keysym = keymap[event->keycode - 10][index];
+    if (keysym == NoSymbol)
+	keysym = XLookupKeysym(event, index);
+
+    /* 그러나 XLookupKeysym()을 사용하게되면 새로 정의된 키를 가져와야 되는
+     * 경우에 못가져오는 수가 생긴다. 이를 피하기 위해서 XLookupKeysym()
+     * 함수가 0을 리턴하면 XLookupString()으로 다시한번 시도하는 방식으로
+     * 처리한다. */
+    if (keysym == NoSymbol)
+	XLookupString(event, buf, sizeof(buf), &keysym, NULL);
+
     return keysym;
 }
+
+static KeySym
+nabi_ic_real_normalize(KeySym keysym, unsigned int state, int translit)
+{
+    keysym = nabi_ic_strip_unicode_keysym(keysym);
+    if (translit)
+	return keysym;
+    return nabi_ic_real_normalize_keysym(keysym, state);
+}
+
+/* returns the keysym of the event and sets normalized to the keysym
+ * for the engine */
+KeySym
+nabi_ic_lookup_keysym(NabiIC* ic, XKeyEvent* event, KeySym* normalized)
+{
+    const NabiKeyEntry* entry = NULL;
+    int index;
+    int translit;
+    KeySym keysym;
+
+    index = (event->state & ShiftMask) ? 1 : 0;
+    translit = nabi_engine_is_transliteration(&ic->engine) ? 1 : 0;
+
+    if (!key_table_valid)
+	nabi_ic_update_keysym_table(event->display);
+
+    if (event->keycode < 256 &&
+	(!translit || (event->state & ~ShiftMask) == 0))
+	entry = &key_table[event->keycode][index][translit];
+
+    if (entry == NULL || entry->keysym == NoSymbol) {
+	keysym = nabi_ic_real_lookup_keysym(event, index, translit);
+	*normalized = nabi_ic_real_normalize(keysym, event->state, translit);
+	return keysym;
+    }
+
+    if (nabi_log_get_level() >= 5) {
+	KeySym expected = nabi_ic_real_lookup_keysym(event, index, translit);
+	if (entry->keysym != expected)
+	    nabi_log(1, "keysym table mismatch: keycode %d: "
+		     "0x%lx != 0x%lx\n", event->keycode, entry->keysym, expected);
+	expected = nabi_ic_real_normalize(expected, event->state, translit);
+	if (entry->normalized != expected)
+	    nabi_log(1, "keysym table mismatch: normalize keycode %d: "
+		     "0x%lx != 0x%lx\n", event->keycode, entry->normalized,
+		     expected);
+    }
+
+    *normalized = entry->normalized;
+    return entry->keysym;
+}
 /* vim: set ts=8 sw=4 sts=4 : */
@@ -31,12 +31,14 @@
 
 #include "candidate.h"
 #include "ustring.h"
+#include "engine.h"
 
 typedef struct _PreeditAttributes PreeditAttributes;
 typedef struct _StatusAttributes StatusAttributes;
 typedef struct _NabiIC         NabiIC;
 typedef struct _NabiConnection NabiConnection;
 typedef struct _NabiToplevel   NabiToplevel;
+typedef struct _NabiICMemory   NabiICMemory;
 
 typedef enum {
     NABI_INPUT_MODE_DIRECT,
@@ -46,9 +48,12 @@ typedef enum {
 struct _NabiConnection {
     CARD16         id;
     NabiInputMode  mode;
+    char*          encoding;
     GIConv         cd;
     CARD16         next_new_ic_id;
     GSList*        ic_list;
+    GSList*        recycled_ics;   /* destroyed ics kept for reuse */
+    guint          recycle_source;
 };
 
 struct _NabiToplevel {
@@ -58,7 +63,6 @@ struct _NabiToplevel {
 };
 
 struct _PreeditAttributes {
-    UString*        str;
     GdkWindow*      window;         /* where to draw the preedit string */
     int             width;          /* preedit area width */
     int             height;         /* preedit area height */
@@ -75,6 +79,7 @@ struct _PreeditAttributes {
 
     char            *base_font;     /* base font of fontset */
     XFontSet        font_set;       /* font set */
+    gboolean        fontset_pending; /* waiting for the fontset loader */
     int             ascent;         /* font property */
     int             descent;        /* font property */
 
@@ -92,6 +97,22 @@ struct _PreeditAttributes {
 				     * registered */
     gboolean        has_done_cb;    /* whether XNPreeditDoneCallback 
 				     * registered */
+
+    /* pango render cache, see nabi_ic_preedit_update_render_cache() */
+    PangoContext*   pango_context;
+    PangoLayout*    normal_layout;
+    PangoLayout*    hilight_layout;
+    int             pango_ascent;   /* ascent of preedit_font in pixel */
+    guint           font_serial;    /* preedit_font_serial of the cache */
+    GdkColor        fg_color;       /* resolved foreground */
+    GdkColor        bg_color;       /* resolved background */
+    gboolean        has_colors;     /* whether fg_color, bg_color valid */
+
+    /* off-screen copy of the preedit window, Expose is copied from this */
+    GdkPixmap*      backing;
+    int             backing_width;
+    int             backing_height;
+    gboolean        backing_valid;  /* whether backing has current text */
 };
 
 struct _StatusAttributes {
@@ -117,14 +138,17 @@ struct _NabiIC {
     PreeditAttributes   preedit;          /* preedit attributes */
 
     NabiConnection*     connection;
-    NabiToplevel*       toplevel;
+    NabiToplevel*       toplevel;         /* NULL until it is found */
+    guint               toplevel_query;   /* window cache walk finding it */
 
     /* hangul data */
     NabiInputMode       mode;
-    HangulInputContext* hic;
+    NabiEngine          engine;           /* hic and the word buffer */
 
     /* hanja or symbol select window */
     NabiCandidate*	candidate;
+    guint		candidate_serial; /* serial of the pending lookup,
+					   * 0 if there is none */
 
     gboolean            composing_started;
     UString*            client_text;
@@ -132,6 +156,22 @@ struct _NabiIC {
 					       * client text */
     gboolean            has_str_conv_cb;  /* whether XNStringConversionCallback
 					   * registered */
+    GTimeVal            recycled_time;    /* when it was put in the
+					   * recycle list */
+    gboolean            has_focus;
+    GTimeVal            unfocus_time;     /* when it lost the focus */
+};
+
+/* resources held by ics, see nabi_ic_add_memory_usage() */
+struct _NabiICMemory {
+    gsize heap;             /* approximate heap size on nabi side */
+    gsize pixmap_bytes;     /* X server memory of the backing pixmaps */
+    int   pixmaps;
+    int   windows;          /* preedit windows */
+    int   gcs;              /* references to the shared gcs */
+    int   fontsets;
+    int   pango_contexts;
+    int   pango_layouts;
 };
 
 NabiConnection* nabi_connection_create(CARD16 id, const char* encoding);
@@ -153,10 +193,15 @@ void    nabi_ic_set_values(NabiIC *ic, IMChangeICStruct *data);
 void    nabi_ic_get_values(NabiIC *ic, IMChangeICStruct *data);
 
 Bool    nabi_ic_is_empty(NabiIC *ic);
+gboolean nabi_ic_reclaim_idle(NabiIC *ic, const GTimeVal *now, int timeout);
+void    nabi_ic_add_memory_usage(NabiIC *ic, NabiICMemory *usage);
 CARD16  nabi_ic_get_id(NabiIC* ic);
-KeySym  nabi_ic_lookup_keysym(NabiIC* ic, XKeyEvent* event);
+KeySym  nabi_ic_lookup_keysym(NabiIC* ic, XKeyEvent* event,
+			      KeySym* normalized);
+void    nabi_ic_invalidate_keysym_table(void);
 
 void    nabi_ic_set_focus(NabiIC *ic);
+void    nabi_ic_unset_focus(NabiIC *ic);
 
 void    nabi_ic_set_mode(NabiIC *ic, NabiInputMode mode);
 void    nabi_ic_start_composing(NabiIC *ic);
@@ -173,12 +218,16 @@ void    nabi_ic_status_update(NabiIC *ic);
 
 Bool    nabi_ic_commit(NabiIC *ic);
 
-Bool    nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, unsigned int state);
+Bool    nabi_ic_process_keyevent(NabiIC* ic, KeySym keysym, KeySym normalized,
+				 unsigned int state);
 void    nabi_ic_flush(NabiIC *ic);
 void    nabi_ic_reset(NabiIC *ic, IMResetICStruct *data);
 
 Bool    nabi_ic_popup_candidate_window(NabiIC *ic, const char* key);
-void    nabi_ic_insert_candidate(NabiIC *ic, const Hanja* hanja);
+void    nabi_ic_close_candidate_window(NabiIC *ic);
+void    nabi_ic_drop_candidate_results(void);
+Bool    nabi_ic_has_pending_jobs(void);
+void    nabi_ic_insert_candidate(NabiIC *ic, const NabiDictItem* hanja);
 
 void    nabi_ic_process_string_conversion_reply(NabiIC* ic, const char* text);
 
@@ -20,8 +20,13 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
+#include "debug.h"
 #include "keyboard-layout.h"
 
 struct KeySymPair {
@@ -29,11 +34,27 @@ struct KeySymPair {
     KeySym value;
 };
 
+/* binary cache of the layout file, ~/.nabi/keyboard_layouts.cache
+ *
+ *   magic, version, byte order, mtime and size of the source file,
+ *   source path, number of layouts,
+ *   for each layout: name, number of pairs, pairs of (key, value)
+ *
+ * All numbers are uint32_t in host byte order except mtime and size
+ * which are int64_t. Strings are length prefixed without NUL. */
+#define LAYOUT_CACHE_MAGIC	"NABIKBDL"
+#define LAYOUT_CACHE_MAGIC_LEN	8
+#define LAYOUT_CACHE_VERSION	1
+#define LAYOUT_CACHE_BYTE_ORDER	0x01020304
+
 NabiKeyboardLayout*
 nabi_keyboard_layout_new(const char* name)
 {
+    int i;
     NabiKeyboardLayout* layout = g_new(NabiKeyboardLayout, 1);
     layout->name = g_strdup(name);
+    for (i = 0; i < 256; i++)
+	layout->latin1[i] = i;
     layout->table = NULL;
     return layout;
 }
@@ -43,22 +64,54 @@ nabi_keyboard_layout_cmp(const void* a, const void* b)
 {
     const struct KeySymPair* pair1 = a;
     const struct KeySymPair* pair2 = b;
-    return pair1->key - pair2->key;
+
+    /* KeySym is unsigned long, so the difference may not fit in int */
+    if (pair1->key < pair2->key)
+	return -1;
+    return pair1->key > pair2->key;
 }
 
+/* table is kept sorted for bsearch, a later pair of the same key
+ * replaces the former one */
 void
 nabi_keyboard_layout_append(NabiKeyboardLayout* layout,
 			    KeySym key, KeySym value)
 {
     struct KeySymPair item = { key, value };
+    struct KeySymPair* pairs;
+    guint low, high;
+
+    if (key < 256) {
+	layout->latin1[key] = value;
+	return;
+    }
+
     if (layout->table == NULL)
 	layout->table = g_array_new(FALSE, FALSE, sizeof(struct KeySymPair));
-    g_array_append_vals(layout->table, &item, 1);
+
+    pairs = (struct KeySymPair*)layout->table->data;
+    low = 0;
+    high = layout->table->len;
+    while (low < high) {
+	guint mid = (low + high) / 2;
+	if (pairs[mid].key < key)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+
+    if (low < layout->table->len && pairs[low].key == key)
+	pairs[low].value = value;
+    else
+	g_array_insert_vals(layout->table, low, &item, 1);
 }
 
 KeySym
 nabi_keyboard_layout_get_key(NabiKeyboardLayout* layout, KeySym keysym)
 {
+    if (keysym < 256)
+	return layout->latin1[keysym];
+
     if (layout->table != NULL) {
 	struct KeySymPair key = { keysym, 0 };
 	struct KeySymPair* ret;
@@ -81,3 +134,306 @@ nabi_keyboard_layout_free(gpointer data, gpointer user_data)
 	g_array_free(layout->table, TRUE);
     g_free(layout);
 }
+
+gboolean
+nabi_keyboard_layout_equal(const NabiKeyboardLayout* a,
+			   const NabiKeyboardLayout* b)
+{
+    guint len_a, len_b;
+
+    if (strcmp(a->name, b->name) != 0)
+	return FALSE;
+
+    if (memcmp(a->latin1, b->latin1, sizeof(a->latin1)) != 0)
+	return FALSE;
+
+    len_a = a->table != NULL ? a->table->len : 0;
+    len_b = b->table != NULL ? b->table->len : 0;
+    if (len_a != len_b)
+	return FALSE;
+
+    return len_a == 0 ||
+	   memcmp(a->table->data, b->table->data,
+		  len_a * sizeof(struct KeySymPair)) == 0;
+}
+
+static gchar*
+skip_space(gchar* p)
+{
+    while (g_ascii_isspace(*p))
+	p++;
+    return p;
+}
+
+/* parses the layout file, the first layout of the list is "none" */
+GList*
+nabi_keyboard_layout_list_load(const char *filename)
+{
+    FILE *file;
+    char *p, *line;
+    char *saved_position = NULL;
+    char buf[256];
+    GList *list = NULL;
+    NabiKeyboardLayout *layout = NULL;
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+	fprintf(stderr, "Nabi: Failed to open keyboard layout file: %s\n", filename);
+	return NULL;
+    }
+
+    layout = nabi_keyboard_layout_new("none");
+    list = g_list_append(list, layout);
+    layout = NULL;
+
+    for (line = fgets(buf, sizeof(buf), file);
+	 line != NULL;
+	 line = fgets(buf, sizeof(buf), file)) {
+	p = skip_space(buf);
+
+	/* skip comments */
+	if (*p == '\0' || *p == ';' || *p == '#')
+	    continue;
+
+	if (p[0] == '[') {
+	    p = strtok_r(p + 1, "]", &saved_position);
+	    if (p != NULL) {
+		if (layout != NULL)
+		    list = g_list_append(list, layout);
+
+		layout = nabi_keyboard_layout_new(p);
+	    }
+	} else if (layout != NULL) {
+	    KeySym key, value;
+
+	    p = strtok_r(p, " \t", &saved_position);
+	    if (p == NULL)
+		continue;
+
+	    key = strtol(p, NULL, 16);
+	    if (key == 0)
+		continue;
+
+	    p = strtok_r(NULL, "\r\n\t ", &saved_position);
+	    if (p == NULL)
+		continue;
+
+	    value = strtol(p, NULL, 16);
+	    if (value == 0)
+		continue;
+
+	    nabi_keyboard_layout_append(layout, key, value);
+	}
+    }
+
+    if (layout != NULL)
+	list = g_list_append(list, layout);
+
+    fclose(file);
+
+    return list;
+}
+
+static gchar*
+nabi_keyboard_layout_get_cache_filename(void)
+{
+    return g_build_filename(g_get_home_dir(), ".nabi",
+			    "keyboard_layouts.cache", NULL);
+}
+
+static void
+cache_put_uint32(GString* buf, guint32 value)
+{
+    g_string_append_len(buf, (const char*)&value, sizeof(value));
+}
+
+static void
+cache_put_int64(GString* buf, gint64 value)
+{
+    g_string_append_len(buf, (const char*)&value, sizeof(value));
+}
+
+static void
+cache_put_string(GString* buf, const char* str)
+{
+    guint32 len = strlen(str);
+    cache_put_uint32(buf, len);
+    g_string_append_len(buf, str, len);
+}
+
+void
+nabi_keyboard_layout_list_save_cache(const char* source, GList* list)
+{
+    struct stat st;
+    GString* buf;
+    gchar* filename;
+    GError* error = NULL;
+
+    if (stat(source, &st) != 0)
+	return;
+
+    buf = g_string_new(NULL);
+    g_string_append_len(buf, LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_MAGIC_LEN);
+    cache_put_uint32(buf, LAYOUT_CACHE_VERSION);
+    cache_put_uint32(buf, LAYOUT_CACHE_BYTE_ORDER);
+    cache_put_int64(buf, st.st_mtime);
+    cache_put_int64(buf, st.st_size);
+    cache_put_string(buf, source);
+    cache_put_uint32(buf, g_list_length(list));
+
+    for (; list != NULL; list = g_list_next(list)) {
+	NabiKeyboardLayout* layout = list->data;
+	guint32 n = 0;
+	gsize n_pos;
+	guint i;
+
+	cache_put_string(buf, layout->name);
+	n_pos = buf->len;
+	cache_put_uint32(buf, 0);
+
+	for (i = 0; i < 256; i++) {
+	    if (layout->latin1[i] != i) {
+		cache_put_uint32(buf, i);
+		cache_put_uint32(buf, layout->latin1[i]);
+		n++;
+	    }
+	}
+
+	if (layout->table != NULL) {
+	    struct KeySymPair* pairs = (struct KeySymPair*)layout->table->data;
+	    for (i = 0; i < layout->table->len; i++) {
+		cache_put_uint32(buf, pairs[i].key);
+		cache_put_uint32(buf, pairs[i].value);
+		n++;
+	    }
+	}
+
+	memcpy(buf->str + n_pos, &n, sizeof(n));
+    }
+
+    filename = nabi_keyboard_layout_get_cache_filename();
+    if (!g_file_set_contents(filename, buf->str, buf->len, &error)) {
+	nabi_log(3, "can't write keyboard layout cache: %s\n",
+		 error->message);
+	g_error_free(error);
+    }
+    g_free(filename);
+    g_string_free(buf, TRUE);
+}
+
+typedef struct {
+    const char* p;
+    const char* end;
+} CacheReader;
+
+static gboolean
+cache_get(CacheReader* reader, void* value, gsize size)
+{
+    if ((gsize)(reader->end - reader->p) < size)
+	return FALSE;
+    memcpy(value, reader->p, size);
+    reader->p += size;
+    return TRUE;
+}
+
+static char*
+cache_get_string(CacheReader* reader)
+{
+    guint32 len;
+    char* str;
+
+    if (!cache_get(reader, &len, sizeof(len)))
+	return NULL;
+    if ((gsize)(reader->end - reader->p) < len)
+	return NULL;
+
+    str = g_strndup(reader->p, len);
+    reader->p += len;
+    return str;
+}
+
+/* returns NULL if the cache is not made from the current source file */
+GList*
+nabi_keyboard_layout_list_load_cache(const char* source)
+{
+    struct stat st;
+    gchar* filename;
+    gchar* contents = NULL;
+    gsize length = 0;
+    CacheReader reader;
+    guint32 version, byte_order, n_layouts, i;
+    gint64 mtime, size;
+    char* path;
+    GList* list = NULL;
+    gboolean valid;
+
+    if (stat(source, &st) != 0)
+	return NULL;
+
+    filename = nabi_keyboard_layout_get_cache_filename();
+    valid = g_file_get_contents(filename, &contents, &length, NULL);
+    g_free(filename);
+    if (!valid)
+	return NULL;
+
+    reader.p = contents;
+    reader.end = contents + length;
+
+    if (length < LAYOUT_CACHE_MAGIC_LEN ||
+	memcmp(contents, LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_MAGIC_LEN) != 0)
+	goto invalid;
+    reader.p += LAYOUT_CACHE_MAGIC_LEN;
+
+    if (!cache_get(&reader, &version, sizeof(version)) ||
+	!cache_get(&reader, &byte_order, sizeof(byte_order)) ||
+	!cache_get(&reader, &mtime, sizeof(mtime)) ||
+	!cache_get(&reader, &size, sizeof(size)))
+	goto invalid;
+
+    if (version != LAYOUT_CACHE_VERSION ||
+	byte_order != LAYOUT_CACHE_BYTE_ORDER ||
+	mtime != (gint64)st.st_mtime || size != (gint64)st.st_size)
+	goto invalid;
+
+    path = cache_get_string(&reader);
+    valid = path != NULL && strcmp(path, source) == 0;
+    g_free(path);
+    if (!valid)
+	goto invalid;
+
+    if (!cache_get(&reader, &n_layouts, sizeof(n_layouts)))
+	goto invalid;
+
+    for (i = 0; i < n_layouts; i++) {
+	NabiKeyboardLayout* layout;
+	char* name;
+	guint32 n, j;
+
+	name = cache_get_string(&reader);
+	if (name == NULL)
+	    goto invalid;
+	layout = nabi_keyboard_layout_new(name);
+	g_free(name);
+	list = g_list_append(list, layout);
+
+	if (!cache_get(&reader, &n, sizeof(n)))
+	    goto invalid;
+
+	for (j = 0; j < n; j++) {
+	    guint32 pair[2];
+	    if (!cache_get(&reader, pair, sizeof(pair)))
+		goto invalid;
+	    nabi_keyboard_layout_append(layout, pair[0], pair[1]);
+	}
+    }
+
+    g_free(contents);
+    nabi_log(3, "load keyboard layout cache: %d layouts\n", n_layouts);
+    return list;
+
+invalid:
+    g_list_foreach(list, nabi_keyboard_layout_free, NULL);
+    g_list_free(list);
+    g_free(contents);
+    return NULL;
+}
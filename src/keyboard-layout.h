@@ -26,7 +26,8 @@ typedef struct _NabiKeyboardLayout NabiKeyboardLayout;
 
 struct _NabiKeyboardLayout {
     char*  name;
-    GArray* table;
+    KeySym latin1[256];	/* direct map of latin1 keysyms */
+    GArray* table;	/* sorted pairs of the other keysyms */
 };
 
 NabiKeyboardLayout* nabi_keyboard_layout_new(const char* name);
@@ -36,4 +37,11 @@ void nabi_keyboard_layout_append(NabiKeyboardLayout* layout,
 	KeySym key, KeySym value);
 KeySym nabi_keyboard_layout_get_key(NabiKeyboardLayout* layout, KeySym keysym);
 
+gboolean nabi_keyboard_layout_equal(const NabiKeyboardLayout* a,
+				    const NabiKeyboardLayout* b);
+
+GList* nabi_keyboard_layout_list_load(const char* filename);
+GList* nabi_keyboard_layout_list_load_cache(const char* source);
+void   nabi_keyboard_layout_list_save_cache(const char* source, GList* list);
+
 #endif /* nabi_keyboard_layout_h */
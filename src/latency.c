@@ -0,0 +1,287 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "latency.h"
+#include "stat.h"
+
+/* fixed buckets, upper limits in microseconds, the last one is open */
+#define N_BUCKETS NABI_STAT_N_BUCKETS
+static const long long bucket_limits[N_BUCKETS - 1] = {
+    NABI_STAT_BUCKET_LIMITS
+};
+
+enum {
+    STYLE_CALLBACKS,
+    STYLE_POSITION,
+    STYLE_AREA,
+    STYLE_NOTHING,
+    N_STYLES
+};
+
+static const char* style_names[N_STYLES] = {
+    "on the spot", "over the spot", "off the spot", "root window"
+};
+
+static const char* stage_names[NABI_LATENCY_N_STAGES] = {
+    NABI_STAT_STAGE_NAMES
+};
+
+static unsigned int histogram[N_STYLES][NABI_LATENCY_N_STAGES][N_BUCKETS];
+
+static long long message_time = 0;
+static long long event_time = 0;
+static int current_style = -1;
+
+/* X server time has an unknown origin, so the queue delay is measured
+ * against the smallest (local time - X time) seen until now */
+static gboolean has_x_offset = FALSE;
+static long long x_offset = 0;
+
+static long long slo = 0;		/* usec, 0 means no slo */
+static unsigned int slo_violations = 0;
+
+/* monotonic, so a step of the wall clock does not make bogus samples */
+long long
+nabi_latency_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * G_USEC_PER_SEC + now.tv_nsec / 1000;
+}
+
+static int
+get_style(long input_style)
+{
+    if (input_style & XIMPreeditCallbacks)
+	return STYLE_CALLBACKS;
+    else if (input_style & XIMPreeditPosition)
+	return STYLE_POSITION;
+    else if (input_style & XIMPreeditArea)
+	return STYLE_AREA;
+    return STYLE_NOTHING;
+}
+
+static void
+histogram_add(int style, int stage, long long usec)
+{
+    int i;
+
+    for (i = 0; i < N_BUCKETS - 1; i++) {
+	if (usec < bucket_limits[i])
+	    break;
+    }
+    histogram[style][stage][i]++;
+    NABI_STAT_INC(latency[stage][i]);
+}
+
+void
+nabi_latency_message_begin(void)
+{
+    message_time = nabi_latency_now();
+}
+
+void
+nabi_latency_event_begin(long input_style, unsigned long x_time)
+{
+    long long offset;
+
+    event_time = nabi_latency_now();
+    current_style = get_style(input_style);
+
+    if (message_time == 0 || message_time > event_time)
+	message_time = event_time;
+
+    histogram_add(current_style, NABI_LATENCY_DISPATCH,
+		  event_time - message_time);
+
+    if (x_time != CurrentTime) {
+	offset = message_time / 1000 - (long long)x_time;
+	/* X time wraps around after 49 days, start again then */
+	if (!has_x_offset || offset < x_offset ||
+	    offset - x_offset > 60 * 1000) {
+	    x_offset = offset;
+	    has_x_offset = TRUE;
+	}
+	histogram_add(current_style, NABI_LATENCY_QUEUE,
+		      (offset - x_offset) * 1000);
+    }
+}
+
+/* stages outside a forwarded key event are not counted */
+void
+nabi_latency_add(int stage, long long start)
+{
+    if (current_style < 0)
+	return;
+
+    histogram_add(current_style, stage, nabi_latency_now() - start);
+}
+
+void
+nabi_latency_event_end(void)
+{
+    long long total;
+
+    if (current_style < 0)
+	return;
+
+    total = nabi_latency_now() - message_time;
+    histogram_add(current_style, NABI_LATENCY_TOTAL, total);
+
+    if (slo > 0 && total > slo) {
+	slo_violations++;
+	nabi_log(2, "input lag: %lld usec, over %lld usec\n", total, slo);
+    }
+
+    current_style = -1;
+    message_time = 0;
+}
+
+void
+nabi_latency_set_slo(int msec)
+{
+    slo = (long long)msec * 1000;
+}
+
+/* bucket limit under which the given ratio of samples are */
+static long long
+get_percentile(const unsigned int* buckets, unsigned int count, double ratio)
+{
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < N_BUCKETS - 1; i++) {
+	sum += buckets[i];
+	if (sum >= count * ratio)
+	    return bucket_limits[i];
+    }
+    return -1;
+}
+
+static void
+append_limit(GString* str, long long limit)
+{
+    if (limit < 0)
+	g_string_append_printf(str, ">%lldms",
+			       bucket_limits[N_BUCKETS - 2] / 1000);
+    else if (limit >= 1000)
+	g_string_append_printf(str, "<%.1fms", limit / 1000.0);
+    else
+	g_string_append_printf(str, "<%lldus", limit);
+}
+
+char*
+nabi_latency_get_report(int verbose)
+{
+    GString* str;
+    int style, stage, i;
+
+    str = g_string_new(NULL);
+    for (style = 0; style < N_STYLES; style++) {
+	unsigned int* total = histogram[style][NABI_LATENCY_TOTAL];
+	unsigned int n_events = 0;
+
+	for (i = 0; i < N_BUCKETS; i++)
+	    n_events += total[i];
+	if (n_events == 0)
+	    continue;
+
+	g_string_append_printf(str, "%s: %u\n", style_names[style], n_events);
+	for (stage = 0; stage < NABI_LATENCY_N_STAGES; stage++) {
+	    unsigned int* buckets = histogram[style][stage];
+	    unsigned int count = 0;
+
+	    for (i = 0; i < N_BUCKETS; i++)
+		count += buckets[i];
+	    if (count == 0)
+		continue;
+
+	    g_string_append_printf(str, "  %-8s %6u  p50 ",
+				   stage_names[stage], count);
+	    append_limit(str, get_percentile(buckets, count, 0.5));
+	    g_string_append(str, "  p99 ");
+	    append_limit(str, get_percentile(buckets, count, 0.99));
+
+	    if (verbose) {
+		g_string_append(str, "  [");
+		for (i = 0; i < N_BUCKETS; i++)
+		    g_string_append_printf(str, i > 0 ? " %u" : "%u",
+					   buckets[i]);
+		g_string_append_c(str, ']');
+	    }
+	    g_string_append_c(str, '\n');
+	}
+    }
+
+    if (slo > 0)
+	g_string_append_printf(str, "slo %lldms: %u violations\n",
+			       slo / 1000, slo_violations);
+
+    return g_string_free(str, FALSE);
+}
+
+/* append the histograms to ~/.nabi/latency.log */
+void
+nabi_latency_dump(void)
+{
+    gchar* filename;
+    gchar* report;
+    FILE* file;
+    int i;
+
+    filename = g_build_filename(g_get_home_dir(), ".nabi", "latency.log",
+				NULL);
+    file = fopen(filename, "a");
+    if (file != NULL) {
+	time_t now = time(NULL);
+	struct tm local_time;
+	char buf[64];
+
+	localtime_r(&now, &local_time);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local_time);
+
+	report = nabi_latency_get_report(TRUE);
+	fprintf(file, "%s\nbuckets (usec):", buf);
+	for (i = 0; i < N_BUCKETS - 1; i++)
+	    fprintf(file, " <%lld", bucket_limits[i]);
+	fprintf(file, " >=%lld\n%s\n", bucket_limits[N_BUCKETS - 2], report);
+	g_free(report);
+	fclose(file);
+	nabi_log(1, "latency histograms are written to %s\n", filename);
+    }
+    g_free(filename);
+}
+
+void
+nabi_latency_reset(void)
+{
+    memset(histogram, 0, sizeof(histogram));
+    slo_violations = 0;
+}
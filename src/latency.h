@@ -0,0 +1,49 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_latency_h
+#define nabi_latency_h
+
+/* keystroke latency histograms
+ * this header is used by IMdkit too, so it does not use glib types */
+
+enum {
+    NABI_LATENCY_QUEUE,		/* X event time -> XIM message handler */
+    NABI_LATENCY_DISPATCH,	/* XIM message handler -> keysym lookup */
+    NABI_LATENCY_LOOKUP,	/* nabi_ic_lookup_keysym() */
+    NABI_LATENCY_PROCESS,	/* hangul_ic_process() */
+    NABI_LATENCY_PREEDIT,	/* preedit update */
+    NABI_LATENCY_ENCODE,	/* commit string to compound text */
+    NABI_LATENCY_SEND,		/* sending XIM_COMMIT */
+    NABI_LATENCY_TOTAL,		/* XIM message handler -> end of the event */
+    NABI_LATENCY_N_STAGES
+};
+
+long long nabi_latency_now(void);
+
+void  nabi_latency_message_begin(void);
+void  nabi_latency_event_begin(long input_style, unsigned long x_time);
+void  nabi_latency_add(int stage, long long start);
+void  nabi_latency_event_end(void);
+
+void  nabi_latency_set_slo(int msec);
+char* nabi_latency_get_report(int verbose);
+void  nabi_latency_dump(void);
+void  nabi_latency_reset(void);
+
+#endif /* nabi_latency_h */
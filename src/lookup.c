@@ -0,0 +1,147 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <ctype.h>
+
+#include "debug.h"
+#include "util.h"
+#include "lookup.h"
+
+/* the last word of the preedit string, normalized for the search.
+ * label points the word in the preedit string, for the candidate window.
+ * NULL if there is nothing to search */
+char*
+nabi_lookup_make_key(const char* preedit, const char** label)
+{
+    const char* key = preedit;
+    const char* p;
+    char* normalized;
+
+    p = strrchr(key, ' ');
+    if (p != NULL)
+	key = p;
+
+    while (isspace(*key) || ispunct(*key))
+	key++;
+
+    if (key[0] == '\0')
+	return NULL;
+
+    /* candidate 검색을 위한 스트링이 자모형일 수도 있으므로 normalized하여
+     * hanja table에서 검색을 해야 한다. */
+    normalized = g_utf8_normalize(key, -1,
+				  G_NORMALIZE_DEFAULT_COMPOSE);
+    if (normalized == NULL)
+	return NULL;
+
+    if (label != NULL)
+	*label = key;
+
+    return normalized;
+}
+
+gboolean
+nabi_lookup_is_valid_str(GIConv cd, const char* str)
+{
+    size_t ret;
+    gchar buf[32];
+    gsize inbytesleft, outbytesleft;
+    gchar *inbuf, *outbuf;
+
+    if (cd == (GIConv)-1)
+	return TRUE;
+
+    inbuf = (char*)str;
+    outbuf = buf;
+    inbytesleft = strlen(str);
+    outbytesleft = sizeof(buf);
+    ret = g_iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
+    if (ret == -1)
+	return FALSE;
+    return TRUE;
+}
+
+/* symbols first, then hanja */
+void
+nabi_lookup_run(NabiLookup* lookup)
+{
+    NabiDictList* list;
+    GIConv cd = (GIConv)-1;
+    int i, n;
+
+    nabi_log(6, "lookup string: %s\n", lookup->key);
+    if (lookup->match_prefix)
+	list = nabi_dict_match_prefix(lookup->symbol_table, lookup->key);
+    else
+	list = nabi_dict_match_suffix(lookup->symbol_table, lookup->key);
+
+    if (list == NULL) {
+	if (lookup->match_prefix)
+	    list = nabi_dict_match_prefix(lookup->hanja_table, lookup->key);
+	else
+	    list = nabi_dict_match_suffix(lookup->hanja_table, lookup->key);
+    }
+
+    lookup->list = list;
+    lookup->valid_list = NULL;
+    lookup->valid_list_length = 0;
+    if (list == NULL)
+	return;
+
+    /* a descriptor of its own, the lookup may run on any thread */
+    if (lookup->encoding != NULL)
+	cd = g_iconv_open(lookup->encoding, "UTF-8");
+
+    n = nabi_dict_list_get_size(list);
+    lookup->valid_list = g_new(const NabiDictItem*, n);
+    for (i = 0; i < n; i++) {
+	const NabiDictItem* hanja = nabi_dict_list_get_nth(list, i);
+
+	if (!nabi_lookup_is_valid_str(cd, hanja->value))
+	    continue;
+
+	if (lookup->use_simplified_chinese) {
+	    char* simplified = nabi_traditional_to_simplified(hanja->value);
+	    if (nabi_lookup_is_valid_str(cd, simplified))
+		nabi_dict_list_set_value(list, i, simplified);
+	    g_free(simplified);
+	}
+
+	lookup->valid_list[lookup->valid_list_length] = hanja;
+	lookup->valid_list_length++;
+    }
+
+    if (cd != (GIConv)-1)
+	g_iconv_close(cd);
+}
+
+/* free the results which nobody took */
+void
+nabi_lookup_clear(NabiLookup* lookup)
+{
+    nabi_dict_list_delete(lookup->list);
+    g_free(lookup->valid_list);
+    lookup->list = NULL;
+    lookup->valid_list = NULL;
+    lookup->valid_list_length = 0;
+}
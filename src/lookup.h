@@ -0,0 +1,53 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_lookup_h
+#define nabi_lookup_h
+
+#include <glib.h>
+
+#include "dictionary.h"
+
+/* candidate search: the symbols or hanja of a preedit string which the
+ * client can take. It only reads the tables, so the lookup thread of
+ * nabi runs it; nabi-bench calls it directly. */
+
+typedef struct _NabiLookup NabiLookup;
+
+struct _NabiLookup {
+    /* input */
+    NabiDict*   symbol_table;
+    NabiDict*   hanja_table;
+    const char* key;		/* from nabi_lookup_make_key() */
+    gboolean    match_prefix;
+    const char* encoding;	/* of the client, NULL for UTF-8 */
+    gboolean    use_simplified_chinese;
+
+    /* output */
+    NabiDictList*        list;
+    const NabiDictItem** valid_list;
+    int                  valid_list_length;
+};
+
+char*    nabi_lookup_make_key(const char* preedit, const char** label);
+void     nabi_lookup_run(NabiLookup* lookup);
+void     nabi_lookup_clear(NabiLookup* lookup);
+
+gboolean nabi_lookup_is_valid_str(GIConv cd, const char* str);
+
+#endif /* nabi_lookup_h */
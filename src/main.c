@@ -23,7 +23,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <langinfo.h>
+#include <locale.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <X11/Xlib.h>
 #include <gdk/gdkx.h>
@@ -34,10 +36,96 @@
 #include "session.h"
 #include "nabi.h"
 #include "debug.h"
+#include "latency.h"
+#include "trace.h"
+#include "stat.h"
+#include "control.h"
+#include "../IMdkit/Xi18nReplay.h"
 
 NabiApplication* nabi = NULL;
 NabiServer* nabi_server = NULL;
 
+/* SIGUSR1 dumps the latency histograms, SIGUSR2 the trace ring,
+ * the signal handler only writes to a pipe watched by the main loop */
+static int dump_pipe[2] = { -1, -1 };
+
+static void
+on_dump_signal(int signo)
+{
+    char c = signo == SIGUSR2 ? 1 : 0;
+    ssize_t ret;
+
+    ret = write(dump_pipe[1], &c, 1);
+    (void)ret;
+}
+
+/* SIGRTMIN + n sets the log level to n */
+static void
+on_log_level_signal(int signo)
+{
+    nabi_log_set_level(signo - SIGRTMIN);
+}
+
+/* on the way out, written before the ring goes away */
+static void
+nabi_dump_trace(void)
+{
+    char* filename;
+
+    if (!nabi_trace_is_enabled())
+	return;
+
+    filename = nabi_trace_get_dump_filename();
+    if (nabi_trace_dump(filename))
+	fprintf(stderr, "Nabi: trace dump: %s\n", filename);
+    else
+	fprintf(stderr, "Nabi: can't write trace dump: %s\n", filename);
+    g_free(filename);
+}
+
+static gboolean
+on_dump_request(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    char c;
+
+    if (read(dump_pipe[0], &c, 1) == 1) {
+	if (c == 0) {
+	    nabi_latency_dump();
+	} else if (nabi_trace_is_enabled()) {
+	    char* filename = nabi_trace_get_dump_filename();
+	    nabi_trace_dump_async(filename);
+	    g_free(filename);
+	}
+    }
+
+    return TRUE;
+}
+
+static void
+nabi_install_dump_handler(void)
+{
+    GIOChannel *channel;
+
+    if (pipe(dump_pipe) != 0)
+	return;
+
+    channel = g_io_channel_unix_new(dump_pipe[0]);
+    g_io_add_watch(channel, G_IO_IN, on_dump_request, NULL);
+    g_io_channel_unref(channel);
+
+    signal(SIGUSR1, on_dump_signal);
+    signal(SIGUSR2, on_dump_signal);
+}
+
+static void
+nabi_install_log_level_handler(void)
+{
+    int i;
+
+    for (i = 0; i <= 9 && SIGRTMIN + i <= SIGRTMAX; i++)
+	signal(SIGRTMIN + i, on_log_level_signal);
+}
+
 static int
 nabi_x_error_handler(Display *display, XErrorEvent *error)
 {
@@ -54,12 +142,44 @@ nabi_x_io_error_handler(Display* display)
 {
     nabi_log(1, "x io error: save config\n");
 
+    nabi_dump_trace();
+    if (nabi_server != NULL)
+	nabi_server_stop_workers(nabi_server);
+    nabi_stat_close();
+    nabi_control_stop();
     nabi_server_write_log(nabi_server);
     nabi_app_save_config();
 
     exit(0);
 }
 
+/* replay needs neither gtk nor a display: the keysyms come from the
+ * fixed keymap in ic.c and nothing is drawn, so its output depends only
+ * on the capture, the config and the locale */
+static int
+nabi_replay(const char *xim_name)
+{
+    int ret;
+    char *report;
+
+    nabi_server = nabi_server_new(NULL, 0, xim_name);
+    nabi_app_setup_server();
+
+    ret = nabi_server_replay(nabi_server,
+			     nabi->replay_file, nabi->replay_output);
+    report = nabi_latency_get_report(TRUE);
+    nabi_log(1, "%s", report);
+    g_free(report);
+
+    nabi_server_stop(nabi_server);
+    nabi_server_destroy(nabi_server);
+    nabi_server = NULL;
+    nabi_dump_trace();
+    nabi_trace_free();
+    nabi_app_free();
+    return ret;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -71,12 +191,34 @@ main(int argc, char *argv[])
     textdomain(PACKAGE);
 #endif
 
-    gtk_init(&argc, &argv);
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    /* candidate lookup runs on a worker thread */
+    if (!g_thread_supported())
+	g_thread_init(NULL);
+#endif
+
+    /* gtk_init() would set it again, replay does not call it */
+    setlocale(LC_ALL, "");
 
     nabi_log_set_device("stdout");
 
     nabi_app_new();
-    nabi_app_init(&argc, &argv);
+    nabi_app_parse_options(&argc, &argv);
+
+    /* the ring records up to --trace-level, -d only sets what is
+     * printed; every message recorded is formatted, so 9 is costly */
+    if (nabi->trace_size > 0 && nabi_trace_init(nabi->trace_size))
+	nabi_log_set_trace_level(nabi->trace_level);
+    nabi_install_log_level_handler();
+
+    if (nabi->replay_file != NULL) {
+	if (nabi->xim_name != NULL)
+	    return nabi_replay(nabi->xim_name);
+	return nabi_replay(nabi->config->xim_name->str);
+    }
+
+    gtk_init(&argc, &argv);
+    nabi_app_init();
 
     XSetErrorHandler(nabi_x_error_handler);
     XSetIOErrorHandler(nabi_x_io_error_handler);
@@ -109,6 +251,11 @@ main(int argc, char *argv[])
 
     if (nabi_server != NULL) {
 	nabi_server_start(nabi_server);
+	nabi_stat_open(DisplayString(nabi_server->display));
+	nabi_control_start(DisplayString(nabi_server->display));
+	nabi_install_dump_handler();
+	if (nabi->capture_file != NULL)
+	    Xi18nCaptureStart(nabi->capture_file);
     }
 
     if (nabi_log_get_level() == 0)
@@ -120,13 +267,18 @@ main(int argc, char *argv[])
 	nabi_session_close();
 
     if (nabi_server != NULL) {
+	nabi_control_stop();
+	Xi18nCaptureStop();
 	nabi_server_stop(nabi_server);
 	nabi_server_write_log(nabi_server);
 	nabi_server_destroy(nabi_server);
 	nabi_server = NULL;
+	nabi_stat_close();
     }
     
 quit:
+    nabi_dump_trace();
+    nabi_trace_free();
     nabi_app_free();
 
     return 0;
@@ -0,0 +1,566 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* nabi-bench: drive the keystroke engine in-process, without X
+ * connections or XIM, and report per keyboard of libhangul:
+ *
+ *   keys/sec, allocations per key, commits per key
+ *   and whether the committed text reproduces the corpus
+ *
+ * usage: nabi-bench [-n repeat] [-k keyboard] [-w] [-c corpus | -t keys]
+ *                   [-d dictionary]
+ *
+ * The corpus is UTF-8 text. For each keyboard it is converted to the
+ * qwerty keys which type it: the key of each jamo is found by
+ * probing the keyboard through the translate callback, compound jamos
+ * are typed as their parts. Lines using a character the keyboard
+ * can not type are skipped for that keyboard.
+ * With -t the given string is typed as it is, there is no check.
+ * With -d the candidate search is measured too: every word of the
+ * corpus is looked up in the dictionary like the hanja key does.
+ * The exit status is 1 when a line is not reproduced by a keyboard. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+
+#include "engine.h"
+#include "lookup.h"
+
+static const char default_corpus[] =
+    "동해 물과 백두산이 마르고 닳도록\n"
+    "하느님이 보우하사 우리나라 만세.\n"
+    "무궁화 삼천리 화려 강산\n"
+    "대한 사람 대한으로 길이 보전하세.\n"
+    "남산 위에 저 소나무 철갑을 두른 듯\n"
+    "바람 서리 불변함은 우리 기상일세.\n"
+    "가을 하늘 공활한데 높고 구름 없이\n"
+    "밝은 달은 우리 가슴 일편단심일세.\n"
+    "이 기상과 이 맘으로 충성을 다하여\n"
+    "괴로우나 즐거우나 나라 사랑하세.\n";
+
+typedef struct {
+    GString*      output;	/* committed and forwarded text */
+    unsigned long commits;
+    ucschar       translated;	/* the last key the keyboard translated */
+} BenchState;
+
+typedef struct {
+    ucschar jamo;
+    ucschar first;
+    ucschar second;
+} JamoPair;
+
+/* compound jamos typed as two keys */
+static const JamoPair compound_jamos[] = {
+    { 0x1101, 0x1100, 0x1100 },	/* ㄲ */
+    { 0x1104, 0x1103, 0x1103 },	/* ㄸ */
+    { 0x1108, 0x1107, 0x1107 },	/* ㅃ */
+    { 0x110a, 0x1109, 0x1109 },	/* ㅆ */
+    { 0x110d, 0x110c, 0x110c },	/* ㅉ */
+    { 0x116a, 0x1169, 0x1161 },	/* ㅘ */
+    { 0x116b, 0x1169, 0x1162 },	/* ㅙ */
+    { 0x116c, 0x1169, 0x1175 },	/* ㅚ */
+    { 0x116f, 0x116e, 0x1165 },	/* ㅝ */
+    { 0x1170, 0x116e, 0x1166 },	/* ㅞ */
+    { 0x1171, 0x116e, 0x1175 },	/* ㅟ */
+    { 0x1174, 0x1173, 0x1175 },	/* ㅢ */
+    { 0x11a9, 0x11a8, 0x11a8 },	/* ㄲ */
+    { 0x11aa, 0x11a8, 0x11ba },	/* ㄳ */
+    { 0x11ac, 0x11ab, 0x11bd },	/* ㄵ */
+    { 0x11ad, 0x11ab, 0x11c2 },	/* ㄶ */
+    { 0x11b0, 0x11af, 0x11a8 },	/* ㄺ */
+    { 0x11b1, 0x11af, 0x11b7 },	/* ㄻ */
+    { 0x11b2, 0x11af, 0x11b8 },	/* ㄼ */
+    { 0x11b3, 0x11af, 0x11ba },	/* ㄽ */
+    { 0x11b4, 0x11af, 0x11c0 },	/* ㄾ */
+    { 0x11b5, 0x11af, 0x11c1 },	/* ㄿ */
+    { 0x11b6, 0x11af, 0x11c2 },	/* ㅀ */
+    { 0x11b9, 0x11b8, 0x11ba },	/* ㅄ */
+    { 0x11bb, 0x11ba, 0x11ba },	/* ㅆ */
+};
+
+/* jongseong 0x11a8 - 0x11c2 as choseong, for the keyboards which
+ * have only choseong keys like 2 set */
+static const ucschar jongseong_to_choseong[] = {
+    0x1100, 0x1101, 0,      0x1102, 0,      0,      0x1103, 0x1105,
+    0,      0,      0,      0,      0,      0,      0,      0x1106,
+    0x1107, 0,      0x1109, 0x110a, 0x110b, 0x110c, 0x110e, 0x110f,
+    0x1110, 0x1111, 0x1112
+};
+
+#ifdef __GLIBC__
+/* count the heap allocations of the engine, glib and libhangul */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long n_allocs = 0;
+
+void*
+malloc(size_t size)
+{
+    n_allocs++;
+    return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+    n_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* ptr, size_t size)
+{
+    n_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT 1
+#else
+static unsigned long n_allocs = 0;
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+static void
+bench_on_commit(NabiEngine* engine, const char* str, gpointer data)
+{
+    BenchState* state = (BenchState*)data;
+
+    state->commits++;
+    g_string_append(state->output, str);
+}
+
+static void
+bench_on_flush(NabiEngine* engine, gpointer data)
+{
+    nabi_engine_flush(engine);
+}
+
+static void
+bench_on_translate(NabiEngine* engine, ucschar c, gpointer data)
+{
+    BenchState* state = (BenchState*)data;
+
+    state->translated = c;
+}
+
+static const NabiEngineSink bench_sink = {
+    bench_on_commit,
+    bench_on_flush,
+    NULL,
+    bench_on_translate
+};
+
+static long long
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the same dispatch as nabi_ic_process_keyevent(): the keys out of
+ * the automata range flush and go to the client, so does a key the
+ * automata did not take */
+static void
+bench_type_key(NabiEngine* engine, BenchState* state, KeySym keysym)
+{
+    gboolean ret = FALSE;
+
+    if (keysym == XK_BackSpace) {
+	nabi_engine_backspace(engine);
+	return;
+    }
+
+    if (keysym >= XK_exclam && keysym <= XK_asciitilde)
+	ret = nabi_engine_process(engine, keysym);
+    else
+	nabi_engine_flush(engine);
+
+    if (!ret) {
+	if (keysym == XK_Return)
+	    g_string_append_c(state->output, '\n');
+	else if (keysym <= XK_asciitilde)
+	    g_string_append_c(state->output, (char)keysym);
+    }
+}
+
+/* char -> key of the keyboard, found by typing every key once */
+static GHashTable*
+bench_probe_keyboard(NabiEngine* engine, BenchState* state)
+{
+    GHashTable* keymap = g_hash_table_new(NULL, NULL);
+    int pass, key;
+
+    /* unshifted keys first */
+    for (pass = 0; pass < 2; pass++) {
+	for (key = XK_exclam; key <= XK_asciitilde; key++) {
+	    gpointer c;
+
+	    if ((pass == 0) == (key >= 'A' && key <= 'Z'))
+		continue;
+
+	    state->translated = 0;
+	    nabi_engine_process(engine, key);
+	    nabi_engine_reset(engine);
+
+	    if (state->translated == 0)
+		continue;
+	    c = GUINT_TO_POINTER(state->translated);
+	    if (g_hash_table_lookup(keymap, c) == NULL)
+		g_hash_table_insert(keymap, c, GINT_TO_POINTER(key));
+	}
+    }
+    g_string_truncate(state->output, 0);
+    state->commits = 0;
+
+    return keymap;
+}
+
+static gboolean
+bench_append_jamo(GHashTable* keymap, ucschar c, GArray* keys)
+{
+    KeySym key;
+    guint i;
+
+    key = GPOINTER_TO_INT(g_hash_table_lookup(keymap, GUINT_TO_POINTER(c)));
+    if (key != 0) {
+	g_array_append_val(keys, key);
+	return TRUE;
+    }
+
+    if (c >= 0x11a8 && c <= 0x11c2) {
+	ucschar cho = jongseong_to_choseong[c - 0x11a8];
+	key = GPOINTER_TO_INT(g_hash_table_lookup(keymap,
+						  GUINT_TO_POINTER(cho)));
+	if (cho != 0 && key != 0) {
+	    g_array_append_val(keys, key);
+	    return TRUE;
+	}
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(compound_jamos); i++) {
+	if (compound_jamos[i].jamo == c) {
+	    return bench_append_jamo(keymap, compound_jamos[i].first, keys) &&
+		   bench_append_jamo(keymap, compound_jamos[i].second, keys);
+	}
+    }
+
+    return FALSE;
+}
+
+/* the keys typing the line, FALSE if the keyboard can not type it */
+static gboolean
+bench_line_to_keys(GHashTable* keymap, const char* line, GArray* keys)
+{
+    const char* p;
+
+    for (p = line; *p != '\0'; p = g_utf8_next_char(p)) {
+	ucschar c = g_utf8_get_char(p);
+	KeySym key;
+
+	if (hangul_is_syllable(c)) {
+	    ucschar cho, jung, jong;
+
+	    hangul_syllable_to_jamos(c, &cho, &jung, &jong);
+	    if (!bench_append_jamo(keymap, cho, keys) ||
+		!bench_append_jamo(keymap, jung, keys))
+		return FALSE;
+	    if (jong != 0 && !bench_append_jamo(keymap, jong, keys))
+		return FALSE;
+	    continue;
+	}
+
+	if (c == ' ') {
+	    key = XK_space;
+	} else {
+	    key = GPOINTER_TO_INT(g_hash_table_lookup(keymap,
+						      GUINT_TO_POINTER(c)));
+	    if (key == 0)
+		return FALSE;
+	}
+	g_array_append_val(keys, key);
+    }
+
+    return TRUE;
+}
+
+/* returns the number of lines which are not reproduced */
+static int
+bench_keyboard(const char* keyboard, const char* corpus, const char* raw,
+	       int repeat, gboolean word_commit)
+{
+    NabiEngineConfig config;
+    NabiEngine engine;
+    BenchState state;
+    GHashTable* keymap;
+    GArray* keys;
+    GString* expected;
+    char** lines;
+    int n_lines = 0, n_skipped = 0, n_wrong = 0;
+    long long start, elapsed;
+    unsigned long allocs;
+    int r;
+    double n_keys;
+    KeySym return_key = XK_Return;
+    guint i;
+
+    config.hangul_keyboard = keyboard;
+    config.word_commit = word_commit;
+    config.auto_reorder = TRUE;
+    config.jamo_output = FALSE;
+
+    state.output = g_string_sized_new(4096);
+    state.commits = 0;
+    state.translated = 0;
+
+    nabi_engine_init(&engine, &config, &bench_sink, &state);
+    keys = g_array_new(FALSE, FALSE, sizeof(KeySym));
+    expected = g_string_new(NULL);
+
+    if (raw != NULL) {
+	const char* p;
+	for (p = raw; *p != '\0'; p++) {
+	    KeySym key = (unsigned char)*p;
+	    g_array_append_val(keys, key);
+	}
+	lines = NULL;
+    } else {
+	keymap = bench_probe_keyboard(&engine, &state);
+	lines = g_strsplit(corpus, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+	    guint len = keys->len;
+
+	    if (lines[i][0] == '\0')
+		continue;
+	    n_lines++;
+	    if (!bench_line_to_keys(keymap, lines[i], keys)) {
+		g_array_set_size(keys, len);
+		n_skipped++;
+		continue;
+	    }
+
+	    g_array_append_val(keys, return_key);
+	    g_string_append(expected, lines[i]);
+	    g_string_append_c(expected, '\n');
+	}
+	g_hash_table_destroy(keymap);
+    }
+
+    /* the first pass is for the check, the hic is made here too */
+    for (i = 0; i < keys->len; i++)
+	bench_type_key(&engine, &state, g_array_index(keys, KeySym, i));
+    nabi_engine_flush(&engine);
+
+    if (lines != NULL) {
+	char** out = g_strsplit(state.output->str, "\n", -1);
+	char** exp = g_strsplit(expected->str, "\n", -1);
+	gboolean out_end = FALSE;
+	int j;
+
+	for (j = 0; exp[j] != NULL && exp[j][0] != '\0'; j++) {
+	    const char* got = "";
+
+	    if (!out_end && out[j] == NULL)
+		out_end = TRUE;
+	    if (!out_end)
+		got = out[j];
+
+	    if (strcmp(got, exp[j]) != 0) {
+		fprintf(stderr, "%s: expected '%s', got '%s'\n",
+			keyboard, exp[j], got);
+		n_wrong++;
+	    }
+	}
+	g_strfreev(out);
+	g_strfreev(exp);
+	g_strfreev(lines);
+    }
+
+    state.commits = 0;
+    allocs = n_allocs;
+    start = bench_now();
+    for (r = 0; r < repeat; r++) {
+	guint j;
+
+	g_string_truncate(state.output, 0);
+	for (j = 0; j < keys->len; j++)
+	    bench_type_key(&engine, &state, g_array_index(keys, KeySym, j));
+	nabi_engine_flush(&engine);
+    }
+    elapsed = bench_now() - start;
+    allocs = n_allocs - allocs;
+
+    n_keys = (double)keys->len * repeat;
+    if (n_keys > 0 && elapsed > 0) {
+	printf("%-12s %12.0f keys/s ", keyboard, n_keys * 1e9 / elapsed);
+	if (HAVE_ALLOC_COUNT)
+	    printf("%6.2f allocs/key ", allocs / n_keys);
+	else
+	    printf("%6s allocs/key ", "n/a");
+	printf("%5.3f commits/key ", state.commits / n_keys);
+    } else {
+	printf("%-12s %12s keys/s ", keyboard, "n/a");
+    }
+    if (lines != NULL)
+	printf("%3d/%d lines ok, %d skipped\n",
+	       n_lines - n_skipped - n_wrong, n_lines, n_skipped);
+    else
+	printf("\n");
+
+    nabi_engine_clear(&engine);
+    g_array_free(keys, TRUE);
+    g_string_free(expected, TRUE);
+    g_string_free(state.output, TRUE);
+
+    return n_wrong;
+}
+
+/* the suffix search of nabi_ic_update_candidate_window() for each word */
+static void
+bench_lookup(const char* filename, const char* corpus, int repeat)
+{
+    NabiDict* dict;
+    NabiLookup lookup;
+    char** words;
+    long long start, elapsed;
+    unsigned long n_lookups = 0;
+    unsigned long n_items = 0;
+    int r, i;
+
+    dict = nabi_dict_load(filename, NULL);
+    if (dict == NULL) {
+	fprintf(stderr, "nabi-bench: can't load %s\n", filename);
+	return;
+    }
+
+    words = g_strsplit_set(corpus, " \n", -1);
+
+    start = bench_now();
+    for (r = 0; r < repeat; r++) {
+	for (i = 0; words[i] != NULL; i++) {
+	    char* key = nabi_lookup_make_key(words[i], NULL);
+	    if (key == NULL)
+		continue;
+
+	    memset(&lookup, 0, sizeof(lookup));
+	    lookup.hanja_table = dict;
+	    lookup.key = key;
+	    lookup.match_prefix = FALSE;
+	    nabi_lookup_run(&lookup);
+
+	    n_lookups++;
+	    n_items += lookup.valid_list_length;
+	    nabi_lookup_clear(&lookup);
+	    g_free(key);
+	}
+    }
+    elapsed = bench_now() - start;
+
+    if (n_lookups > 0 && elapsed > 0) {
+	printf("%-12s %12.0f lookups/s %6.2f items/lookup (%s)\n", "lookup",
+	       n_lookups * 1e9 / elapsed, (double)n_items / n_lookups,
+	       nabi_dict_is_mapped(dict) ? "mapped" : "text table");
+    } else {
+	printf("%-12s %12s lookups/s\n", "lookup", "n/a");
+    }
+
+    g_strfreev(words);
+    nabi_dict_delete(dict);
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* keyboard = NULL;
+    const char* raw = NULL;
+    const char* dictionary = NULL;
+    char* corpus = NULL;
+    gboolean word_commit = FALSE;
+    int repeat = 1000;
+    int n_wrong = 0;
+    int i;
+
+    /* let the g_slice allocations show up in the count */
+    setenv("G_SLICE", "always-malloc", 1);
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+	    repeat = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+	    keyboard = argv[++i];
+	} else if (strcmp(argv[i], "-w") == 0) {
+	    word_commit = TRUE;
+	} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+	    GError* error = NULL;
+	    if (!g_file_get_contents(argv[++i], &corpus, NULL, &error)) {
+		fprintf(stderr, "nabi-bench: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	    }
+	} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+	    raw = argv[++i];
+	} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+	    dictionary = argv[++i];
+	} else {
+	    fprintf(stderr,
+		    "usage: %s [-n repeat] [-k keyboard] [-w] "
+		    "[-c corpus | -t keys] [-d dictionary]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if (corpus == NULL)
+	corpus = g_strdup(default_corpus);
+
+    if (!g_utf8_validate(corpus, -1, NULL)) {
+	fprintf(stderr, "nabi-bench: the corpus is not UTF-8\n");
+	return 1;
+    }
+
+    if (keyboard != NULL) {
+	n_wrong = bench_keyboard(keyboard, corpus, raw, repeat, word_commit);
+    } else {
+	int n = hangul_ic_get_n_keyboards();
+	for (i = 0; i < n; i++)
+	    n_wrong += bench_keyboard(hangul_ic_get_keyboard_id(i), corpus,
+				      raw, repeat, word_commit);
+    }
+
+    if (dictionary != NULL)
+	bench_lookup(dictionary, corpus, repeat);
+
+    g_free(corpus);
+
+    if (n_wrong > 0) {
+	fprintf(stderr, "nabi-bench: %d lines are not reproduced\n", n_wrong);
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,396 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* nabi-stat: print the live counters of a running nabi
+ *
+ * usage: nabi-stat [-d display] [-a | -l] [interval [count]]
+ *
+ * Like vmstat, the first line is the average since nabi started and
+ * the next ones are the rates of each interval. -a prints all the
+ * counters as "name value" lines for scripts, -l lists the segments
+ * of the user. nabi keeps the counters in the shared memory segment
+ * described in stat-format.h. */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "stat-format.h"
+#include "xim_protocol.h"
+
+#define N_XIM_PROTOCOL_NAMES \
+    (sizeof(xim_protocol_name) / sizeof(xim_protocol_name[0]))
+
+static const long long bucket_limits[NABI_STAT_N_BUCKETS - 1] = {
+    NABI_STAT_BUCKET_LIMITS
+};
+
+static const char* stage_names[NABI_STAT_N_STAGES] = {
+    NABI_STAT_STAGE_NAMES
+};
+
+static const NabiStatSegment*
+open_segment(const char* name)
+{
+    int fd;
+    struct stat st;
+    void* addr;
+    const NabiStatSegment* segment;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+	fprintf(stderr, "nabi-stat: can't open %s: %s\n",
+		name, strerror(errno));
+	return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_uid != getuid()) {
+	fprintf(stderr, "nabi-stat: %s is not owned by you\n", name);
+	close(fd);
+	return NULL;
+    }
+
+    if (st.st_size < (off_t)sizeof(NabiStatSegment)) {
+	fprintf(stderr, "nabi-stat: %s is too small\n", name);
+	close(fd);
+	return NULL;
+    }
+
+    addr = mmap(NULL, sizeof(NabiStatSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+	fprintf(stderr, "nabi-stat: can't map %s: %s\n",
+		name, strerror(errno));
+	return NULL;
+    }
+
+    segment = addr;
+    if (memcmp(segment->magic, NABI_STAT_MAGIC, NABI_STAT_MAGIC_LEN) != 0 ||
+	segment->version != NABI_STAT_VERSION ||
+	segment->size != sizeof(NabiStatSegment)) {
+	fprintf(stderr, "nabi-stat: %s is not a nabi stat segment "
+			"of this version\n", name);
+	munmap(addr, sizeof(NabiStatSegment));
+	return NULL;
+    }
+
+    return segment;
+}
+
+static int
+list_segments(void)
+{
+    DIR* dir;
+    struct dirent* entry;
+    char prefix[64];
+    size_t len;
+
+    /* shm_open() names live in /dev/shm on linux */
+    dir = opendir("/dev/shm");
+    if (dir == NULL) {
+	fprintf(stderr, "nabi-stat: can't open /dev/shm: %s\n",
+		strerror(errno));
+	return 1;
+    }
+
+    snprintf(prefix, sizeof(prefix), "nabi-%u-", (unsigned int)getuid());
+    len = strlen(prefix);
+    while ((entry = readdir(dir)) != NULL) {
+	if (strncmp(entry->d_name, prefix, len) == 0)
+	    printf("/%s\n", entry->d_name);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+static uint64_t
+sum(const uint64_t* counters, int n)
+{
+    uint64_t ret = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+	ret += counters[i];
+    return ret;
+}
+
+/* upper limit of the bucket of the percentile, in usec */
+static void
+format_percentile(char* buf, size_t len,
+		  const uint64_t* now, const uint64_t* prev, double percent)
+{
+    uint64_t count[NABI_STAT_N_BUCKETS];
+    uint64_t total = 0, acc = 0, rank;
+    int i;
+
+    for (i = 0; i < NABI_STAT_N_BUCKETS; i++) {
+	count[i] = now[i] - (prev != NULL ? prev[i] : 0);
+	total += count[i];
+    }
+
+    if (total == 0) {
+	snprintf(buf, len, "-");
+	return;
+    }
+
+    rank = (uint64_t)(total * percent / 100.0 + 0.5);
+    if (rank == 0)
+	rank = 1;
+    for (i = 0; i < NABI_STAT_N_BUCKETS - 1; i++) {
+	acc += count[i];
+	if (acc >= rank) {
+	    snprintf(buf, len, "%lld", bucket_limits[i]);
+	    return;
+	}
+    }
+    snprintf(buf, len, ">%lld", bucket_limits[NABI_STAT_N_BUCKETS - 2]);
+}
+
+static void
+print_header(void)
+{
+    printf("%5s %5s %8s %8s %8s %8s %7s %7s %6s %7s %7s\n",
+	   "conn", "ics", "keys/s", "in/s", "out/s", "commit/s",
+	   "sync/s", "wc-rt/s", "wc-hit", "p50us", "p99us");
+}
+
+/* prev == NULL means since the start */
+static void
+print_row(const NabiStatSegment* now, const NabiStatSegment* prev,
+	  double seconds)
+{
+    static const NabiStatSegment zero;
+    const uint64_t* total = now->latency[NABI_STAT_N_STAGES - 1];
+    uint64_t hits, lookups;
+    char hit[16];
+    char p50[16];
+    char p99[16];
+
+    if (seconds <= 0.0)
+	seconds = 1.0;
+    if (prev == NULL)
+	prev = &zero;
+
+    hits = now->window_cache_hits - prev->window_cache_hits;
+    lookups = hits + now->window_cache_misses - prev->window_cache_misses;
+    if (lookups > 0)
+	snprintf(hit, sizeof(hit), "%.1f%%", hits * 100.0 / lookups);
+    else
+	snprintf(hit, sizeof(hit), "-");
+
+    format_percentile(p50, sizeof(p50), total,
+		      prev->latency[NABI_STAT_N_STAGES - 1], 50.0);
+    format_percentile(p99, sizeof(p99), total,
+		      prev->latency[NABI_STAT_N_STAGES - 1], 99.0);
+
+    printf("%5llu %5llu %8.1f %8.1f %8.1f %8.1f %7.1f %7.1f %6s %7s %7s\n",
+	   (unsigned long long)now->connections,
+	   (unsigned long long)now->ics,
+	   (now->keys - prev->keys) / seconds,
+	   (sum(now->msg_in, NABI_STAT_N_OPCODES) -
+	    sum(prev->msg_in, NABI_STAT_N_OPCODES)) / seconds,
+	   (sum(now->msg_out, NABI_STAT_N_OPCODES) -
+	    sum(prev->msg_out, NABI_STAT_N_OPCODES)) / seconds,
+	   (now->commits - prev->commits) / seconds,
+	   (now->sync_waits - prev->sync_waits) / seconds,
+	   (now->window_cache_round_trips -
+	    prev->window_cache_round_trips) / seconds,
+	   hit, p50, p99);
+    fflush(stdout);
+}
+
+static const char*
+opcode_name(int opcode, char* buf, size_t len)
+{
+    if (opcode > 0 && (size_t)opcode < N_XIM_PROTOCOL_NAMES &&
+	strcmp(xim_protocol_name[opcode], "XIM_UNKNOWN") != 0)
+	return xim_protocol_name[opcode];
+
+    snprintf(buf, len, "%d", opcode);
+    return buf;
+}
+
+static void
+print_all(const NabiStatSegment* s)
+{
+    char buf[16];
+    int i, j;
+
+#define PRINT(field) \
+    printf("%s %llu\n", #field, (unsigned long long)s->field)
+
+    PRINT(pid);
+    PRINT(start_time);
+    PRINT(connections);
+    PRINT(connections_total);
+    PRINT(ics);
+    PRINT(ics_total);
+    PRINT(ic_recycle_hits);
+    PRINT(ic_recycle_misses);
+    PRINT(ic_recycle_expired);
+    PRINT(ics_reclaimed);
+    PRINT(keys);
+    PRINT(commits);
+    PRINT(commit_bytes);
+    PRINT(sync_waits);
+    PRINT(window_cache_round_trips);
+    PRINT(window_cache_hits);
+    PRINT(window_cache_misses);
+    PRINT(candidate_lookups);
+    PRINT(candidate_stale);
+
+#undef PRINT
+
+    for (i = 0; i < NABI_STAT_N_OPCODES; i++) {
+	if (s->msg_in[i] > 0)
+	    printf("msg_in.%s %llu\n", opcode_name(i, buf, sizeof(buf)),
+		   (unsigned long long)s->msg_in[i]);
+    }
+    for (i = 0; i < NABI_STAT_N_OPCODES; i++) {
+	if (s->msg_out[i] > 0)
+	    printf("msg_out.%s %llu\n", opcode_name(i, buf, sizeof(buf)),
+		   (unsigned long long)s->msg_out[i]);
+    }
+
+    for (i = 0; i < NABI_STAT_N_STAGES; i++) {
+	for (j = 0; j < NABI_STAT_N_BUCKETS; j++) {
+	    if (j < NABI_STAT_N_BUCKETS - 1)
+		printf("latency.%s.lt%lld %llu\n", stage_names[i],
+		       bucket_limits[j],
+		       (unsigned long long)s->latency[i][j]);
+	    else
+		printf("latency.%s.ge%lld %llu\n", stage_names[i],
+		       bucket_limits[j - 1],
+		       (unsigned long long)s->latency[i][j]);
+	}
+    }
+}
+
+static double
+now_seconds(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-d display] [-a | -l] [interval [count]]\n",
+	    prog);
+    exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* display = getenv("DISPLAY");
+    const NabiStatSegment* segment;
+    NabiStatSegment prev;
+    NabiStatSegment now;
+    char name[256];
+    int all = 0;
+    int interval = 0;
+    long count = -1;
+    long rows;
+    double prev_time;
+    double now_time;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ad:lh")) != -1) {
+	switch (opt) {
+	case 'a':
+	    all = 1;
+	    break;
+	case 'd':
+	    display = optarg;
+	    break;
+	case 'l':
+	    return list_segments();
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    if (optind < argc) {
+	interval = atoi(argv[optind++]);
+	if (interval <= 0)
+	    usage(argv[0]);
+    }
+    if (optind < argc) {
+	count = atol(argv[optind++]);
+	if (count <= 0)
+	    usage(argv[0]);
+    }
+    if (optind < argc)
+	usage(argv[0]);
+
+    if (display == NULL) {
+	fprintf(stderr, "nabi-stat: DISPLAY is not set, use -d\n");
+	return 1;
+    }
+
+    nabi_stat_make_name(name, sizeof(name), getuid(), display);
+    segment = open_segment(name);
+    if (segment == NULL)
+	return 1;
+
+    memcpy(&now, segment, sizeof(now));
+    now_time = now_seconds();
+
+    if (all) {
+	print_all(&now);
+	return 0;
+    }
+
+    print_header();
+    print_row(&now, NULL, now_time - now.start_time / 1000000.0);
+
+    for (rows = 1; interval > 0 && (count < 0 || rows < count); rows++) {
+	sleep(interval);
+
+	/* nabi restarted, the segment is not the same anymore */
+	if (segment->pid != now.pid ||
+	    memcmp(segment->magic, NABI_STAT_MAGIC, NABI_STAT_MAGIC_LEN) != 0) {
+	    fprintf(stderr, "nabi-stat: nabi %lld has exited\n",
+		    (long long)now.pid);
+	    return 1;
+	}
+
+	prev = now;
+	prev_time = now_time;
+	memcpy(&now, segment, sizeof(now));
+	now_time = now_seconds();
+
+	if (rows % 20 == 0)
+	    print_header();
+	print_row(&now, &prev, now_time - prev_time);
+    }
+
+    return 0;
+}
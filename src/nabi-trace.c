@@ -0,0 +1,263 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* nabi-trace: print a trace dump of nabi as text
+ *
+ * usage: nabi-trace dump.bin
+ *
+ * nabi writes the dump on SIGUSR2 and at exit when it runs with
+ * --trace, see nabi_trace_dump(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace-format.h"
+
+static void*
+read_all(const char* filename, size_t* size)
+{
+    FILE* file;
+    char* data = NULL;
+    size_t len = 0, alloc = 0, n;
+
+    file = fopen(filename, "rb");
+    if (file == NULL)
+	return NULL;
+
+    do {
+	if (len == alloc) {
+	    alloc = alloc > 0 ? alloc * 2 : 65536;
+	    data = realloc(data, alloc);
+	    if (data == NULL) {
+		fclose(file);
+		return NULL;
+	    }
+	}
+	n = fread(data + len, 1, alloc - len, file);
+	len += n;
+    } while (n > 0);
+
+    fclose(file);
+    *size = len;
+    return data;
+}
+
+static const char*
+arg_str(const NabiTraceRecord* rec, uint64_t offset)
+{
+    if (offset == ~(uint64_t)0)
+	return "(null)";
+    if (offset >= NABI_TRACE_STR_SIZE)
+	return "";
+    return rec->str + offset;
+}
+
+/* print one conversion with printf, the length modifier is replaced
+ * by the one of the stored type */
+static void
+print_spec(const char* begin, const char* end, const NabiTraceSpec* spec,
+	   const NabiTraceRecord* rec, int n_args, int* arg)
+{
+    char buf[64];
+    size_t len = 0;
+    const char* p;
+    double d;
+
+    for (p = begin; p < end - 1 && len < sizeof(buf) - 24; p++) {
+	if (*p == '*') {
+	    int value = 0;
+	    if (*arg < n_args)
+		value = (int)rec->args[(*arg)++];
+	    len += snprintf(buf + len, sizeof(buf) - len, "%d", value);
+	} else if (strchr("hlqLjzt", *p) == NULL) {
+	    buf[len++] = *p;
+	}
+    }
+
+    if (*arg >= n_args) {
+	fputs("<?>", stdout);
+	return;
+    }
+
+    switch (rec->types[*arg] & ~NABI_TRACE_ARG_CUT) {
+    case NABI_TRACE_ARG_INT:
+	if (spec->conversion != 'c') {
+	    buf[len++] = 'l';
+	    buf[len++] = 'l';
+	}
+	buf[len++] = spec->conversion;
+	buf[len] = '\0';
+	printf(buf, (long long)rec->args[*arg]);
+	break;
+    case NABI_TRACE_ARG_UINT:
+	buf[len++] = 'l';
+	buf[len++] = 'l';
+	buf[len++] = spec->conversion;
+	buf[len] = '\0';
+	printf(buf, (unsigned long long)rec->args[*arg]);
+	break;
+    case NABI_TRACE_ARG_DOUBLE:
+	memcpy(&d, &rec->args[*arg], sizeof(d));
+	buf[len++] = spec->conversion;
+	buf[len] = '\0';
+	printf(buf, d);
+	break;
+    case NABI_TRACE_ARG_STR:
+	buf[len++] = 's';
+	buf[len] = '\0';
+	printf(buf, arg_str(rec, rec->args[*arg]));
+	if (rec->types[*arg] & NABI_TRACE_ARG_CUT)
+	    fputs("...", stdout);
+	break;
+    case NABI_TRACE_ARG_PTR:
+	printf("0x%llx", (unsigned long long)rec->args[*arg]);
+	break;
+    default:
+	fputs("<?>", stdout);
+	break;
+    }
+    (*arg)++;
+}
+
+static void
+print_record(const NabiTraceRecord* rec, const char* format)
+{
+    char stamp[32];
+    time_t sec = rec->time / 1000000;
+    struct tm* tm = localtime(&sec);
+    const char* p = format;
+    const char* end = format + strlen(format);
+    int arg = 0;
+    /* the dump may be damaged */
+    int n_args = rec->n_args;
+    int truncated = rec->truncated;
+
+    if (n_args > NABI_TRACE_MAX_ARGS) {
+	n_args = NABI_TRACE_MAX_ARGS;
+	truncated = 1;
+    }
+
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", tm);
+    printf("%s.%06u Nabi(%d): ", stamp,
+	   (unsigned int)(rec->time % 1000000), rec->level);
+
+    /* most messages end with a newline, some do not */
+    if (end > format && end[-1] == '\n')
+	end--;
+
+    while (p < end) {
+	const char* begin;
+	NabiTraceSpec spec;
+
+	if (*p != '%') {
+	    putchar(*p++);
+	    continue;
+	}
+
+	begin = p;
+	p = nabi_trace_parse_spec(p + 1, &spec);
+	if (spec.conversion == '%') {
+	    putchar('%');
+	    continue;
+	}
+	if (spec.conversion == '\0')
+	    break;
+
+	print_spec(begin, p, &spec, rec, n_args, &arg);
+    }
+
+    if (truncated)
+	fputs(" <truncated>", stdout);
+    putchar('\n');
+}
+
+int
+main(int argc, char* argv[])
+{
+    char* data;
+    size_t size = 0;
+    const NabiTraceHeader* header;
+    const char** formats;
+    const char* pool;
+    const NabiTraceRecord* records;
+    uint32_t i;
+
+    if (argc != 2) {
+	fprintf(stderr, "usage: %s dump.bin\n", argv[0]);
+	return 1;
+    }
+
+    data = read_all(argv[1], &size);
+    if (data == NULL) {
+	fprintf(stderr, "nabi-trace: can't read %s\n", argv[1]);
+	return 1;
+    }
+
+    header = (const NabiTraceHeader*)data;
+    if (size < sizeof(*header) ||
+	memcmp(header->magic, NABI_TRACE_MAGIC, NABI_TRACE_MAGIC_LEN) != 0 ||
+	header->version != NABI_TRACE_VERSION ||
+	header->byte_order != NABI_TRACE_BYTE_ORDER) {
+	fprintf(stderr, "nabi-trace: %s is not a trace dump of this machine\n",
+		argv[1]);
+	free(data);
+	return 1;
+    }
+
+    if (size < sizeof(*header) + header->formats_size +
+	       (size_t)header->n_records * sizeof(NabiTraceRecord)) {
+	fprintf(stderr, "nabi-trace: %s is truncated\n", argv[1]);
+	free(data);
+	return 1;
+    }
+
+    /* index the format pool */
+    pool = data + sizeof(*header);
+    formats = calloc(header->n_formats + 1, sizeof(char*));
+    if (formats == NULL) {
+	free(data);
+	return 1;
+    }
+    {
+	const char* p = pool;
+	const char* end = pool + header->formats_size;
+	for (i = 0; i < header->n_formats && p < end; i++) {
+	    formats[i] = p;
+	    p += strnlen(p, end - p) + 1;
+	}
+    }
+
+    /* records are not aligned after the pool, so copy them */
+    records = (const NabiTraceRecord*)(pool + header->formats_size);
+    for (i = 0; i < header->n_records; i++) {
+	NabiTraceRecord rec;
+
+	memcpy(&rec, records + i, sizeof(rec));
+	if (rec.format < header->n_formats && formats[rec.format] != NULL)
+	    print_record(&rec, formats[rec.format]);
+    }
+
+    if (header->lost > 0)
+	fprintf(stderr, "nabi-trace: %u records were lost\n", header->lost);
+
+    free(formats);
+    free(data);
+    return 0;
+}
@@ -35,6 +35,16 @@ struct _NabiApplication {
     gboolean	    status_only;
     gchar*	    session_id;
 
+    /* xim session capture and replay */
+    gchar*	    capture_file;
+    gchar*	    replay_file;
+    gchar*	    replay_output;
+
+    /* nabi_log() messages up to trace_level go to the trace ring of
+     * this many records, -d only sets what is printed to stdout */
+    int		    trace_size;
+    int		    trace_level;
+
     int             icon_size;
 
     /* hangul status data */
@@ -50,7 +60,8 @@ struct _NabiApplication {
 extern NabiApplication* nabi;
 
 void nabi_app_new(void);
-void nabi_app_init(int *argc, char ***argv);
+void nabi_app_parse_options(int *argc, char ***argv);
+void nabi_app_init(void);
 void nabi_app_setup_server(void);
 void nabi_app_quit(void);
 void nabi_app_free(void);
@@ -0,0 +1,54 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_probes_h
+#define nabi_probes_h
+
+/* USDT probes for bpftrace, perf or systemtap
+ * A probe is a nop until a tracer attaches to it, but the arguments are
+ * still evaluated, so they should be cheap.
+ * this header is used by IMdkit too, so it does not use glib types.
+ * config.h should be included before, it defines NABI_USDT.
+ *
+ * provider: nabi
+ *   xim_message(cid, major, minor)         XIM message received
+ *   xim_dispatched(cid, major, minor)      XIM message handled
+ *   xim_send(cid, major, length)           XIM message sent by X transport
+ *   key_begin(cid, icid, keysym, state)    nabi_ic_process_keyevent() entry
+ *   key_end(cid, icid, keysym, ret)        nabi_ic_process_keyevent() exit
+ *   commit(cid, icid, utf8)
+ *   preedit_update(cid, icid, utf8)
+ *   candidate_begin(cid, icid, serial, key)
+ *   candidate_end(cid, icid, serial, n)    n < 0 if the result is stale
+ *   ic_create(cid, icid, recycled)
+ *   ic_destroy(cid, icid)
+ */
+
+#ifdef NABI_USDT
+#include <sys/sdt.h>
+
+#define NABI_PROBE2(name, a, b)		DTRACE_PROBE2(nabi, name, a, b)
+#define NABI_PROBE3(name, a, b, c)	DTRACE_PROBE3(nabi, name, a, b, c)
+#define NABI_PROBE4(name, a, b, c, d)	DTRACE_PROBE4(nabi, name, a, b, c, d)
+#else
+#define NABI_PROBE2(name, a, b)
+#define NABI_PROBE3(name, a, b, c)
+#define NABI_PROBE4(name, a, b, c, d)
+#endif
+
+#endif /* nabi_probes_h */
@@ -39,15 +39,30 @@
 #include "gettext.h"
 #include "server.h"
 #include "fontset.h"
+#include "window-cache.h"
+#include "glyph-atlas.h"
+#include "gc-cache.h"
+#include "latency.h"
+#include "stat.h"
+#include "../IMdkit/Xi18nReplay.h"
 #include "hangul.h"
 
 #define NABI_SYMBOL_TABLE NABI_DATA_DIR G_DIR_SEPARATOR_S "symbol.txt"
+#define NABI_SYMBOL_DICT  NABI_DATA_DIR G_DIR_SEPARATOR_S "symbol.dic"
+#define NABI_HANJA_DICT   NABI_DATA_DIR G_DIR_SEPARATOR_S "hanja.dic"
+
+/* hanja.dic is compiled from this file, NULL means that we don't know
+ * where it is, then nabi uses the default table of libhangul */
+#ifndef NABI_HANJA_TABLE
+#define NABI_HANJA_TABLE NULL
+#endif
 
 
 /* from handler.c */
 Bool nabi_handler(XIMS ims, IMProtocol *call_data);
 
 static void nabi_server_delete_layouts(NabiServer* server);
+static void nabi_server_update_engine_config(NabiServer* server);
 
 long nabi_filter_mask = KeyPressMask | KeyReleaseMask;
 
@@ -274,6 +289,17 @@ static char *nabi_locales[] = {
     NULL
 };
 
+/* the ics refer to server->engine_config, so it is updated in place */
+static void
+nabi_server_update_engine_config(NabiServer* server)
+{
+    server->engine_config.hangul_keyboard = server->hangul_keyboard;
+    server->engine_config.word_commit = server->commit_by_word ||
+					server->hanja_mode;
+    server->engine_config.auto_reorder = server->auto_reorder;
+    server->engine_config.jamo_output = server->output_mode == NABI_OUTPUT_JAMO;
+}
+
 NabiServer*
 nabi_server_new(Display* display, int screen, const char *name)
 {
@@ -356,18 +382,25 @@ nabi_server_new(Display* display, int screen, const char *name)
     server->input_mode = server->default_input_mode;
     server->input_mode_scope = NABI_INPUT_MODE_PER_TOPLEVEL;
     server->output_mode = NABI_OUTPUT_SYLLABLE;
+    nabi_server_update_engine_config(server);
 
-    /* hanja */
-    server->hanja_table = hanja_table_load(NULL);
+    /* hanja: compiled dictionary first, libhangul text table as fallback */
+    server->hanja_table = nabi_dict_load(NABI_HANJA_DICT, NABI_HANJA_TABLE);
 
     /* symbol */
-    server->symbol_table = hanja_table_load(NABI_SYMBOL_TABLE);
+    server->symbol_table = nabi_dict_load(NABI_SYMBOL_DICT, NABI_SYMBOL_TABLE);
+
+    /* candidate lookup thread is created on the first lookup */
+    server->candidate_lookup = NULL;
+    server->preedit_idle_timeout = 0;
+    server->preedit_reclaim_source = 0;
 
     /* options */
     server->show_status = False;
     server->use_simplified_chinese = False;
     server->ignore_app_fontset = False;
     server->use_system_keymap = False;
+    server->use_glyph_atlas = False;
     server->preedit_fg.pixel = 0;
     server->preedit_fg.red = 0xffff;
     server->preedit_fg.green = 0;
@@ -377,6 +410,7 @@ nabi_server_new(Display* display, int screen, const char *name)
     server->preedit_bg.green = 0;
     server->preedit_bg.blue = 0;
     server->preedit_font = pango_font_description_from_string("Sans 9");
+    server->preedit_font_serial = 1;
     server->candidate_font = pango_font_description_from_string("Sans 14");
 
     /* statistics */
@@ -385,6 +419,20 @@ nabi_server_new(Display* display, int screen, const char *name)
     return server;
 }
 
+/* the candidate lookup and the fontset loader threads, after this only
+ * the main thread logs and counts */
+void
+nabi_server_stop_workers(NabiServer *server)
+{
+    /* finish the queued lookups, they use the hanja and symbol tables */
+    if (server->candidate_lookup != NULL) {
+	g_thread_pool_free(server->candidate_lookup, FALSE, TRUE);
+	server->candidate_lookup = NULL;
+    }
+
+    nabi_fontset_loader_stop();
+}
+
 void
 nabi_server_destroy(NabiServer *server)
 {
@@ -393,6 +441,8 @@ nabi_server_destroy(NabiServer *server)
     if (server == NULL)
 	return;
 
+    nabi_server_stop_workers(server);
+
     /* destroy remaining connections */
     if (server->connections != NULL) {
 	item = server->connections;
@@ -421,20 +471,31 @@ nabi_server_destroy(NabiServer *server)
 	server->toplevels = NULL;
     }
 
-    /* free remaining fontsets */
+    /* free remaining fontsets, this stops the fontset loader */
     nabi_fontset_free_all(server->display);
 
+    /* client window geometry */
+    nabi_window_cache_free_all(server->display);
+    nabi_glyph_atlas_free_all();
+
     /* keyboard */
     nabi_server_delete_layouts(server);
     g_free(server->hangul_keyboard);
 
+    /* the lookups are finished, drop the results the main loop has not
+     * taken yet */
+    nabi_ic_drop_candidate_results();
+
+    if (server->preedit_reclaim_source != 0)
+	g_source_remove(server->preedit_reclaim_source);
+
     /* delete hanja table */
     if (server->hanja_table != NULL)
-	hanja_table_delete(server->hanja_table);
+	nabi_dict_delete(server->hanja_table);
 
     /* delete symbol table */
     if (server->symbol_table != NULL)
-	hanja_table_delete(server->symbol_table);
+	nabi_dict_delete(server->symbol_table);
 
     /* libhangul keyboard list */
     g_free(server->hangul_keyboard_list);
@@ -460,6 +521,7 @@ nabi_server_set_hangul_keyboard(NabiServer *server, const char *id)
 	g_free(server->hangul_keyboard);
 
     server->hangul_keyboard = g_strdup(id);
+    nabi_server_update_engine_config(server);
 }
 
 void
@@ -470,7 +532,8 @@ nabi_server_set_mode_info(NabiServer *server, int state)
     Atom property;
     Atom type;
 
-    if (server == NULL)
+    /* replay has no display */
+    if (server == NULL || server->display == NULL)
 	return;
 
     data = state;
@@ -493,6 +556,7 @@ nabi_server_set_output_mode(NabiServer *server, NabiOutputMode mode)
     } else  {
 	server->output_mode = mode;
     }
+    nabi_server_update_engine_config(server);
 }
 
 void
@@ -504,6 +568,7 @@ nabi_server_set_preedit_font(NabiServer *server, const char *font_desc)
     if (font_desc != NULL)
 	pango_font_description_free(server->preedit_font);
     server->preedit_font = pango_font_description_from_string(font_desc);
+    server->preedit_font_serial++;
     nabi_log(3, "set preedit font: %s\n", font_desc);
 }
 
@@ -686,25 +751,21 @@ nabi_server_is_running(const char* name)
     return False;
 }
 
-int
-nabi_server_start(NabiServer *server)
+static gboolean
+nabi_server_on_idle_preload(gpointer data)
+{
+    nabi_candidate_preload();
+    return FALSE;
+}
+
+static XIMS
+nabi_server_open_im(NabiServer *server, Window window, const char *transport)
 {
-    Window window;
     XIMS xims;
     XIMStyles input_styles;
     XIMEncodings encodings;
     char *locales;
 
-    if (server == NULL)
-	return 0;
-
-    if (server->xims != NULL)
-	return 0;
-
-    window = XCreateSimpleWindow(server->display,
-				 RootWindow(server->display, server->screen),
-				 0, 0, 1, 1, 1, 0, 0);
-
     input_styles.count_styles = sizeof(nabi_input_styles) 
 		    / sizeof(XIMStyle) - 1;
     input_styles.supported_styles = nabi_input_styles;
@@ -719,15 +780,13 @@ nabi_server_start(NabiServer *server)
 		   IMServerWindow, window,
 		   IMServerName, server->name,
 		   IMLocale, locales,
-		   IMServerTransport, "X/",
+		   IMServerTransport, transport,
 		   IMInputStyles, &input_styles,
 		   NULL);
     g_free(locales);
 
-    if (xims == NULL) {
-	nabi_log(1, "can't open input method service\n");
-	exit(1);
-    }
+    if (xims == NULL)
+	return NULL;
 
     if (server->dynamic_event_flow) {
 	IMSetIMValues(xims,
@@ -741,16 +800,91 @@ nabi_server_start(NabiServer *server)
 		  IMFilterEventMask, nabi_filter_mask,
 		  NULL);
 
+    return xims;
+}
+
+int
+nabi_server_start(NabiServer *server)
+{
+    Window window;
+    XIMS xims;
+
+    if (server == NULL)
+	return 0;
+
+    if (server->xims != NULL)
+	return 0;
+
+    window = XCreateSimpleWindow(server->display,
+				 RootWindow(server->display, server->screen),
+				 0, 0, 1, 1, 1, 0, 0);
+
+    xims = nabi_server_open_im(server, window, "X/");
+    if (xims == NULL) {
+	nabi_log(1, "can't open input method service\n");
+	exit(1);
+    }
+
     server->xims = xims;
     server->window = window;
 
     server->start_time = time(NULL);
 
+    g_idle_add(nabi_server_on_idle_preload, NULL);
+
     nabi_log(1, "xim server started\n");
 
     return 0;
 }
 
+/* what a message has left to the main loop, idle sources and the results
+ * of the worker threads, is done before the next one is replayed, so that
+ * its output is in the same place in every replay */
+static void
+nabi_server_replay_idle(void)
+{
+    while (g_main_context_iteration(NULL, FALSE))
+	continue;
+
+    while (nabi_ic_has_pending_jobs())
+	g_main_context_iteration(NULL, TRUE);
+}
+
+/* run a captured XIM session through the handler without any client,
+ * the server is not announced and no X event is read */
+int
+nabi_server_replay(NabiServer *server, const char *capture, const char *output)
+{
+    XIMS xims;
+    XimReplayStats stats;
+    Bool ret;
+
+    if (server == NULL || server->xims != NULL)
+	return 1;
+
+    xims = nabi_server_open_im(server, None, "replay/");
+    if (xims == NULL) {
+	nabi_log(1, "can't open replay transport\n");
+	return 1;
+    }
+
+    server->xims = xims;
+    server->start_time = time(NULL);
+
+    ret = Xi18nReplay(xims, capture, output, nabi_server_replay_idle, &stats);
+
+    nabi_log(1, "replay: %s: %lu in (%lu bytes), %lu out (%lu bytes), "
+		"%lu dropped, %lu sessions\n",
+	     capture, stats.n_in, stats.bytes_in, stats.n_out, stats.bytes_out,
+	     stats.n_dropped, stats.n_clients);
+    if (stats.n_in > 0) {
+	nabi_log(1, "replay: %.3f ms, %.2f us/message\n",
+		 stats.elapsed * 1000.0, stats.elapsed * 1000000.0 / stats.n_in);
+    }
+
+    return ret ? 0 : 1;
+}
+
 int
 nabi_server_stop(NabiServer *server)
 {
@@ -870,14 +1004,6 @@ nabi_server_log_key(NabiServer *server, ucschar c, unsigned int state)
 	server->statistics.shift++;
 }
 
-static gchar*
-skip_space(gchar* p)
-{
-    while (g_ascii_isspace(*p))
-	p++;
-    return p;
-}
-
 static void
 nabi_server_delete_layouts(NabiServer* server)
 {
@@ -888,73 +1014,25 @@ nabi_server_delete_layouts(NabiServer* server)
     }
 }
 
+/* the parsed layouts are kept in ~/.nabi/keyboard_layouts.cache
+ * and used while the layout file is not changed */
 void
 nabi_server_load_keyboard_layout(NabiServer *server, const char *filename)
 {
-    FILE *file;
-    char *p, *line;
-    char *saved_position = NULL;
-    char buf[256];
-    GList *list = NULL;
-    NabiKeyboardLayout *layout = NULL;
-
-    file = fopen(filename, "r");
-    if (file == NULL) {
-	fprintf(stderr, "Nabi: Failed to open keyboard layout file: %s\n", filename);
-	return;
+    GList *list;
+
+    list = nabi_keyboard_layout_list_load_cache(filename);
+    if (list == NULL) {
+	list = nabi_keyboard_layout_list_load(filename);
+	if (list == NULL)
+	    return;
+	nabi_keyboard_layout_list_save_cache(filename, list);
     }
 
-    layout = nabi_keyboard_layout_new("none");
-    list = g_list_append(list, layout);
-    layout = NULL;
-
-    for (line = fgets(buf, sizeof(buf), file);
-	 line != NULL;
-	 line = fgets(buf, sizeof(buf), file)) {
-	p = skip_space(buf);
-
-	/* skip comments */
-	if (*p == '\0' || *p == ';' || *p == '#')
-	    continue;
-
-	if (p[0] == '[') {
-	    p = strtok_r(p + 1, "]", &saved_position);
-	    if (p != NULL) {
-		if (layout != NULL)
-		    list = g_list_append(list, layout);
-
-		layout = nabi_keyboard_layout_new(p);
-	    }
-	} else if (layout != NULL) {
-	    KeySym key, value;
-
-	    p = strtok_r(p, " \t", &saved_position);
-	    if (p == NULL)
-		continue;
-
-	    key = strtol(p, NULL, 16);
-	    if (key == 0)
-		continue;
-
-	    p = strtok_r(NULL, "\r\n\t ", &saved_position);
-	    if (p == NULL)
-		continue;
-
-	    value = strtol(p, NULL, 16);
-	    if (value == 0)
-		continue;
-
-	    nabi_keyboard_layout_append(layout, key, value);
-	}
-    }
-
-    if (layout != NULL)
-	list = g_list_append(list, layout);
-
-    fclose(file);
-
     nabi_server_delete_layouts(server);
     server->layouts = list;
+    server->layout = NULL;
+    nabi_ic_invalidate_keysym_table();
 }
 
 void
@@ -967,6 +1045,7 @@ nabi_server_set_keyboard_layout(NabiServer *server, const char* name)
 
     if (strcmp(name, "none") == 0) {
 	server->layout = NULL;
+	nabi_ic_invalidate_keysym_table();
 	return;
     }
 
@@ -978,6 +1057,9 @@ nabi_server_set_keyboard_layout(NabiServer *server, const char* name)
 	}
 	list = g_list_next(list);
     }
+
+    /* the keysym table is made with the new layout */
+    nabi_ic_invalidate_keysym_table();
 }
 
 const NabiHangulKeyboard*
@@ -1050,15 +1132,75 @@ nabi_server_set_xim_name(NabiServer* server, const char* name)
 void
 nabi_server_set_commit_by_word(NabiServer* server, Bool flag)
 {
-    if (server != NULL)
-	server->commit_by_word = flag;
+    if (server == NULL)
+	return;
+
+    server->commit_by_word = flag;
+    nabi_server_update_engine_config(server);
+}
+
+static gboolean
+nabi_server_on_reclaim_idle_ics(gpointer data)
+{
+    NabiServer* server = (NabiServer*)data;
+    GSList* conn_item;
+    GTimeVal now;
+
+    g_get_current_time(&now);
+
+    for (conn_item = server->connections; conn_item != NULL;
+	 conn_item = g_slist_next(conn_item)) {
+	NabiConnection* conn = (NabiConnection*)conn_item->data;
+	GSList* item;
+
+	for (item = conn->ic_list; item != NULL; item = g_slist_next(item)) {
+	    NabiIC* ic = (NabiIC*)item->data;
+	    if (nabi_ic_reclaim_idle(ic, &now, server->preedit_idle_timeout)) {
+		server->statistics.ic_reclaimed++;
+		NABI_STAT_INC(ics_reclaimed);
+	    }
+	}
+    }
+
+    return TRUE;
+}
+
+void
+nabi_server_set_preedit_idle_timeout(NabiServer* server, int timeout)
+{
+    if (server == NULL)
+	return;
+
+    if (server->preedit_reclaim_source != 0) {
+	g_source_remove(server->preedit_reclaim_source);
+	server->preedit_reclaim_source = 0;
+    }
+
+    server->preedit_idle_timeout = timeout;
+    if (timeout > 0)
+	server->preedit_reclaim_source = g_timeout_add(timeout * 1000,
+				nabi_server_on_reclaim_idle_ics, server);
+}
+
+void
+nabi_server_set_use_glyph_atlas(NabiServer* server, Bool flag)
+{
+    if (server == NULL)
+	return;
+
+    server->use_glyph_atlas = flag;
+    if (!flag)
+	nabi_glyph_atlas_free_all();
 }
 
 void
 nabi_server_set_auto_reorder(NabiServer* server, Bool flag)
 {
-    if (server != NULL)
-	server->auto_reorder = flag;
+    if (server == NULL)
+	return;
+
+    server->auto_reorder = flag;
+    nabi_server_update_engine_config(server);
 }
 
 void
@@ -1078,8 +1220,11 @@ nabi_server_set_input_mode_scope(NabiServer* server, NabiInputModeScope scope)
 void
 nabi_server_set_hanja_mode(NabiServer* server, Bool flag)
 {
-    if (server != NULL)
-	server->hanja_mode = flag;
+    if (server == NULL)
+	return;
+
+    server->hanja_mode = flag;
+    nabi_server_update_engine_config(server);
 }
 
 void
@@ -1099,8 +1244,67 @@ nabi_server_set_ignore_app_fontset(NabiServer* server, Bool state)
 void
 nabi_server_set_use_system_keymap(NabiServer* server, Bool state)
 {
-    if (server != NULL)
-	server->use_system_keymap = state;
+    if (server == NULL)
+	return;
+
+    server->use_system_keymap = state;
+    nabi_ic_invalidate_keysym_table();
+}
+
+/* recycled ics are not counted in n_ics but their resources are */
+void
+nabi_server_get_ic_memory_usage(NabiServer* server,
+				int* n_ics, NabiICMemory* usage)
+{
+    GSList* conn_item;
+
+    *n_ics = 0;
+    memset(usage, 0, sizeof(NabiICMemory));
+
+    for (conn_item = server->connections; conn_item != NULL;
+	 conn_item = g_slist_next(conn_item)) {
+	NabiConnection* conn = (NabiConnection*)conn_item->data;
+	GSList* item;
+
+	for (item = conn->ic_list; item != NULL; item = g_slist_next(item)) {
+	    nabi_ic_add_memory_usage((NabiIC*)item->data, usage);
+	    (*n_ics)++;
+	}
+
+	for (item = conn->recycled_ics; item != NULL;
+	     item = g_slist_next(item))
+	    nabi_ic_add_memory_usage((NabiIC*)item->data, usage);
+    }
+}
+
+/* ic counters and resources for nabi.log and the statistics dialog */
+char*
+nabi_server_get_ic_report(NabiServer* server)
+{
+    GString* str;
+    NabiICMemory usage;
+    int n_ics;
+
+    nabi_server_get_ic_memory_usage(server, &n_ics, &usage);
+
+    str = g_string_new(NULL);
+    g_string_append_printf(str, "ic: fresh %d, recycled %d, reclaimed %d\n",
+		server->statistics.ic_fresh, server->statistics.ic_recycled,
+		server->statistics.ic_reclaimed);
+    g_string_append_printf(str, "ic memory: %d ics, heap %d bytes/ic\n",
+		n_ics, n_ics > 0 ? (int)(usage.heap / n_ics) : 0);
+    g_string_append_printf(str, "  preedit windows %d, "
+		"backing pixmaps %d (%d KB)\n",
+		usage.windows, usage.pixmaps, (int)(usage.pixmap_bytes / 1024));
+    g_string_append_printf(str, "  fontsets %d, "
+		"pango contexts %d, pango layouts %d\n",
+		usage.fontsets, usage.pango_contexts, usage.pango_layouts);
+    g_string_append_printf(str, "  gc references %d, shared gcs %d\n",
+		usage.gcs, nabi_gc_cache_get_size());
+    g_string_append_printf(str, "  glyph atlas %d KB\n",
+		(int)(nabi_glyph_atlas_get_memory_size() / 1024));
+
+    return g_string_free(str, FALSE);
 }
 
 void
@@ -1119,6 +1323,9 @@ nabi_server_write_log(NabiServer *server)
     file = fopen(filename, "a");
     if (file != NULL) {
 	int i, sum;
+	int hits, misses, round_trips;
+	char *ic_report;
+	char *latency;
 	time_t current_time;
 	struct tm local_time;
 	char buf[256] = { '\0', };
@@ -1139,6 +1346,17 @@ nabi_server_write_log(NabiServer *server)
 	fprintf(file, "backspace: %d\n", server->statistics.backspace);
 	fprintf(file, "keyboard: %s\n", server->hangul_keyboard);
 
+	nabi_window_cache_get_stats(&hits, &misses, &round_trips);
+	fprintf(file, "window cache: hit %d, miss %d, round trips %d\n",
+		hits, misses, round_trips);
+	ic_report = nabi_server_get_ic_report(server);
+	fprintf(file, "%s", ic_report);
+	g_free(ic_report);
+
+	latency = nabi_latency_get_report(TRUE);
+	fprintf(file, "latency:\n%s", latency);
+	g_free(latency);
+
 	/* choseong */
 	sum = 0; 
 	for (i = 0x00; i <= 0x12; i++)
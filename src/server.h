@@ -35,7 +35,9 @@
 #include "../IMdkit/Xi18n.h"
 
 #include "ic.h"
+#include "dictionary.h"
 #include "keyboard-layout.h"
+#include "engine.h"
 
 typedef struct _NabiHangulKeyboard NabiHangulKeyboard;
 typedef struct _NabiServer NabiServer;
@@ -73,6 +75,9 @@ struct NabiStatistics {
     int backspace;
     int shift;
     int jamo[256];
+    int ic_fresh;
+    int ic_recycled;
+    int ic_reclaimed;
 };
 
 struct _NabiServer {
@@ -102,11 +107,22 @@ struct _NabiServer {
 
     NabiOutputMode          output_mode;
 
+    /* the options above as the keystroke engine sees them */
+    NabiEngineConfig        engine_config;
+
     /* hanja */
-    HanjaTable*             hanja_table;
+    NabiDict*               hanja_table;
 
     /* symbol */
-    HanjaTable*             symbol_table;
+    NabiDict*               symbol_table;
+
+    /* worker thread for candidate lookup */
+    GThreadPool*            candidate_lookup;
+
+    /* release preedit resources of ics unfocused longer than this (sec),
+     * 0 means never */
+    int                     preedit_idle_timeout;
+    guint                   preedit_reclaim_source;
 
     /* options */
     Bool                    dynamic_event_flow;
@@ -117,6 +133,7 @@ struct _NabiServer {
     Bool                    use_simplified_chinese;
     Bool                    ignore_app_fontset;
     Bool                    use_system_keymap;
+    Bool                    use_glyph_atlas;
     NabiInputMode           default_input_mode;
     NabiInputMode           input_mode;
     NabiInputModeScope      input_mode_scope;
@@ -124,6 +141,7 @@ struct _NabiServer {
     GdkColor                preedit_bg;
 
     PangoFontDescription*   preedit_font;
+    guint                   preedit_font_serial; /* changed with preedit_font */
     PangoFontDescription*   candidate_font;
 
     /* statistics */
@@ -139,6 +157,10 @@ NabiServer* nabi_server_new		(Display*    display,
 void        nabi_server_destroy         (NabiServer* server);
 int         nabi_server_start           (NabiServer* server);
 int         nabi_server_stop            (NabiServer *server);
+void        nabi_server_stop_workers    (NabiServer *server);
+int         nabi_server_replay          (NabiServer* server,
+					 const char* capture,
+					 const char* output);
 
 Bool        nabi_server_is_running(const char* name);
 Bool        nabi_server_is_trigger_key  (NabiServer*  server,
@@ -172,7 +194,10 @@ void	    nabi_server_set_candidate_font(NabiServer *server,
 void        nabi_server_set_dynamic_event_flow(NabiServer* server, Bool flag);
 void        nabi_server_set_xim_name(NabiServer* server, const char* name);
 void        nabi_server_set_commit_by_word(NabiServer* server, Bool flag);
+void        nabi_server_set_preedit_idle_timeout(NabiServer* server,
+						 int timeout);
 void        nabi_server_set_auto_reorder(NabiServer* server, Bool flag);
+void        nabi_server_set_use_glyph_atlas(NabiServer* server, Bool flag);
 void        nabi_server_set_hanja_mode(NabiServer* server, Bool flag);
 void        nabi_server_set_default_input_mode(NabiServer* server,
 					       NabiInputMode mode);
@@ -205,6 +230,9 @@ Bool        nabi_server_is_valid_str    (NabiServer *server, const char* str);
 void        nabi_server_log_key         (NabiServer *server,
 					 ucschar c,
 					 unsigned int state);
+void        nabi_server_get_ic_memory_usage(NabiServer* server,
+					    int* n_ics, NabiICMemory* usage);
+char*       nabi_server_get_ic_report(NabiServer* server);
 void        nabi_server_write_log(NabiServer *server);
 
 Bool	    nabi_server_load_keyboard_table(NabiServer *server,
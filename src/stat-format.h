@@ -0,0 +1,95 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_stat_format_h
+#define nabi_stat_format_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* live counter segment in POSIX shared memory
+ *
+ * nabi creates /nabi-<uid>-<display> and increments the counters with
+ * atomic adds, nabi-stat maps it read only. A second nabi on the display
+ * leaves the segment to the first one. All counters only go up
+ * except the gauges (connections, ics). */
+
+#define NABI_STAT_MAGIC		"NABISTAT"
+#define NABI_STAT_MAGIC_LEN	8
+#define NABI_STAT_VERSION	1
+
+#define NABI_STAT_N_OPCODES	256
+#define NABI_STAT_N_STAGES	8	/* NABI_LATENCY_N_STAGES */
+#define NABI_STAT_N_BUCKETS	12
+
+/* upper limits of the latency buckets in usec, the last one is open */
+#define NABI_STAT_BUCKET_LIMITS \
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000
+
+#define NABI_STAT_STAGE_NAMES \
+    "queue", "dispatch", "lookup", "process", \
+    "preedit", "encode", "send", "total"
+
+typedef struct _NabiStatSegment NabiStatSegment;
+
+struct _NabiStatSegment {
+    char     magic[NABI_STAT_MAGIC_LEN];
+    uint32_t version;
+    uint32_t size;			/* sizeof(NabiStatSegment) */
+    int64_t  pid;
+    uint64_t start_time;		/* usec since the epoch */
+
+    uint64_t connections;		/* gauge */
+    uint64_t connections_total;
+    uint64_t ics;			/* gauge, not counting recycled */
+    uint64_t ics_total;
+    uint64_t ic_recycle_hits;		/* ic made from a destroyed one */
+    uint64_t ic_recycle_misses;		/* none kept for the client window */
+    uint64_t ic_recycle_expired;	/* kept ones destroyed unused */
+    uint64_t ics_reclaimed;
+
+    uint64_t keys;			/* nabi_ic_process_keyevent() */
+    uint64_t commits;
+    uint64_t commit_bytes;
+    uint64_t sync_waits;		/* key events queued until sync reply */
+    uint64_t window_cache_round_trips;	/* X round trips */
+    uint64_t window_cache_hits;
+    uint64_t window_cache_misses;
+    uint64_t candidate_lookups;
+    uint64_t candidate_stale;
+
+    uint64_t msg_in[NABI_STAT_N_OPCODES];	/* by major opcode */
+    uint64_t msg_out[NABI_STAT_N_OPCODES];
+    uint64_t latency[NABI_STAT_N_STAGES][NABI_STAT_N_BUCKETS];
+};
+
+/* shm name of the segment of the display */
+static inline void
+nabi_stat_make_name(char* buf, size_t len, unsigned int uid,
+		    const char* display)
+{
+    char* p;
+
+    snprintf(buf, len, "/nabi-%u-%s", uid, display != NULL ? display : "");
+    for (p = buf + 1; *p != '\0'; p++) {
+	if (*p == '/')
+	    *p = '_';
+    }
+}
+
+#endif /* nabi_stat_format_h */
@@ -0,0 +1,168 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "stat.h"
+
+/* the counters before nabi_stat_open() and after a failure */
+static NabiStatSegment local_segment;
+static NabiStatSegment* shared_segment = NULL;
+static char segment_name[256];
+
+NabiStatSegment* nabi_stat = &local_segment;
+
+/* the pid of the nabi which has the segment, 0 if none is running */
+static pid_t
+nabi_stat_get_owner(const char* name)
+{
+    int fd;
+    struct stat st;
+    NabiStatSegment* segment;
+    pid_t pid = 0;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+	return 0;
+
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(NabiStatSegment)) {
+	segment = mmap(NULL, sizeof(NabiStatSegment), PROT_READ,
+		       MAP_SHARED, fd, 0);
+	if (segment != MAP_FAILED) {
+	    if (memcmp(segment->magic, NABI_STAT_MAGIC,
+		       NABI_STAT_MAGIC_LEN) == 0)
+		pid = segment->pid;
+	    munmap(segment, sizeof(NabiStatSegment));
+	}
+    }
+    close(fd);
+
+    if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM))
+	return pid;
+    return 0;
+}
+
+int
+nabi_stat_open(const char* display)
+{
+    int fd;
+    void* addr;
+    struct stat st;
+    struct timeval now;
+    pid_t owner;
+
+    if (shared_segment != NULL)
+	return TRUE;
+
+    nabi_stat_make_name(segment_name, sizeof(segment_name),
+			getuid(), display);
+
+    /* another nabi on the display keeps its segment, this one counts
+     * in process memory only */
+    owner = nabi_stat_get_owner(segment_name);
+    if (owner != 0) {
+	nabi_log(1, "stat segment %s is used by nabi %d\n",
+		 segment_name, (int)owner);
+	return FALSE;
+    }
+
+    /* the name is predictable, so never open an existing segment:
+     * remove the one left by a crashed nabi and create a new one */
+    shm_unlink(segment_name);
+    fd = shm_open(segment_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+	nabi_log(1, "can't create stat segment %s: %s\n",
+		 segment_name, strerror(errno));
+	return FALSE;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_uid != getuid() ||
+	(st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+	nabi_log(1, "stat segment %s is not private\n", segment_name);
+	close(fd);
+	return FALSE;
+    }
+
+    if (ftruncate(fd, sizeof(NabiStatSegment)) != 0) {
+	nabi_log(1, "can't resize stat segment %s: %s\n",
+		 segment_name, strerror(errno));
+	close(fd);
+	shm_unlink(segment_name);
+	return FALSE;
+    }
+
+    addr = mmap(NULL, sizeof(NabiStatSegment), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+	nabi_log(1, "can't map stat segment %s: %s\n",
+		 segment_name, strerror(errno));
+	shm_unlink(segment_name);
+	return FALSE;
+    }
+
+    shared_segment = addr;
+    memcpy(shared_segment, &local_segment, sizeof(NabiStatSegment));
+
+    gettimeofday(&now, NULL);
+    shared_segment->version = NABI_STAT_VERSION;
+    shared_segment->size = sizeof(NabiStatSegment);
+    shared_segment->pid = getpid();
+    shared_segment->start_time = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+    /* readers check the magic last */
+    nabi_stat = shared_segment;
+    __sync_synchronize();
+    memcpy(shared_segment->magic, NABI_STAT_MAGIC, NABI_STAT_MAGIC_LEN);
+
+    nabi_log(3, "stat segment: %s\n", segment_name);
+    return TRUE;
+}
+
+/* nabi_server_stop_workers() must be called before, the other threads
+ * count too */
+void
+nabi_stat_close(void)
+{
+    if (shared_segment == NULL)
+	return;
+
+    /* keep counting in process memory, there may be late updates */
+    memcpy(&local_segment, shared_segment, sizeof(NabiStatSegment));
+    nabi_stat = &local_segment;
+    __sync_synchronize();
+
+    /* tell the readers, they may keep the mapping after the unlink */
+    memset(shared_segment->magic, 0, NABI_STAT_MAGIC_LEN);
+    munmap(shared_segment, sizeof(NabiStatSegment));
+    shm_unlink(segment_name);
+    shared_segment = NULL;
+}
@@ -0,0 +1,39 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_stat_h
+#define nabi_stat_h
+
+#include "stat-format.h"
+
+/* live counters, see stat-format.h
+ * Until nabi_stat_open() the counters are in process memory, so the
+ * macros can be used anywhere without checking.
+ * this header is used by IMdkit too, so it does not use glib types */
+
+extern NabiStatSegment* nabi_stat;
+
+int  nabi_stat_open(const char* display);
+void nabi_stat_close(void);
+
+#define NABI_STAT_ADD(field, n)	__sync_fetch_and_add(&nabi_stat->field, (n))
+#define NABI_STAT_SUB(field, n)	__sync_fetch_and_sub(&nabi_stat->field, (n))
+#define NABI_STAT_INC(field)	NABI_STAT_ADD(field, 1)
+#define NABI_STAT_DEC(field)	NABI_STAT_SUB(field, 1)
+
+#endif /* nabi_stat_h */
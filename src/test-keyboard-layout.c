@@ -0,0 +1,305 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* test-keyboard-layout: checks nabi_keyboard_layout_get_key() against
+ * every key pair of the layout file
+ *
+ * usage: test-keyboard-layout [keyboard_layouts]
+ *
+ * The file is read again here with a plain parser, the pairs of it are
+ * the expected result. Then the latin1 array, the table fallback, the
+ * duplicate keys and the sort order of the table are checked with
+ * layouts built in the test. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyboard-layout.h"
+
+#ifndef KEYBOARD_LAYOUTS
+#define KEYBOARD_LAYOUTS "keyboard_layouts"
+#endif
+
+#define MAX_PAIRS 1024
+
+typedef struct {
+    char   name[64];
+    KeySym keys[MAX_PAIRS];
+    KeySym values[MAX_PAIRS];
+    int    n;
+} Expected;
+
+static int n_failed = 0;
+
+#define check(expr, ...)				\
+    do {						\
+	if (!(expr)) {					\
+	    fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	    fprintf(stderr, __VA_ARGS__);		\
+	    fprintf(stderr, "\n");			\
+	    n_failed++;					\
+	}						\
+    } while (0)
+
+/* the same as struct KeySymPair of keyboard-layout.c */
+struct Pair {
+    KeySym key;
+    KeySym value;
+};
+
+/* a later pair of the same key replaces the former one */
+static void
+expected_set(Expected* e, KeySym key, KeySym value)
+{
+    int i;
+
+    for (i = 0; i < e->n; i++) {
+	if (e->keys[i] == key) {
+	    e->values[i] = value;
+	    return;
+	}
+    }
+
+    if (e->n < MAX_PAIRS) {
+	e->keys[e->n] = key;
+	e->values[e->n] = value;
+	e->n++;
+    }
+}
+
+static Expected*
+expected_load(const char* filename, int* n_layouts)
+{
+    FILE* file;
+    char buf[256];
+    Expected* list = NULL;
+    int n = 0;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+	return NULL;
+
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+	char* p = buf;
+	unsigned long key, value;
+
+	while (*p == ' ' || *p == '\t')
+	    p++;
+
+	if (*p == '[') {
+	    char* end = strchr(p, ']');
+	    if (end == NULL)
+		continue;
+	    list = realloc(list, (n + 1) * sizeof(Expected));
+	    memset(&list[n], 0, sizeof(Expected));
+	    *end = '\0';
+	    strncpy(list[n].name, p + 1, sizeof(list[n].name) - 1);
+	    n++;
+	} else if (n > 0 && sscanf(p, "%lx %lx", &key, &value) == 2 &&
+		   key != 0 && value != 0) {
+	    expected_set(&list[n - 1], key, value);
+	}
+    }
+    fclose(file);
+
+    *n_layouts = n;
+    return list;
+}
+
+static KeySym
+expected_get(const Expected* e, KeySym key)
+{
+    int i;
+
+    for (i = 0; i < e->n; i++) {
+	if (e->keys[i] == key)
+	    return e->values[i];
+    }
+    return key;
+}
+
+static void
+check_sorted(NabiKeyboardLayout* layout)
+{
+    const struct Pair* pairs;
+    guint i;
+
+    if (layout->table == NULL)
+	return;
+
+    pairs = (const struct Pair*)layout->table->data;
+    for (i = 0; i < layout->table->len; i++) {
+	check(pairs[i].key >= 256, "%s: latin1 key 0x%lx in the table",
+	      layout->name, pairs[i].key);
+	if (i > 0)
+	    check(pairs[i - 1].key < pairs[i].key,
+		  "%s: table is not sorted at %u", layout->name, i);
+    }
+}
+
+static void
+check_layout(NabiKeyboardLayout* layout, const Expected* e)
+{
+    KeySym keysym;
+    int i;
+
+    check(strcmp(layout->name, e->name) == 0,
+	  "layout name: expected %s, got %s", e->name, layout->name);
+
+    /* every pair of the file */
+    for (i = 0; i < e->n; i++) {
+	KeySym got = nabi_keyboard_layout_get_key(layout, e->keys[i]);
+	check(got == e->values[i], "%s: 0x%lx: expected 0x%lx, got 0x%lx",
+	      e->name, e->keys[i], e->values[i], got);
+    }
+
+    /* the keys not in the file are not changed */
+    for (keysym = 0; keysym < 256; keysym++) {
+	KeySym got = nabi_keyboard_layout_get_key(layout, keysym);
+	check(got == expected_get(e, keysym),
+	      "%s: latin1 0x%lx: expected 0x%lx, got 0x%lx",
+	      e->name, keysym, expected_get(e, keysym), got);
+    }
+
+    for (keysym = 0xff00; keysym < 0x10000; keysym++) {
+	KeySym got = nabi_keyboard_layout_get_key(layout, keysym);
+	check(got == expected_get(e, keysym),
+	      "%s: fallback 0x%lx: got 0x%lx", e->name, keysym, got);
+    }
+
+    check_sorted(layout);
+}
+
+static void
+check_file(const char* filename)
+{
+    GList* list;
+    GList* item;
+    Expected* expected;
+    int n_expected = 0;
+    int i;
+
+    expected = expected_load(filename, &n_expected);
+    check(expected != NULL && n_expected > 0, "can't read %s", filename);
+    if (expected == NULL)
+	return;
+
+    list = nabi_keyboard_layout_list_load(filename);
+    check(list != NULL, "can't load %s", filename);
+    if (list == NULL) {
+	free(expected);
+	return;
+    }
+
+    /* the first one is "none", it changes nothing */
+    item = list;
+    check(strcmp(((NabiKeyboardLayout*)item->data)->name, "none") == 0,
+	  "the first layout is not none");
+    for (i = 0; i < 256; i++)
+	check(nabi_keyboard_layout_get_key(item->data, i) == (KeySym)i,
+	      "none: 0x%x is changed", i);
+
+    check((int)g_list_length(list) == n_expected + 1,
+	  "number of layouts: expected %d, got %d",
+	  n_expected + 1, g_list_length(list));
+
+    for (item = g_list_next(item), i = 0;
+	 item != NULL && i < n_expected;
+	 item = g_list_next(item), i++) {
+	check_layout(item->data, &expected[i]);
+    }
+
+    g_list_foreach(list, nabi_keyboard_layout_free, NULL);
+    g_list_free(list);
+    free(expected);
+}
+
+/* layouts built here cover what the shipped file does not */
+static void
+check_append(void)
+{
+    static const struct Pair pairs[] = {
+	{ 0x0061, 0x0062 },	/* latin1 */
+	{ 0x0061, 0x0063 },	/* duplicate latin1, replaces */
+	{ 0x10011b1, 0x0041 },	/* table, inserted out of order */
+	{ 0x0fe52, 0x005e },
+	{ 0x0ff0d, 0x0020 },
+	{ 0x0fe52, 0x0060 },	/* duplicate in the table, replaces */
+	{ 0x01000, 0x0042 },
+	{ 0x0ff0d, 0x000d },
+    };
+    Expected e;
+    NabiKeyboardLayout* layout;
+    NabiKeyboardLayout* same;
+    guint i;
+
+    memset(&e, 0, sizeof(e));
+    strcpy(e.name, "test");
+    layout = nabi_keyboard_layout_new("test");
+    same = nabi_keyboard_layout_new("test");
+    for (i = 0; i < G_N_ELEMENTS(pairs); i++) {
+	expected_set(&e, pairs[i].key, pairs[i].value);
+	nabi_keyboard_layout_append(layout, pairs[i].key, pairs[i].value);
+	nabi_keyboard_layout_append(same, pairs[i].key, pairs[i].value);
+    }
+
+    check(layout->table != NULL && layout->table->len == 4,
+	  "duplicate keys are kept in the table");
+    check(nabi_keyboard_layout_get_key(layout, 0x0061) == 0x0063,
+	  "duplicate latin1 key is not replaced");
+    check(nabi_keyboard_layout_get_key(layout, 0x0fe52) == 0x0060,
+	  "duplicate table key is not replaced");
+    check(nabi_keyboard_layout_get_key(layout, 0x10011b1) == 0x0041,
+	  "key above 0xffff is not found");
+    check(nabi_keyboard_layout_get_key(layout, 0x10011b2) == 0x10011b2,
+	  "missing key is changed");
+    check_layout(layout, &e);
+
+    check(nabi_keyboard_layout_equal(layout, same),
+	  "same pairs make different layouts");
+    nabi_keyboard_layout_append(same, 0x0ff0d, 0x0020);
+    check(!nabi_keyboard_layout_equal(layout, same),
+	  "different pairs make equal layouts");
+
+    nabi_keyboard_layout_free(layout, NULL);
+    nabi_keyboard_layout_free(same, NULL);
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* filename = KEYBOARD_LAYOUTS;
+
+    if (argc > 1)
+	filename = argv[1];
+
+    check_file(filename);
+    check_append();
+
+    if (n_failed > 0) {
+	fprintf(stderr, "%d checks failed\n", n_failed);
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# make check: replays the captures in test/replay and compares what nabi
+# sends back with the .out file next to each capture.
+#
+# hangul-2set.cap: one Xlib client in the root window style, turns on
+# hangul with the trigger key and types "gks" and space on a us keymap,
+# nabi commits "한" and forwards the key releases and the space back.
+# ../test/replay/record.sh records a capture from a real session.
+
+srcdir=${srcdir-.}
+replaydir=$srcdir/../test/replay
+
+# replay opens no display, the keysyms come from the fixed keymap
+unset DISPLAY
+
+tmpdir=`mktemp -d "${TMPDIR-/tmp}/nabi-replay.XXXXXX"` || exit 1
+trap 'rm -rf "$tmpdir"' 0
+
+status=0
+for capture in "$replaydir"/*.cap; do
+    name=`basename "$capture" .cap`
+
+    # the default configuration, in a locale which has hangul
+    HOME=$tmpdir LC_ALL=C.UTF-8 ./nabi --replay "$capture" \
+	    --replay-output "$tmpdir/$name.out" > "$tmpdir/$name.log" 2>&1
+    if test $? -ne 0 || ! cmp "$replaydir/$name.out" "$tmpdir/$name.out"; then
+	echo "test-replay: $name: the output differs"
+	cat "$tmpdir/$name.log"
+	status=1
+    else
+	echo "test-replay: $name: ok"
+    fi
+done
+
+exit $status
@@ -0,0 +1,142 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_trace_format_h
+#define nabi_trace_format_h
+
+#include <stdint.h>
+#include <string.h>
+
+/* trace dump file layout
+ *
+ *   NabiTraceHeader
+ *   format pool                 n_formats NUL terminated strings
+ *   NabiTraceRecord[n_records]  oldest first
+ *
+ * In memory the format field of a record is the pointer to the format
+ * string given to nabi_log(), in the file it is the index of the string
+ * in the format pool. The arguments are kept as they are and formatted
+ * by the decoder, %s arguments are copied into str.
+ * The file is written in host byte order like the dictionary. */
+
+#define NABI_TRACE_MAGIC	"NABITRCE"
+#define NABI_TRACE_MAGIC_LEN	8
+#define NABI_TRACE_VERSION	2
+#define NABI_TRACE_BYTE_ORDER	0x01020304
+
+#define NABI_TRACE_MAX_ARGS	8
+#define NABI_TRACE_STR_SIZE	64
+
+enum {
+    NABI_TRACE_ARG_INT,
+    NABI_TRACE_ARG_UINT,
+    NABI_TRACE_ARG_DOUBLE,	/* bits of the double in the uint64_t */
+    NABI_TRACE_ARG_STR,		/* offset in str, ~0 for NULL */
+    NABI_TRACE_ARG_PTR
+};
+
+/* or'ed to NABI_TRACE_ARG_STR when the string was cut to fit in str */
+#define NABI_TRACE_ARG_CUT	0x80
+
+typedef struct _NabiTraceHeader NabiTraceHeader;
+typedef struct _NabiTraceRecord NabiTraceRecord;
+typedef struct _NabiTraceSpec   NabiTraceSpec;
+
+struct _NabiTraceHeader {
+    char     magic[NABI_TRACE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n_formats;
+    uint32_t formats_size;
+    uint32_t n_records;
+    uint32_t lost;		/* overwritten before the dump */
+};
+
+struct _NabiTraceRecord {
+    uint32_t seq;		/* index + 1, 0 while it is written */
+    uint16_t level;
+    uint8_t  n_args;
+    uint8_t  truncated;		/* some args or strings did not fit */
+    uint64_t time;		/* usec since the epoch */
+    uint64_t format;
+    uint8_t  types[NABI_TRACE_MAX_ARGS];
+    uint64_t args[NABI_TRACE_MAX_ARGS];
+    char     str[NABI_TRACE_STR_SIZE];
+};
+
+/* a printf conversion: % flags width .precision length conversion */
+struct _NabiTraceSpec {
+    char length;		/* 0, 'h', 'H' (hh), 'l', 'q' (ll), 'L',
+				 * 'j', 'z', 't' */
+    char conversion;
+    int  n_stars;		/* '*' width and precision, int args */
+};
+
+/* p points the char after '%', returns the char after the conversion */
+static inline const char*
+nabi_trace_parse_spec(const char* p, NabiTraceSpec* spec)
+{
+    spec->length = 0;
+    spec->n_stars = 0;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+	p++;
+
+    while ((*p >= '0' && *p <= '9') || *p == '.' || *p == '*') {
+	if (*p == '*')
+	    spec->n_stars++;
+	p++;
+    }
+
+    switch (*p) {
+    case 'h':
+	spec->length = 'h';
+	p++;
+	if (*p == 'h') {
+	    spec->length = 'H';
+	    p++;
+	}
+	break;
+    case 'l':
+	spec->length = 'l';
+	p++;
+	if (*p == 'l') {
+	    spec->length = 'q';
+	    p++;
+	}
+	break;
+    case 'q':
+    case 'L':
+    case 'j':
+    case 'z':
+    case 't':
+	spec->length = *p;
+	p++;
+	break;
+    default:
+	break;
+    }
+
+    spec->conversion = *p;
+    if (*p != '\0')
+	p++;
+
+    return p;
+}
+
+#endif /* nabi_trace_format_h */
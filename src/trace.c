@@ -0,0 +1,384 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "debug.h"
+#include "trace.h"
+#include "trace-format.h"
+
+/* one writer claims a record with an atomic add on the head, the other
+ * writers and the dump do not wait for it. The dump skips the records
+ * whose seq does not match, they are being written or overwritten. */
+static NabiTraceRecord* ring = NULL;
+static unsigned int ring_size = 0;	/* power of 2 */
+static volatile unsigned int ring_head = 0;
+
+/* nabi_trace_dump_async() writes the dumps on this thread */
+static GThreadPool* dump_thread = NULL;
+static unsigned int dump_serial = 0;
+
+int
+nabi_trace_init(unsigned int n_records)
+{
+    unsigned int size = 64;
+
+    if (ring != NULL)
+	return TRUE;
+
+    while (size < n_records && size < (1U << 24))
+	size <<= 1;
+
+    ring = g_try_new0(NabiTraceRecord, size);
+    if (ring == NULL)
+	return FALSE;
+
+    ring_size = size;
+    ring_head = 0;
+    nabi_log_set_trace_func(nabi_trace_record);
+    return TRUE;
+}
+
+/* the other threads which log, the candidate lookup and the fontset
+ * loader, must be stopped before, nabi_server_destroy() does it */
+void
+nabi_trace_free(void)
+{
+    NabiTraceRecord* old = ring;
+
+    nabi_log_set_trace_func(NULL);
+
+    /* the dumps read the ring */
+    if (dump_thread != NULL) {
+	g_thread_pool_free(dump_thread, FALSE, TRUE);
+	dump_thread = NULL;
+    }
+
+    ring = NULL;
+    ring_size = 0;
+    g_free(old);
+}
+
+int
+nabi_trace_is_enabled(void)
+{
+    return ring != NULL;
+}
+
+static inline gboolean
+trace_add_arg(NabiTraceRecord* rec, int type, uint64_t value)
+{
+    if (rec->n_args >= NABI_TRACE_MAX_ARGS) {
+	rec->truncated = 1;
+	return FALSE;
+    }
+
+    rec->types[rec->n_args] = type;
+    rec->args[rec->n_args] = value;
+    rec->n_args++;
+    return TRUE;
+}
+
+static inline gboolean
+trace_add_str(NabiTraceRecord* rec, size_t* str_len, const char* str)
+{
+    size_t offset = *str_len;
+    size_t len;
+    int type = NABI_TRACE_ARG_STR;
+
+    if (str == NULL)
+	return trace_add_arg(rec, type, ~(uint64_t)0);
+
+    /* no room, point the last NUL */
+    if (offset >= NABI_TRACE_STR_SIZE) {
+	rec->truncated = 1;
+	return trace_add_arg(rec, type | NABI_TRACE_ARG_CUT,
+			     NABI_TRACE_STR_SIZE - 1);
+    }
+
+    len = strlen(str);
+    if (len > NABI_TRACE_STR_SIZE - offset - 1) {
+	len = NABI_TRACE_STR_SIZE - offset - 1;
+	type |= NABI_TRACE_ARG_CUT;
+	rec->truncated = 1;
+    }
+    memcpy(rec->str + offset, str, len);
+    rec->str[offset + len] = '\0';
+    *str_len = offset + len + 1;
+
+    return trace_add_arg(rec, type, offset);
+}
+
+/* the arguments are fetched as the format says, like vprintf() does */
+void
+nabi_trace_record(int level, const char* format, va_list ap)
+{
+    NabiTraceRecord* rec;
+    NabiTraceSpec spec;
+    unsigned int index;
+    size_t str_len = 0;
+    const char* p;
+    GTimeVal now;
+    int i;
+
+    if (ring == NULL)
+	return;
+
+    index = __sync_fetch_and_add(&ring_head, 1);
+    rec = &ring[index & (ring_size - 1)];
+    rec->seq = 0;
+    __sync_synchronize();
+
+    g_get_current_time(&now);
+    rec->time = (uint64_t)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+    rec->level = level;
+    rec->format = (uintptr_t)format;
+    rec->n_args = 0;
+    rec->truncated = 0;
+
+    p = format;
+    while ((p = strchr(p, '%')) != NULL) {
+	gboolean ret = TRUE;
+	int64_t  s;
+	uint64_t u;
+	double   d;
+
+	p = nabi_trace_parse_spec(p + 1, &spec);
+	if (spec.conversion == '%')
+	    continue;
+
+	for (i = 0; i < spec.n_stars && ret; i++)
+	    ret = trace_add_arg(rec, NABI_TRACE_ARG_INT, va_arg(ap, int));
+
+	switch (spec.conversion) {
+	case 'd':
+	case 'i':
+	    switch (spec.length) {
+	    case 'l': s = va_arg(ap, long); break;
+	    case 'q': s = va_arg(ap, long long); break;
+	    case 'j': s = va_arg(ap, intmax_t); break;
+	    case 'z': s = va_arg(ap, ssize_t); break;
+	    case 't': s = va_arg(ap, ptrdiff_t); break;
+	    default:  s = va_arg(ap, int); break;
+	    }
+	    ret = ret && trace_add_arg(rec, NABI_TRACE_ARG_INT, s);
+	    break;
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+	    switch (spec.length) {
+	    case 'l': u = va_arg(ap, unsigned long); break;
+	    case 'q': u = va_arg(ap, unsigned long long); break;
+	    case 'j': u = va_arg(ap, uintmax_t); break;
+	    case 'z': u = va_arg(ap, size_t); break;
+	    case 't': u = va_arg(ap, ptrdiff_t); break;
+	    default:  u = va_arg(ap, unsigned int); break;
+	    }
+	    ret = ret && trace_add_arg(rec, NABI_TRACE_ARG_UINT, u);
+	    break;
+	case 'c':
+	    ret = ret && trace_add_arg(rec, NABI_TRACE_ARG_INT,
+				       va_arg(ap, int));
+	    break;
+	case 'p':
+	    u = (uintptr_t)va_arg(ap, void*);
+	    ret = ret && trace_add_arg(rec, NABI_TRACE_ARG_PTR, u);
+	    break;
+	case 's':
+	    ret = ret && trace_add_str(rec, &str_len, va_arg(ap, const char*));
+	    break;
+	case 'e': case 'E':
+	case 'f': case 'F':
+	case 'g': case 'G':
+	case 'a': case 'A':
+	    if (spec.length == 'L')
+		d = va_arg(ap, long double);
+	    else
+		d = va_arg(ap, double);
+	    memcpy(&u, &d, sizeof(u));
+	    ret = ret && trace_add_arg(rec, NABI_TRACE_ARG_DOUBLE, u);
+	    break;
+	default:
+	    /* %n or unknown, the rest can not be fetched */
+	    rec->truncated = 1;
+	    ret = FALSE;
+	    break;
+	}
+
+	if (!ret)
+	    break;
+    }
+
+    __sync_synchronize();
+    rec->seq = index + 1;
+}
+
+/* $XDG_RUNTIME_DIR or ~/.nabi, both belong to the user, a new name
+ * for every dump as nabi_trace_dump() does not replace a file */
+char*
+nabi_trace_get_dump_filename(void)
+{
+    const char* runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+    char* dir;
+    char* name;
+    char* filename;
+
+    if (runtime_dir != NULL && runtime_dir[0] == '/')
+	dir = g_strdup(runtime_dir);
+    else
+	dir = g_build_filename(g_get_home_dir(), ".nabi", NULL);
+    mkdir(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+
+    dump_serial++;
+    name = g_strdup_printf("nabi-trace-%d-%u.bin", (int)getpid(), dump_serial);
+    filename = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+
+    return filename;
+}
+
+/* the records are copied out of the ring first, the writers keep
+ * going meanwhile */
+int
+nabi_trace_dump(const char* filename)
+{
+    NabiTraceHeader header;
+    GHashTable* formats;
+    GString* pool;
+    GArray* records;
+    unsigned int head, start, i;
+    unsigned int n_formats = 0;
+    unsigned int lost;
+    FILE* file;
+    int fd;
+    gboolean ret = TRUE;
+
+    if (ring == NULL)
+	return FALSE;
+
+    head = ring_head;
+    start = head > ring_size ? head - ring_size : 0;
+    lost = start;
+
+    formats = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pool = g_string_new(NULL);
+    records = g_array_sized_new(FALSE, FALSE, sizeof(NabiTraceRecord),
+				head - start);
+
+    for (i = start; i != head; i++) {
+	NabiTraceRecord* slot = &ring[i & (ring_size - 1)];
+	NabiTraceRecord rec = *slot;
+	const char* format;
+	gpointer value;
+
+	__sync_synchronize();
+	if (rec.seq != i + 1 || slot->seq != i + 1) {
+	    lost++;
+	    continue;
+	}
+
+	format = (const char*)(uintptr_t)rec.format;
+	value = g_hash_table_lookup(formats, format);
+	if (value == NULL) {
+	    n_formats++;
+	    value = GUINT_TO_POINTER(n_formats);
+	    g_hash_table_insert(formats, (gpointer)format, value);
+	    g_string_append_len(pool, format, strlen(format) + 1);
+	}
+	rec.format = GPOINTER_TO_UINT(value) - 1;
+	g_array_append_val(records, rec);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NABI_TRACE_MAGIC, NABI_TRACE_MAGIC_LEN);
+    header.version = NABI_TRACE_VERSION;
+    header.byte_order = NABI_TRACE_BYTE_ORDER;
+    header.n_formats = n_formats;
+    header.formats_size = pool->len;
+    header.n_records = records->len;
+    header.lost = lost;
+
+    /* a new file only, not through a link someone else put there */
+    fd = open(filename, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+	      S_IRUSR | S_IWUSR);
+    file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (file == NULL) {
+	if (fd >= 0)
+	    close(fd);
+	ret = FALSE;
+    } else {
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+	    fwrite(pool->str, 1, pool->len, file) != pool->len ||
+	    fwrite(records->data, sizeof(NabiTraceRecord), records->len,
+		   file) != records->len)
+	    ret = FALSE;
+	if (fclose(file) != 0)
+	    ret = FALSE;
+    }
+
+    g_hash_table_destroy(formats);
+    g_string_free(pool, TRUE);
+    g_array_free(records, TRUE);
+
+    return ret;
+}
+
+static void
+nabi_trace_dump_run(gpointer data, gpointer user_data)
+{
+    char* filename = data;
+
+    if (nabi_trace_dump(filename))
+	fprintf(stderr, "Nabi: trace dump: %s\n", filename);
+    else
+	fprintf(stderr, "Nabi: can't write trace dump: %s: %s\n",
+		filename, g_strerror(errno));
+    g_free(filename);
+}
+
+/* the dump is written on its own thread, so the main loop does not wait
+ * for the disk; the result goes to stderr */
+int
+nabi_trace_dump_async(const char* filename)
+{
+    if (ring == NULL)
+	return FALSE;
+
+    if (dump_thread == NULL)
+	dump_thread = g_thread_pool_new(nabi_trace_dump_run, NULL,
+					1, FALSE, NULL);
+    if (dump_thread == NULL)
+	return FALSE;
+
+    g_thread_pool_push(dump_thread, g_strdup(filename), NULL);
+    return TRUE;
+}
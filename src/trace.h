@@ -0,0 +1,38 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef nabi_trace_h
+#define nabi_trace_h
+
+#include <stdarg.h>
+
+/* binary trace ring buffer
+ * When it is enabled, nabi_log() keeps the format and the arguments in
+ * fixed size records instead of printing them. The ring is written to a
+ * file on request and nabi-trace turns the file into text.
+ * this header is used by IMdkit too, so it does not use glib types */
+
+int   nabi_trace_init(unsigned int n_records);
+void  nabi_trace_free(void);
+int   nabi_trace_is_enabled(void);
+void  nabi_trace_record(int level, const char* format, va_list ap);
+int   nabi_trace_dump(const char* filename);
+int   nabi_trace_dump_async(const char* filename);
+char* nabi_trace_get_dump_filename(void);
+
+#endif /* nabi_trace_h */
@@ -21,6 +21,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -46,6 +47,7 @@
 #include "nabi.h"
 #include "ic.h"
 #include "server.h"
+#include "latency.h"
 #include "conf.h"
 #include "handlebox.h"
 #include "preference.h"
@@ -178,6 +180,22 @@ set_up_keyboard(void)
 				    nabi->config->hangul_keyboard->str);
 }
 
+/* takes the argument of the option at *i, exits when it is missing */
+static gchar*
+nabi_app_take_option_arg(int argc, char** argv, int* i)
+{
+    const char* option = argv[*i];
+
+    if (*i + 1 >= argc) {
+	fprintf(stderr, "nabi: option %s needs an argument\n", option);
+	exit(1);
+    }
+
+    argv[*i] = NULL;
+    (*i)++;
+    return argv[*i];
+}
+
 void
 nabi_app_new(void)
 {
@@ -187,6 +205,11 @@ nabi_app_new(void)
     nabi->palette = NULL;
     nabi->status_only = FALSE;
     nabi->session_id = NULL;
+    nabi->capture_file = NULL;
+    nabi->replay_file = NULL;
+    nabi->replay_output = NULL;
+    nabi->trace_size = 0;
+    nabi->trace_level = 3;
     nabi->icon_size = 0;
 
     nabi->root_window = NULL;
@@ -198,12 +221,10 @@ nabi_app_new(void)
     nabi->config = NULL;
 }
 
+/* options and config, before gtk_init(): replay does not open a display */
 void
-nabi_app_init(int *argc, char ***argv)
+nabi_app_parse_options(int *argc, char ***argv)
 {
-    gchar *icon_filename;
-    GdkPixbuf *default_icon = NULL;
-
     /* set XMODIFIERS env var to none before creating any widget
      * If this is not set, xim server will try to connect herself.
      * So It would be blocked */
@@ -244,6 +265,37 @@ nabi_app_init(int *argc, char ***argv)
 		(*argv)[i] = NULL;
 
 		nabi->xim_name = g_strdup(xim_name);
+	    } else if (strcmp("--capture", (*argv)[i]) == 0) {
+		gchar* arg = nabi_app_take_option_arg(*argc, *argv, &i);
+		nabi->capture_file = g_strdup(arg);
+		(*argv)[i] = NULL;
+	    } else if (strcmp("--replay", (*argv)[i]) == 0) {
+		gchar* arg = nabi_app_take_option_arg(*argc, *argv, &i);
+		nabi->replay_file = g_strdup(arg);
+		(*argv)[i] = NULL;
+	    } else if (strcmp("--replay-output", (*argv)[i]) == 0) {
+		gchar* arg = nabi_app_take_option_arg(*argc, *argv, &i);
+		nabi->replay_output = g_strdup(arg);
+		(*argv)[i] = NULL;
+	    } else if (strcmp("--trace", (*argv)[i]) == 0) {
+		gchar* arg = nabi_app_take_option_arg(*argc, *argv, &i);
+		gchar* end = NULL;
+		nabi->trace_size = strtol(arg, &end, 10);
+		if (end == arg || *end != '\0' || nabi->trace_size <= 0) {
+		    fprintf(stderr, "nabi: --trace needs a number of records\n");
+		    exit(1);
+		}
+		(*argv)[i] = NULL;
+	    } else if (strcmp("--trace-level", (*argv)[i]) == 0) {
+		gchar* arg = nabi_app_take_option_arg(*argc, *argv, &i);
+		gchar* end = NULL;
+		nabi->trace_level = strtol(arg, &end, 10);
+		if (end == arg || *end != '\0' ||
+		    nabi->trace_level < 0 || nabi->trace_level > 9) {
+		    fprintf(stderr, "nabi: --trace-level needs a level, 0-9\n");
+		    exit(1);
+		}
+		(*argv)[i] = NULL;
 	    } else if (strcmp("-d", (*argv)[i]) == 0) {
 		gchar* log_level = "0";
 		(*argv)[i] = NULL;
@@ -271,6 +323,13 @@ nabi_app_init(int *argc, char ***argv)
 
     nabi->config = nabi_config_new();
     nabi_config_load(nabi->config);
+}
+
+void
+nabi_app_init(void)
+{
+    gchar *icon_filename;
+    GdkPixbuf *default_icon = NULL;
 
     /* set atoms for hangul status */
     nabi->mode_info_atom = gdk_atom_intern("_HANGUL_INPUT_MODE", TRUE);
@@ -330,23 +389,31 @@ nabi_app_setup_server(void)
 	const gchar *encoding = "";
 
 	g_get_charset(&encoding);
-	message = gtk_message_dialog_new(NULL, GTK_DIALOG_MODAL,
-					 GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE,
-	   "<span size=\"x-large\" weight=\"bold\">"
-	   "한글 입력기 나비에서 알림</span>\n\n"
-	   "현재 로캘이 나비에서 지원하는 것이 아닙니다. "
-	   "이렇게 되어 있으면 한글 입력에 문제가 있을수 있습니다. "
-	   "설정을 확인해보십시오.\n\n"
-	   "현재 로캘 설정: <b>%s (%s)</b>", locale, encoding);
-	gtk_label_set_use_markup(GTK_LABEL(GTK_MESSAGE_DIALOG(message)->label),
-				 TRUE);
-	gtk_widget_show(message);
-	gtk_dialog_run(GTK_DIALOG(message));
-	gtk_widget_destroy(message);
+	if (nabi_server->display == NULL) {
+	    /* replay, there is no display to show the dialog on */
+	    nabi_log(1, "locale is not supported: %s (%s)\n",
+		     locale != NULL ? locale : "", encoding);
+	} else {
+	    message = gtk_message_dialog_new(NULL, GTK_DIALOG_MODAL,
+					     GTK_MESSAGE_WARNING,
+					     GTK_BUTTONS_CLOSE,
+	       "<span size=\"x-large\" weight=\"bold\">"
+	       "한글 입력기 나비에서 알림</span>\n\n"
+	       "현재 로캘이 나비에서 지원하는 것이 아닙니다. "
+	       "이렇게 되어 있으면 한글 입력에 문제가 있을수 있습니다. "
+	       "설정을 확인해보십시오.\n\n"
+	       "현재 로캘 설정: <b>%s (%s)</b>", locale, encoding);
+	    gtk_label_set_use_markup(
+		    GTK_LABEL(GTK_MESSAGE_DIALOG(message)->label), TRUE);
+	    gtk_widget_show(message);
+	    gtk_dialog_run(GTK_DIALOG(message));
+	    gtk_widget_destroy(message);
+	}
     }
 
     set_up_keyboard();
-    load_colors();
+    if (nabi_server->display != NULL)
+	load_colors();
     set_up_output_mode();
     keys = g_strsplit(nabi->config->trigger_keys->str, ",", 0);
     nabi_server_set_trigger_keys(nabi_server, keys);
@@ -359,6 +426,11 @@ nabi_app_setup_server(void)
     nabi_server_set_dynamic_event_flow(nabi_server,
 				       nabi->config->use_dynamic_event_flow);
     nabi_server_set_commit_by_word(nabi_server, nabi->config->commit_by_word);
+    nabi_server_set_preedit_idle_timeout(nabi_server,
+					 nabi->config->preedit_idle_timeout);
+    nabi_server_set_use_glyph_atlas(nabi_server,
+				    nabi->config->preedit_glyph_atlas);
+    nabi_latency_set_slo(nabi->config->input_lag_slo);
     nabi_server_set_auto_reorder(nabi_server, nabi->config->auto_reorder);
     nabi_server_set_simplified_chinese(nabi_server,
 				       nabi->config->use_simplified_chinese);
@@ -425,6 +497,9 @@ nabi_app_free(void)
     }
 
     g_free(nabi->xim_name);
+    g_free(nabi->capture_file);
+    g_free(nabi->replay_file);
+    g_free(nabi->replay_output);
 
     g_free(nabi);
     nabi = NULL;
@@ -701,6 +776,8 @@ static void get_statistic_string(GString *str)
     } else {
 	int i;
 	int sum;
+	char *latency;
+	char *ic_report;
 
 	g_string_append_printf(str, 
 		 "%s: %3d\n"
@@ -762,6 +839,22 @@ static void get_statistic_string(GString *str)
 	    }
 	    g_string_append(str, "\n");
 	}
+
+	latency = nabi_latency_get_report(FALSE);
+	if (latency[0] != '\0') {
+	    g_string_append_c(str, '\n');
+	    g_string_append(str, _("Keystroke latency"));
+	    g_string_append_c(str, '\n');
+	    g_string_append(str, latency);
+	}
+	g_free(latency);
+
+	ic_report = nabi_server_get_ic_report(nabi_server);
+	g_string_append_c(str, '\n');
+	g_string_append(str, _("Input contexts"));
+	g_string_append_c(str, '\n');
+	g_string_append(str, ic_report);
+	g_free(ic_report);
     }
 }
 
@@ -0,0 +1,592 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* geometry and ancestry cache of client windows
+ *
+ * Positioning the candidate window and finding the toplevel of a client
+ * window needed XGetGeometry, XTranslateCoordinates and XQueryTree round
+ * trips every time. Here a window is queried only once and kept current
+ * with ConfigureNotify, ReparentNotify and DestroyNotify.
+ *
+ * The cache talks to the X server on a private xcb connection. The
+ * toplevel walk sends a QueryTree and comes back when the reply arrives
+ * on the connection, so the main loop never waits for it. StructureNotify
+ * is selected on that connection too, which leaves the event masks of
+ * nabi's own connection alone. The geometry is fetched only when the
+ * candidate window is placed. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>		/* xcb_poll_for_reply */
+#include <glib.h>
+
+#include "debug.h"
+#include "window-cache.h"
+#include "stat.h"
+
+typedef struct _NabiWindowInfo NabiWindowInfo;
+typedef struct _NabiWindowWalk NabiWindowWalk;
+
+struct _NabiWindowInfo {
+    Window id;
+    Window root;
+    Window parent;
+    gboolean has_geometry;
+    int x;
+    int y;
+    unsigned int width;
+    unsigned int height;
+    unsigned int border;
+};
+
+/* a toplevel search waiting for a QueryTree reply */
+struct _NabiWindowWalk {
+    guint id;
+    Window window;		/* being queried */
+    Window toplevel;		/* the topmost window found so far */
+    unsigned int sequence;	/* of the QueryTree request */
+    NabiWindowCacheFunc func;
+    gpointer data;
+};
+
+static xcb_connection_t *connection = NULL;
+static gboolean connection_failed = FALSE;
+static guint connection_watch = 0;
+static guint dispatch_source = 0;
+
+static GHashTable *window_cache = NULL;
+static GList *walks = NULL;
+static guint walk_id = 0;
+
+static int window_cache_hits = 0;
+static int window_cache_misses = 0;
+static int window_cache_round_trips = 0;
+
+static void     nabi_window_cache_dispatch(void);
+
+static gboolean
+nabi_window_cache_on_readable(GIOChannel *channel, GIOCondition condition,
+			      gpointer data)
+{
+    nabi_window_cache_dispatch();
+
+    if (xcb_connection_has_error(connection)) {
+	nabi_log(1, "window cache: lost the connection to the X server\n");
+	connection_watch = 0;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+nabi_window_cache_on_idle(gpointer data)
+{
+    dispatch_source = 0;
+    nabi_window_cache_dispatch();
+    return FALSE;
+}
+
+/* a blocking wait may have read events and replies into the buffer of
+ * xcb, the fd is not readable for them any more */
+static void
+nabi_window_cache_queue_dispatch(void)
+{
+    if (dispatch_source == 0)
+	dispatch_source = g_idle_add(nabi_window_cache_on_idle, NULL);
+}
+
+static gboolean
+nabi_window_cache_open(Display *display)
+{
+    GIOChannel *channel;
+
+    if (connection != NULL)
+	return !xcb_connection_has_error(connection);
+
+    if (connection_failed)
+	return FALSE;
+
+    connection = xcb_connect(DisplayString(display), NULL);
+    if (xcb_connection_has_error(connection)) {
+	nabi_log(1, "window cache: can't connect to %s\n",
+		 DisplayString(display));
+	xcb_disconnect(connection);
+	connection = NULL;
+	connection_failed = TRUE;
+	return FALSE;
+    }
+
+    channel = g_io_channel_unix_new(xcb_get_file_descriptor(connection));
+    connection_watch = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+				      nabi_window_cache_on_readable, NULL);
+    g_io_channel_unref(channel);
+
+    window_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, g_free);
+
+    return TRUE;
+}
+
+static NabiWindowInfo*
+nabi_window_cache_lookup(Window w)
+{
+    NabiWindowInfo *info;
+
+    if (w == None || window_cache == NULL)
+	return NULL;
+
+    info = g_hash_table_lookup(window_cache, GUINT_TO_POINTER(w));
+    if (info != NULL) {
+	window_cache_hits++;
+	NABI_STAT_INC(window_cache_hits);
+    }
+
+    return info;
+}
+
+/* select before the query, so no change after it is lost */
+static void
+nabi_window_cache_select(Window w)
+{
+    uint32_t mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+
+    window_cache_misses++;
+    NABI_STAT_INC(window_cache_misses);
+    xcb_change_window_attributes(connection, w, XCB_CW_EVENT_MASK, &mask);
+}
+
+static NabiWindowInfo*
+nabi_window_cache_insert(Window w, Window root, Window parent)
+{
+    NabiWindowInfo *info;
+
+    /* it may be cached already */
+    info = g_hash_table_lookup(window_cache, GUINT_TO_POINTER(w));
+    if (info == NULL) {
+	info = g_new0(NabiWindowInfo, 1);
+	info->id = w;
+	g_hash_table_insert(window_cache, GUINT_TO_POINTER(w), info);
+    }
+    info->root = root;
+    info->parent = parent;
+
+    return info;
+}
+
+static void
+nabi_window_cache_set_geometry(NabiWindowInfo *info,
+			       xcb_get_geometry_reply_t *reply)
+{
+    info->x = reply->x;
+    info->y = reply->y;
+    info->width = reply->width;
+    info->height = reply->height;
+    info->border = reply->border_width;
+    info->has_geometry = TRUE;
+}
+
+static void
+nabi_window_walk_finish(NabiWindowWalk *walk)
+{
+    walks = g_list_remove(walks, walk);
+    walk->func(walk->toplevel, walk->data);
+    g_free(walk);
+}
+
+/* follow the cached ancestors, send a QueryTree for the first one not
+ * cached. Returns FALSE if the walk is finished */
+static gboolean
+nabi_window_walk_step(NabiWindowWalk *walk)
+{
+    NabiWindowInfo *info;
+
+    while ((info = nabi_window_cache_lookup(walk->window)) != NULL) {
+	walk->toplevel = info->id;
+	if (info->parent == info->root || info->parent == None)
+	    return FALSE;
+	walk->window = info->parent;
+    }
+
+    nabi_window_cache_select(walk->window);
+    walk->sequence = xcb_query_tree(connection, walk->window).sequence;
+    xcb_flush(connection);
+
+    return TRUE;
+}
+
+static gboolean
+nabi_window_walk_on_reply(NabiWindowWalk *walk,
+			  xcb_query_tree_reply_t *reply)
+{
+    if (reply == NULL) {
+	/* a window which can't be queried ends the walk */
+	nabi_log(4, "window cache: can't query window: 0x%x\n", walk->window);
+	return FALSE;
+    }
+
+    nabi_window_cache_insert(walk->window, reply->root, reply->parent);
+    free(reply);
+
+    return nabi_window_walk_step(walk);
+}
+
+static void
+nabi_window_cache_on_event(xcb_generic_event_t *event)
+{
+    NabiWindowInfo *info;
+
+    switch (event->response_type) {
+    case XCB_CONFIGURE_NOTIFY: {
+	/* synthetic events from the window manager have the send_event
+	 * bit and carry root coordinates, they don't match here */
+	xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t*)event;
+	info = g_hash_table_lookup(window_cache, GUINT_TO_POINTER(e->window));
+	if (info != NULL) {
+	    info->x = e->x;
+	    info->y = e->y;
+	    info->width = e->width;
+	    info->height = e->height;
+	    info->border = e->border_width;
+	    info->has_geometry = TRUE;
+	}
+	break;
+    }
+    case XCB_REPARENT_NOTIFY: {
+	xcb_reparent_notify_event_t *e = (xcb_reparent_notify_event_t*)event;
+	info = g_hash_table_lookup(window_cache, GUINT_TO_POINTER(e->window));
+	if (info != NULL) {
+	    info->parent = e->parent;
+	    info->x = e->x;
+	    info->y = e->y;
+	}
+	break;
+    }
+    case XCB_DESTROY_NOTIFY: {
+	xcb_destroy_notify_event_t *e = (xcb_destroy_notify_event_t*)event;
+	g_hash_table_remove(window_cache, GUINT_TO_POINTER(e->window));
+	break;
+    }
+    default:
+	/* errors of the selection on windows already gone */
+	break;
+    }
+}
+
+/* Replies first, then events. An event older than a reply describes
+ * a state the reply already has, applying the events in order after it
+ * ends at the same state. */
+static void
+nabi_window_cache_dispatch(void)
+{
+    xcb_generic_event_t *event;
+    gboolean progress = TRUE;
+
+    if (connection == NULL)
+	return;
+
+    /* a finished walk may start or cancel others, so scan again from
+     * the start after each reply */
+    while (progress) {
+	GList *item;
+
+	progress = FALSE;
+	for (item = walks; item != NULL; item = g_list_next(item)) {
+	    NabiWindowWalk *walk = item->data;
+	    void *reply = NULL;
+	    xcb_generic_error_t *error = NULL;
+
+	    if (!xcb_poll_for_reply(connection, walk->sequence,
+				    &reply, &error))
+		continue;
+
+	    free(error);
+	    if (!nabi_window_walk_on_reply(walk, reply))
+		nabi_window_walk_finish(walk);
+	    progress = TRUE;
+	    break;
+	}
+    }
+
+    while ((event = xcb_poll_for_event(connection)) != NULL) {
+	nabi_window_cache_on_event(event);
+	free(event);
+    }
+}
+
+/* Finds the child of the root window which contains w from the cache
+ * only. Returns FALSE if some ancestor is not cached. */
+gboolean
+nabi_window_cache_find_toplevel(Display *display, Window w,
+				Window *toplevel)
+{
+    NabiWindowInfo *info;
+
+    *toplevel = w;
+
+    info = nabi_window_cache_lookup(w);
+    while (info != NULL) {
+	*toplevel = info->id;
+	if (info->parent == info->root || info->parent == None)
+	    return TRUE;
+	info = nabi_window_cache_lookup(info->parent);
+    }
+
+    return FALSE;
+}
+
+/* The same search, with QueryTree requests for the windows not cached.
+ * func gets the toplevel when the replies arrive, or the topmost window
+ * found if some window can't be queried. If it is known already, func is
+ * called before this returns and the return value is 0, otherwise it is
+ * the id for nabi_window_cache_cancel() */
+guint
+nabi_window_cache_find_toplevel_async(Display *display, Window w,
+				      NabiWindowCacheFunc func, gpointer data)
+{
+    NabiWindowWalk *walk;
+
+    if (!nabi_window_cache_open(display)) {
+	func(w, data);
+	return 0;
+    }
+
+    walk = g_new0(NabiWindowWalk, 1);
+    walk->window = w;
+    walk->toplevel = w;
+    walk->func = func;
+    walk->data = data;
+
+    if (!nabi_window_walk_step(walk)) {
+	func(walk->toplevel, data);
+	g_free(walk);
+	return 0;
+    }
+
+    walk_id++;
+    if (walk_id == 0)
+	walk_id++;
+    walk->id = walk_id;
+    walks = g_list_prepend(walks, walk);
+
+    return walk->id;
+}
+
+void
+nabi_window_cache_cancel(guint id)
+{
+    GList *item;
+
+    for (item = walks; item != NULL; item = g_list_next(item)) {
+	NabiWindowWalk *walk = item->data;
+	if (walk->id == id) {
+	    xcb_discard_reply(connection, walk->sequence);
+	    walks = g_list_delete_link(walks, item);
+	    g_free(walk);
+	    return;
+	}
+    }
+}
+
+gboolean
+nabi_window_cache_has_pending(void)
+{
+    return walks != NULL;
+}
+
+/* QueryTree and GetGeometry together, one round trip */
+static NabiWindowInfo*
+nabi_window_cache_query(Window w)
+{
+    NabiWindowInfo *info;
+    xcb_query_tree_cookie_t tree;
+    xcb_get_geometry_cookie_t geometry;
+    xcb_query_tree_reply_t *tree_reply;
+    xcb_get_geometry_reply_t *geometry_reply;
+    xcb_generic_error_t *error = NULL;
+
+    nabi_window_cache_select(w);
+    tree = xcb_query_tree(connection, w);
+    geometry = xcb_get_geometry(connection, w);
+
+    tree_reply = xcb_query_tree_reply(connection, tree, &error);
+    free(error);
+    error = NULL;
+    geometry_reply = xcb_get_geometry_reply(connection, geometry, &error);
+    free(error);
+    window_cache_round_trips++;
+    NABI_STAT_INC(window_cache_round_trips);
+
+    if (tree_reply == NULL || geometry_reply == NULL) {
+	nabi_log(4, "window cache: can't query window: 0x%x\n", w);
+	free(tree_reply);
+	free(geometry_reply);
+	return NULL;
+    }
+
+    info = nabi_window_cache_insert(w, tree_reply->root, tree_reply->parent);
+    nabi_window_cache_set_geometry(info, geometry_reply);
+    free(tree_reply);
+    free(geometry_reply);
+
+    return info;
+}
+
+/* The root position of w, a sum over its ancestors. An uncached level
+ * costs one round trip, the geometry of the cached ones is fetched all
+ * at once in one more. */
+gboolean
+nabi_window_cache_get_geometry(Display *display, Window w,
+			       int *root_x, int *root_y,
+			       unsigned int *width, unsigned int *height)
+{
+    GPtrArray *chain;
+    GArray *cookies;
+    NabiWindowInfo *info;
+    int n_requests = 0;
+    int x = 0;
+    int y = 0;
+    guint i;
+
+    if (w == None || !nabi_window_cache_open(display))
+	return FALSE;
+
+    chain = g_ptr_array_new();
+    info = nabi_window_cache_lookup(w);
+    if (info == NULL)
+	info = nabi_window_cache_query(w);
+    while (info != NULL) {
+	g_ptr_array_add(chain, info);
+	if (info->parent == info->root || info->parent == None)
+	    break;
+	w = info->parent;
+	info = nabi_window_cache_lookup(w);
+	if (info == NULL)
+	    info = nabi_window_cache_query(w);
+    }
+
+    cookies = g_array_new(FALSE, FALSE, sizeof(xcb_get_geometry_cookie_t));
+    for (i = 0; i < chain->len; i++) {
+	xcb_get_geometry_cookie_t cookie = { 0 };
+	info = g_ptr_array_index(chain, i);
+	if (!info->has_geometry) {
+	    cookie = xcb_get_geometry(connection, info->id);
+	    n_requests++;
+	}
+	g_array_append_val(cookies, cookie);
+    }
+
+    for (i = 0; i < chain->len; i++) {
+	xcb_get_geometry_cookie_t cookie;
+	xcb_get_geometry_reply_t *reply;
+	xcb_generic_error_t *error = NULL;
+
+	cookie = g_array_index(cookies, xcb_get_geometry_cookie_t, i);
+	if (cookie.sequence == 0)
+	    continue;
+
+	info = g_ptr_array_index(chain, i);
+	reply = xcb_get_geometry_reply(connection, cookie, &error);
+	free(error);
+	if (reply != NULL) {
+	    nabi_window_cache_set_geometry(info, reply);
+	    free(reply);
+	}
+    }
+    if (n_requests > 0) {
+	window_cache_round_trips++;
+	NABI_STAT_INC(window_cache_round_trips);
+    }
+    g_array_free(cookies, TRUE);
+
+    nabi_window_cache_queue_dispatch();
+
+    /* the first window could not be queried */
+    if (chain->len == 0) {
+	g_ptr_array_free(chain, TRUE);
+	return FALSE;
+    }
+
+    info = g_ptr_array_index(chain, 0);
+    if (width != NULL)
+	*width = info->width;
+    if (height != NULL)
+	*height = info->height;
+
+    for (i = 0; i < chain->len; i++) {
+	info = g_ptr_array_index(chain, i);
+	x += info->x + info->border;
+	y += info->y + info->border;
+    }
+    g_ptr_array_free(chain, TRUE);
+
+    if (root_x != NULL)
+	*root_x = x;
+    if (root_y != NULL)
+	*root_y = y;
+
+    return TRUE;
+}
+
+void
+nabi_window_cache_get_stats(int *hits, int *misses, int *round_trips)
+{
+    if (hits != NULL)
+	*hits = window_cache_hits;
+    if (misses != NULL)
+	*misses = window_cache_misses;
+    if (round_trips != NULL)
+	*round_trips = window_cache_round_trips;
+}
+
+/* the selections go away with the connection */
+void
+nabi_window_cache_free_all(Display *display)
+{
+    GList *item;
+
+    for (item = walks; item != NULL; item = g_list_next(item))
+	g_free(item->data);
+    g_list_free(walks);
+    walks = NULL;
+
+    if (dispatch_source != 0) {
+	g_source_remove(dispatch_source);
+	dispatch_source = 0;
+    }
+
+    if (connection_watch != 0) {
+	g_source_remove(connection_watch);
+	connection_watch = 0;
+    }
+
+    if (connection != NULL) {
+	xcb_disconnect(connection);
+	connection = NULL;
+    }
+
+    if (window_cache != NULL) {
+	g_hash_table_destroy(window_cache);
+	window_cache = NULL;
+    }
+}
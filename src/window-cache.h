@@ -0,0 +1,42 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+#ifndef _WINDOW_CACHE_H
+#define _WINDOW_CACHE_H
+
+#include <X11/Xlib.h>
+#include <glib.h>
+
+typedef void (*NabiWindowCacheFunc)(Window toplevel, gpointer data);
+
+gboolean nabi_window_cache_find_toplevel(Display *display, Window w,
+					 Window *toplevel);
+guint    nabi_window_cache_find_toplevel_async(Display *display, Window w,
+					 NabiWindowCacheFunc func,
+					 gpointer data);
+void     nabi_window_cache_cancel       (guint id);
+gboolean nabi_window_cache_has_pending  (void);
+gboolean nabi_window_cache_get_geometry (Display *display, Window w,
+					 int *root_x, int *root_y,
+					 unsigned int *width,
+					 unsigned int *height);
+void     nabi_window_cache_get_stats    (int *hits, int *misses,
+					 int *round_trips);
+void     nabi_window_cache_free_all     (Display *display);
+
+#endif /* _WINDOW_CACHE_H */
@@ -0,0 +1,289 @@
+/* Nabi - X Input Method server for hangul
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA
+ */
+
+/* nabi-mkdict: compile a hanja/symbol text table into the binary
+ * dictionary format described in src/dictionary-format.h
+ *
+ * usage: nabi-mkdict input.txt output.dic
+ *
+ * The text format is the one of libhangul: "key:value:comment",
+ * lines starting with '#' are comments. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dictionary-format.h"
+
+typedef struct {
+    char*  key;
+    char*  value;
+    char*  comment;
+    size_t order;
+} Record;
+
+typedef struct {
+    const char* key;
+    uint32_t    first;
+} Suffix;
+
+typedef struct {
+    char*  data;
+    size_t len;
+    size_t alloc;
+} Pool;
+
+static void*
+xrealloc(void* ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+	fprintf(stderr, "nabi-mkdict: memory allocation error\n");
+	exit(1);
+    }
+    return ptr;
+}
+
+static char*
+xstrdup(const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* ret = xrealloc(NULL, len);
+    memcpy(ret, str, len);
+    return ret;
+}
+
+static uint32_t
+pool_add(Pool* pool, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    uint32_t offset = pool->len;
+
+    if (pool->len + len > pool->alloc) {
+	while (pool->len + len > pool->alloc)
+	    pool->alloc = pool->alloc > 0 ? pool->alloc * 2 : 4096;
+	pool->data = xrealloc(pool->data, pool->alloc);
+    }
+
+    memcpy(pool->data + pool->len, str, len);
+    pool->len += len;
+    return offset;
+}
+
+static int
+record_compare(const void* a, const void* b)
+{
+    const Record* r1 = a;
+    const Record* r2 = b;
+    int ret = strcmp(r1->key, r2->key);
+    if (ret != 0)
+	return ret;
+
+    /* keep the order of the text file for the same key */
+    if (r1->order < r2->order)
+	return -1;
+    return r1->order > r2->order;
+}
+
+static int
+suffix_compare(const void* a, const void* b)
+{
+    const Suffix* s1 = a;
+    const Suffix* s2 = b;
+    return nabi_dict_reverse_compare(s1->key, s2->key);
+}
+
+/* split like strtok_r(line, ":") does in libhangul,
+ * so both loaders see the same fields */
+static char*
+next_field(char** saved)
+{
+    char* p = *saved;
+    char* begin;
+
+    while (*p == ':')
+	p++;
+    if (*p == '\0') {
+	*saved = p;
+	return NULL;
+    }
+
+    begin = p;
+    while (*p != '\0' && *p != ':')
+	p++;
+    if (*p == ':')
+	*p++ = '\0';
+    *saved = p;
+    return begin;
+}
+
+int
+main(int argc, char* argv[])
+{
+    FILE* input;
+    FILE* output;
+    char buf[1024];
+    unsigned long line = 0;
+    Record* records = NULL;
+    size_t n = 0, alloc = 0;
+    size_t i;
+    Pool pool = { NULL, 0, 0 };
+    NabiDictHeader header;
+    NabiDictEntry* entries;
+    Suffix* suffixes;
+    NabiDictSuffix* suffix_index;
+    size_t n_suffixes;
+    uint32_t empty;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s input.txt output.dic\n", argv[0]);
+	return 1;
+    }
+
+    input = fopen(argv[1], "r");
+    if (input == NULL) {
+	fprintf(stderr, "nabi-mkdict: can't open %s\n", argv[1]);
+	return 1;
+    }
+
+    while (fgets(buf, sizeof(buf), input) != NULL) {
+	char* saved = buf;
+	char* key;
+	char* value;
+	char* comment;
+
+	/* fgets() splits a long line, the rest would be read as
+	 * another record */
+	line++;
+	if (strchr(buf, '\n') == NULL && !feof(input)) {
+	    fprintf(stderr, "nabi-mkdict: %s:%lu: line too long\n",
+		    argv[1], line);
+	    fclose(input);
+	    return 1;
+	}
+
+	if (buf[0] == '#')
+	    continue;
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+
+	key = next_field(&saved);
+	value = next_field(&saved);
+	comment = next_field(&saved);
+
+	if (key == NULL || value == NULL)
+	    continue;
+
+	if (n == alloc) {
+	    alloc = alloc > 0 ? alloc * 2 : 1024;
+	    records = xrealloc(records, alloc * sizeof(Record));
+	}
+	records[n].key = xstrdup(key);
+	records[n].value = xstrdup(value);
+	records[n].comment = xstrdup(comment != NULL ? comment : "");
+	records[n].order = n;
+	n++;
+    }
+    fclose(input);
+
+    qsort(records, n, sizeof(Record), record_compare);
+
+    entries = xrealloc(NULL, (n > 0 ? n : 1) * sizeof(NabiDictEntry));
+    empty = pool_add(&pool, "");
+    for (i = 0; i < n; i++) {
+	/* entries of the same key share one key string */
+	if (i > 0 && strcmp(records[i].key, records[i - 1].key) == 0)
+	    entries[i].key = entries[i - 1].key;
+	else
+	    entries[i].key = pool_add(&pool, records[i].key);
+
+	entries[i].value = pool_add(&pool, records[i].value);
+	if (records[i].comment[0] == '\0')
+	    entries[i].comment = empty;
+	else
+	    entries[i].comment = pool_add(&pool, records[i].comment);
+    }
+
+    /* one suffix index item for each distinct key */
+    suffixes = xrealloc(NULL, (n > 0 ? n : 1) * sizeof(Suffix));
+    n_suffixes = 0;
+    for (i = 0; i < n; i++) {
+	if (i > 0 && entries[i].key == entries[i - 1].key)
+	    continue;
+	suffixes[n_suffixes].key = records[i].key;
+	suffixes[n_suffixes].first = i;
+	n_suffixes++;
+    }
+    qsort(suffixes, n_suffixes, sizeof(Suffix), suffix_compare);
+
+    suffix_index = xrealloc(NULL, (n_suffixes > 0 ? n_suffixes : 1) *
+				  sizeof(NabiDictSuffix));
+    for (i = 0; i < n_suffixes; i++) {
+	suffix_index[i].entry = suffixes[i].first;
+	suffix_index[i].key_len = strlen(suffixes[i].key);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NABI_DICT_MAGIC, NABI_DICT_MAGIC_LEN);
+    header.version = NABI_DICT_VERSION;
+    header.byte_order = NABI_DICT_BYTE_ORDER;
+    header.n_entries = n;
+    header.entries_offset = sizeof(header);
+    header.n_suffixes = n_suffixes;
+    header.suffix_offset = header.entries_offset + n * sizeof(NabiDictEntry);
+    header.pool_offset = header.suffix_offset +
+			 n_suffixes * sizeof(NabiDictSuffix);
+    header.pool_size = pool.len;
+
+    output = fopen(argv[2], "wb");
+    if (output == NULL) {
+	fprintf(stderr, "nabi-mkdict: can't open %s\n", argv[2]);
+	return 1;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, output) != 1 ||
+	fwrite(entries, sizeof(NabiDictEntry), n, output) != n ||
+	fwrite(suffix_index, sizeof(NabiDictSuffix), n_suffixes, output)
+							!= n_suffixes ||
+	fwrite(pool.data, 1, pool.len, output) != pool.len) {
+	fprintf(stderr, "nabi-mkdict: write error: %s\n", argv[2]);
+	fclose(output);
+	remove(argv[2]);
+	return 1;
+    }
+
+    /* the buffered data is written here, a full disk shows up now */
+    if (fclose(output) != 0) {
+	fprintf(stderr, "nabi-mkdict: write error: %s\n", argv[2]);
+	remove(argv[2]);
+	return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+	free(records[i].key);
+	free(records[i].value);
+	free(records[i].comment);
+    }
+    free(records);
+    free(entries);
+    free(suffixes);
+    free(suffix_index);
+    free(pool.data);
+
+    return 0;
+}
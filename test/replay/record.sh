@@ -0,0 +1,71 @@
+#!/bin/sh
+# Records a capture for src/test-replay.sh from a real XIM session and
+# makes its expected output by replaying it.
+#
+#   test/replay/record.sh NAME [ximload options]
+#
+# nabi runs on its own Xvfb with the keymap the replay uses (replay_keymap
+# in src/ic.c: evdev rules, pc105 model, us layout) and test/ximload types
+# into it through XTest. Killing the X server makes nabi exit and close
+# the capture. The replay runs the same way as make check does. To
+# record hangul-2set again:
+#
+#   test/replay/record.sh hangul-2set -style root -words 1 -text gks
+#
+# Needs Xvfb, setxkbmap, a built src/nabi and test/ximload
+# (make -C test ximload).
+
+if test $# -lt 1; then
+    echo "usage: $0 NAME [ximload options]"
+    exit 1
+fi
+
+name=$1
+shift
+
+replaydir=`cd "\`dirname "$0"\`" && pwd`
+top=`cd "$replaydir/../.." && pwd`
+display=:${NABI_RECORD_DISPLAY-99}
+locale=${NABI_RECORD_LOCALE-ko_KR.UTF-8}
+
+tmpdir=`mktemp -d "${TMPDIR-/tmp}/nabi-record.XXXXXX"` || exit 1
+trap 'rm -rf "$tmpdir"' 0
+
+Xvfb $display -nolisten tcp > "$tmpdir/xvfb.log" 2>&1 &
+xvfb=$!
+sleep 1
+if ! DISPLAY=$display setxkbmap -rules evdev -model pc105 -layout us; then
+    kill $xvfb
+    exit 1
+fi
+
+# the default configuration, as test-replay.sh uses
+HOME=$tmpdir LC_ALL=$locale DISPLAY=$display \
+	"$top/src/nabi" --capture "$tmpdir/$name.cap" \
+	> "$tmpdir/nabi.log" 2>&1 &
+nabi=$!
+sleep 2
+
+LC_ALL=$locale DISPLAY=$display XMODIFIERS=@im=nabi \
+	"$top/test/ximload" -rate 10 "$@"
+status=$?
+sleep 1
+
+kill $xvfb
+wait $nabi
+wait $xvfb
+
+if test $status -ne 0; then
+    cat "$tmpdir/nabi.log"
+    exit $status
+fi
+
+HOME=$tmpdir LC_ALL=C.UTF-8 "$top/src/nabi" --replay "$tmpdir/$name.cap" \
+	--replay-output "$tmpdir/$name.out" > "$tmpdir/replay.log" 2>&1 || {
+    cat "$tmpdir/replay.log"
+    exit 1
+}
+
+cp "$tmpdir/$name.cap" "$tmpdir/$name.out" "$replaydir/"
+echo "$replaydir/$name.cap"
+echo "$replaydir/$name.out"
@@ -1,5 +1,36 @@
+/* xim_filter.so: XIM latency profiler for unmodified X applications
+ *
+ *   LD_PRELOAD=./xim_filter.so gvim
+ *
+ * Every KeyPress entering XFilterEvent() is timestamped and matched with
+ * the result that reaches the application:
+ *
+ *   lookup   the key comes back from the IM server, or a commit string
+ *            (a KeyPress with keycode 0) is read with X*LookupString()
+ *   preedit  the preedit draw callback of an on the spot IC is called
+ *
+ * The IM server answers the keys of one display in order, so a commit or
+ * a preedit draw is taken as the answer of the latest pending key, and
+ * the keys before it are counted as consumed without a visible result
+ * (the preedit of the other styles is drawn by the server itself).
+ * A burst of keys typed faster than the server answers is therefore
+ * measured a bit short.
+ *
+ * The time spent inside XFilterEvent() itself is recorded too. A KeyPress
+ * that blocks there longer than XIM_FILTER_SYNC_MS (default 1) is counted
+ * as stuck in a synchronous wait for the server.
+ *
+ * The report is written at exit to XIM_FILTER_LOG (default stderr),
+ * one block per process. XIM_FILTER_TRACE=1 prints every call as before. */
+
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <dlfcn.h>
 #include <X11/Xlib.h>
 
@@ -63,9 +94,320 @@ static Bool (*orig_XUnregisterIMInstantiateCallback)(
     XPointer                    /* client_data */
 ) = NULL;
 
+static int (*orig_XwcLookupString)(
+    XIC                 /* ic */,
+    XKeyPressedEvent*   /* event */,
+    wchar_t*            /* buffer_return */,
+    int                 /* wchars_buffer */,
+    KeySym*             /* keysym_return */,
+    Status*             /* status_return */
+) = NULL;
+
+static int (*orig_Xutf8LookupString)(
+    XIC                 /* ic */,
+    XKeyPressedEvent*   /* event */,
+    char*               /* buffer_return */,
+    int                 /* bytes_buffer */,
+    KeySym*             /* keysym_return */,
+    Status*             /* status_return */
+) = NULL;
+
+/* histogram buckets, upper limits in microseconds like src/latency.c */
+#define N_BUCKETS 12
+static const long long bucket_limits[N_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000
+};
+
+enum {
+    HIST_LOOKUP,
+    HIST_PREEDIT,
+    HIST_FILTER,
+    N_HISTS
+};
+
+static const char *hist_names[N_HISTS] = {
+    "lookup", "preedit", "filter"
+};
+
+typedef struct {
+    unsigned long count;
+    long long sum;
+    long long max;
+    unsigned long buckets[N_BUCKETS];
+} Histogram;
+
+#define N_PENDING 256
+
+typedef struct {
+    Display *display;
+    unsigned int keycode;
+    Time time;
+    long long start;
+} PendingKey;
+
+#define N_WRAPPED_ICS 64
+
+typedef struct {
+    XIC ic;
+    Display *display;
+    XIMCallback draw;	/* callback of the application */
+} WrappedIC;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace = 0;
+static long long sync_threshold = 1000;
+
+static Histogram hists[N_HISTS];
+static PendingKey pending[N_PENDING];
+static int n_pending = 0;
+static WrappedIC wrapped_ics[N_WRAPPED_ICS];
+
+static unsigned long n_keys = 0;	/* KeyPress seen by XFilterEvent */
+static unsigned long n_passed = 0;	/* not taken by the IM */
+static unsigned long n_consumed = 0;	/* taken without visible result */
+static unsigned long n_dropped = 0;	/* pending table overflow */
+static unsigned long n_sync = 0;	/* blocked in XFilterEvent */
+
+static long long
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+hist_add(int hist, long long usec)
+{
+    Histogram *h = &hists[hist];
+    int i;
+
+    for (i = 0; i < N_BUCKETS - 1; i++) {
+	if (usec < bucket_limits[i])
+	    break;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum += usec;
+    if (usec > h->max)
+	h->max = usec;
+}
+
+static long long
+hist_percentile(const Histogram *h, double ratio)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for (i = 0; i < N_BUCKETS - 1; i++) {
+	sum += h->buckets[i];
+	if (sum >= h->count * ratio)
+	    return bucket_limits[i];
+    }
+    return h->max;
+}
+
+static void
+pending_remove(int index)
+{
+    n_pending--;
+    memmove(&pending[index], &pending[index + 1],
+	    (n_pending - index) * sizeof(PendingKey));
+}
+
+static int
+pending_find(Display *display, unsigned int keycode, Time time)
+{
+    int i;
+    for (i = 0; i < n_pending; i++) {
+	if (pending[i].display == display &&
+	    pending[i].keycode == keycode &&
+	    pending[i].time == time)
+	    return i;
+    }
+    return -1;
+}
+
+static int
+pending_find_latest(Display *display)
+{
+    int i;
+    for (i = n_pending - 1; i >= 0; i--) {
+	if (pending[i].display == display)
+	    return i;
+    }
+    return -1;
+}
+
+/* record the answer of the pending key at index, the keys of the same
+ * display before it have been processed without a visible result */
+static void
+pending_answer(int index, int hist, long long now)
+{
+    Display *display = pending[index].display;
+    int i;
+
+    hist_add(hist, now - pending[index].start);
+    pending_remove(index);
+
+    for (i = index - 1; i >= 0; i--) {
+	if (pending[i].display == display) {
+	    pending_remove(i);
+	    n_consumed++;
+	}
+    }
+}
+
+static void
+on_key_result(XKeyPressedEvent *event)
+{
+    long long now = now_usec();
+    int index;
+
+    pthread_mutex_lock(&lock);
+    if (event->keycode == 0)
+	index = pending_find_latest(event->display);
+    else
+	index = pending_find(event->display, event->keycode, event->time);
+    if (index >= 0)
+	pending_answer(index, HIST_LOOKUP, now);
+    pthread_mutex_unlock(&lock);
+}
+
+static void
+preedit_draw_hook(XIC ic, XPointer client_data, XPointer call_data)
+{
+    WrappedIC *w = (WrappedIC*)client_data;
+    long long now = now_usec();
+    int index;
+
+    pthread_mutex_lock(&lock);
+    index = pending_find_latest(w->display);
+    if (index >= 0)
+	pending_answer(index, HIST_PREEDIT, now);
+    pthread_mutex_unlock(&lock);
+
+    if (w->draw.callback != NULL)
+	w->draw.callback((XIM)ic, w->draw.client_data, call_data);
+}
+
+/* replace the preedit draw callback of an on the spot IC,
+ * called on XSetICFocus() because XCreateIC() is variadic */
+static void
+wrap_preedit_draw(XIC ic)
+{
+    XIMStyle style = 0;
+    XIMCallback *draw = NULL;
+    XIMCallback hook;
+    XVaNestedList attr;
+    WrappedIC *w = NULL;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < N_WRAPPED_ICS; i++) {
+	if (wrapped_ics[i].ic == ic) {
+	    pthread_mutex_unlock(&lock);
+	    return;
+	}
+	if (w == NULL && wrapped_ics[i].ic == NULL)
+	    w = &wrapped_ics[i];
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (w == NULL)
+	return;
+
+    if (XGetICValues(ic, XNInputStyle, &style, NULL) != NULL)
+	return;
+    if ((style & XIMPreeditCallbacks) != XIMPreeditCallbacks)
+	return;
+
+    attr = XVaCreateNestedList(0, XNPreeditDrawCallback, &draw, NULL);
+    if (XGetICValues(ic, XNPreeditAttributes, attr, NULL) != NULL)
+	draw = NULL;
+    XFree(attr);
+    if (draw == NULL)
+	return;
+
+    pthread_mutex_lock(&lock);
+    w->ic = ic;
+    w->display = XDisplayOfIM(XIMOfIC(ic));
+    w->draw = *draw;
+    pthread_mutex_unlock(&lock);
+    XFree(draw);
+
+    hook.callback = (XIMProc)preedit_draw_hook;
+    hook.client_data = (XPointer)w;
+    attr = XVaCreateNestedList(0, XNPreeditDrawCallback, &hook, NULL);
+    XSetICValues(ic, XNPreeditAttributes, attr, NULL);
+    XFree(attr);
+}
+
+static void
+unwrap_ic(XIC ic)
+{
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < N_WRAPPED_ICS; i++) {
+	if (wrapped_ics[i].ic == ic)
+	    memset(&wrapped_ics[i], 0, sizeof(WrappedIC));
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void
+write_report(void)
+{
+    FILE *file = stderr;
+    const char *filename = getenv("XIM_FILTER_LOG");
+    int i, j;
+
+    if (n_keys == 0)
+	return;
+
+    if (filename != NULL) {
+	file = fopen(filename, "a");
+	if (file == NULL)
+	    return;
+    }
+
+    pthread_mutex_lock(&lock);
+    fprintf(file, "xim latency: %s[%d]\n",
+	    program_invocation_short_name, (int)getpid());
+    fprintf(file, "  keys: %lu, passed: %lu, consumed: %lu, "
+		  "unanswered: %d, dropped: %lu\n",
+	    n_keys, n_passed, n_consumed, n_pending, n_dropped);
+    fprintf(file, "  stuck in sync wait (>= %lld us): %lu\n",
+	    sync_threshold, n_sync);
+    for (i = 0; i < N_HISTS; i++) {
+	Histogram *h = &hists[i];
+	if (h->count == 0)
+	    continue;
+
+	fprintf(file, "  %-8s n=%lu avg=%lldus p50<%lldus p99<%lldus max=%lldus\n",
+		hist_names[i], h->count, h->sum / (long long)h->count,
+		hist_percentile(h, 0.5), hist_percentile(h, 0.99), h->max);
+	fprintf(file, "          ");
+	for (j = 0; j < N_BUCKETS; j++)
+	    fprintf(file, " %lu", h->buckets[j]);
+	fprintf(file, "\n");
+    }
+    fprintf(file, "  buckets (us):");
+    for (j = 0; j < N_BUCKETS - 1; j++)
+	fprintf(file, " <%lld", bucket_limits[j]);
+    fprintf(file, " >=%lld\n", bucket_limits[N_BUCKETS - 2]);
+    pthread_mutex_unlock(&lock);
+
+    if (file != stderr)
+	fclose(file);
+}
+
 __attribute__((constructor))
 void init()
 {
+    const char *env;
+
     orig_XNextEvent       = dlsym(RTLD_NEXT, "XNextEvent");
     orig_XOpenIM          = dlsym(RTLD_NEXT, "XOpenIM");
     orig_XCloseIM         = dlsym(RTLD_NEXT, "XCloseIM");
@@ -74,10 +416,25 @@ void init()
     orig_XUnsetICFocus    = dlsym(RTLD_NEXT, "XUnsetICFocus");
     orig_XFilterEvent     = dlsym(RTLD_NEXT, "XFilterEvent");
     orig_XmbLookupString  = dlsym(RTLD_NEXT, "XmbLookupString");
+    orig_XwcLookupString  = dlsym(RTLD_NEXT, "XwcLookupString");
+    orig_Xutf8LookupString = dlsym(RTLD_NEXT, "Xutf8LookupString");
     orig_XRegisterIMInstantiateCallback
 	= dlsym(RTLD_NEXT, "XRegisterIMInstantiateCallback");
     orig_XUnregisterIMInstantiateCallback
 	= dlsym(RTLD_NEXT, "XUnregisterIMInstantiateCallback");
+
+    env = getenv("XIM_FILTER_TRACE");
+    trace = env != NULL && env[0] != '\0' && env[0] != '0';
+
+    env = getenv("XIM_FILTER_SYNC_MS");
+    if (env != NULL)
+	sync_threshold = strtod(env, NULL) * 1000;
+}
+
+__attribute__((destructor))
+void fini()
+{
+    write_report();
 }
 
 int XNextEvent(
@@ -87,7 +444,8 @@ int XNextEvent(
 {
     int ret;
     ret = orig_XNextEvent(display, event_return);
-    if (event_return->type == KeyPress || event_return->type == KeyRelease) {
+    if (trace &&
+	(event_return->type == KeyPress || event_return->type == KeyRelease)) {
 	char t = event_return->type == KeyPress ? 'P' : 'R';
 	printf("%s: (%c, c:0x%x, w:0x%x)\n",
 		__func__,
@@ -104,7 +462,8 @@ XIM XOpenIM(
     char*                       res_class
 )
 {
-    printf("%s:\n", __func__);
+    if (trace)
+	printf("%s:\n", __func__);
     return orig_XOpenIM(dpy, rdb, res_name, res_class);
 }
 
@@ -112,7 +471,8 @@ Status XCloseIM(
     XIM im
 )
 {
-    printf("%s:\n", __func__);
+    if (trace)
+	printf("%s:\n", __func__);
     return orig_XCloseIM(im);
 }
 
@@ -120,7 +480,9 @@ void XDestroyIC(
     XIC ic
 )
 {
-    printf("%s: %p\n", __func__, ic);
+    if (trace)
+	printf("%s: %p\n", __func__, ic);
+    unwrap_ic(ic);
     return orig_XDestroyIC(ic);
 }
 
@@ -128,8 +490,11 @@ void XSetICFocus(
     XIC ic
 )
 {
-    unsigned int* p = (unsigned int*)ic;
-    printf("%s: %p: focus window: %x %x\n", __func__, ic, p[3], p[5]);
+    if (trace) {
+	unsigned int* p = (unsigned int*)ic;
+	printf("%s: %p: focus window: %x %x\n", __func__, ic, p[3], p[5]);
+    }
+    wrap_preedit_draw(ic);
     return orig_XSetICFocus(ic);
 }
 
@@ -137,7 +502,8 @@ void XUnsetICFocus(
     XIC ic
 )
 {
-    printf("%s: %p\n", __func__, ic);
+    if (trace)
+	printf("%s: %p\n", __func__, ic);
     return orig_XUnsetICFocus(ic);
 }
 
@@ -146,17 +512,65 @@ Bool XFilterEvent(
     Window      window
 )
 {
-    if (window != None) {
-	if (event->type == KeyPress || event->type == KeyRelease) {
-	    Bool ret = orig_XFilterEvent(event, window);
-	    char t = event->type == KeyPress ? 'P' : 'R';
-	    printf("%s: (%c, c:0x%x, w:0x%x), window=0x%x, ret: %d\n",
+    if (window != None && event->type == KeyPress) {
+	XKeyPressedEvent *key = &event->xkey;
+	long long start = now_usec();
+	long long elapsed;
+	int is_new = 0;
+	Bool ret;
+
+	/* a key forwarded back by the server is seen here a second time */
+	pthread_mutex_lock(&lock);
+	if (key->keycode != 0 &&
+	    pending_find(key->display, key->keycode, key->time) < 0) {
+	    is_new = 1;
+	    n_keys++;
+	    if (n_pending == N_PENDING) {
+		pending_remove(0);
+		n_dropped++;
+	    }
+	    pending[n_pending].display = key->display;
+	    pending[n_pending].keycode = key->keycode;
+	    pending[n_pending].time = key->time;
+	    pending[n_pending].start = start;
+	    n_pending++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	ret = orig_XFilterEvent(event, window);
+
+	elapsed = now_usec() - start;
+	pthread_mutex_lock(&lock);
+	hist_add(HIST_FILTER, elapsed);
+	if (elapsed >= sync_threshold)
+	    n_sync++;
+	if (is_new && !ret) {
+	    /* the IM did not take it */
+	    int index = pending_find(key->display, key->keycode, key->time);
+	    if (index >= 0)
+		pending_remove(index);
+	    n_passed++;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (trace) {
+	    printf("%s: (P, c:0x%x, w:0x%x), window=0x%x, ret: %d, %lldus\n",
 		    __func__,
-		    t, event->xkey.keycode,
-		    (unsigned int)event->xkey.window,
-		    (unsigned int)window, ret);
-	    return ret;
+		    key->keycode,
+		    (unsigned int)key->window,
+		    (unsigned int)window, ret, elapsed);
 	}
+	return ret;
+    }
+
+    if (trace && window != None && event->type == KeyRelease) {
+	Bool ret = orig_XFilterEvent(event, window);
+	printf("%s: (R, c:0x%x, w:0x%x), window=0x%x, ret: %d\n",
+		__func__,
+		event->xkey.keycode,
+		(unsigned int)event->xkey.window,
+		(unsigned int)window, ret);
+	return ret;
     }
     return orig_XFilterEvent(event, window);
 }
@@ -170,11 +584,48 @@ int XmbLookupString(
     Status*             status_return
 ) 
 {
-    printf("%s: %p\n", __func__, ic);
+    if (trace)
+	printf("%s: %p\n", __func__, ic);
+    if (event->type == KeyPress)
+	on_key_result(event);
     return orig_XmbLookupString(ic, event, buffer_return, bytes_buffer,
 				keysym_return, status_return);
 }
 
+int XwcLookupString(
+    XIC                 ic,
+    XKeyPressedEvent*   event,
+    wchar_t*            buffer_return,
+    int                 wchars_buffer,
+    KeySym*             keysym_return,
+    Status*             status_return
+)
+{
+    if (trace)
+	printf("%s: %p\n", __func__, ic);
+    if (event->type == KeyPress)
+	on_key_result(event);
+    return orig_XwcLookupString(ic, event, buffer_return, wchars_buffer,
+				keysym_return, status_return);
+}
+
+int Xutf8LookupString(
+    XIC                 ic,
+    XKeyPressedEvent*   event,
+    char*               buffer_return,
+    int                 bytes_buffer,
+    KeySym*             keysym_return,
+    Status*             status_return
+)
+{
+    if (trace)
+	printf("%s: %p\n", __func__, ic);
+    if (event->type == KeyPress)
+	on_key_result(event);
+    return orig_Xutf8LookupString(ic, event, buffer_return, bytes_buffer,
+				  keysym_return, status_return);
+}
+
 Bool XRegisterIMInstantiateCallback(
     Display*                    dpy,
     struct _XrmHashBucketRec*   rdb,
@@ -184,7 +635,8 @@ Bool XRegisterIMInstantiateCallback(
     XPointer                    client_data
 )
 {
-    printf("%s:\n", __func__);
+    if (trace)
+	printf("%s:\n", __func__);
     return orig_XRegisterIMInstantiateCallback(dpy, rdb, res_name, res_class,
 					       callback, client_data);
 }
@@ -198,7 +650,8 @@ Bool XUnregisterIMInstantiateCallback(
     XPointer                    client_data
 )
 {
-    printf("%s:\n", __func__);
+    if (trace)
+	printf("%s:\n", __func__);
     return orig_XUnregisterIMInstantiateCallback(dpy, rdb, res_name, res_class,
 					       callback, client_data);
 }
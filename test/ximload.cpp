@@ -0,0 +1,595 @@
+// ximload: multi client XIM load generator
+//
+// Opens N connections with M ICs each against the running XIM server,
+// types hangul words into them through XTest and reports the latency of
+// each word and the throughput. Run it against nabi on Xvfb:
+//
+//   Xvfb :9 &
+//   DISPLAY=:9 nabi &
+//   DISPLAY=:9 ./ximload -n 8 -m 4 -style on -rate 200 -words 2000
+//
+// A word is typed as its 2-beolsik keys followed by a space. The latency
+// of a word is the time from injecting the space until the client gets
+// the space back from the server, which comes after the commit of the
+// word. With "-rate 0" the next word is typed as soon as fewer than
+// "-window" words are in flight, which gives the throughput ceiling.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+#include <poll.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+#include <string>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class LoadView {
+public:
+    LoadView();
+
+    bool create(Display *display, XIM im, XFontSet fontset, int inputStyle);
+    void destroy();
+
+    Window window() const { return m_window; }
+
+    void onKeyPress(XKeyPressedEvent *event);
+
+    // on the spot callbacks
+    static void preeditStartCallback(XIM xim, XPointer client_data, XPointer data);
+    static void preeditDoneCallback(XIM xim, XPointer client_data, XPointer data);
+    static void preeditDrawCallback(XIM xim, XPointer client_data, XPointer data);
+    static void preeditCaretCallback(XIM xim, XPointer client_data, XPointer data);
+
+    std::deque<double> pending;	// injection time of the words in flight
+
+    static std::vector<double> latencies;
+    static unsigned long preeditDraws;
+    static unsigned long committedBytes;
+    static unsigned long hangulChars;
+
+private:
+    Display *m_display;
+    Window m_window;
+    XIC m_ic;
+    int m_width;
+    int m_height;
+};
+
+std::vector<double> LoadView::latencies;
+unsigned long LoadView::preeditDraws = 0;
+unsigned long LoadView::committedBytes = 0;
+unsigned long LoadView::hangulChars = 0;
+
+LoadView::LoadView() :
+    m_display(NULL),
+    m_window(0),
+    m_ic(NULL),
+    m_width(200),
+    m_height(40)
+{
+}
+
+bool LoadView::create(Display *display, XIM im, XFontSet fontset, int inputStyle)
+{
+    m_display = display;
+    int screen = DefaultScreen(m_display);
+    m_window = XCreateSimpleWindow(m_display, RootWindow(m_display, screen),
+				   0, 0, m_width, m_height, 0,
+				   BlackPixel(m_display, screen),
+				   WhitePixel(m_display, screen));
+
+    if ((inputStyle & XIMPreeditCallbacks) == XIMPreeditCallbacks) {
+	XIMCallback preedit_start;
+	XIMCallback preedit_done;
+	XIMCallback preedit_draw;
+	XIMCallback preedit_caret;
+	preedit_start.callback = preeditStartCallback;
+	preedit_start.client_data = (XPointer)this;
+	preedit_done.callback = preeditDoneCallback;
+	preedit_done.client_data = (XPointer)this;
+	preedit_draw.callback = preeditDrawCallback;
+	preedit_draw.client_data = (XPointer)this;
+	preedit_caret.callback = preeditCaretCallback;
+	preedit_caret.client_data = (XPointer)this;
+	XVaNestedList p_attr = XVaCreateNestedList(0,
+				 XNPreeditStartCallback, &preedit_start,
+				 XNPreeditDoneCallback,  &preedit_done,
+				 XNPreeditDrawCallback,  &preedit_draw,
+				 XNPreeditCaretCallback, &preedit_caret,
+				 NULL);
+	m_ic = XCreateIC(im,
+			 XNInputStyle, XIMPreeditCallbacks | XIMStatusNothing,
+			 XNClientWindow, m_window,
+			 XNPreeditAttributes, p_attr,
+			 NULL);
+	XFree(p_attr);
+    } else if ((inputStyle & XIMPreeditPosition) == XIMPreeditPosition) {
+	XRectangle area;
+	area.x = 0;
+	area.y = 0;
+	area.width = m_width;
+	area.height = m_height;
+
+	XPoint spotLocation;
+	spotLocation.x = 0;
+	spotLocation.y = m_height / 2;
+
+	XVaNestedList attr = XVaCreateNestedList(0,
+					     XNSpotLocation, &spotLocation,
+					     XNArea, &area,
+					     XNFontSet, fontset,
+					     NULL);
+	m_ic = XCreateIC(im,
+			 XNInputStyle, XIMPreeditPosition | XIMStatusNothing,
+			 XNClientWindow, m_window,
+			 XNPreeditAttributes, attr,
+			 NULL);
+	XFree(attr);
+    } else {
+	m_ic = XCreateIC(im,
+			 XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
+			 XNClientWindow, m_window,
+			 NULL);
+    }
+
+    if (m_ic == NULL) {
+	printf("cannot create XIC\n");
+	return false;
+    }
+
+    unsigned long fevent = 0;
+    XGetICValues(m_ic, XNFilterEvents, &fevent, NULL);
+    XSelectInput(m_display, m_window, KeyPressMask | FocusChangeMask | fevent);
+    XMapWindow(m_display, m_window);
+
+    // the focus of X moves between the views all the time,
+    // the IC keeps its focus so no reset happens on the way
+    XSetICFocus(m_ic);
+    return true;
+}
+
+void LoadView::destroy()
+{
+    if (m_ic != NULL) {
+	XDestroyIC(m_ic);
+	m_ic = NULL;
+    }
+    if (m_window != 0) {
+	XDestroyWindow(m_display, m_window);
+	m_window = 0;
+    }
+}
+
+void LoadView::onKeyPress(XKeyPressedEvent *event)
+{
+    char buf[256];
+    KeySym keysym = 0;
+    Status status = XLookupNone;
+
+    int len = XmbLookupString(m_ic, event, buf, sizeof(buf) - 1, &keysym, &status);
+    if (status == XLookupChars || status == XLookupBoth) {
+	committedBytes += len;
+	for (int i = 0; i < len; i++) {
+	    // lead bytes of U+AC00..U+D7A3 in utf-8
+	    unsigned char c = buf[i];
+	    if (c >= 0xea && c <= 0xed)
+		hangulChars++;
+	}
+    }
+
+    if ((status == XLookupKeySym || status == XLookupBoth) &&
+	keysym == XK_space) {
+	if (!pending.empty()) {
+	    latencies.push_back(now() - pending.front());
+	    pending.pop_front();
+	}
+    }
+}
+
+void LoadView::preeditStartCallback(XIM xim, XPointer user_data, XPointer data)
+{
+}
+
+void LoadView::preeditDoneCallback(XIM xim, XPointer user_data, XPointer data)
+{
+}
+
+void LoadView::preeditDrawCallback(XIM xim, XPointer user_data, XPointer data)
+{
+    preeditDraws++;
+}
+
+void LoadView::preeditCaretCallback(XIM xim, XPointer user_data, XPointer data)
+{
+}
+
+struct Connection {
+    Display *display;
+    XIM im;
+    XFontSet fontset;
+    std::vector<LoadView*> views;
+};
+
+class KeyInjector {
+public:
+    KeyInjector(Display *display) : m_display(display) {}
+
+    bool typeKey(char c);
+    bool typeKeysym(const char *name);
+    void focus(Window window);
+
+private:
+    void fakeKey(KeySym keysym, bool shift);
+
+    Display *m_display;
+};
+
+void KeyInjector::fakeKey(KeySym keysym, bool shift)
+{
+    KeyCode code = XKeysymToKeycode(m_display, keysym);
+    KeyCode shiftCode = XKeysymToKeycode(m_display, XK_Shift_L);
+
+    if (code == 0)
+	return;
+
+    if (shift)
+	XTestFakeKeyEvent(m_display, shiftCode, True, CurrentTime);
+    XTestFakeKeyEvent(m_display, code, True, CurrentTime);
+    XTestFakeKeyEvent(m_display, code, False, CurrentTime);
+    if (shift)
+	XTestFakeKeyEvent(m_display, shiftCode, False, CurrentTime);
+}
+
+bool KeyInjector::typeKey(char c)
+{
+    if (c == ' ') {
+	fakeKey(XK_space, false);
+    } else if (c >= 'a' && c <= 'z') {
+	fakeKey(XK_a + (c - 'a'), false);
+    } else if (c >= 'A' && c <= 'Z') {
+	fakeKey(XK_a + (c - 'A'), true);
+    } else {
+	return false;
+    }
+    return true;
+}
+
+// "Hangul" or "Shift+space"
+bool KeyInjector::typeKeysym(const char *name)
+{
+    bool shift = false;
+    if (strncmp(name, "Shift+", 6) == 0) {
+	shift = true;
+	name += 6;
+    }
+
+    KeySym keysym = XStringToKeysym(name);
+    if (keysym == NoSymbol || XKeysymToKeycode(m_display, keysym) == 0) {
+	printf("no keycode for %s\n", name);
+	return false;
+    }
+    fakeKey(keysym, shift);
+    return true;
+}
+
+void KeyInjector::focus(Window window)
+{
+    XSetInputFocus(m_display, window, RevertToPointerRoot, CurrentTime);
+}
+
+static std::map<Window, LoadView*> views;
+static std::vector<Connection> connections;
+
+static int processEvents(int timeout)
+{
+    std::vector<struct pollfd> fds(connections.size());
+    int n = 0;
+
+    for (size_t i = 0; i < connections.size(); i++) {
+	if (XPending(connections[i].display) > 0)
+	    timeout = 0;
+	fds[i].fd = ConnectionNumber(connections[i].display);
+	fds[i].events = POLLIN;
+	fds[i].revents = 0;
+    }
+
+    poll(&fds[0], fds.size(), timeout);
+
+    for (size_t i = 0; i < connections.size(); i++) {
+	Display *display = connections[i].display;
+	while (XPending(display) > 0) {
+	    XEvent event;
+	    XNextEvent(display, &event);
+	    n++;
+	    if (XFilterEvent(&event, None))
+		continue;
+
+	    if (event.type == KeyPress) {
+		std::map<Window, LoadView*>::iterator iter;
+		iter = views.find(event.xkey.window);
+		if (iter != views.end())
+		    iter->second->onKeyPress(&event.xkey);
+	    }
+	}
+    }
+    return n;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+	return 0.0;
+    size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [options]\n"
+	   "  -n N          number of connections (1)\n"
+	   "  -m M          number of ICs per connection (1)\n"
+	   "  -style STYLE  on, over or root (on)\n"
+	   "  -rate R       keys per second, 0 for as fast as possible (100)\n"
+	   "  -window W     words in flight with -rate 0 (N * M)\n"
+	   "  -words W      number of words to type (1000)\n"
+	   "  -text KEYS    space separated 2-beolsik words\n"
+	   "  -trigger KEY  key to turn on hangul mode (Shift+space)\n"
+	   "  -notrigger    do not send the trigger key\n",
+	   name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int nconnections = 1;
+    int nics = 1;
+    int inputStyle = XIMPreeditCallbacks;
+    double rate = 100.0;
+    int window = 0;
+    int nwords = 1000;
+    const char *text = "dkssud gktpdy qksrkqtmqslek gksrmf dlqfur xptmxm";
+    const char *trigger = "Shift+space";
+
+    for (int i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+	    nconnections = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+	    nics = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-style") == 0 && i + 1 < argc) {
+	    i++;
+	    if (strcmp(argv[i], "on") == 0) {
+		inputStyle = XIMPreeditCallbacks;
+	    } else if (strcmp(argv[i], "over") == 0) {
+		inputStyle = XIMPreeditPosition;
+	    } else if (strcmp(argv[i], "root") == 0) {
+		inputStyle = XIMPreeditNothing;
+	    } else {
+		usage(argv[0]);
+		return 1;
+	    }
+	} else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc) {
+	    rate = atof(argv[++i]);
+	} else if (strcmp(argv[i], "-window") == 0 && i + 1 < argc) {
+	    window = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-words") == 0 && i + 1 < argc) {
+	    nwords = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-text") == 0 && i + 1 < argc) {
+	    text = argv[++i];
+	} else if (strcmp(argv[i], "-trigger") == 0 && i + 1 < argc) {
+	    trigger = argv[++i];
+	} else if (strcmp(argv[i], "-notrigger") == 0) {
+	    trigger = NULL;
+	} else {
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+
+    if (nconnections <= 0 || nics <= 0 || nwords <= 0) {
+	usage(argv[0]);
+	return 1;
+    }
+    if (window <= 0)
+	window = nconnections * nics;
+
+    std::vector<std::string> words;
+    {
+	std::string all(text);
+	size_t pos = 0;
+	while (pos < all.size()) {
+	    size_t end = all.find(' ', pos);
+	    if (end == std::string::npos)
+		end = all.size();
+	    if (end > pos)
+		words.push_back(all.substr(pos, end - pos));
+	    pos = end + 1;
+	}
+    }
+    if (words.empty()) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    if (setlocale(LC_CTYPE, "") == NULL || !XSupportsLocale()) {
+	printf("Can't set locale\n");
+	return 1;
+    }
+    if (XSetLocaleModifiers("") == NULL) {
+	printf("Can't set locale modifiers\n");
+	return 1;
+    }
+
+    Display *control = XOpenDisplay("");
+    if (control == NULL) {
+	printf("Can't open display\n");
+	return 1;
+    }
+
+    int event_base, error_base, major, minor;
+    if (!XTestQueryExtension(control, &event_base, &error_base, &major, &minor)) {
+	printf("XTest is not available\n");
+	return 1;
+    }
+
+    std::vector<LoadView*> all;
+    for (int i = 0; i < nconnections; i++) {
+	Connection conn;
+	conn.display = XOpenDisplay("");
+	if (conn.display == NULL) {
+	    printf("Can't open display\n");
+	    return 1;
+	}
+
+	conn.im = XOpenIM(conn.display, NULL, NULL, NULL);
+	if (conn.im == NULL) {
+	    printf("Can't open XIM\n");
+	    return 1;
+	}
+
+	conn.fontset = NULL;
+	if (inputStyle == XIMPreeditPosition) {
+	    char **missing_list = NULL;
+	    int missing_count = 0;
+	    char *default_string = NULL;
+	    conn.fontset = XCreateFontSet(conn.display, "*,*",
+				&missing_list, &missing_count, &default_string);
+	    if (missing_list != NULL)
+		XFreeStringList(missing_list);
+	}
+
+	for (int j = 0; j < nics; j++) {
+	    LoadView *view = new LoadView();
+	    if (!view->create(conn.display, conn.im, conn.fontset, inputStyle))
+		return 1;
+	    conn.views.push_back(view);
+	    views[view->window()] = view;
+	    all.push_back(view);
+	}
+	XSync(conn.display, False);
+	connections.push_back(conn);
+    }
+
+    printf("%d connections, %d ICs each, style: 0x%x\n",
+	   nconnections, nics, inputStyle);
+
+    KeyInjector injector(control);
+
+    // turn on hangul mode of every view
+    if (trigger != NULL) {
+	for (size_t i = 0; i < all.size(); i++) {
+	    injector.focus(all[i]->window());
+	    if (!injector.typeKeysym(trigger))
+		return 1;
+	    XSync(control, False);
+	    processEvents(10);
+	}
+    }
+    double settle = now() + 0.5;
+    while (now() < settle)
+	processEvents(50);
+    LoadView::preeditDraws = 0;
+    LoadView::committedBytes = 0;
+    LoadView::hangulChars = 0;
+
+    // type the words, word by word in round robin over the views
+    size_t sent = 0;
+    size_t nkeys = 0;
+    size_t inflight = 0;
+    size_t current = 0;
+    double interval = rate > 0.0 ? 1.0 / rate : 0.0;
+    double start = now();
+    double next = start;
+
+    while (sent < (size_t)nwords) {
+	if (rate > 0.0) {
+	    double t = now();
+	    if (t < next) {
+		processEvents((int)((next - t) * 1000.0));
+		continue;
+	    }
+	} else {
+	    inflight = sent - LoadView::latencies.size();
+	    if (inflight >= (size_t)window) {
+		processEvents(100);
+		continue;
+	    }
+	}
+
+	LoadView *view = all[current];
+	const std::string& word = words[sent % words.size()];
+
+	injector.focus(view->window());
+	for (size_t i = 0; i < word.size(); i++) {
+	    if (injector.typeKey(word[i]))
+		nkeys++;
+	}
+	XFlush(control);
+	view->pending.push_back(now());
+	injector.typeKey(' ');
+	nkeys++;
+	XFlush(control);
+
+	sent++;
+	current = (current + 1) % all.size();
+	next += interval * (word.size() + 1);
+
+	processEvents(0);
+    }
+    double typed = now();
+
+    // wait for the words in flight
+    double deadline = now() + 5.0;
+    while (LoadView::latencies.size() < sent && now() < deadline)
+	processEvents(50);
+    double end = now();
+
+    std::vector<double> sorted(LoadView::latencies);
+    std::sort(sorted.begin(), sorted.end());
+
+    printf("words: %lu sent, %lu completed, %lu lost\n",
+	   (unsigned long)sent, (unsigned long)sorted.size(),
+	   (unsigned long)(sent - sorted.size()));
+    printf("keys: %lu in %.3f s, %.1f keys/s typed, %.1f words/s completed\n",
+	   (unsigned long)nkeys, typed - start,
+	   nkeys / (typed - start),
+	   sorted.size() / (end - start));
+    printf("latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+	   percentile(sorted, 50) * 1000.0,
+	   percentile(sorted, 90) * 1000.0,
+	   percentile(sorted, 99) * 1000.0,
+	   percentile(sorted, 99.9) * 1000.0,
+	   sorted.empty() ? 0.0 : sorted.back() * 1000.0);
+    printf("preedit draws: %lu, committed: %lu bytes, %lu hangul\n",
+	   LoadView::preeditDraws, LoadView::committedBytes,
+	   LoadView::hangulChars);
+
+    for (size_t i = 0; i < connections.size(); i++) {
+	for (size_t j = 0; j < connections[i].views.size(); j++) {
+	    connections[i].views[j]->destroy();
+	    delete connections[i].views[j];
+	}
+	if (connections[i].fontset != NULL)
+	    XFreeFontSet(connections[i].display, connections[i].fontset);
+	XCloseIM(connections[i].im);
+	XCloseDisplay(connections[i].display);
+    }
+    XCloseDisplay(control);
+
+    return 0;
+}